@@ -0,0 +1,191 @@
+#include "sdkconfig.h"
+#include <esp_log.h>
+#include "captive_dns.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include <cstring>
+
+#define DNS_PORT 53
+#define DNS_MAX_MESSAGE_LEN 512 // maximum size of a DNS message over UDP
+#define DNS_ANSWER_TTL_S 60
+#define DNS_TASK_STACK_SIZE CONFIG_WIFI_PROV_PORTAL_DNS_TASK_STACK_SIZE
+#define DNS_TASK_PRIORITY 5
+
+#define DNS_HEADER_LEN 12
+#define DNS_ANSWER_LEN 16     // name pointer, type, class, TTL, rdlength, IPv4 address
+#define DNS_FLAG_QR 0x8000    // response
+#define DNS_FLAG_AA 0x0400    // authoritative answer
+#define DNS_FLAG_RD 0x0100    // recursion desired
+#define DNS_OPCODE_MASK 0x7800
+#define DNS_TYPE_A 1
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+
+namespace WIFI_PROVISIONING
+{
+      static const char *TAG = "CAPTIVE_DNS"; // used in ESP_LOGx
+      static TaskHandle_t s_dns_task = NULL;
+      static TaskHandle_t s_stop_requester = NULL; // task waiting in captive_dns_stop()
+      static volatile bool s_dns_running = false;
+      static uint32_t s_ap_ip = 0; // IP address of softAP, network byte order
+
+      static uint16_t _get_u16(const uint8_t *p)
+      {
+            return (uint16_t)((p[0] << 8) | p[1]);
+      }
+
+      static void _put_u16(uint8_t *p, uint16_t value)
+      {
+            p[0] = value >> 8;
+            p[1] = value & 0xff;
+      }
+
+      /**
+       * @brief Turn a DNS query into the response, in place: one question, and for A (or ANY) queries one answer with
+       *        the softAP IP address
+       *
+       * @param message received query; response is written in the same buffer
+       * @param len length of query
+       * @return length of response, or 0 when the message is not a valid query and is ignored
+       */
+      static size_t _build_response(uint8_t *message, size_t len)
+      {
+            if (len < DNS_HEADER_LEN)
+            {
+                  return 0;
+            }
+            uint16_t flags = _get_u16(message + 2);
+            if ((flags & DNS_FLAG_QR) || (flags & DNS_OPCODE_MASK) || _get_u16(message + 4) == 0)
+            {
+                  return 0; // no standard query
+            }
+
+            // skip QNAME of the first question: labels ending with a zero-length label; compression is not allowed here
+            size_t pos = DNS_HEADER_LEN;
+            while (pos < len && message[pos] != 0)
+            {
+                  if (message[pos] & 0xc0)
+                  {
+                        return 0;
+                  }
+                  pos += message[pos] + 1;
+            }
+            pos += 1 + 4; // zero-length label, QTYPE, QCLASS
+            if (pos > len)
+            {
+                  return 0;
+            }
+            uint16_t qtype = _get_u16(message + pos - 4);
+            uint16_t qclass = _get_u16(message + pos - 2);
+            bool answer = (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY) && qclass == DNS_CLASS_IN;
+
+            _put_u16(message + 2, DNS_FLAG_QR | DNS_FLAG_AA | (flags & DNS_FLAG_RD));
+            _put_u16(message + 4, 1);          // QDCOUNT; only the first question is answered
+            _put_u16(message + 6, answer);     // ANCOUNT
+            _put_u16(message + 8, 0);          // NSCOUNT
+            _put_u16(message + 10, 0);         // ARCOUNT
+            if (!answer)
+            {
+                  return pos; // no AAAA etc.: empty answer, so the client falls back to A
+            }
+
+            uint8_t *rr = message + pos;
+            _put_u16(rr, 0xc000 | DNS_HEADER_LEN); // name: pointer to QNAME of question
+            _put_u16(rr + 2, DNS_TYPE_A);
+            _put_u16(rr + 4, DNS_CLASS_IN);
+            _put_u16(rr + 6, 0);
+            _put_u16(rr + 8, DNS_ANSWER_TTL_S);
+            _put_u16(rr + 10, 4);
+            memcpy(rr + 12, &s_ap_ip, 4);
+            return pos + DNS_ANSWER_LEN;
+      }
+
+      /**
+       * @brief Task of the DNS responder
+       *
+       * @param arg not used
+       */
+      static void _dns_task(void *arg)
+      {
+            uint8_t message[DNS_MAX_MESSAGE_LEN + DNS_ANSWER_LEN]; // room for the answer after the longest query
+
+            int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            struct sockaddr_in server_addr = {};
+            server_addr.sin_family = AF_INET;
+            server_addr.sin_port = htons(DNS_PORT);
+            server_addr.sin_addr.s_addr = s_ap_ip; // only on softAP interface
+            struct timeval timeout = {1, 0};       // check s_dns_running every second
+            if (sock < 0 ||
+                bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 ||
+                setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+            {
+                  ESP_LOGE(TAG, "cannot open DNS socket, errno %d", errno);
+                  s_dns_running = false;
+            }
+
+            while (s_dns_running)
+            {
+                  struct sockaddr_in client_addr;
+                  socklen_t client_addr_len = sizeof(client_addr);
+                  int len = recvfrom(sock, message, DNS_MAX_MESSAGE_LEN, 0, (struct sockaddr *)&client_addr, &client_addr_len);
+                  if (len <= 0)
+                  {
+                        continue; // timeout
+                  }
+                  size_t response_len = _build_response(message, len);
+                  if (response_len > 0)
+                  {
+                        sendto(sock, message, response_len, 0, (struct sockaddr *)&client_addr, client_addr_len);
+                  }
+            }
+
+            if (sock >= 0)
+            {
+                  close(sock);
+            }
+            s_dns_task = NULL;
+            if (s_stop_requester != NULL)
+            {
+                  xTaskNotifyGive(s_stop_requester);
+            }
+            vTaskDelete(NULL);
+      }
+
+      esp_err_t captive_dns_start(esp_netif_t *ap_netif)
+      {
+            esp_netif_ip_info_t ip_info;
+
+            if (s_dns_task != NULL)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            esp_err_t err = esp_netif_get_ip_info(ap_netif, &ip_info);
+            if (err != ESP_OK)
+            {
+                  return err;
+            }
+            s_ap_ip = ip_info.ip.addr;
+            s_stop_requester = NULL;
+            s_dns_running = true;
+            if (xTaskCreate(_dns_task, "captive_dns", DNS_TASK_STACK_SIZE, NULL, DNS_TASK_PRIORITY, &s_dns_task) != pdPASS)
+            {
+                  s_dns_running = false;
+                  return ESP_ERR_NO_MEM;
+            }
+            ESP_LOGI(TAG, "DNS responder started; all names resolve to " IPSTR, IP2STR(&ip_info.ip));
+            return ESP_OK;
+      }
+
+      void captive_dns_stop()
+      {
+            if (s_dns_task == NULL)
+            {
+                  return;
+            }
+            s_stop_requester = xTaskGetCurrentTaskHandle();
+            s_dns_running = false;
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(2000)); // task notices within the receive timeout of 1 s
+            ESP_LOGI(TAG, "DNS responder stopped");
+      }
+} // namespace
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_netif.h"
+
+namespace WIFI_PROVISIONING
+{
+    /**
+     * @brief Start the DNS responder of the captive portal: every A query received on the softAP interface is answered
+     *        with the IP address of the softAP, so phones and laptops that join the softAP open the portal by themselves
+     *
+     * @param ap_netif netif of the softAP; the responder only listens on its IP address
+     * @return esp_err_t
+     */
+    esp_err_t captive_dns_start(esp_netif_t *ap_netif);
+
+    /**
+     * @brief Stop the DNS responder, and wait until its task is finished
+     *
+     */
+    void captive_dns_stop();
+} // Namespace
@@ -0,0 +1,288 @@
+// Measurement of the power profiles on a device. Per profile the device reconnects with it (the listen interval is
+// used from the association on), idles, pings the LAN host, sends to `iperf -s` on it over TCP and, with
+// POWER_IPERF_DOWNLINK, receives from `iperf -c` of the host. Prints a table at the end; the host and the network are
+// set in menuconfig.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "lwip/inet.h"
+#include "lwip/sockets.h"
+#include "nvs_flash.h"
+#include "ping/ping_sock.h"
+#include "wifi_provisioning.h"
+
+using namespace WIFI_PROVISIONING;
+
+#define IDLE_MS 10000      // before the pings; the adaptive profile goes to minimum power
+#define PING_INTERVAL_MS 1000
+#define BUFFER_SIZE 2920   // two TCP segments
+
+static const char *TAG = "power_iperf";
+
+typedef struct
+{
+    const char *name;
+    power_profile_t profile;
+} profile_case_t;
+
+static const profile_case_t PROFILES[] = {
+    {"max_throughput", POWER_PROFILE_MAX_THROUGHPUT},
+    {"balanced", POWER_PROFILE_BALANCED},
+    {"min_power", POWER_PROFILE_MIN_POWER},
+    {"adaptive", POWER_PROFILE_ADAPTIVE},
+};
+
+typedef struct
+{
+    bool measured;
+    wifi_ps_type_t ps;               // when idle
+    int8_t max_tx_power;             // when idle, in 0.25 dBm
+    uint32_t ping_p50_ms;
+    uint32_t ping_max_ms;
+    uint32_t ping_lost;
+    double uplink_mbps;              // -1: no connection to iperf
+    double downlink_mbps;            // -1: not measured, or no iperf client
+    power_profile_t active_uplink;   // profile in effect at the end of the uplink
+} profile_result_t;
+
+typedef struct
+{
+    std::vector<uint32_t> rtt_ms;
+    SemaphoreHandle_t done;
+} ping_state_t;
+
+static char s_buffer[BUFFER_SIZE];
+
+static void _ping_success(esp_ping_handle_t hdl, void *args)
+{
+    ping_state_t *state = (ping_state_t *)args;
+    uint32_t rtt_ms;
+    esp_ping_get_profile(hdl, ESP_PING_PROF_TIMEGAP, &rtt_ms, sizeof(rtt_ms));
+    state->rtt_ms.push_back(rtt_ms);
+}
+
+static void _ping_end(esp_ping_handle_t hdl, void *args)
+{
+    xSemaphoreGive(((ping_state_t *)args)->done);
+}
+
+/**
+ * @brief Ping the LAN host CONFIG_POWER_IPERF_PING_COUNT times, one per second
+ *
+ */
+static void _ping(profile_result_t *result)
+{
+    ping_state_t state;
+    state.done = xSemaphoreCreateBinary();
+    esp_ping_config_t config = ESP_PING_DEFAULT_CONFIG();
+    ipaddr_aton(CONFIG_POWER_IPERF_HOST, &config.target_addr);
+    config.count = CONFIG_POWER_IPERF_PING_COUNT;
+    config.interval_ms = PING_INTERVAL_MS;
+    esp_ping_callbacks_t callbacks = {};
+    callbacks.cb_args = &state;
+    callbacks.on_ping_success = _ping_success;
+    callbacks.on_ping_end = _ping_end;
+    esp_ping_handle_t ping;
+    ESP_ERROR_CHECK(esp_ping_new_session(&config, &callbacks, &ping));
+    ESP_ERROR_CHECK(esp_ping_start(ping));
+    xSemaphoreTake(state.done, portMAX_DELAY);
+    esp_ping_delete_session(ping);
+    vSemaphoreDelete(state.done);
+
+    std::sort(state.rtt_ms.begin(), state.rtt_ms.end());
+    result->ping_lost = CONFIG_POWER_IPERF_PING_COUNT - state.rtt_ms.size();
+    if (!state.rtt_ms.empty())
+    {
+        result->ping_p50_ms = state.rtt_ms[(state.rtt_ms.size() - 1) / 2];
+        result->ping_max_ms = state.rtt_ms.back();
+    }
+}
+
+/**
+ * @brief Send to `iperf -s` of the LAN host for CONFIG_POWER_IPERF_DURATION_S
+ *
+ * @return Mbit/s; -1 when the host does not accept the connection
+ */
+static double _uplink()
+{
+    sockaddr_in host = {};
+    host.sin_family = AF_INET;
+    host.sin_port = htons(CONFIG_POWER_IPERF_PORT);
+    inet_pton(AF_INET, CONFIG_POWER_IPERF_HOST, &host.sin_addr);
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0 || connect(sock, (sockaddr *)&host, sizeof(host)) != 0)
+    {
+        ESP_LOGE(TAG, "No connection to iperf on %s:%d", CONFIG_POWER_IPERF_HOST, CONFIG_POWER_IPERF_PORT);
+        if (sock >= 0)
+        {
+            close(sock);
+        }
+        return -1;
+    }
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + CONFIG_POWER_IPERF_DURATION_S * 1000000LL;
+    int64_t bytes = 0;
+    while (esp_timer_get_time() < end)
+    {
+        int sent = send(sock, s_buffer, sizeof(s_buffer), 0);
+        if (sent < 0)
+        {
+            break;
+        }
+        bytes += sent;
+    }
+    int64_t duration_us = esp_timer_get_time() - start;
+    close(sock);
+    return bytes * 8.0 / duration_us;
+}
+
+/**
+ * @brief Receive what `iperf -c` of the LAN host sends, until it closes the connection
+ *
+ * @return Mbit/s; -1 when no client connects within CONFIG_POWER_IPERF_DOWNLINK_WAIT_S
+ */
+static double _downlink()
+{
+#if CONFIG_POWER_IPERF_DOWNLINK
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(CONFIG_POWER_IPERF_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    int listener = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0)
+    {
+        ESP_LOGE(TAG, "Cannot listen on port %d", CONFIG_POWER_IPERF_PORT);
+        close(listener);
+        return -1;
+    }
+    esp_netif_ip_info_t ip_info;
+    esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), &ip_info);
+    ESP_LOGI(TAG, "Waiting %d s for: iperf -c " IPSTR " -p %d -t %d", CONFIG_POWER_IPERF_DOWNLINK_WAIT_S,
+             IP2STR(&ip_info.ip), CONFIG_POWER_IPERF_PORT, CONFIG_POWER_IPERF_DURATION_S);
+    fd_set ready;
+    FD_ZERO(&ready);
+    FD_SET(listener, &ready);
+    timeval wait = {CONFIG_POWER_IPERF_DOWNLINK_WAIT_S, 0};
+    int sock = select(listener + 1, &ready, NULL, NULL, &wait) > 0 ? accept(listener, NULL, NULL) : -1;
+    close(listener);
+    if (sock < 0)
+    {
+        ESP_LOGW(TAG, "No iperf client");
+        return -1;
+    }
+    int64_t start = esp_timer_get_time();
+    int64_t bytes = 0;
+    int received;
+    while ((received = recv(sock, s_buffer, sizeof(s_buffer), 0)) > 0)
+    {
+        bytes += received;
+    }
+    int64_t duration_us = esp_timer_get_time() - start;
+    close(sock);
+    return bytes * 8.0 / duration_us;
+#else
+    return -1;
+#endif
+}
+
+static void _measure(wifi_provisioning &wifi, const profile_case_t &profile, profile_result_t *result)
+{
+    ESP_ERROR_CHECK(wifi.stop());
+    if (wifi.set_power_profile(profile.profile) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "%s: not supported, skipped", profile.name);
+        return;
+    }
+    if (wifi.connect_to_network(0) != PROVISIONING_CONNECTED)
+    {
+        ESP_LOGE(TAG, "%s: not connected", profile.name);
+        return;
+    }
+    ESP_LOGI(TAG, "%s: idle %d s, then %d pings", profile.name, IDLE_MS / 1000, CONFIG_POWER_IPERF_PING_COUNT);
+    vTaskDelay(pdMS_TO_TICKS(IDLE_MS));
+    esp_wifi_get_ps(&result->ps);
+    esp_wifi_get_max_tx_power(&result->max_tx_power);
+    _ping(result);
+    ESP_LOGI(TAG, "%s: uplink", profile.name);
+    result->uplink_mbps = _uplink();
+    result->active_uplink = wifi.get_power_status().active_profile;
+    result->downlink_mbps = _downlink();
+    result->measured = true;
+}
+
+static const char *_ps_name(wifi_ps_type_t ps)
+{
+    switch (ps)
+    {
+    case WIFI_PS_NONE:
+        return "none";
+    case WIFI_PS_MIN_MODEM:
+        return "min_modem";
+    default:
+        return "max_modem";
+    }
+}
+
+static void _print_mbps(double mbps)
+{
+    if (mbps < 0)
+    {
+        printf(" %8s", "-");
+    }
+    else
+    {
+        printf(" %8.1f", mbps);
+    }
+}
+
+extern "C" void app_main(void)
+{
+    ESP_ERROR_CHECK(nvs_flash_init());
+    static wifi_provisioning wifi;
+    if (strlen(CONFIG_POWER_IPERF_WIFI_SSID) > 0)
+    {
+        ESP_ERROR_CHECK(wifi.add_network(CONFIG_POWER_IPERF_WIFI_SSID, CONFIG_POWER_IPERF_WIFI_PASSWORD));
+    }
+    if (wifi.connect_to_network(0) != PROVISIONING_CONNECTED)
+    {
+        ESP_LOGE(TAG, "Not connected");
+        return;
+    }
+
+    static profile_result_t results[sizeof(PROFILES) / sizeof(PROFILES[0])];
+    for (size_t i = 0; i < sizeof(PROFILES) / sizeof(PROFILES[0]); i++)
+    {
+        _measure(wifi, PROFILES[i], &results[i]);
+    }
+
+    printf("\nPer power profile, against %s: ping round trip in ms after %d s idle (%d pings), TCP throughput in "
+           "Mbit/s for %d s\n\n",
+           CONFIG_POWER_IPERF_HOST, IDLE_MS / 1000, CONFIG_POWER_IPERF_PING_COUNT, CONFIG_POWER_IPERF_DURATION_S);
+    printf("%-15s %-9s %6s %8s %8s %5s %8s %8s  %s\n", "profile", "idle PS", "TX dBm", "ping p50", "ping max", "lost",
+           "up", "down", "in effect in uplink");
+    for (size_t i = 0; i < sizeof(PROFILES) / sizeof(PROFILES[0]); i++)
+    {
+        const profile_result_t &result = results[i];
+        if (!result.measured)
+        {
+            printf("%-15s not measured\n", PROFILES[i].name);
+            continue;
+        }
+        printf("%-15s %-9s %6.1f %8lu %8lu %5lu", PROFILES[i].name, _ps_name(result.ps), result.max_tx_power / 4.0,
+               (unsigned long)result.ping_p50_ms, (unsigned long)result.ping_max_ms, (unsigned long)result.ping_lost);
+        _print_mbps(result.uplink_mbps);
+        _print_mbps(result.downlink_mbps);
+        printf("  %s\n", PROFILES[result.active_uplink].name);
+    }
+}
@@ -0,0 +1,19 @@
+// Application of the size report: provisions and connects, as a product does, so the linker keeps what a product
+// keeps of the component
+
+#include <cstdio>
+#include "nvs_flash.h"
+#include "wifi_provisioning.h"
+
+using namespace WIFI_PROVISIONING;
+
+extern "C" void app_main(void)
+{
+    ESP_ERROR_CHECK(nvs_flash_init());
+    static wifi_provisioning wifi;
+    if (wifi.connect_to_network(0) == PROVISIONING_CONNECTED)
+    {
+        connect_metrics_t metrics = wifi.get_metrics();
+        printf("connected in %lld ms\n", (long long)(metrics.time_to_ip_us / 1000));
+    }
+}
@@ -0,0 +1,173 @@
+// Microbenchmark of the credentials form parser: _parse_wifi_form(), one pass without heap, against the path it
+// replaced (baseline setWifiParams()): copy the query to the heap, httpd_query_key_value() per key into a 32 byte
+// buffer, urldecode2(), and strcpy() into the STA config. httpd_query_key_value() is the one of ESP-IDF v5
+// (sim/esp_http_server.cpp). CPU time of the host, so only the ratio means something for the device.
+//
+//   bench_form_parser
+
+#include "wifi_provisioning.cpp"
+#include "sim.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+
+using namespace WIFI_PROVISIONING;
+
+#define MEASURE_TIME_US 50000 // per repetition
+#define MEASURE_REPETITIONS 5 // the fastest counts
+
+/**
+ * @brief urldecode2() of the baseline, unchanged
+ *
+ */
+static void _baseline_urldecode2(char *dst, const char *src)
+{
+    char a, b;
+    while (*src)
+    {
+        if ((*src == '%') &&
+            ((a = src[1]) && (b = src[2])) &&
+            (isxdigit(a) && isxdigit(b)))
+        {
+            if (a >= 'a')
+                a -= 'a' - 'A';
+            if (a >= 'A')
+                a -= ('A' - 10);
+            else
+                a -= '0';
+            if (b >= 'a')
+                b -= 'a' - 'A';
+            if (b >= 'A')
+                b -= ('A' - 10);
+            else
+                b -= '0';
+            *dst++ = 16 * a + b;
+            src += 3;
+        }
+        else if (*src == '+')
+        {
+            *dst++ = ' ';
+            src++;
+        }
+        else
+        {
+            *dst++ = *src++;
+        }
+    }
+    *dst++ = '\0';
+}
+
+/**
+ * @brief Form handling of baseline setWifiParams(), without the request: httpd_req_get_url_query_str() is the copy to
+ *        the heap
+ *
+ */
+static void _baseline_parse(const char *form, size_t form_len, wifi_config_t *wifi_config)
+{
+    char *buf = (char *)malloc(form_len + 1);
+    memcpy(buf, form, form_len);
+    buf[form_len] = '\0';
+    char urlpart[32];
+    char ssid[32];
+    char passkey[32];
+    if (httpd_query_key_value(buf, "ssid", urlpart, sizeof(urlpart)) == ESP_OK)
+    {
+        _baseline_urldecode2(ssid, urlpart);
+        strcpy((char *)wifi_config->sta.ssid, ssid);
+    }
+    if (httpd_query_key_value(buf, "passkey", urlpart, sizeof(urlpart)) == ESP_OK)
+    {
+        _baseline_urldecode2(passkey, urlpart);
+        strcpy((char *)wifi_config->sta.password, passkey);
+    }
+    free(buf);
+}
+
+static void _parse(const char *form, size_t form_len, wifi_config_t *wifi_config)
+{
+    _parse_wifi_form(form, form_len, wifi_config);
+}
+
+/**
+ * @brief Fastest of MEASURE_REPETITIONS runs of MEASURE_TIME_US
+ *
+ * @return nanoseconds per parse
+ */
+static double _measure(void (*parse)(const char *, size_t, wifi_config_t *), const char *form)
+{
+    size_t form_len = strlen(form);
+    wifi_config_t wifi_config = {};
+    double best_ns = 1e30;
+    for (int repetition = 0; repetition < MEASURE_REPETITIONS; repetition++)
+    {
+        long iterations = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::chrono::duration<double, std::nano> elapsed(0);
+        do
+        {
+            for (int i = 0; i < 1000; i++)
+            {
+                parse(form, form_len, &wifi_config);
+                __asm__ volatile("" : : "r"(&wifi_config) : "memory"); // keep the result
+            }
+            iterations += 1000;
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while (elapsed.count() < MEASURE_TIME_US * 1000.0);
+        best_ns = std::min(best_ns, elapsed.count() / iterations);
+    }
+    return best_ns;
+}
+
+/**
+ * @brief Heap the parse allocates at most
+ *
+ */
+static size_t _heap_bytes(void (*parse)(const char *, size_t, wifi_config_t *), const char *form)
+{
+    wifi_config_t wifi_config = {};
+    sim::heap_reset_peak();
+    size_t used = sim::heap_used();
+    parse(form, strlen(form), &wifi_config);
+    return sim::heap_peak() - used;
+}
+
+static bool _same_result(const char *form)
+{
+    wifi_config_t baseline = {};
+    wifi_config_t parsed = {};
+    _baseline_parse(form, strlen(form), &baseline);
+    _parse(form, strlen(form), &parsed);
+    return memcmp(baseline.sta.ssid, parsed.sta.ssid, sizeof(parsed.sta.ssid)) == 0 &&
+           memcmp(baseline.sta.password, parsed.sta.password, sizeof(parsed.sta.password)) == 0;
+}
+
+typedef struct
+{
+    const char *name;
+    const char *form;
+} form_case_t;
+
+static const form_case_t FORMS[] = {
+    {"typical", "ssid=home&passkey=correct+horse+battery"},
+    {"encoded", "ssid=caf%C3%A9+%26+bar&passkey=p%40ss%26w%3Drd%21"},
+    {"extra fields", "submit=Save&lang=en&passkey=correct+horse+battery&ssid=home"},
+    // longer than the 31 characters the baseline handled; it truncated them
+    {"long", "ssid=0123456789abcdef0123456789abcdef&passkey=0123456789abcdef0123456789abcdef0123456789abcdef012345678"},
+};
+
+int main()
+{
+    printf("%-14s %12s %12s %8s %12s %12s  %s\n", "form", "baseline ns", "parser ns", "speedup", "baseline heap",
+           "parser heap", "result");
+    for (const form_case_t &form_case : FORMS)
+    {
+        size_t parser_heap = _heap_bytes(_parse, form_case.form);
+        size_t baseline_heap = _heap_bytes(_baseline_parse, form_case.form);
+        double baseline_ns = _measure(_baseline_parse, form_case.form);
+        double parser_ns = _measure(_parse, form_case.form);
+        printf("%-14s %12.1f %12.1f %7.1fx %12zu %12zu  %s\n", form_case.name, baseline_ns, parser_ns,
+               baseline_ns / parser_ns, baseline_heap, parser_heap,
+               _same_result(form_case.form) ? "same" : "differs (baseline truncated)");
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+// Benchmark of the power profiles on the host, in simulated time (sim/): the power save mode and TX power each profile
+// sets, and for the adaptive profile how fast it follows the traffic, from the packet rate it samples to the switch.
+// One boot per profile, near the AP and far from it. Latency and throughput per profile are measured on a device, by
+// examples/power_iperf; the simulation would only restate its traffic model.
+//
+//   bench_power
+
+#include "scenario.h"
+#include "wifi_provisioning.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace WIFI_PROVISIONING;
+
+#define BURST_RATE 50            // requests of a server on the LAN per second during the burst
+#define BURST_US 10000000LL
+#define SETTLE_US 15000000LL     // after the connect; the adaptive profile reaches minimum power
+#define ADAPT_TIMEOUT_US 60000000LL
+
+/**
+ * @brief What the boot of a profile reports to the benchmark, via the result memory of the device
+ *
+ */
+typedef struct
+{
+    provisioning_status_t status;
+    wifi_ps_type_t ps;              // when idle
+    int8_t max_tx_power;            // when idle, in 0.25 dBm
+    wifi_ps_type_t burst_ps;        // at the end of the burst
+    int8_t burst_max_tx_power;
+    int64_t to_max_throughput_us;   // adaptive: burst started until maximum throughput; -1 otherwise
+    int64_t to_min_power_us;        // adaptive: burst ended until minimum power; -1 otherwise
+} power_result_t;
+
+typedef struct
+{
+    const char *name;
+    power_profile_t profile;
+} profile_case_t;
+
+static const profile_case_t PROFILES[] = {
+    {"max_throughput", POWER_PROFILE_MAX_THROUGHPUT},
+    {"balanced", POWER_PROFILE_BALANCED},
+    {"min_power", POWER_PROFILE_MIN_POWER},
+    {"adaptive", POWER_PROFILE_ADAPTIVE},
+};
+
+static void _measure(wifi_provisioning &wifi, power_result_t *result)
+{
+    bool adaptive = wifi.get_power_status().profile == POWER_PROFILE_ADAPTIVE;
+    sim::sleep(SETTLE_US, "settle");
+    esp_wifi_get_ps(&result->ps);
+    esp_wifi_get_max_tx_power(&result->max_tx_power);
+
+    int64_t start = sim::now_us();
+    result->to_max_throughput_us = -1;
+    for (int64_t next = start; next < start + BURST_US; next += 1000000 / BURST_RATE)
+    {
+        sim::sleep(std::max<int64_t>(next - sim::now_us(), 0), "burst");
+        sim::lan_request(100, 100);
+        if (adaptive && result->to_max_throughput_us < 0 &&
+            wifi.get_power_status().active_profile == POWER_PROFILE_MAX_THROUGHPUT)
+        {
+            result->to_max_throughput_us = sim::now_us() - start;
+        }
+    }
+    esp_wifi_get_ps(&result->burst_ps);
+    esp_wifi_get_max_tx_power(&result->burst_max_tx_power);
+
+    result->to_min_power_us = -1;
+    for (int64_t end = sim::now_us(); adaptive && sim::now_us() - end < ADAPT_TIMEOUT_US; sim::sleep(100000, "adapt"))
+    {
+        if (wifi.get_power_status().active_profile == POWER_PROFILE_MIN_POWER)
+        {
+            result->to_min_power_us = sim::now_us() - end;
+            break;
+        }
+    }
+}
+
+static power_result_t _run(const sim_world_t &world, power_profile_t profile)
+{
+    sim::sim_device_t *device = sim::device_create();
+    power_result_t *result = (power_result_t *)sim::device_result(device);
+    sim::boot(device, world, ESP_RST_POWERON, [profile, result]
+              {
+                  ESP_ERROR_CHECK(nvs_flash_init());
+                  wifi_provisioning wifi;
+                  ESP_ERROR_CHECK(wifi.add_network(scenario::HOME_SSID, scenario::HOME_PASSWORD));
+                  ESP_ERROR_CHECK(wifi.set_power_profile(profile));
+                  result->status = wifi.connect_to_network(0);
+                  if (result->status == PROVISIONING_CONNECTED)
+                  {
+                      _measure(wifi, result);
+                  }
+                  return 0; });
+    power_result_t copy = *result; // a crashed boot leaves the result zeroed
+    sim::device_destroy(device);
+    return copy;
+}
+
+static const char *_ps_name(wifi_ps_type_t ps)
+{
+    switch (ps)
+    {
+    case WIFI_PS_NONE:
+        return "none";
+    case WIFI_PS_MIN_MODEM:
+        return "min_modem";
+    default:
+        return "max_modem";
+    }
+}
+
+static void _print_duration(int64_t us)
+{
+    if (us < 0)
+    {
+        printf(" %9s", "-");
+    }
+    else
+    {
+        printf(" %9.0f", us / 1000.0);
+    }
+}
+
+int main()
+{
+    sim_world_t far = scenario::home_world();
+    far.aps[scenario::HOME_AP].up = false;
+    far.aps[scenario::HOME_AP_UPSTAIRS].rssi = -78;
+    const struct
+    {
+        const char *name;
+        sim_world_t world;
+    } worlds[] = {{"near", scenario::home_world()}, {"far", far}};
+
+    printf("Per power profile: power save mode and TX power when idle and at the end of a burst of %d requests/s for "
+           "%lld s. Near: AP at %d dBm; far: AP at %d dBm\n\n",
+           BURST_RATE, BURST_US / 1000000, scenario::home_world().aps[scenario::HOME_AP].rssi,
+           far.aps[scenario::HOME_AP_UPSTAIRS].rssi);
+    printf("%-5s %-15s %-9s %6s %-9s %6s %9s %9s\n", "world", "profile", "idle PS", "TX dBm", "burst PS", "TX dBm",
+           "to max ms", "to min ms");
+    int failures = 0;
+    for (const auto &world : worlds)
+    {
+        for (const profile_case_t &profile : PROFILES)
+        {
+            power_result_t result = _run(world.world, profile.profile);
+            if (result.status != PROVISIONING_CONNECTED)
+            {
+                fprintf(stderr, "%s %s: not connected\n", world.name, profile.name);
+                failures++;
+                continue;
+            }
+            printf("%-5s %-15s %-9s %6.1f %-9s %6.1f", world.name, profile.name, _ps_name(result.ps),
+                   result.max_tx_power / 4.0, _ps_name(result.burst_ps), result.burst_max_tx_power / 4.0);
+            _print_duration(result.to_max_throughput_us);
+            _print_duration(result.to_min_power_us);
+            printf("\n");
+        }
+    }
+    printf("\nto max, to min: adaptive profile only; burst started until maximum throughput, and burst ended until "
+           "minimum power. Latency and throughput per profile: examples/power_iperf on a device\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+// Benchmark of the connect flow of the component on the host, in simulated time (sim/): time-to-IP and its phases,
+// retries, heap high-water mark and NVS operations, per scenario. The numbers follow from the timing model of
+// sim_world.h, so they compare builds and configurations of the component, not devices.
+//
+//   bench_provisioning           table
+//   bench_provisioning --json    one JSON object per scenario
+
+#include "scenario.h"
+#include "wifi_provisioning.h"
+#include "nvs_flash.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace WIFI_PROVISIONING;
+
+#define SECONDS(s) ((s) * 1000 / portTICK_PERIOD_MS)
+
+/**
+ * @brief What the measured boot of a scenario reports to the benchmark, via the result memory of the device
+ *
+ */
+typedef struct
+{
+    provisioning_status_t status;
+    connect_metrics_t metrics;
+    size_t heap_peak;                 // simulated heap in use at its highest, since boot
+    sim::nvs_counters_t nvs_storage;  // NVS of the component
+    sim::nvs_counters_t nvs_total;    // including the wifi driver and lwIP
+} bench_result_t;
+
+typedef struct
+{
+    const char *name;
+    const char *description;
+    void (*run)(sim::sim_device_t *device, const sim_world_t &world); // boots the device; the last boot is measured
+} bench_scenario_t;
+
+/**
+ * @brief Boot the device, and write the measurements of the boot to its result memory when body returns
+ *
+ * @return exit code of the boot; 0 when body ran to the end
+ */
+static int _measured_boot(sim::sim_device_t *device, const sim_world_t &world, esp_reset_reason_t reason,
+                          const std::function<provisioning_status_t(wifi_provisioning &wifi)> &body)
+{
+    bench_result_t *result = (bench_result_t *)sim::device_result(device);
+    return sim::boot(device, world, reason, [&body, result]
+                     {
+                         ESP_ERROR_CHECK(nvs_flash_init());
+                         wifi_provisioning wifi;
+                         result->status = body(wifi);
+                         result->metrics = wifi.get_metrics();
+                         result->heap_peak = sim::heap_peak();
+                         result->nvs_storage = sim::nvs_counters("storage");
+                         result->nvs_total = sim::nvs_counters();
+                         return 0; });
+}
+
+static provisioning_status_t _provision(wifi_provisioning &wifi, const char *password)
+{
+    wifi.connect_to_network_async();
+    wifi.wait_for_state(PROVISIONING_STATE_BIT(PROVISIONING_STATE_PORTAL), SECONDS(10));
+    if (password != NULL && scenario::phone_provision(scenario::HOME_SSID, password) != scenario::PORTAL_CONNECT_FAILED)
+    {
+        return PROVISIONING_CONNECT_FAILED; // the wrong password was accepted
+    }
+    scenario::phone_provision(scenario::HOME_SSID, scenario::HOME_PASSWORD);
+    return wifi.wait_for_connection(SECONDS(30));
+}
+
+static void _cold_provision(sim::sim_device_t *device, const sim_world_t &world)
+{
+    _measured_boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                   { return _provision(wifi, NULL); });
+}
+
+static void _warm_boot(sim::sim_device_t *device, const sim_world_t &world)
+{
+    _measured_boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                   { return _provision(wifi, NULL); });
+    sim::device_advance_wall_clock(device, 600000000LL);
+    _measured_boot(device, world, ESP_RST_SW, [](wifi_provisioning &wifi)
+                   { return wifi.connect_to_network(0); });
+}
+
+static void _deep_sleep_wake(sim::sim_device_t *device, const sim_world_t &world)
+{
+    _measured_boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                   {
+                       provisioning_status_t status = _provision(wifi, NULL);
+                       wifi.stop();
+                       return status; });
+    sim::device_advance_wall_clock(device, 60000000LL);
+    _measured_boot(device, world, ESP_RST_DEEPSLEEP, [](wifi_provisioning &wifi)
+                   { return wifi.connect_to_network(0); });
+}
+
+static void _bad_password(sim::sim_device_t *device, const sim_world_t &world)
+{
+    _measured_boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                   { return _provision(wifi, "wrong password"); });
+}
+
+static void _stale_password(sim::sim_device_t *device, const sim_world_t &world)
+{
+    _measured_boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                   { return _provision(wifi, NULL); });
+    sim_world_t changed = world;
+    changed.aps[scenario::HOME_AP].password = "new password";
+    changed.aps[scenario::HOME_AP_UPSTAIRS].password = "new password";
+    _measured_boot(device, changed, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                   { return wifi.connect_to_network(60000); });
+}
+
+static const bench_scenario_t SCENARIOS[] = {
+    {"cold_provision", "first boot; credentials via the portal, user types for 20 s", _cold_provision},
+    {"warm_boot", "reboot with credentials in NVS; fast reconnect", _warm_boot},
+    {"deep_sleep_wake", "wake from deep sleep; context in RTC memory", _deep_sleep_wake},
+    {"bad_password", "first boot; wrong password typed first, then the right one", _bad_password},
+    {"stale_password", "reboot after the password of the network changed; portal times out after 60 s", _stale_password},
+};
+
+static const char *_status_name(provisioning_status_t status)
+{
+    switch (status)
+    {
+    case PROVISIONING_CONNECTED:
+        return "connected";
+    case PROVISIONING_CONNECT_FAILED:
+        return "failed";
+    case PROVISIONING_TIMED_OUT:
+        return "timed out";
+    default:
+        return "other";
+    }
+}
+
+static double _ms(int64_t us)
+{
+    return us / 1000.0;
+}
+
+static void _print_table_header()
+{
+    printf("%-16s %-10s %10s %9s %8s %8s %8s %9s %7s %9s %9s %16s %9s\n", "scenario", "status", "to IP ms",
+           "portal", "scan", "assoc", "DHCP", "radio on", "retries", "heap peak", "min free", "NVS r/w/e/commit",
+           "NVS total");
+}
+
+static void _print_table_row(const bench_scenario_t &scenario, const bench_result_t &result)
+{
+    const connect_metrics_t &m = result.metrics;
+    char nvs[32];
+    snprintf(nvs, sizeof(nvs), "%u/%u/%u/%u", (unsigned)result.nvs_storage.reads, (unsigned)result.nvs_storage.writes,
+             (unsigned)result.nvs_storage.erases, (unsigned)result.nvs_storage.commits);
+    uint32_t nvs_total = result.nvs_total.opens + result.nvs_total.reads + result.nvs_total.writes +
+                         result.nvs_total.erases + result.nvs_total.commits;
+    printf("%-16s %-10s %10.0f %9.0f %8.0f %8.0f %8.0f %9.0f %7u %9zu %9u %16s %9u\n", scenario.name,
+           _status_name(result.status), _ms(m.time_to_ip_us), _ms(m.portal_us), _ms(m.scan_us), _ms(m.association_us),
+           _ms(m.dhcp_us), _ms(m.radio_on_us), (unsigned)m.retries, result.heap_peak,
+           (unsigned)m.heap_minimum_free, nvs, (unsigned)nvs_total);
+}
+
+static void _print_counters_json(const char *name, const sim::nvs_counters_t &counters)
+{
+    printf("\"%s\":{\"opens\":%u,\"reads\":%u,\"writes\":%u,\"erases\":%u,\"commits\":%u,\"flash_writes\":%u,"
+           "\"flash_bytes\":%u}",
+           name, (unsigned)counters.opens, (unsigned)counters.reads, (unsigned)counters.writes,
+           (unsigned)counters.erases, (unsigned)counters.commits, (unsigned)counters.flash_writes,
+           (unsigned)counters.flash_bytes);
+}
+
+static void _print_json(const bench_scenario_t &scenario, const bench_result_t &result)
+{
+    const connect_metrics_t &m = result.metrics;
+    printf("{\"scenario\":\"%s\",\"status\":\"%s\",\"time_to_ip_us\":%lld,\"portal_us\":%lld,\"nvs_read_us\":%lld,"
+           "\"stack_init_us\":%lld,\"wifi_start_us\":%lld,\"scan_us\":%lld,\"association_us\":%lld,\"dhcp_us\":%lld,"
+           "\"retries\":%u,\"fast_reconnect\":%s,\"warm_start\":%s,\"radio_on_us\":%lld,\"heap_peak\":%zu,"
+           "\"heap_minimum_free\":%u,",
+           scenario.name, _status_name(result.status), (long long)m.time_to_ip_us, (long long)m.portal_us,
+           (long long)m.nvs_read_us, (long long)m.stack_init_us, (long long)m.wifi_start_us, (long long)m.scan_us,
+           (long long)m.association_us, (long long)m.dhcp_us, (unsigned)m.retries, m.fast_reconnect ? "true" : "false",
+           m.warm_start ? "true" : "false", (long long)m.radio_on_us, result.heap_peak, (unsigned)m.heap_minimum_free);
+    _print_counters_json("nvs_storage", result.nvs_storage);
+    printf(",");
+    _print_counters_json("nvs_total", result.nvs_total);
+    printf("}\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool json = argc == 2 && strcmp(argv[1], "--json") == 0;
+    if (argc > 2 || (argc == 2 && !json))
+    {
+        fprintf(stderr, "usage: %s [--json]\n", argv[0]);
+        return 2;
+    }
+    if (!json)
+    {
+        printf("Measured boot of each scenario, in simulated time (ms); heap in bytes; NVS: calls on namespace "
+               "\"storage\", and all NVS calls. The portal is open until the phone fetched the result page, after "
+               "the IP address\n\n");
+        _print_table_header();
+    }
+    int failures = 0;
+    for (const bench_scenario_t &scenario : SCENARIOS)
+    {
+        sim::sim_device_t *device = sim::device_create();
+        scenario.run(device, scenario::home_world());
+        bench_result_t result = *(const bench_result_t *)sim::device_result(device);
+        sim::device_destroy(device);
+        // a crashed boot leaves the result zeroed
+        bool expected = strcmp(scenario.name, "stale_password") == 0 ? result.status == PROVISIONING_CONNECT_FAILED
+                                                                     : result.status == PROVISIONING_CONNECTED;
+        if (!expected)
+        {
+            fprintf(stderr, "%s: unexpected status %s\n", scenario.name, _status_name(result.status));
+            failures++;
+        }
+        if (json)
+        {
+            _print_json(scenario, result);
+        }
+        else
+        {
+            _print_table_row(scenario, result);
+        }
+    }
+    if (!json)
+    {
+        printf("\n");
+        for (const bench_scenario_t &scenario : SCENARIOS)
+        {
+            printf("%-16s %s\n", scenario.name, scenario.description);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+// Fuzz target of _parse_wifi_form(), the parser of the credentials form of the captive portal. The result is compared
+// with a straightforward decoder of application/x-www-form-urlencoded, and the input is in a buffer of exactly its
+// length, so AddressSanitizer reports a read past the end.
+//
+// With clang, libFuzzer supplies main():   clang++ -fsanitize=fuzzer,address ...  (WIFI_PROV_LIBFUZZER in CMake)
+// Without it, the driver below:
+//   fuzz_form_parser                   mutate the seeds for -runs= inputs (default 200000), with a fixed seed
+//   fuzz_form_parser [-runs=N] FILE... run each file, as libFuzzer does to reproduce a crash
+//
+// The component is included, so its static functions can be called.
+
+#include "wifi_provisioning.cpp"
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace WIFI_PROVISIONING;
+
+typedef struct
+{
+    esp_err_t err;
+    std::string ssid;     // decoded value of the last "ssid" key
+    std::string password; // decoded value of the last "passkey" key
+} form_t;
+
+/**
+ * @brief Decode a form the simple way: split on '&', then on the first '=', then decode "+" and valid "%XX"
+ *
+ */
+static form_t _reference_parse(const std::string &form)
+{
+    form_t result = {ESP_ERR_NOT_FOUND, "", ""};
+    bool ssid_found = false;
+    size_t start = 0;
+    while (start < form.size())
+    {
+        size_t end = form.find('&', start);
+        end = end == std::string::npos ? form.size() : end;
+        std::string pair = form.substr(start, end - start);
+        start = end + 1;
+
+        size_t equals = pair.find('=');
+        std::string key = pair.substr(0, equals);
+        std::string encoded = equals == std::string::npos ? "" : pair.substr(equals + 1);
+        std::string value;
+        for (size_t i = 0; i < encoded.size(); i++)
+        {
+            if (encoded[i] == '+')
+            {
+                value += ' ';
+            }
+            else if (encoded[i] == '%' && i + 2 < encoded.size() && isxdigit((unsigned char)encoded[i + 1]) &&
+                     isxdigit((unsigned char)encoded[i + 2]))
+            {
+                value += (char)strtol(encoded.substr(i + 1, 2).c_str(), NULL, 16);
+                i += 2;
+            }
+            else
+            {
+                value += encoded[i];
+            }
+        }
+
+        if (key == "ssid")
+        {
+            if (value.size() > sizeof(wifi_config_t::sta.ssid))
+            {
+                return {ESP_ERR_INVALID_SIZE, "", ""};
+            }
+            ssid_found = true;
+            result.ssid = value;
+        }
+        else if (key == "passkey")
+        {
+            if (value.size() > sizeof(wifi_config_t::sta.password))
+            {
+                return {ESP_ERR_INVALID_SIZE, "", ""};
+            }
+            result.password = value;
+        }
+    }
+    result.err = ssid_found && !result.ssid.empty() && result.ssid[0] != '\0' ? ESP_OK : ESP_ERR_NOT_FOUND;
+    return result;
+}
+
+static bool _field_equals(const uint8_t *field, size_t field_size, const std::string &value)
+{
+    for (size_t i = 0; i < field_size; i++)
+    {
+        if (field[i] != (i < value.size() ? (uint8_t)value[i] : 0))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    std::unique_ptr<char[]> form(new char[size]); // exactly the input; not null terminated, as the POST body
+    memcpy(form.get(), data, size);
+    wifi_config_t wifi_config;
+    memset(&wifi_config, 0xA5, sizeof(wifi_config)); // what the parser does not write stays visible
+    esp_err_t err = _parse_wifi_form(form.get(), size, &wifi_config);
+
+    form_t expected = _reference_parse(std::string((const char *)data, size));
+    bool ok = err == expected.err;
+    if (ok && err == ESP_OK)
+    {
+        ok = _field_equals(wifi_config.sta.ssid, sizeof(wifi_config.sta.ssid), expected.ssid) &&
+             _field_equals(wifi_config.sta.password, sizeof(wifi_config.sta.password), expected.password);
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "mismatch for form \"%.*s\": %s, expected %s\n  ssid \"%.32s\" expected \"%s\"\n"
+                        "  passkey \"%.64s\" expected \"%s\"\n",
+                (int)size, (const char *)data, esp_err_to_name(err), esp_err_to_name(expected.err),
+                (const char *)wifi_config.sta.ssid, expected.ssid.c_str(), (const char *)wifi_config.sta.password,
+                expected.password.c_str());
+        abort();
+    }
+    return 0;
+}
+
+#ifndef WIFI_PROV_LIBFUZZER
+static const char *const SEEDS[] = {
+    "ssid=home&passkey=correct+horse+battery",
+    "ssid=caf%C3%A9&passkey=p%40ss%26word%3D1",
+    "passkey=12345678&ssid=home&submit=Save",
+    "ssid=0123456789abcdef0123456789abcdef&passkey=0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef",
+    "ssid=&passkey=",
+    "ssid=a&ssid=bb&passkey=%zz%4",
+};
+
+static const char *const TOKENS[] = {"ssid", "passkey", "=", "&", "%", "%4", "%41", "+", "%00", "%%"};
+
+/**
+ * @brief Mutate a seed as a fuzzer does: replace, insert or erase bytes, insert tokens of the form syntax, repeat parts
+ *
+ */
+static std::string _mutate(std::mt19937 &random, std::string input)
+{
+    int mutations = 1 + random() % 8;
+    for (int i = 0; i < mutations; i++)
+    {
+        size_t pos = input.empty() ? 0 : random() % (input.size() + 1);
+        switch (random() % 6)
+        {
+        case 0:
+            if (pos < input.size())
+            {
+                input[pos] = (char)random();
+            }
+            break;
+        case 1:
+            input.insert(pos, 1, (char)random());
+            break;
+        case 2:
+            if (pos < input.size())
+            {
+                input.erase(pos, 1 + random() % 8);
+            }
+            break;
+        case 3:
+            input.insert(pos, TOKENS[random() % (sizeof(TOKENS) / sizeof(TOKENS[0]))]);
+            break;
+        case 4:
+            input.insert(pos, input.substr(random() % (input.size() + 1), random() % 40));
+            break;
+        default:
+            input.insert(pos, std::string(random() % 70, "a%+"[random() % 3]));
+            break;
+        }
+    }
+    return input;
+}
+
+int main(int argc, char **argv)
+{
+    long runs = 200000;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-runs=", 6) == 0)
+        {
+            runs = atol(argv[i] + 6);
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+    for (const std::string &file : files)
+    {
+        std::ifstream in(file, std::ios::binary);
+        std::string input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput((const uint8_t *)input.data(), input.size());
+        printf("%s: OK\n", file.c_str());
+    }
+    if (!files.empty())
+    {
+        return 0;
+    }
+
+    std::mt19937 random(1);
+    for (const char *seed : SEEDS)
+    {
+        LLVMFuzzerTestOneInput((const uint8_t *)seed, strlen(seed));
+    }
+    for (long run = 0; run < runs; run++)
+    {
+        std::string input = _mutate(random, SEEDS[random() % (sizeof(SEEDS) / sizeof(SEEDS[0]))]);
+        LLVMFuzzerTestOneInput((const uint8_t *)input.data(), input.size());
+    }
+    printf("%ld inputs: OK\n", runs);
+    return 0;
+}
+#endif
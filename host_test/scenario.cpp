@@ -0,0 +1,80 @@
+#include "scenario.h"
+#include "esp_http_server.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#define PORTAL_POLL_INTERVAL_US 1000000
+#define PORTAL_POLL_MAXIMUM 60 // the portal tests credentials for at most 30 s
+
+namespace scenario
+{
+      sim_world_t home_world()
+      {
+            sim_world_t world;
+            world.aps.push_back(sim_make_ap(HOME_SSID, HOME_PASSWORD, 6, -52, 1));
+            world.aps.push_back(sim_make_ap(HOME_SSID, HOME_PASSWORD, 1, -71, 2));
+            world.aps.push_back(sim_make_ap("neighbour", "their password", 6, -80, 3));
+            world.aps.push_back(sim_make_ap("neighbour-guest", "", 11, -84, 4));
+            world.aps.push_back(sim_make_ap("printer", "printer password", 3, -77, 5));
+            return world;
+      }
+
+      std::string form_encode(const char *value)
+      {
+            std::string encoded;
+            for (const char *c = value; *c != '\0'; c++)
+            {
+                  if (isalnum((unsigned char)*c) || strchr("-._~", *c) != NULL)
+                  {
+                        encoded += *c;
+                  }
+                  else if (*c == ' ')
+                  {
+                        encoded += '+';
+                  }
+                  else
+                  {
+                        char hex[4];
+                        snprintf(hex, sizeof(hex), "%%%02X", (unsigned char)*c);
+                        encoded += hex;
+                  }
+            }
+            return encoded;
+      }
+
+      static bool _contains(const std::string &body, const char *text)
+      {
+            return body.find(text) != std::string::npos;
+      }
+
+      portal_result_t phone_provision(const char *ssid, const char *password, int64_t think_us)
+      {
+            sim::phone_join(1);
+            sim::http_request(HTTP_GET, "/generate_204"); // connectivity probe of the phone; redirected to the portal
+            sim::http_request(HTTP_GET, "/");
+            sim::sleep(think_us, "user types the credentials");
+            std::string form = "ssid=" + form_encode(ssid) + "&passkey=" + form_encode(password);
+            sim::http_response_t response = sim::http_request(HTTP_POST, "/control", form,
+                                                              {{"Content-Type", "application/x-www-form-urlencoded"}});
+            for (int poll = 0; poll < PORTAL_POLL_MAXIMUM && response.status == 200; poll++)
+            {
+                  if (_contains(response.body, "Connected to wifi network"))
+                  {
+                        sim::phone_leave(1); // the softAP is switched off
+                        return PORTAL_CONNECTED;
+                  }
+                  if (_contains(response.body, "Could not connect to wifi network"))
+                  {
+                        return PORTAL_CONNECT_FAILED;
+                  }
+                  if (_contains(response.body, "Wifi network not found") || _contains(response.body, "Passkey does not fit"))
+                  {
+                        return PORTAL_REJECTED;
+                  }
+                  sim::sleep(PORTAL_POLL_INTERVAL_US, "testing page reloads");
+                  response = sim::http_request(HTTP_GET, "/control/result");
+            }
+            return PORTAL_NO_RESPONSE;
+      }
+} // Namespace
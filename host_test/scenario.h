@@ -0,0 +1,44 @@
+#pragma once
+
+// Building blocks of the host tests and benchmarks: the world of a home network, and a phone that supplies
+// credentials via the captive portal, as a user does
+
+#include <stdint.h>
+#include <string>
+#include "sim.h"
+
+namespace scenario
+{
+    const char *const HOME_SSID = "home";
+    const char *const HOME_PASSWORD = "correct horse battery";
+    const size_t HOME_AP = 0;        // index in sim_world_t::aps
+    const size_t HOME_AP_UPSTAIRS = 1; // second AP of the home network, weaker
+
+    /**
+     * @brief Home network with two APs, and three networks of the neighbours
+     *
+     */
+    sim_world_t home_world();
+
+    typedef enum
+    {
+        PORTAL_CONNECTED,        // "Connected to wifi network"
+        PORTAL_CONNECT_FAILED,   // tested, but could not connect
+        PORTAL_REJECTED,         // pre-flight check: not found, or passkey does not fit the network
+        PORTAL_NO_RESPONSE,      // portal closed, or no result within the timeout of the test
+    } portal_result_t;
+
+    /**
+     * @brief Phone that joins the softAP, opens the portal, waits think_us for the user to type, posts the form, and
+     *        polls the result page every second, as the testing page does
+     *
+     * @return result shown on the result page
+     */
+    portal_result_t phone_provision(const char *ssid, const char *password, int64_t think_us = 20000000);
+
+    /**
+     * @brief application/x-www-form-urlencoded value
+     *
+     */
+    std::string form_encode(const char *value);
+} // Namespace
@@ -0,0 +1,38 @@
+#include "sim_internal.h"
+#include "sdkconfig.h"
+#include "captive_dns.h"
+
+// DNS responder of the captive portal, without sockets: the simulated phones send no DNS queries, so only the task
+// and its buffer are modelled (heap use as in captive_dns.cpp)
+#define DNS_TASK_SIZE (CONFIG_WIFI_PROV_PORTAL_DNS_TASK_STACK_SIZE + 344 + 512)
+
+namespace WIFI_PROVISIONING
+{
+      static bool s_dns_running = false;
+
+      esp_err_t captive_dns_start(esp_netif_t *ap_netif)
+      {
+            (void)ap_netif;
+            sim::lock_t l = sim::lock();
+            if (s_dns_running)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            if (!sim::heap_try_alloc(DNS_TASK_SIZE))
+            {
+                  return ESP_ERR_NO_MEM;
+            }
+            s_dns_running = true;
+            return ESP_OK;
+      }
+
+      void captive_dns_stop()
+      {
+            sim::lock_t l = sim::lock();
+            if (s_dns_running)
+            {
+                  sim::heap_free(DNS_TASK_SIZE);
+                  s_dns_running = false;
+            }
+      }
+} // Namespace
@@ -0,0 +1,197 @@
+#include "sim_internal.h"
+#include "esp_event.h"
+#include <deque>
+#include <list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Default event loop of the simulation; heap use as in ESP-IDF v5: the "sys_evt" task and its queue, and one
+// allocation per handler and per queued event
+#define EVENT_LOOP_SIZE (2304 + 344 + 32 * 16)
+#define EVENT_HANDLER_SIZE 40
+
+namespace sim
+{
+      typedef struct
+      {
+            esp_event_base_t base;
+            int32_t id;
+            esp_event_handler_t handler;
+            void *arg;
+            bool registered;
+      } handler_t;
+
+      typedef struct
+      {
+            esp_event_base_t base;
+            int32_t id;
+            std::vector<uint8_t> data;
+      } event_t;
+
+      static bool s_loop_created = false;
+      static std::list<std::shared_ptr<handler_t>> s_handlers;
+      static std::deque<event_t> s_events;
+      static bool s_dispatching = false; // a handler runs; ESP-IDF holds the mutex of the loop meanwhile
+      static std::thread::id s_loop_thread;
+
+      static bool _matches(const handler_t &handler, esp_event_base_t base, int32_t id)
+      {
+            return (handler.base == ESP_EVENT_ANY_BASE || handler.base == base) &&
+                   (handler.id == ESP_EVENT_ANY_ID || handler.id == id);
+      }
+
+      /**
+       * @brief sys_evt task: calls the handlers of every event in order of registration
+       *
+       */
+      static void _event_loop_task()
+      {
+            lock_t l = lock();
+            s_loop_thread = std::this_thread::get_id();
+            for (;;)
+            {
+                  wait(l, []
+                       { return !s_events.empty(); },
+                       -1, "event queue");
+                  event_t event = s_events.front();
+                  s_events.pop_front();
+                  heap_free(event.data.size());
+                  std::vector<std::shared_ptr<handler_t>> handlers;
+                  for (const std::shared_ptr<handler_t> &handler : s_handlers)
+                  {
+                        if (_matches(*handler, event.base, event.id))
+                        {
+                              handlers.push_back(handler);
+                        }
+                  }
+                  for (const std::shared_ptr<handler_t> &handler : handlers)
+                  {
+                        if (handler->registered) // not unregistered by an earlier handler of this event
+                        {
+                              s_dispatching = true;
+                              l.unlock();
+                              handler->handler(handler->arg, event.base, event.id, event.data.empty() ? NULL : event.data.data());
+                              l.lock();
+                              s_dispatching = false;
+                              notify(l);
+                        }
+                  }
+            }
+      }
+
+      void post_event(lock_t &lock, esp_event_base_t base, int32_t id, const void *data, size_t size)
+      {
+            if (!s_loop_created || !heap_try_alloc(size))
+            {
+                  return;
+            }
+            event_t event = {base, id, std::vector<uint8_t>((const uint8_t *)data, (const uint8_t *)data + size)};
+            s_events.push_back(event);
+            notify(lock);
+      }
+} // Namespace
+
+extern "C"
+{
+      ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+      ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+      esp_err_t esp_event_loop_create_default(void)
+      {
+            sim::lock_t l = sim::lock();
+            if (sim::s_loop_created)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            if (!sim::heap_try_alloc(EVENT_LOOP_SIZE))
+            {
+                  return ESP_ERR_NO_MEM;
+            }
+            sim::s_loop_created = true;
+            sim::spawn(l, "sys_evt", sim::_event_loop_task);
+            return ESP_OK;
+      }
+
+      esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+                                                    esp_event_handler_t event_handler, void *event_handler_arg,
+                                                    esp_event_handler_instance_t *instance)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_loop_created)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            if (!sim::heap_try_alloc(EVENT_HANDLER_SIZE))
+            {
+                  return ESP_ERR_NO_MEM;
+            }
+            std::shared_ptr<sim::handler_t> handler(new sim::handler_t{event_base, event_id, event_handler, event_handler_arg, true});
+            sim::s_handlers.push_back(handler);
+            if (instance != NULL)
+            {
+                  *instance = handler.get();
+            }
+            return ESP_OK;
+      }
+
+      esp_err_t esp_event_handler_instance_unregister(esp_event_base_t event_base, int32_t event_id,
+                                                      esp_event_handler_instance_t instance)
+      {
+            sim::lock_t l = sim::lock();
+            if (std::this_thread::get_id() != sim::s_loop_thread)
+            {
+                  // as the mutex of the loop in ESP-IDF: a running handler returns before it is unregistered
+                  sim::wait(l, []
+                            { return !sim::s_dispatching; },
+                            -1, "event handler returns");
+            }
+            for (auto it = sim::s_handlers.begin(); it != sim::s_handlers.end(); ++it)
+            {
+                  if (it->get() == instance && (*it)->base == event_base && (*it)->id == event_id)
+                  {
+                        (*it)->registered = false;
+                        sim::s_handlers.erase(it);
+                        sim::heap_free(EVENT_HANDLER_SIZE);
+                        return ESP_OK;
+                  }
+            }
+            return ESP_ERR_INVALID_ARG;
+      }
+
+      esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id,
+                                           esp_event_handler_t event_handler, void *event_handler_arg)
+      {
+            return esp_event_handler_instance_register(event_base, event_id, event_handler, event_handler_arg, NULL);
+      }
+
+      esp_err_t esp_event_handler_unregister(esp_event_base_t event_base, int32_t event_id,
+                                             esp_event_handler_t event_handler)
+      {
+            esp_event_handler_instance_t instance = NULL;
+            {
+                  sim::lock_t l = sim::lock();
+                  for (const std::shared_ptr<sim::handler_t> &handler : sim::s_handlers)
+                  {
+                        if (handler->handler == event_handler && handler->base == event_base && handler->id == event_id)
+                        {
+                              instance = handler.get();
+                        }
+                  }
+            }
+            return esp_event_handler_instance_unregister(event_base, event_id, instance);
+      }
+
+      esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data,
+                               size_t event_data_size, TickType_t ticks_to_wait)
+      {
+            (void)ticks_to_wait;
+            sim::lock_t l = sim::lock();
+            if (!sim::s_loop_created)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            sim::post_event(l, event_base, event_id, event_data, event_data_size);
+            return ESP_OK;
+      }
+}
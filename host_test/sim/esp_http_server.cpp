@@ -0,0 +1,452 @@
+#include "sim_internal.h"
+#include "esp_http_server.h"
+#include <cstring>
+#include <deque>
+#include <strings.h>
+#include <vector>
+
+// HTTP server of the simulation: a server task runs the handlers for the requests of sim::http_request(), one at a
+// time, as esp_http_server does. Heap use as in ESP-IDF v5: the task, the server data, and the sockets and handlers
+#define SERVER_SIZE(config) ((config).stack_size + 344 + 400 + (config).max_open_sockets * 300 + (config).max_uri_handlers * 32)
+
+namespace sim
+{
+      typedef struct
+      {
+            std::string uri;
+            httpd_method_t method;
+            esp_err_t (*handler)(httpd_req_t *r);
+            void *user_ctx;
+      } handler_t;
+
+      typedef struct
+      {
+            httpd_req_t *req;
+            std::string uri;
+            std::string body;
+            size_t received;
+            std::map<std::string, std::string> headers;
+            http_response_t response;
+            bool sent;      // response complete
+            bool started;   // status line and headers sent
+            bool done;      // handled, or the server stopped
+      } request_t;
+
+      typedef struct
+      {
+            httpd_config_t config;
+            std::vector<handler_t> handlers;
+            httpd_err_handler_func_t err_handlers[HTTPD_ERR_CODE_MAX];
+            std::deque<request_t *> queue;
+            bool stopping;
+            bool stopped;
+      } server_t;
+
+      static server_t *s_server = NULL; // one server; enough for the component
+
+      static request_t *_request(httpd_req_t *r)
+      {
+            return (request_t *)r->aux;
+      }
+
+      static std::string _path(const std::string &uri)
+      {
+            return uri.substr(0, uri.find('?'));
+      }
+
+      static const char *_err_status(httpd_err_code_t error)
+      {
+            switch (error)
+            {
+            case HTTPD_501_METHOD_NOT_IMPLEMENTED:
+                  return "501 Method Not Implemented";
+            case HTTPD_505_VERSION_NOT_SUPPORTED:
+                  return "505 Version Not Supported";
+            case HTTPD_400_BAD_REQUEST:
+                  return HTTPD_400;
+            case HTTPD_401_UNAUTHORIZED:
+                  return "401 Unauthorized";
+            case HTTPD_403_FORBIDDEN:
+                  return "403 Forbidden";
+            case HTTPD_404_NOT_FOUND:
+                  return HTTPD_404;
+            case HTTPD_405_METHOD_NOT_ALLOWED:
+                  return "405 Method Not Allowed";
+            case HTTPD_408_REQ_TIMEOUT:
+                  return HTTPD_408;
+            case HTTPD_411_LENGTH_REQUIRED:
+                  return "411 Length Required";
+            case HTTPD_414_URI_TOO_LONG:
+                  return "414 URI Too Long";
+            case HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE:
+                  return "431 Request Header Fields Too Large";
+            default:
+                  return HTTPD_500;
+            }
+      }
+
+      /**
+       * @brief Run the handler of the URI and method of the request, or the error handler (404 or 405)
+       *
+       */
+      static void _dispatch(server_t *server, request_t *request)
+      {
+            std::string path = _path(request->uri);
+            const handler_t *found = NULL;
+            bool path_found = false;
+            for (const handler_t &handler : server->handlers)
+            {
+                  bool matches = server->config.uri_match_fn != NULL
+                                     ? server->config.uri_match_fn(handler.uri.c_str(), path.c_str(), path.size())
+                                     : handler.uri == path;
+                  if (matches)
+                  {
+                        path_found = true;
+                        if (handler.method == request->req->method)
+                        {
+                              found = &handler;
+                              break;
+                        }
+                  }
+            }
+            if (found != NULL)
+            {
+                  request->req->user_ctx = found->user_ctx;
+                  found->handler(request->req); // nothing sent on error: esp_http_server closes the socket
+                  return;
+            }
+            httpd_err_code_t error = path_found ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND;
+            if (server->err_handlers[error] != NULL)
+            {
+                  server->err_handlers[error](request->req, error);
+            }
+            else
+            {
+                  httpd_resp_send_err(request->req, error, NULL);
+            }
+      }
+
+      static void _server_task(server_t *server)
+      {
+            lock_t l = lock();
+            for (;;)
+            {
+                  wait(l, [server]
+                       { return server->stopping || !server->queue.empty(); },
+                       -1, "httpd: requests");
+                  if (server->stopping)
+                  {
+                        break;
+                  }
+                  request_t *request = server->queue.front();
+                  server->queue.pop_front();
+                  l.unlock();
+                  _dispatch(server, request);
+                  l.lock();
+                  request->done = true;
+                  notify(l);
+            }
+            server->stopped = true;
+            notify(l);
+      }
+
+      http_response_t http_request(int method, const std::string &uri, const std::string &body,
+                                   const std::map<std::string, std::string> &headers)
+      {
+            lock_t l = lock();
+            sleep_locked(l, world().http_rtt_us / 2, "http: request");
+            server_t *server = s_server;
+            if (server == NULL || server->stopping)
+            {
+                  return {0, {}, ""};
+            }
+            httpd_req_t *req = (httpd_req_t *)::operator new(sizeof(httpd_req_t));
+            memset((void *)req, 0, sizeof(*req));
+            request_t request = {req, uri, body, 0, headers, {0, {}, ""}, false, false, false};
+            req->handle = server;
+            req->method = method;
+            strncpy((char *)req->uri, uri.c_str(), HTTPD_MAX_URI_LEN);
+            req->content_len = body.size();
+            req->aux = &request;
+            server->queue.push_back(&request);
+            notify(l);
+            wait(l, [&request]
+                 { return request.done; },
+                 -1, "http: response");
+            if (req->free_ctx != NULL && req->sess_ctx != NULL)
+            {
+                  req->free_ctx(req->sess_ctx);
+            }
+            ::operator delete(req);
+            if (!request.started)
+            {
+                  request.response.status = 0; // handler failed: the socket is closed without a response
+            }
+            sleep_locked(l, world().http_rtt_us / 2, "http: response");
+            return request.response;
+      }
+} // Namespace
+
+extern "C"
+{
+      esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+      {
+            sim::lock_t l = sim::lock();
+            if (sim::s_server != NULL)
+            {
+                  return ESP_ERR_HTTPD_TASK; // the port is in use
+            }
+            if (!sim::heap_try_alloc(SERVER_SIZE(*config)))
+            {
+                  return ESP_ERR_HTTPD_ALLOC_MEM;
+            }
+            sim::server_t *server = new sim::server_t{*config, {}, {}, {}, false, false};
+            sim::s_server = server;
+            *handle = server;
+            sim::spawn(l, "httpd", [server]
+                       { sim::_server_task(server); });
+            return ESP_OK;
+      }
+
+      esp_err_t httpd_stop(httpd_handle_t handle)
+      {
+            sim::server_t *server = (sim::server_t *)handle;
+            if (server == NULL)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            sim::lock_t l = sim::lock();
+            server->stopping = true;
+            sim::notify(l);
+            sim::wait(l, [server]
+                      { return server->stopped; },
+                      -1, "httpd_stop");
+            for (sim::request_t *request : server->queue) // connections are closed
+            {
+                  request->done = true;
+            }
+            server->queue.clear();
+            sim::notify(l);
+            sim::heap_free(SERVER_SIZE(server->config));
+            if (sim::s_server == server)
+            {
+                  sim::s_server = NULL;
+            }
+            delete server;
+            return ESP_OK;
+      }
+
+      esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+      {
+            sim::server_t *server = (sim::server_t *)handle;
+            if (server == NULL || uri_handler == NULL)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            sim::lock_t l = sim::lock();
+            for (const sim::handler_t &handler : server->handlers)
+            {
+                  if (handler.uri == uri_handler->uri && handler.method == uri_handler->method)
+                  {
+                        return ESP_ERR_HTTPD_HANDLER_EXISTS;
+                  }
+            }
+            if (server->handlers.size() >= server->config.max_uri_handlers)
+            {
+                  return ESP_ERR_HTTPD_HANDLERS_FULL;
+            }
+            server->handlers.push_back({uri_handler->uri, uri_handler->method, uri_handler->handler, uri_handler->user_ctx});
+            return ESP_OK;
+      }
+
+      esp_err_t httpd_register_err_handler(httpd_handle_t handle, httpd_err_code_t error, httpd_err_handler_func_t handler_fn)
+      {
+            sim::server_t *server = (sim::server_t *)handle;
+            if (server == NULL || error >= HTTPD_ERR_CODE_MAX)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            sim::lock_t l = sim::lock();
+            server->err_handlers[error] = handler_fn;
+            return ESP_OK;
+      }
+
+      int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+      {
+            sim::request_t *request = sim::_request(r);
+            size_t length = std::min(buf_len, request->body.size() - request->received);
+            memcpy(buf, request->body.data() + request->received, length);
+            request->received += length;
+            return (int)length;
+      }
+
+      size_t httpd_req_get_url_query_len(httpd_req_t *r)
+      {
+            size_t query = sim::_request(r)->uri.find('?');
+            return query == std::string::npos ? 0 : sim::_request(r)->uri.size() - query - 1;
+      }
+
+      esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+      {
+            const std::string &uri = sim::_request(r)->uri;
+            size_t query = uri.find('?');
+            if (query == std::string::npos)
+            {
+                  return ESP_ERR_NOT_FOUND;
+            }
+            if (buf == NULL || buf_len == 0)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            std::string value = uri.substr(query + 1);
+            strlcpy(buf, value.c_str(), buf_len);
+            return value.size() >= buf_len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+      }
+
+      static const std::string *_header(httpd_req_t *r, const char *field)
+      {
+            for (const auto &header : sim::_request(r)->headers)
+            {
+                  if (strcasecmp(header.first.c_str(), field) == 0)
+                  {
+                        return &header.second;
+                  }
+            }
+            return NULL;
+      }
+
+      size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+      {
+            const std::string *value = _header(r, field);
+            return value != NULL ? value->size() : 0;
+      }
+
+      esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+      {
+            const std::string *value = _header(r, field);
+            if (value == NULL)
+            {
+                  return ESP_ERR_NOT_FOUND;
+            }
+            if (val == NULL || val_size == 0)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            strlcpy(val, value->c_str(), val_size);
+            return value->size() >= val_size ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+      }
+
+      // as in esp_http_server: the value of the first key=value pair of the query with the key, not URL decoded
+      esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+      {
+            if (qry == NULL || key == NULL || val == NULL)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            const char *qry_ptr = qry;
+            const size_t buf_len = val_size;
+            while (strlen(qry_ptr))
+            {
+                  const char *val_ptr = strchr(qry_ptr, '=');
+                  if (!val_ptr)
+                  {
+                        break;
+                  }
+                  size_t offset = val_ptr - qry_ptr;
+                  if ((offset != strlen(key)) || (strncasecmp(qry_ptr, key, offset)))
+                  {
+                        qry_ptr = strchr(val_ptr, '&');
+                        if (!qry_ptr)
+                        {
+                              break;
+                        }
+                        qry_ptr++;
+                        continue;
+                  }
+                  val_ptr++;
+                  qry_ptr = strchr(val_ptr, '&');
+                  if (!qry_ptr)
+                  {
+                        qry_ptr = val_ptr + strlen(val_ptr);
+                  }
+                  val_size = qry_ptr - val_ptr;
+                  strlcpy(val, val_ptr, std::min(val_size + 1, buf_len));
+                  if (buf_len < val_size + 1)
+                  {
+                        return ESP_ERR_HTTPD_RESULT_TRUNC;
+                  }
+                  return ESP_OK;
+            }
+            return ESP_ERR_NOT_FOUND;
+      }
+
+      esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+      {
+            sim::_request(r)->response.status = atoi(status);
+            return ESP_OK;
+      }
+
+      esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+      {
+            sim::_request(r)->response.headers["Content-Type"] = type;
+            return ESP_OK;
+      }
+
+      esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+      {
+            sim::request_t *request = sim::_request(r);
+            sim::server_t *server = (sim::server_t *)r->handle;
+            if (request->response.headers.count(field) == 0 &&
+                request->response.headers.size() >= server->config.max_resp_headers + request->response.headers.count("Content-Type"))
+            {
+                  return ESP_ERR_HTTPD_RESP_HDR;
+            }
+            request->response.headers[field] = value;
+            return ESP_OK;
+      }
+
+      static esp_err_t _send(httpd_req_t *r, const char *buf, ssize_t buf_len, bool last)
+      {
+            sim::request_t *request = sim::_request(r);
+            if (request->sent)
+            {
+                  return ESP_ERR_HTTPD_RESP_SEND;
+            }
+            if (!request->started)
+            {
+                  request->started = true;
+                  if (request->response.status == 0)
+                  {
+                        request->response.status = 200;
+                  }
+                  if (request->response.headers.count("Content-Type") == 0)
+                  {
+                        request->response.headers["Content-Type"] = HTTPD_TYPE_TEXT;
+                  }
+            }
+            if (buf != NULL)
+            {
+                  request->response.body.append(buf, buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : (size_t)buf_len);
+            }
+            request->sent = last;
+            return ESP_OK;
+      }
+
+      esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+      {
+            return _send(r, buf, buf_len, true);
+      }
+
+      esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+      {
+            return _send(r, buf, buf_len, buf == NULL || buf_len == 0);
+      }
+
+      esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+      {
+            const char *status = sim::_err_status(error);
+            httpd_resp_set_status(req, status);
+            httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+            return httpd_resp_send(req, msg != NULL ? msg : status + 4, HTTPD_RESP_USE_STRLEN);
+      }
+}
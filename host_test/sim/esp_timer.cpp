@@ -0,0 +1,156 @@
+#include "sim_internal.h"
+#include "esp_timer.h"
+#include <list>
+
+#define TIMER_SIZE 56 // struct esp_timer of ESP-IDF v5
+#define TIMER_TASK_SIZE (4096 + 344)
+
+struct esp_timer
+{
+      esp_timer_cb_t callback;
+      void *arg;
+      const char *name;
+      int64_t alarm_us; // -1 when not armed
+      int64_t period_us; // 0 for a one-shot timer
+};
+
+namespace sim
+{
+      static std::list<esp_timer *> s_timers;
+      static bool s_timers_changed = false;
+
+      static esp_timer *_first_alarm()
+      {
+            esp_timer *first = NULL;
+            for (esp_timer *timer : s_timers)
+            {
+                  if (timer->alarm_us >= 0 && (first == NULL || timer->alarm_us < first->alarm_us))
+                  {
+                        first = timer;
+                  }
+            }
+            return first;
+      }
+
+      /**
+       * @brief esp_timer task: calls the callbacks of the expired timers, one at a time
+       *
+       */
+      static void _timer_task()
+      {
+            lock_t l = lock();
+            for (;;)
+            {
+                  esp_timer *first = _first_alarm();
+                  int64_t alarm_us = first != NULL ? first->alarm_us : -1;
+                  wait(l, [alarm_us]
+                       {
+                             if (s_timers_changed)
+                             {
+                                   s_timers_changed = false;
+                                   return true;
+                             }
+                             return alarm_us >= 0 && now_us() >= alarm_us; },
+                       alarm_us, "esp_timer");
+                  for (esp_timer *timer = _first_alarm(); timer != NULL && timer->alarm_us <= now_us(); timer = _first_alarm())
+                  {
+                        timer->alarm_us = timer->period_us > 0 ? timer->alarm_us + timer->period_us : -1;
+                        esp_timer_cb_t callback = timer->callback;
+                        void *arg = timer->arg;
+                        l.unlock();
+                        callback(arg);
+                        l.lock();
+                  }
+            }
+      }
+
+      void timer_boot()
+      {
+            lock_t l = lock();
+            heap_alloc(TIMER_TASK_SIZE);
+            spawn(l, "esp_timer", _timer_task);
+      }
+
+      static esp_err_t _start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+      {
+            lock_t l = lock();
+            if (timer->alarm_us >= 0)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            timer->alarm_us = now_us() + (int64_t)timeout_us;
+            timer->period_us = (int64_t)period_us;
+            s_timers_changed = true;
+            notify(l);
+            return ESP_OK;
+      }
+} // Namespace
+
+extern "C"
+{
+      esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+      {
+            if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            if (!sim::heap_try_alloc(TIMER_SIZE))
+            {
+                  return ESP_ERR_NO_MEM;
+            }
+            sim::lock_t l = sim::lock();
+            esp_timer *timer = new esp_timer{create_args->callback, create_args->arg, create_args->name, -1, 0};
+            sim::s_timers.push_back(timer);
+            *out_handle = timer;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+      {
+            return sim::_start(timer, timeout_us, 0);
+      }
+
+      esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+      {
+            return sim::_start(timer, period, period);
+      }
+
+      esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+      {
+            sim::lock_t l = sim::lock();
+            if (timer->alarm_us < 0)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            timer->alarm_us = -1;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+      {
+            if (timer == NULL)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            sim::lock_t l = sim::lock();
+            if (timer->alarm_us >= 0)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            sim::s_timers.remove(timer);
+            delete timer;
+            sim::heap_free(TIMER_SIZE);
+            return ESP_OK;
+      }
+
+      int64_t esp_timer_get_time(void)
+      {
+            return sim::now_us();
+      }
+
+      bool esp_timer_is_active(esp_timer_handle_t timer)
+      {
+            sim::lock_t l = sim::lock();
+            return timer->alarm_us >= 0;
+      }
+}
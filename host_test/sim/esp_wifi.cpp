@@ -0,0 +1,1324 @@
+#include "sim_internal.h"
+#include "esp_wifi.h"
+#include "esp_rrm.h"
+#include "esp_wnm.h"
+#include "esp_netif_net_stack.h"
+#include "lwip/dhcp.h"
+#include "lwip/stats.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#define TCP_MSS 1436 // CONFIG_LWIP_TCP_MSS of ESP-IDF
+
+// Wifi driver, netifs and DHCP client of the simulation. The driver scans the access points of the world, joins
+// them after the modelled delays, and posts the events of ESP-IDF. Heap use as in ESP-IDF v5 with the default
+// wifi_init_config_t: buffers and the wifi task, netif and lwIP structures, and 80 bytes per scanned BSS.
+//
+// Traffic model of the connected STA: the link rate follows the RSSI, for the uplink lowered by the TX power below
+// the maximum. A STA in power save receives a frame the AP buffered only at its next wake: every DTIM beacon
+// (WIFI_PS_MIN_MODEM) or every listen interval (WIFI_PS_MAX_MODEM); after traffic it stays awake for a while. Packets
+// are counted in lwip_stats.link, for the sampler of the adaptive power profile
+#define WIFI_DRIVER_SIZE (48 * 1024)
+#define STA_NETIF_SIZE 1400
+#define AP_NETIF_SIZE 1900 // with DHCP server
+#define AP_RECORD_SIZE 80
+#define SCAN_CONFIG_NVS_READS 6 // values the driver reads from NVS at esp_wifi_init() with nvs_enable
+
+struct esp_netif_obj
+{
+      bool is_sta;
+      esp_netif_ip_info_t ip_info;
+      esp_netif_dns_info_t dns[ESP_NETIF_DNS_MAX];
+      std::string hostname;
+      bool dhcpc_started;
+      bool link_up;
+      uint32_t dhcp_generation; // changes when a DHCP exchange in progress must stop
+      struct netif lwip_netif;
+      struct dhcp dhcp;
+};
+
+struct stats_ lwip_stats;
+
+namespace sim
+{
+      typedef enum
+      {
+            STA_IDLE,
+            STA_CONNECTING,
+            STA_CONNECTED,
+      } sta_state_t;
+
+      typedef struct
+      {
+            bool initialized;
+            bool started;
+            bool nvs_enable;
+            wifi_mode_t mode;
+            wifi_config_t sta_config;
+            wifi_config_t ap_config;
+            sta_state_t sta_state;
+            uint32_t attempt;             // changes when a connect attempt in progress must stop
+            int ap;                       // index of the AP of the attempt or connection; -1 when none
+            bool scanning;
+            uint32_t scan;                // changes when a scan in progress must stop
+            uint8_t scan_id;
+            std::vector<wifi_ap_record_t> scan_results;
+            std::set<std::string> pmk_cache; // passphrases the supplicant derived a PMK for
+            wifi_ps_type_t ps;
+            int8_t max_tx_power;
+            uint16_t listen_interval;     // of the association, in beacon intervals
+            esp_netif_t *sta_netif;
+            esp_netif_t *ap_netif;
+            std::set<uint8_t> phones;     // stations on the softAP
+      } driver_t;
+
+      static driver_t s_driver = {false, false, true, WIFI_MODE_STA, {}, {}, STA_IDLE, 0, -1, false, 0, 0, {}, {},
+                                  WIFI_PS_MIN_MODEM, 80, 3, NULL, NULL, {}};
+
+      static bool _has_sta(wifi_mode_t mode)
+      {
+            return mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA;
+      }
+
+      static bool _has_ap(wifi_mode_t mode)
+      {
+            return mode == WIFI_MODE_AP || mode == WIFI_MODE_APSTA;
+      }
+
+      static esp_ip4_addr_t _ip4(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      {
+            esp_ip4_addr_t ip;
+            uint8_t bytes[4] = {a, b, c, d};
+            memcpy(&ip.addr, bytes, sizeof(bytes));
+            return ip;
+      }
+
+      /**
+       * @brief Address the DHCP server of the LAN of the AP gives the device: 192.168.<LAN>.100, where the LAN follows
+       *        from the SSID, so every AP of an SSID is in the same subnet
+       *
+       */
+      static esp_netif_ip_info_t _lease(const sim_ap_t &ap)
+      {
+            uint32_t hash = 2166136261u;
+            for (char c : ap.ssid)
+            {
+                  hash = (hash ^ (uint8_t)c) * 16777619u;
+            }
+            uint8_t lan = 10 + hash % 200;
+            return {_ip4(192, 168, lan, 100), _ip4(255, 255, 255, 0), _ip4(192, 168, lan, 1)};
+      }
+
+      /**
+       * @brief Strength of the security of an auth mode, for the threshold of the STA config
+       *
+       */
+      static int _auth_strength(wifi_auth_mode_t authmode)
+      {
+            switch (authmode)
+            {
+            case WIFI_AUTH_OPEN:
+                  return 0;
+            case WIFI_AUTH_WEP:
+                  return 1;
+            case WIFI_AUTH_WPA_PSK:
+                  return 2;
+            case WIFI_AUTH_WPA3_PSK:
+            case WIFI_AUTH_WPA2_WPA3_PSK:
+                  return 4;
+            default:
+                  return 3;
+            }
+      }
+
+      static bool _is_psk(wifi_auth_mode_t authmode)
+      {
+            return authmode == WIFI_AUTH_WPA_PSK || authmode == WIFI_AUTH_WPA2_PSK || authmode == WIFI_AUTH_WPA_WPA2_PSK ||
+                   authmode == WIFI_AUTH_WPA2_WPA3_PSK || authmode == WIFI_AUTH_WPA3_PSK;
+      }
+
+      static std::string _password(const wifi_sta_config_t &config)
+      {
+            return std::string((const char *)config.password, strnlen((const char *)config.password, sizeof(config.password)));
+      }
+
+      static std::string _ssid(const uint8_t *ssid, size_t size)
+      {
+            return std::string((const char *)ssid, strnlen((const char *)ssid, size));
+      }
+
+      static bool _is_hex_pmk(const std::string &password)
+      {
+            return password.size() == 64 && std::all_of(password.begin(), password.end(), ::isxdigit);
+      }
+
+      /**
+       * @brief 4-way handshake: the passphrase, or for WPA/WPA2 the PMK as 64 hex digits, must be those of the AP
+       *
+       */
+      static bool _handshake_ok(const sim_ap_t &ap, const std::string &password)
+      {
+            if (!_is_psk(ap.authmode))
+            {
+                  return true;
+            }
+            if (password == ap.password)
+            {
+                  return true;
+            }
+            if (!_is_hex_pmk(password) || ap.authmode == WIFI_AUTH_WPA3_PSK) // SAE needs the passphrase
+            {
+                  return false;
+            }
+            uint8_t pmk[32];
+            derive_pmk((const uint8_t *)ap.password.data(), ap.password.size(), (const uint8_t *)ap.ssid.data(),
+                       ap.ssid.size(), pmk, sizeof(pmk));
+            char hex[65];
+            for (int i = 0; i < 32; i++)
+            {
+                  snprintf(&hex[2 * i], 3, "%02x", pmk[i]);
+            }
+            return strcasecmp(hex, password.c_str()) == 0;
+      }
+
+      static bool _sta_config_matches(const sim_ap_t &ap, const wifi_sta_config_t &config)
+      {
+            return ap.up && ap.ssid == _ssid(config.ssid, sizeof(config.ssid)) &&
+                   (!config.bssid_set || memcmp(ap.bssid, config.bssid, sizeof(ap.bssid)) == 0) &&
+                   _auth_strength(ap.authmode) >= _auth_strength(config.threshold.authmode);
+      }
+
+      static void _free_scan_results()
+      {
+            heap_free(s_driver.scan_results.size() * AP_RECORD_SIZE);
+            s_driver.scan_results.clear();
+      }
+
+      static void _post_got_ip(lock_t &l, esp_netif_t *netif, bool ip_changed)
+      {
+            ip_event_got_ip_t event = {netif, netif->ip_info, ip_changed};
+            post_event(l, IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event));
+      }
+
+      /**
+       * @brief lwIP with LWIP_DHCP_RESTORE_LAST_IP keeps the address of the last lease in NVS, and asks for it again
+       *        with INIT-REBOOT when the DHCP client starts
+       *
+       */
+      static bool _restored_ip(esp_ip4_addr_t *ip)
+      {
+#ifdef CONFIG_LWIP_DHCP_RESTORE_LAST_IP
+            nvs_handle_t handle;
+            size_t size = sizeof(*ip);
+            bool found = false;
+            if (nvs_open("dhcp_state", NVS_READONLY, &handle) == ESP_OK)
+            {
+                  found = nvs_get_blob(handle, "sta.ip", ip, &size) == ESP_OK;
+                  nvs_close(handle);
+            }
+            return found;
+#else
+            (void)ip;
+            return false;
+#endif
+      }
+
+      static void _store_ip(const esp_ip4_addr_t *ip)
+      {
+#ifdef CONFIG_LWIP_DHCP_RESTORE_LAST_IP
+            nvs_handle_t handle;
+            if (nvs_open("dhcp_state", NVS_READWRITE, &handle) == ESP_OK)
+            {
+                  if (ip != NULL)
+                  {
+                        nvs_set_blob(handle, "sta.ip", ip, sizeof(*ip));
+                  }
+                  else
+                  {
+                        nvs_erase_key(handle, "sta.ip");
+                  }
+                  nvs_commit(handle);
+                  nvs_close(handle);
+            }
+#else
+            (void)ip;
+#endif
+      }
+
+      /**
+       * @brief DHCP client of the STA netif, started when the link is up: INIT-REBOOT with the restored address, and
+       *        the full exchange when there is none, or the server answers with NAK
+       *
+       */
+      static void _dhcp_client(esp_netif_t *netif, uint32_t generation)
+      {
+            esp_ip4_addr_t requested = {};
+            bool restored = _restored_ip(&requested); // NVS calls take the scheduler lock
+            lock_t l = lock();
+            if (generation != netif->dhcp_generation || s_driver.ap < 0)
+            {
+                  return;
+            }
+            sim_world_t &w = world();
+            const esp_netif_ip_info_t lease = _lease(w.aps[s_driver.ap]);
+            bool acked = false;
+            if (restored && requested.addr != 0)
+            {
+                  sleep_locked(l, w.dhcp_reboot_us, "dhcp: INIT-REBOOT");
+                  if (generation != netif->dhcp_generation)
+                  {
+                        return;
+                  }
+                  acked = requested.addr == lease.ip.addr && !w.dhcp_nak_reboot;
+            }
+            if (!acked)
+            {
+                  sleep_locked(l, w.dhcp_discover_us, "dhcp: DISCOVER");
+                  if (generation != netif->dhcp_generation)
+                  {
+                        return;
+                  }
+            }
+            bool ip_changed = netif->ip_info.ip.addr != lease.ip.addr;
+            netif->ip_info = lease;
+            netif->dns[ESP_NETIF_DNS_MAIN].ip.type = ESP_IPADDR_TYPE_V4;
+            netif->dns[ESP_NETIF_DNS_MAIN].ip.u_addr.ip4 = lease.gw;
+            netif->dhcp.offered_t0_lease = w.dhcp_lease_s;
+            netif->dhcp.offered_t1_renew = w.dhcp_lease_s / 2;
+            netif->dhcp.offered_t2_rebind = w.dhcp_lease_s * 7 / 8;
+            _post_got_ip(l, netif, ip_changed);
+            l.unlock();
+            _store_ip(&lease.ip);
+      }
+
+      typedef struct
+      {
+            int64_t from_us;
+            int64_t until_us;
+      } awake_window_t;
+
+      static awake_window_t s_awake_window = {0, 0}; // STA in power save awake for traffic
+
+      /**
+       * @brief Time between the wakes of the STA in power save; 0 without power save
+       *
+       */
+      static int64_t _ps_period_us()
+      {
+            switch (s_driver.ps)
+            {
+            case WIFI_PS_NONE:
+                  return 0;
+            case WIFI_PS_MIN_MODEM:
+                  return world().beacon_interval_us * world().dtim_period;
+            default:
+                  return world().beacon_interval_us * s_driver.listen_interval;
+            }
+      }
+
+      static bool _awake_for_traffic(int64_t t)
+      {
+            return t >= s_awake_window.from_us && t < s_awake_window.until_us;
+      }
+
+      /**
+       * @brief The STA is awake for traffic from from_us until until_us, and then for the awake tail
+       *
+       */
+      static void _awake_for(int64_t from_us, int64_t until_us)
+      {
+            until_us += world().ps_awake_tail_us;
+            if (from_us <= s_awake_window.until_us)
+            {
+                  s_awake_window.until_us = std::max(s_awake_window.until_us, until_us);
+            }
+            else
+            {
+                  s_awake_window = {from_us, until_us};
+            }
+      }
+
+      /**
+       * @brief Time until the STA can receive a frame the AP got at time t
+       *
+       */
+      static int64_t _downlink_wait_us(int64_t t)
+      {
+            int64_t period = _ps_period_us();
+            if (period == 0 || _awake_for_traffic(t))
+            {
+                  return 0;
+            }
+            return (t / period + 1) * period - t + world().ps_wake_us; // the beacon tells it that the AP has frames
+      }
+
+      /**
+       * @brief Effective rate of the link of an ESP32 (802.11n HT20, one stream, after protocol overhead)
+       *
+       * @param rssi signal strength at the receiver
+       * @return bits per second
+       */
+      static double _link_rate_bps(int rssi)
+      {
+            if (rssi >= -67)
+                  return 20e6;
+            if (rssi >= -73)
+                  return 12e6;
+            if (rssi >= -80)
+                  return 5e6;
+            if (rssi >= -87)
+                  return 1.5e6;
+            return 0.5e6;
+      }
+
+      static double _downlink_rate_bps()
+      {
+            return _link_rate_bps(world().aps[s_driver.ap].rssi);
+      }
+
+      /**
+       * @brief The AP receives the STA at the RSSI the STA sees, less the TX power below the maximum of 21 dBm
+       *
+       */
+      static double _uplink_rate_bps()
+      {
+            return _link_rate_bps(world().aps[s_driver.ap].rssi - (84 - s_driver.max_tx_power) / 4);
+      }
+
+      static int64_t _air_us(size_t bytes, double rate_bps)
+      {
+            return world().frame_overhead_us + (int64_t)(bytes * 8 * 1e6 / rate_bps);
+      }
+
+      static uint32_t _packets(size_t bytes)
+      {
+            return bytes == 0 ? 0 : (uint32_t)((bytes + TCP_MSS - 1) / TCP_MSS);
+      }
+
+      static void _link_up(lock_t &l)
+      {
+            esp_netif_t *netif = s_driver.sta_netif;
+            if (netif == NULL)
+            {
+                  return;
+            }
+            netif->link_up = true;
+            if (netif->dhcpc_started)
+            {
+                  uint32_t generation = ++netif->dhcp_generation;
+                  spawn(l, "dhcpc", [netif, generation]
+                        { _dhcp_client(netif, generation); });
+            }
+            else if (netif->ip_info.ip.addr != 0)
+            {
+                  _post_got_ip(l, netif, false); // static IP
+            }
+      }
+
+      /**
+       * @brief End the connection or the connect attempt, and post WIFI_EVENT_STA_DISCONNECTED
+       *
+       */
+      static void _sta_disconnected(lock_t &l, uint8_t reason)
+      {
+            wifi_event_sta_disconnected_t event = {};
+            const wifi_sta_config_t &config = s_driver.sta_config.sta;
+            memcpy(event.ssid, config.ssid, sizeof(event.ssid));
+            event.ssid_len = strnlen((const char *)config.ssid, sizeof(config.ssid));
+            if (s_driver.ap >= 0)
+            {
+                  memcpy(event.bssid, world().aps[s_driver.ap].bssid, sizeof(event.bssid));
+                  event.rssi = world().aps[s_driver.ap].rssi;
+            }
+            event.reason = reason;
+            s_driver.sta_state = STA_IDLE;
+            s_driver.attempt++;
+            s_driver.ap = -1;
+            esp_netif_t *netif = s_driver.sta_netif;
+            if (netif != NULL)
+            {
+                  netif->link_up = false;
+                  netif->dhcp_generation++;
+                  if (netif->dhcpc_started)
+                  {
+                        netif->ip_info = {};
+                  }
+            }
+            post_event(l, WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event, sizeof(event));
+      }
+
+      /**
+       * @brief Connect attempt of esp_wifi_connect(): find the AP (a probe on the channel of a known BSSID, otherwise
+       *        a scan, which stops at the first channel with a match for WIFI_FAST_SCAN), derive the PMK, associate
+       *
+       */
+      static void _connect_attempt(uint32_t attempt)
+      {
+            lock_t l = lock();
+            sim_world_t &w = world();
+            const wifi_sta_config_t config = s_driver.sta_config.sta;
+            bool directed = config.bssid_set && config.channel != 0;
+            uint8_t first_channel = config.channel != 0 ? config.channel : 1;
+            uint8_t last_channel = config.channel != 0 ? config.channel : w.country_nchan;
+            int found = -1;
+            for (uint8_t channel = first_channel; channel <= last_channel; channel++)
+            {
+                  sleep_locked(l, directed ? w.probe_us : w.scan_channel_us, "wifi: connect scan");
+                  if (attempt != s_driver.attempt)
+                  {
+                        return;
+                  }
+                  for (size_t i = 0; i < w.aps.size(); i++)
+                  {
+                        if (w.aps[i].channel == channel && _sta_config_matches(w.aps[i], config) &&
+                            (found < 0 || w.aps[i].rssi > w.aps[found].rssi))
+                        {
+                              found = i;
+                        }
+                  }
+                  if (found >= 0 && config.scan_method == WIFI_FAST_SCAN)
+                  {
+                        break;
+                  }
+            }
+            if (found < 0)
+            {
+                  _sta_disconnected(l, WIFI_REASON_NO_AP_FOUND);
+                  return;
+            }
+            s_driver.ap = found;
+            sim_ap_t &ap = w.aps[found];
+            std::string password = _password(config);
+            if (_is_psk(ap.authmode) && !_is_hex_pmk(password) && s_driver.pmk_cache.insert(ap.ssid + '\n' + password).second)
+            {
+                  sleep_locked(l, w.pmk_us, "wifi: PMK");
+                  if (attempt != s_driver.attempt)
+                  {
+                        return;
+                  }
+            }
+            if (ap.fail_attempts > 0)
+            {
+                  ap.fail_attempts--;
+                  sleep_locked(l, w.assoc_us, "wifi: association");
+                  if (attempt == s_driver.attempt)
+                  {
+                        _sta_disconnected(l, ap.fail_reason);
+                  }
+                  return;
+            }
+            if (!_handshake_ok(ap, password))
+            {
+                  sleep_locked(l, w.assoc_us + w.handshake_fail_us, "wifi: 4-way handshake");
+                  if (attempt == s_driver.attempt)
+                  {
+                        _sta_disconnected(l, WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT);
+                  }
+                  return;
+            }
+            sleep_locked(l, w.assoc_us, "wifi: association");
+            if (attempt != s_driver.attempt)
+            {
+                  return;
+            }
+            s_driver.sta_state = STA_CONNECTED;
+            s_driver.listen_interval = config.listen_interval != 0 ? config.listen_interval : 3; // 0: default of the driver
+            s_awake_window = {0, 0};
+            wifi_event_sta_connected_t event = {};
+            memcpy(event.ssid, ap.ssid.data(), std::min(ap.ssid.size(), sizeof(event.ssid)));
+            event.ssid_len = std::min(ap.ssid.size(), sizeof(event.ssid));
+            memcpy(event.bssid, ap.bssid, sizeof(event.bssid));
+            event.channel = ap.channel;
+            event.authmode = ap.authmode;
+            event.aid = 1;
+            post_event(l, WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &event, sizeof(event));
+            _link_up(l);
+      }
+
+      typedef struct
+      {
+            std::string ssid;
+            bool has_bssid;
+            uint8_t bssid[6];
+            uint8_t channel;
+            bool show_hidden;
+            int64_t channel_us;
+      } scan_t;
+
+      static void _scan_finished(lock_t &l, const scan_t &scan)
+      {
+            _free_scan_results();
+            for (const sim_ap_t &ap : world().aps)
+            {
+                  bool visible = ap.up && (scan.channel == 0 || ap.channel == scan.channel) &&
+                                 (scan.ssid.empty() || ap.ssid == scan.ssid) &&
+                                 (!scan.has_bssid || memcmp(ap.bssid, scan.bssid, sizeof(ap.bssid)) == 0) &&
+                                 (!ap.hidden || !scan.ssid.empty() || scan.show_hidden);
+                  if (!visible || !heap_try_alloc(AP_RECORD_SIZE))
+                  {
+                        continue;
+                  }
+                  wifi_ap_record_t record = {};
+                  memcpy(record.bssid, ap.bssid, sizeof(record.bssid));
+                  if (!ap.hidden || !scan.ssid.empty())
+                  {
+                        memcpy(record.ssid, ap.ssid.data(), std::min(ap.ssid.size(), sizeof(record.ssid) - 1));
+                  }
+                  record.primary = ap.channel;
+                  record.rssi = ap.rssi;
+                  record.authmode = ap.authmode;
+                  record.pairwise_cipher = ap.authmode == WIFI_AUTH_OPEN ? WIFI_CIPHER_TYPE_NONE : WIFI_CIPHER_TYPE_CCMP;
+                  record.group_cipher = record.pairwise_cipher;
+                  record.phy_11b = record.phy_11g = record.phy_11n = 1;
+                  s_driver.scan_results.push_back(record);
+            }
+            std::stable_sort(s_driver.scan_results.begin(), s_driver.scan_results.end(),
+                             [](const wifi_ap_record_t &a, const wifi_ap_record_t &b)
+                             { return a.rssi > b.rssi; });
+            s_driver.scanning = false;
+            wifi_event_sta_scan_done_t event = {0, (uint8_t)s_driver.scan_results.size(), ++s_driver.scan_id};
+            post_event(l, WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event, sizeof(event));
+      }
+
+      static int64_t _scan_duration(const scan_t &scan)
+      {
+            return (scan.channel != 0 ? 1 : world().country_nchan) * scan.channel_us;
+      }
+
+      static void _stop_scan(lock_t &l, bool post_done)
+      {
+            if (!s_driver.scanning)
+            {
+                  return;
+            }
+            s_driver.scanning = false;
+            s_driver.scan++;
+            if (post_done)
+            {
+                  wifi_event_sta_scan_done_t event = {1, 0, ++s_driver.scan_id};
+                  post_event(l, WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event, sizeof(event));
+            }
+      }
+
+      static esp_netif_t *_netif_create(bool is_sta)
+      {
+            size_t size = is_sta ? STA_NETIF_SIZE : AP_NETIF_SIZE;
+            if (!heap_try_alloc(size))
+            {
+                  return NULL;
+            }
+            esp_netif_t *netif = new esp_netif_obj();
+            netif->is_sta = is_sta;
+            netif->dhcpc_started = is_sta;
+            netif->lwip_netif.client_data[LWIP_NETIF_CLIENT_DATA_INDEX_DHCP] = &netif->dhcp;
+            if (!is_sta)
+            {
+                  netif->ip_info = {_ip4(192, 168, 4, 1), _ip4(255, 255, 255, 0), _ip4(192, 168, 4, 1)};
+            }
+            return netif;
+      }
+} // Namespace
+
+void sim::phone_join(uint8_t id)
+{
+      lock_t l = lock();
+      if (!s_driver.started || !_has_ap(s_driver.mode) || !s_driver.phones.insert(id).second)
+      {
+            return;
+      }
+      wifi_event_ap_staconnected_t event = {{0x0a, 0x00, 0x00, 0x00, 0x00, id}, (uint8_t)s_driver.phones.size(), false};
+      post_event(l, WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, &event, sizeof(event));
+}
+
+void sim::phone_leave(uint8_t id)
+{
+      lock_t l = lock();
+      if (s_driver.phones.erase(id) == 0)
+      {
+            return;
+      }
+      wifi_event_ap_stadisconnected_t event = {{0x0a, 0x00, 0x00, 0x00, 0x00, id}, 1, false, WIFI_REASON_ASSOC_LEAVE};
+      post_event(l, WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, &event, sizeof(event));
+}
+
+void sim::set_ap_up(size_t ap, bool up)
+{
+      lock_t l = lock();
+      world().aps.at(ap).up = up;
+      if (up || s_driver.ap != (int)ap || s_driver.sta_state != STA_CONNECTED)
+      {
+            return;
+      }
+      uint32_t attempt = s_driver.attempt;
+      spawn(l, "wifi: beacons", [ap, attempt] // the STA misses the beacons until the beacon timeout
+            {
+                  lock_t l = lock();
+                  sleep_locked(l, world().beacon_timeout_us, "wifi: beacon timeout");
+                  if (attempt == s_driver.attempt && s_driver.ap == (int)ap && !world().aps[ap].up)
+                  {
+                        _sta_disconnected(l, WIFI_REASON_BEACON_TIMEOUT);
+                  } });
+}
+
+void sim::set_ap_rssi(size_t ap, int8_t rssi)
+{
+      lock_t l = lock();
+      world().aps.at(ap).rssi = rssi;
+}
+
+void sim::set_ap_password(size_t ap, const char *password)
+{
+      lock_t l = lock();
+      world().aps.at(ap).password = password;
+}
+
+int64_t sim::lan_request(size_t request_bytes, size_t response_bytes)
+{
+      lock_t l = lock();
+      if (s_driver.sta_state != STA_CONNECTED)
+      {
+            return -1;
+      }
+      int64_t start = now_us();
+      int64_t wait = _downlink_wait_us(start + world().lan_rtt_us / 2);
+      int64_t air = _air_us(request_bytes, _downlink_rate_bps()) + _air_us(response_bytes, _uplink_rate_bps());
+      int64_t round_trip = world().lan_rtt_us + wait + air;
+      _awake_for(start + world().lan_rtt_us / 2 + wait - (wait > 0 ? world().ps_wake_us : 0), start + round_trip);
+      lwip_stats.link.recv += _packets(request_bytes);
+      lwip_stats.link.xmit += _packets(response_bytes);
+      sleep_locked(l, round_trip, "LAN request");
+      return round_trip;
+}
+
+void sim::deauth(size_t ap, uint8_t reason)
+{
+      lock_t l = lock();
+      if (s_driver.ap == (int)ap && s_driver.sta_state == STA_CONNECTED)
+      {
+            _sta_disconnected(l, reason);
+      }
+}
+
+extern "C"
+{
+      esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+      {
+            {
+                  sim::lock_t l = sim::lock();
+                  if (sim::s_driver.initialized)
+                  {
+                        return ESP_ERR_INVALID_STATE;
+                  }
+                  if (!sim::heap_try_alloc(WIFI_DRIVER_SIZE))
+                  {
+                        return ESP_ERR_NO_MEM;
+                  }
+                  sim::sleep_locked(l, sim::world().wifi_init_us, "esp_wifi_init");
+                  sim::s_driver.initialized = true;
+                  sim::s_driver.nvs_enable = config->nvs_enable;
+                  sim::s_driver.mode = WIFI_MODE_STA;
+            }
+            nvs_handle_t handle;
+            if (config->nvs_enable && nvs_open("nvs.net80211", NVS_READWRITE, &handle) == ESP_OK) // mode, configs, country
+            {
+                  for (int i = 0; i < SCAN_CONFIG_NVS_READS; i++)
+                  {
+                        uint8_t value;
+                        nvs_get_u8(handle, "cfg", &value);
+                  }
+                  nvs_close(handle);
+            }
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_deinit(void)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            if (sim::s_driver.started)
+            {
+                  return ESP_ERR_WIFI_NOT_STOPPED;
+            }
+            sim::_free_scan_results();
+            sim::heap_free(WIFI_DRIVER_SIZE);
+            sim::s_driver.initialized = false;
+            sim::s_driver.pmk_cache.clear();
+            sim::s_driver.sta_config = {};
+            sim::s_driver.ap_config = {};
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            if (mode >= WIFI_MODE_MAX)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            wifi_mode_t old_mode = sim::s_driver.mode;
+            sim::s_driver.mode = mode;
+            if (!sim::s_driver.started)
+            {
+                  return ESP_OK;
+            }
+            if (sim::_has_sta(old_mode) && !sim::_has_sta(mode))
+            {
+                  if (sim::s_driver.sta_state != sim::STA_IDLE)
+                  {
+                        sim::_sta_disconnected(l, WIFI_REASON_ASSOC_LEAVE);
+                  }
+                  sim::post_event(l, WIFI_EVENT, WIFI_EVENT_STA_STOP, NULL, 0);
+            }
+            if (sim::_has_ap(old_mode) && !sim::_has_ap(mode))
+            {
+                  sim::s_driver.phones.clear();
+                  sim::post_event(l, WIFI_EVENT, WIFI_EVENT_AP_STOP, NULL, 0);
+            }
+            if (!sim::_has_sta(old_mode) && sim::_has_sta(mode))
+            {
+                  sim::post_event(l, WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0);
+            }
+            if (!sim::_has_ap(old_mode) && sim::_has_ap(mode))
+            {
+                  sim::post_event(l, WIFI_EVENT, WIFI_EVENT_AP_START, NULL, 0);
+            }
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_get_mode(wifi_mode_t *mode)
+      {
+            sim::lock_t l = sim::lock();
+            *mode = sim::s_driver.mode;
+            return sim::s_driver.initialized ? ESP_OK : ESP_ERR_WIFI_NOT_INIT;
+      }
+
+      esp_err_t esp_wifi_start(void)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            if (sim::s_driver.started)
+            {
+                  return ESP_OK;
+            }
+            sim::sleep_locked(l, sim::world().wifi_start_us, "esp_wifi_start");
+            sim::s_driver.started = true;
+            if (sim::_has_sta(sim::s_driver.mode))
+            {
+                  sim::post_event(l, WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0);
+            }
+            if (sim::_has_ap(sim::s_driver.mode))
+            {
+                  sim::post_event(l, WIFI_EVENT, WIFI_EVENT_AP_START, NULL, 0);
+            }
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_stop(void)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            if (!sim::s_driver.started)
+            {
+                  return ESP_OK;
+            }
+            sim::_stop_scan(l, false);
+            if (sim::s_driver.sta_state != sim::STA_IDLE)
+            {
+                  sim::_sta_disconnected(l, WIFI_REASON_ASSOC_LEAVE);
+            }
+            if (sim::_has_sta(sim::s_driver.mode))
+            {
+                  sim::post_event(l, WIFI_EVENT, WIFI_EVENT_STA_STOP, NULL, 0);
+            }
+            if (sim::_has_ap(sim::s_driver.mode))
+            {
+                  sim::s_driver.phones.clear();
+                  sim::post_event(l, WIFI_EVENT, WIFI_EVENT_AP_STOP, NULL, 0);
+            }
+            sim::s_driver.started = false;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_connect(void)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            if (!sim::s_driver.started)
+            {
+                  return ESP_ERR_WIFI_NOT_STARTED;
+            }
+            if (!sim::_has_sta(sim::s_driver.mode))
+            {
+                  return ESP_ERR_WIFI_MODE;
+            }
+            if (sim::s_driver.sta_state != sim::STA_IDLE)
+            {
+                  return ESP_ERR_WIFI_CONN;
+            }
+            sim::_stop_scan(l, true); // the connect takes the radio
+            sim::s_driver.sta_state = sim::STA_CONNECTING;
+            uint32_t attempt = ++sim::s_driver.attempt;
+            sim::spawn(l, "wifi", [attempt]
+                       { sim::_connect_attempt(attempt); });
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_disconnect(void)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            if (!sim::s_driver.started)
+            {
+                  return ESP_ERR_WIFI_NOT_STARTED;
+            }
+            if (sim::s_driver.sta_state != sim::STA_IDLE)
+            {
+                  sim::_sta_disconnected(l, WIFI_REASON_ASSOC_LEAVE);
+            }
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+      {
+            bool store = false;
+            {
+                  sim::lock_t l = sim::lock();
+                  if (!sim::s_driver.initialized)
+                  {
+                        return ESP_ERR_WIFI_NOT_INIT;
+                  }
+                  if (interface == WIFI_IF_STA)
+                  {
+                        sim::s_driver.sta_config = *conf;
+                  }
+                  else
+                  {
+                        sim::s_driver.ap_config = *conf;
+                  }
+                  store = sim::s_driver.nvs_enable;
+            }
+            nvs_handle_t handle;
+            if (store && nvs_open("nvs.net80211", NVS_READWRITE, &handle) == ESP_OK) // WIFI_STORAGE_FLASH
+            {
+                  nvs_set_blob(handle, interface == WIFI_IF_STA ? "sta.cfg" : "ap.cfg", conf, sizeof(*conf));
+                  nvs_commit(handle);
+                  nvs_close(handle);
+            }
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            *conf = interface == WIFI_IF_STA ? sim::s_driver.sta_config : sim::s_driver.ap_config;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            if (!sim::s_driver.started)
+            {
+                  return ESP_ERR_WIFI_NOT_STARTED;
+            }
+            if (!sim::_has_sta(sim::s_driver.mode))
+            {
+                  return ESP_ERR_WIFI_MODE;
+            }
+            if (sim::s_driver.scanning || sim::s_driver.sta_state == sim::STA_CONNECTING)
+            {
+                  return ESP_ERR_WIFI_STATE;
+            }
+            sim::scan_t scan = {"", false, {}, 0, false, sim::world().scan_channel_us};
+            if (config != NULL)
+            {
+                  if (config->ssid != NULL)
+                  {
+                        scan.ssid = sim::_ssid(config->ssid, 32);
+                  }
+                  if (config->bssid != NULL)
+                  {
+                        scan.has_bssid = true;
+                        memcpy(scan.bssid, config->bssid, sizeof(scan.bssid));
+                  }
+                  scan.channel = config->channel;
+                  scan.show_hidden = config->show_hidden;
+                  if (config->scan_time.active.max != 0)
+                  {
+                        scan.channel_us = config->scan_time.active.max * 1000LL;
+                  }
+            }
+            sim::s_driver.scanning = true;
+            uint32_t id = ++sim::s_driver.scan;
+            auto run = [scan, id](sim::lock_t &l)
+            {
+                  sim::sleep_locked(l, sim::_scan_duration(scan), "wifi: scan");
+                  if (id != sim::s_driver.scan)
+                  {
+                        return false;
+                  }
+                  sim::_scan_finished(l, scan);
+                  return true;
+            };
+            if (block)
+            {
+                  return run(l) ? ESP_OK : ESP_FAIL;
+            }
+            sim::spawn(l, "wifi: scan", [run]
+                       {
+                             sim::lock_t l = sim::lock();
+                             run(l); });
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_scan_stop(void)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            sim::_stop_scan(l, false);
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_scan_get_ap_num(uint16_t *number)
+      {
+            sim::lock_t l = sim::lock();
+            *number = sim::s_driver.scan_results.size();
+            return sim::s_driver.initialized ? ESP_OK : ESP_ERR_WIFI_NOT_INIT;
+      }
+
+      esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.initialized)
+            {
+                  return ESP_ERR_WIFI_NOT_INIT;
+            }
+            if (!sim::s_driver.started)
+            {
+                  return ESP_ERR_WIFI_NOT_STARTED;
+            }
+            uint16_t count = std::min<size_t>(*number, sim::s_driver.scan_results.size());
+            std::copy(sim::s_driver.scan_results.begin(), sim::s_driver.scan_results.begin() + count, ap_records);
+            *number = count;
+            sim::_free_scan_results(); // the driver frees its list when it is read
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_clear_ap_list(void)
+      {
+            sim::lock_t l = sim::lock();
+            sim::_free_scan_results();
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+      {
+            sim::lock_t l = sim::lock();
+            if (sim::s_driver.sta_state != sim::STA_CONNECTED)
+            {
+                  return ESP_ERR_WIFI_NOT_CONNECT;
+            }
+            const sim_ap_t &ap = sim::world().aps[sim::s_driver.ap];
+            *ap_info = {};
+            memcpy(ap_info->bssid, ap.bssid, sizeof(ap_info->bssid));
+            memcpy(ap_info->ssid, ap.ssid.data(), std::min(ap.ssid.size(), sizeof(ap_info->ssid) - 1));
+            ap_info->primary = ap.channel;
+            ap_info->rssi = ap.rssi;
+            ap_info->authmode = ap.authmode;
+            ap_info->phy_11b = ap_info->phy_11g = ap_info->phy_11n = 1;
+            return ESP_OK;
+      }
+
+      // supplicant: 802.11k neighbor reports of the APs with rrm set; no AP supports 802.11v
+      bool esp_rrm_is_rrm_supported_connected_bss(void)
+      {
+            sim::lock_t l = sim::lock();
+            return sim::s_driver.sta_state == sim::STA_CONNECTED && sim::world().aps[sim::s_driver.ap].rrm;
+      }
+
+      int esp_rrm_send_neighbor_rep_request(neighbor_rep_request_cb cb, void *cb_ctx)
+      {
+            sim::lock_t l = sim::lock();
+            if (sim::s_driver.sta_state != sim::STA_CONNECTED || !sim::world().aps[sim::s_driver.ap].rrm)
+            {
+                  return -1;
+            }
+            uint32_t attempt = sim::s_driver.attempt;
+            sim::spawn(l, "wpa: neighbor report", [cb, cb_ctx, attempt]
+                       {
+                             sim::lock_t l = sim::lock();
+                             sim::sleep_locked(l, sim::world().action_frame_us, "wpa: neighbor report request");
+                             if (attempt != sim::s_driver.attempt)
+                             {
+                                   return; // connection lost; no answer
+                             }
+                             std::vector<uint8_t> report = {1}; // dialog token, then a neighbor report element per neighbor
+                             for (size_t neighbor : sim::world().aps[sim::s_driver.ap].neighbors)
+                             {
+                                   const sim_ap_t &ap = sim::world().aps.at(neighbor);
+                                   report.insert(report.end(), {52, 13});
+                                   report.insert(report.end(), ap.bssid, ap.bssid + sizeof(ap.bssid));
+                                   // BSSID information: reachable, same security, same key scope; operating class 81
+                                   // (2.4 GHz, 20 MHz); PHY type HT
+                                   report.insert(report.end(), {0x0f, 0x00, 0x00, 0x00, 81, ap.channel, 7});
+                             }
+                             l.unlock();
+                             cb(cb_ctx, report.data(), report.size()); });
+            return 0;
+      }
+
+      bool esp_wnm_is_btm_supported_connected_bss(void)
+      {
+            return false;
+      }
+
+      int esp_wnm_send_bss_transition_mgmt_query(enum btm_query_reason query_reason, const char *btm_candidates,
+                                                 int cand_list)
+      {
+            return -1;
+      }
+
+      esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+      {
+            sim::lock_t l = sim::lock();
+            sim::s_driver.ps = type;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type)
+      {
+            sim::lock_t l = sim::lock();
+            *type = sim::s_driver.ps;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_set_max_tx_power(int8_t power)
+      {
+            sim::lock_t l = sim::lock();
+            if (!sim::s_driver.started)
+            {
+                  return ESP_ERR_WIFI_NOT_STARTED;
+            }
+            if (power < 8 || power > 84)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            sim::s_driver.max_tx_power = power;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_get_max_tx_power(int8_t *power)
+      {
+            sim::lock_t l = sim::lock();
+            *power = sim::s_driver.max_tx_power;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_wifi_get_country(wifi_country_t *country)
+      {
+            sim::lock_t l = sim::lock();
+            *country = {"EU", 1, sim::world().country_nchan, 20, WIFI_COUNTRY_POLICY_AUTO};
+            return ESP_OK;
+      }
+
+      esp_netif_t *esp_netif_create_default_wifi_sta(void)
+      {
+            sim::lock_t l = sim::lock();
+            sim::s_driver.sta_netif = sim::_netif_create(true);
+            return sim::s_driver.sta_netif;
+      }
+
+      esp_netif_t *esp_netif_create_default_wifi_ap(void)
+      {
+            sim::lock_t l = sim::lock();
+            sim::s_driver.ap_netif = sim::_netif_create(false);
+            return sim::s_driver.ap_netif;
+      }
+
+      esp_err_t esp_wifi_clear_default_wifi_driver_and_handlers(void *esp_netif)
+      {
+            (void)esp_netif;
+            return ESP_OK;
+      }
+
+      void esp_netif_destroy(esp_netif_t *esp_netif)
+      {
+            if (esp_netif == NULL)
+            {
+                  return;
+            }
+            sim::lock_t l = sim::lock();
+            if (esp_netif == sim::s_driver.sta_netif)
+            {
+                  sim::s_driver.sta_netif = NULL;
+            }
+            if (esp_netif == sim::s_driver.ap_netif)
+            {
+                  sim::s_driver.ap_netif = NULL;
+            }
+            sim::heap_free(esp_netif->is_sta ? STA_NETIF_SIZE : AP_NETIF_SIZE);
+            esp_netif->dhcp_generation++;
+            delete esp_netif;
+      }
+
+      void esp_netif_destroy_default_wifi(void *esp_netif)
+      {
+            esp_wifi_clear_default_wifi_driver_and_handlers(esp_netif);
+            esp_netif_destroy((esp_netif_t *)esp_netif);
+      }
+
+      esp_err_t esp_netif_init(void)
+      {
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info)
+      {
+            if (esp_netif == NULL)
+            {
+                  return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+            }
+            sim::lock_t l = sim::lock();
+            *ip_info = esp_netif->ip_info;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_set_ip_info(esp_netif_t *esp_netif, const esp_netif_ip_info_t *ip_info)
+      {
+            sim::lock_t l = sim::lock();
+            if (esp_netif->is_sta && esp_netif->dhcpc_started)
+            {
+                  return ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED;
+            }
+            esp_netif->ip_info = *ip_info;
+            if (esp_netif->is_sta && esp_netif->link_up && ip_info->ip.addr != 0)
+            {
+                  sim::_post_got_ip(l, esp_netif, true);
+            }
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_get_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+      {
+            if (esp_netif == NULL || type >= ESP_NETIF_DNS_MAX)
+            {
+                  return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+            }
+            sim::lock_t l = sim::lock();
+            *dns = esp_netif->dns[type];
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_set_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+      {
+            if (esp_netif == NULL || type >= ESP_NETIF_DNS_MAX)
+            {
+                  return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+            }
+            sim::lock_t l = sim::lock();
+            esp_netif->dns[type] = *dns;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_set_hostname(esp_netif_t *esp_netif, const char *hostname)
+      {
+            if (esp_netif == NULL || hostname == NULL || strlen(hostname) > 32)
+            {
+                  return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+            }
+            sim::lock_t l = sim::lock();
+            esp_netif->hostname = hostname;
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_get_hostname(esp_netif_t *esp_netif, const char **hostname)
+      {
+            sim::lock_t l = sim::lock();
+            *hostname = esp_netif->hostname.c_str();
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_dhcpc_start(esp_netif_t *esp_netif)
+      {
+            sim::lock_t l = sim::lock();
+            if (esp_netif->dhcpc_started)
+            {
+                  return ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED;
+            }
+            esp_netif->dhcpc_started = true;
+            esp_netif->ip_info = {};
+            if (esp_netif->link_up)
+            {
+                  uint32_t generation = ++esp_netif->dhcp_generation;
+                  sim::spawn(l, "dhcpc", [esp_netif, generation]
+                             { sim::_dhcp_client(esp_netif, generation); });
+            }
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_dhcpc_stop(esp_netif_t *esp_netif)
+      {
+            {
+                  sim::lock_t l = sim::lock();
+                  if (!esp_netif->dhcpc_started)
+                  {
+                        return ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED;
+                  }
+                  esp_netif->dhcpc_started = false;
+                  esp_netif->dhcp_generation++;
+                  esp_netif->ip_info = {};
+            }
+            sim::_store_ip(NULL); // lwIP forgets the restored address when the client is stopped
+            return ESP_OK;
+      }
+
+      esp_err_t esp_netif_str_to_ip4(const char *src, esp_ip4_addr_t *dst)
+      {
+            if (src == NULL || dst == NULL || inet_pton(AF_INET, src, &dst->addr) != 1)
+            {
+                  return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+            }
+            return ESP_OK;
+      }
+
+      void *esp_netif_get_netif_impl(esp_netif_t *esp_netif)
+      {
+            return esp_netif != NULL ? &esp_netif->lwip_netif : NULL;
+      }
+}
@@ -0,0 +1,269 @@
+#include "sim_internal.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include <new>
+#include <sched.h>
+#include <string>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// FreeRTOS objects of the simulation; sizes in the heap are those of ESP-IDF v5 on an ESP32
+#define TCB_SIZE 344
+#define EVENT_GROUP_SIZE 32
+#define SEMAPHORE_SIZE 84
+
+struct tskTaskControlBlock
+{
+      std::string name;
+      uint32_t stack_size;
+};
+
+struct EventGroupDef_t
+{
+      EventBits_t bits;
+      bool is_static;
+};
+
+struct QueueDefinition
+{
+      UBaseType_t count;
+      UBaseType_t maximum;
+};
+
+namespace sim
+{
+      static thread_local tskTaskControlBlock *t_current_task = NULL;
+
+      /**
+       * @brief Thrown by vTaskDelete(NULL), which does not return, to the start of the task
+       *
+       */
+      struct task_deleted
+      {
+      };
+
+      static int64_t _deadline(TickType_t ticks)
+      {
+            return ticks == portMAX_DELAY ? -1 : now_us() + (int64_t)ticks * 1000000 / configTICK_RATE_HZ;
+      }
+} // Namespace
+
+extern "C"
+{
+      void vPortEnterCritical(portMUX_TYPE *mux)
+      {
+            static_assert(sizeof(portMUX_TYPE) == sizeof(int), "portMUX_TYPE");
+            int self = (int)syscall(SYS_gettid);
+            int expected = 0;
+            while (!__atomic_compare_exchange_n(&mux->owner, &expected, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            {
+                  if (expected == self)
+                  {
+                        fprintf(stderr, "SIM portENTER_CRITICAL nested on the same lock in task %s\n", sim::task_name());
+                        abort();
+                  }
+                  expected = 0;
+                  sched_yield();
+            }
+      }
+
+      void vPortExitCritical(portMUX_TYPE *mux)
+      {
+            __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+      }
+
+      BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *pcName, const uint32_t usStackDepth, void *pvParameters,
+                             UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask)
+      {
+            (void)uxPriority;
+            if (!sim::heap_try_alloc(TCB_SIZE + usStackDepth))
+            {
+                  return -1; // errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY
+            }
+            tskTaskControlBlock *task = new tskTaskControlBlock{pcName, usStackDepth};
+            if (pxCreatedTask != NULL)
+            {
+                  *pxCreatedTask = task;
+            }
+            sim::spawn(task->name.c_str(), [task, pxTaskCode, pvParameters]
+                       {
+                             sim::t_current_task = task;
+                             try
+                             {
+                                   pxTaskCode(pvParameters);
+                                   fprintf(stderr, "SIM task %s returned without vTaskDelete(NULL)\n", task->name.c_str());
+                                   abort();
+                             }
+                             catch (const sim::task_deleted &)
+                             {
+                             }
+                             sim::heap_free(TCB_SIZE + task->stack_size); });
+            return pdPASS;
+      }
+
+      BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pxTaskCode, const char *pcName, const uint32_t usStackDepth,
+                                         void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask,
+                                         const BaseType_t xCoreID)
+      {
+            (void)xCoreID;
+            return xTaskCreate(pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask);
+      }
+
+      void vTaskDelete(TaskHandle_t xTaskToDelete)
+      {
+            if (xTaskToDelete != NULL && xTaskToDelete != sim::t_current_task)
+            {
+                  fprintf(stderr, "SIM vTaskDelete() of another task is not simulated\n");
+                  abort();
+            }
+            throw sim::task_deleted();
+      }
+
+      void vTaskDelay(const TickType_t xTicksToDelay)
+      {
+            sim::sleep((int64_t)xTicksToDelay * 1000000 / configTICK_RATE_HZ, "vTaskDelay");
+      }
+
+      TickType_t xTaskGetTickCount(void)
+      {
+            return (TickType_t)(sim::now_us() * configTICK_RATE_HZ / 1000000);
+      }
+
+      TaskHandle_t xTaskGetCurrentTaskHandle(void)
+      {
+            return sim::t_current_task;
+      }
+
+      UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+      {
+            tskTaskControlBlock *task = xTask != NULL ? xTask : sim::t_current_task;
+            return task != NULL ? task->stack_size : 0;
+      }
+
+      EventGroupHandle_t xEventGroupCreate(void)
+      {
+            if (!sim::heap_try_alloc(EVENT_GROUP_SIZE))
+            {
+                  return NULL;
+            }
+            return new EventGroupDef_t{0, false};
+      }
+
+      EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *pxEventGroupBuffer)
+      {
+            static_assert(sizeof(EventGroupDef_t) <= sizeof(StaticEventGroup_t), "StaticEventGroup_t");
+            return new (pxEventGroupBuffer) EventGroupDef_t{0, true};
+      }
+
+      void vEventGroupDelete(EventGroupHandle_t xEventGroup)
+      {
+            if (xEventGroup->is_static)
+            {
+                  return;
+            }
+            delete xEventGroup;
+            sim::heap_free(EVENT_GROUP_SIZE);
+      }
+
+      EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor,
+                                      const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits,
+                                      TickType_t xTicksToWait)
+      {
+            sim::lock_t l = sim::lock();
+            EventBits_t result = 0;
+            bool ready = sim::wait(
+                l, [&]
+                {
+                      EventBits_t bits = xEventGroup->bits;
+                      if (xWaitForAllBits ? (bits & uxBitsToWaitFor) != uxBitsToWaitFor : (bits & uxBitsToWaitFor) == 0)
+                      {
+                            return false;
+                      }
+                      result = bits;
+                      if (xClearOnExit)
+                      {
+                            xEventGroup->bits &= ~uxBitsToWaitFor;
+                      }
+                      return true; },
+                sim::_deadline(xTicksToWait), "xEventGroupWaitBits");
+            return ready ? result : xEventGroup->bits;
+      }
+
+      EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet)
+      {
+            sim::lock_t l = sim::lock();
+            xEventGroup->bits |= uxBitsToSet;
+            sim::notify(l);
+            return xEventGroup->bits;
+      }
+
+      EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear)
+      {
+            sim::lock_t l = sim::lock();
+            EventBits_t bits = xEventGroup->bits;
+            xEventGroup->bits &= ~uxBitsToClear;
+            return bits;
+      }
+
+      EventBits_t xEventGroupGetBits(EventGroupHandle_t xEventGroup)
+      {
+            sim::lock_t l = sim::lock();
+            return xEventGroup->bits;
+      }
+
+      static SemaphoreHandle_t _semaphore_create(UBaseType_t count, UBaseType_t maximum)
+      {
+            if (!sim::heap_try_alloc(SEMAPHORE_SIZE))
+            {
+                  return NULL;
+            }
+            return new QueueDefinition{count, maximum};
+      }
+
+      SemaphoreHandle_t xSemaphoreCreateMutex(void)
+      {
+            return _semaphore_create(1, 1);
+      }
+
+      SemaphoreHandle_t xSemaphoreCreateBinary(void)
+      {
+            return _semaphore_create(0, 1);
+      }
+
+      BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+      {
+            sim::lock_t l = sim::lock();
+            return sim::wait(
+                       l, [xSemaphore]
+                       {
+                             if (xSemaphore->count == 0)
+                             {
+                                   return false;
+                             }
+                             xSemaphore->count--;
+                             return true; },
+                       sim::_deadline(xBlockTime), "xSemaphoreTake")
+                       ? pdTRUE
+                       : pdFALSE;
+      }
+
+      BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+      {
+            sim::lock_t l = sim::lock();
+            if (xSemaphore->count >= xSemaphore->maximum)
+            {
+                  return pdFALSE;
+            }
+            xSemaphore->count++;
+            sim::notify(l);
+            return pdTRUE;
+      }
+
+      void vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+      {
+            delete xSemaphore;
+            sim::heap_free(SEMAPHORE_SIZE);
+      }
+}
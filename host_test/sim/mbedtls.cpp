@@ -0,0 +1,20 @@
+#include "sim_internal.h"
+#include "mbedtls/pkcs5.h"
+
+// PBKDF2 of the simulation: the key of sim::derive_pmk(), after the time the ESP32 needs for the iterations
+
+extern "C"
+{
+      int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t md_type, const unsigned char *password, size_t plen,
+                                        const unsigned char *salt, size_t slen, unsigned int iteration_count,
+                                        uint32_t key_length, unsigned char *output)
+      {
+            if (md_type != MBEDTLS_MD_SHA1 || iteration_count == 0)
+            {
+                  return MBEDTLS_ERR_PKCS5_BAD_INPUT_DATA;
+            }
+            sim::sleep(sim::world().pmk_us * iteration_count / 4096, "PBKDF2");
+            sim::derive_pmk(password, plen, salt, slen, output, key_length);
+            return 0;
+      }
+}
@@ -0,0 +1,315 @@
+#include "sim_internal.h"
+#include "nvs_flash.h"
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// NVS of the simulation: namespaces of typed values, kept in the flash of the simulated device (serialized after every
+// change), so they survive a reboot. Like NVS of ESP-IDF, a write of an unchanged value does not touch the flash
+
+namespace sim
+{
+      enum
+      {
+            TYPE_U8 = 0x01,
+            TYPE_STR = 0x21,
+            TYPE_BLOB = 0x42,
+      };
+
+      typedef struct
+      {
+            uint8_t type;
+            std::vector<uint8_t> data;
+      } item_t;
+
+      typedef struct
+      {
+            std::string name_space;
+            bool writable;
+      } handle_t;
+
+      static bool s_initialized = false;
+      static std::map<std::string, std::map<std::string, item_t>> s_namespaces;
+      static std::map<nvs_handle_t, handle_t> s_handles;
+      static nvs_handle_t s_next_handle = 1;
+      static nvs_counters_t s_counters = {};
+      static std::map<std::string, nvs_counters_t> s_namespace_counters;
+      static std::map<std::string, uint32_t> s_key_reads;
+      static std::map<std::string, uint32_t> s_key_writes;
+
+      static void _append(std::vector<uint8_t> &out, const void *data, uint32_t size)
+      {
+            out.insert(out.end(), (const uint8_t *)&size, (const uint8_t *)&size + sizeof(size));
+            out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+      }
+
+      static bool _take(const uint8_t *&in, const uint8_t *end, std::string &out)
+      {
+            uint32_t size;
+            if (end - in < (ptrdiff_t)sizeof(size))
+            {
+                  return false;
+            }
+            memcpy(&size, in, sizeof(size));
+            in += sizeof(size);
+            if (end - in < (ptrdiff_t)size)
+            {
+                  return false;
+            }
+            out.assign((const char *)in, size);
+            in += size;
+            return true;
+      }
+
+      static void _save()
+      {
+            std::vector<uint8_t> image;
+            for (const auto &name_space : s_namespaces)
+            {
+                  for (const auto &item : name_space.second)
+                  {
+                        _append(image, name_space.first.data(), name_space.first.size());
+                        _append(image, item.first.data(), item.first.size());
+                        _append(image, &item.second.type, 1);
+                        _append(image, item.second.data.data(), item.second.data.size());
+                  }
+            }
+            sim_device_t *dev = device();
+            if (image.size() > sizeof(dev->nvs))
+            {
+                  fprintf(stderr, "SIM NVS partition full\n");
+                  abort();
+            }
+            memcpy(dev->nvs, image.data(), image.size());
+            dev->nvs_size = image.size();
+      }
+
+      void nvs_boot()
+      {
+            sim_device_t *dev = device();
+            const uint8_t *in = dev->nvs;
+            const uint8_t *end = dev->nvs + dev->nvs_size;
+            std::string name_space, key, type, data;
+            while (in < end && _take(in, end, name_space) && _take(in, end, key) && _take(in, end, type) && _take(in, end, data))
+            {
+                  s_namespaces[name_space][key] = {(uint8_t)type[0], std::vector<uint8_t>(data.begin(), data.end())};
+            }
+      }
+
+      nvs_counters_t nvs_counters(const char *name_space)
+      {
+            lock_t l = lock();
+            return name_space != NULL ? s_namespace_counters[name_space] : s_counters;
+      }
+
+      /**
+       * @brief Count an operation in the total and in the counters of its namespace
+       *
+       */
+      static void _count(const std::string &name_space, uint32_t nvs_counters_t::*counter, uint32_t n = 1)
+      {
+            s_counters.*counter += n;
+            s_namespace_counters[name_space].*counter += n;
+      }
+
+      uint32_t nvs_key_reads(const char *key)
+      {
+            lock_t l = lock();
+            return s_key_reads[key];
+      }
+
+      uint32_t nvs_key_writes(const char *key)
+      {
+            lock_t l = lock();
+            return s_key_writes[key];
+      }
+
+      static esp_err_t _get(nvs_handle_t handle, const char *key, uint8_t type, void *out_value, size_t *length)
+      {
+            lock_t l = lock();
+            s_key_reads[key]++;
+            auto h = s_handles.find(handle);
+            if (h == s_handles.end())
+            {
+                  s_counters.reads++;
+                  return ESP_ERR_NVS_INVALID_HANDLE;
+            }
+            _count(h->second.name_space, &nvs_counters_t::reads);
+            auto &items = s_namespaces[h->second.name_space];
+            auto item = items.find(key);
+            if (item == items.end() || item->second.type != type)
+            {
+                  return ESP_ERR_NVS_NOT_FOUND;
+            }
+            size_t size = item->second.data.size();
+            if (out_value == NULL)
+            {
+                  *length = size;
+                  return ESP_OK;
+            }
+            if (*length < size)
+            {
+                  *length = size;
+                  return ESP_ERR_NVS_INVALID_LENGTH;
+            }
+            memcpy(out_value, item->second.data.data(), size);
+            *length = size;
+            return ESP_OK;
+      }
+
+      static esp_err_t _set(nvs_handle_t handle, const char *key, uint8_t type, const void *value, size_t length)
+      {
+            lock_t l = lock();
+            s_key_writes[key]++;
+            auto h = s_handles.find(handle);
+            if (h == s_handles.end())
+            {
+                  s_counters.writes++;
+                  return ESP_ERR_NVS_INVALID_HANDLE;
+            }
+            _count(h->second.name_space, &nvs_counters_t::writes);
+            if (!h->second.writable)
+            {
+                  return ESP_ERR_NVS_READ_ONLY;
+            }
+            if (strlen(key) > NVS_KEY_NAME_MAX_SIZE - 1)
+            {
+                  return ESP_ERR_NVS_KEY_TOO_LONG;
+            }
+            item_t item = {type, std::vector<uint8_t>((const uint8_t *)value, (const uint8_t *)value + length)};
+            auto &items = s_namespaces[h->second.name_space];
+            auto existing = items.find(key);
+            if (existing != items.end() && existing->second.type == type && existing->second.data == item.data)
+            {
+                  return ESP_OK;
+            }
+            items[key] = item;
+            _count(h->second.name_space, &nvs_counters_t::flash_writes);
+            _count(h->second.name_space, &nvs_counters_t::flash_bytes, length);
+            _save();
+            return ESP_OK;
+      }
+} // Namespace
+
+extern "C"
+{
+      esp_err_t nvs_flash_init(void)
+      {
+            sim::lock_t l = sim::lock();
+            sim::s_initialized = true;
+            return ESP_OK;
+      }
+
+      esp_err_t nvs_flash_erase(void)
+      {
+            sim::lock_t l = sim::lock();
+            sim::s_namespaces.clear();
+            sim::_save();
+            return ESP_OK;
+      }
+
+      esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+      {
+            sim::lock_t l = sim::lock();
+            sim::_count(namespace_name, &sim::nvs_counters_t::opens);
+            if (!sim::s_initialized)
+            {
+                  return ESP_ERR_NVS_NOT_INITIALIZED;
+            }
+            if (open_mode == NVS_READONLY && sim::s_namespaces.count(namespace_name) == 0)
+            {
+                  return ESP_ERR_NVS_NOT_FOUND;
+            }
+            sim::s_namespaces[namespace_name];
+            *out_handle = sim::s_next_handle++;
+            sim::s_handles[*out_handle] = {namespace_name, open_mode == NVS_READWRITE};
+            return ESP_OK;
+      }
+
+      void nvs_close(nvs_handle_t handle)
+      {
+            sim::lock_t l = sim::lock();
+            sim::s_handles.erase(handle);
+      }
+
+      esp_err_t nvs_commit(nvs_handle_t handle)
+      {
+            sim::lock_t l = sim::lock();
+            auto h = sim::s_handles.find(handle);
+            if (h == sim::s_handles.end())
+            {
+                  return ESP_ERR_NVS_INVALID_HANDLE;
+            }
+            sim::_count(h->second.name_space, &sim::nvs_counters_t::commits);
+            return ESP_OK;
+      }
+
+      esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+      {
+            return sim::_get(handle, key, sim::TYPE_BLOB, out_value, length);
+      }
+
+      esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+      {
+            return sim::_set(handle, key, sim::TYPE_BLOB, value, length);
+      }
+
+      esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+      {
+            return sim::_get(handle, key, sim::TYPE_STR, out_value, length);
+      }
+
+      esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+      {
+            return sim::_set(handle, key, sim::TYPE_STR, value, strlen(value) + 1);
+      }
+
+      esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+      {
+            size_t length = sizeof(*out_value);
+            return sim::_get(handle, key, sim::TYPE_U8, out_value, &length);
+      }
+
+      esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+      {
+            return sim::_set(handle, key, sim::TYPE_U8, &value, sizeof(value));
+      }
+
+      esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+      {
+            sim::lock_t l = sim::lock();
+            auto h = sim::s_handles.find(handle);
+            if (h == sim::s_handles.end())
+            {
+                  return ESP_ERR_NVS_INVALID_HANDLE;
+            }
+            sim::_count(h->second.name_space, &sim::nvs_counters_t::erases);
+            if (!h->second.writable)
+            {
+                  return ESP_ERR_NVS_READ_ONLY;
+            }
+            if (sim::s_namespaces[h->second.name_space].erase(key) == 0)
+            {
+                  return ESP_ERR_NVS_NOT_FOUND;
+            }
+            sim::_count(h->second.name_space, &sim::nvs_counters_t::flash_writes);
+            sim::_save();
+            return ESP_OK;
+      }
+
+      esp_err_t nvs_erase_all(nvs_handle_t handle)
+      {
+            sim::lock_t l = sim::lock();
+            auto h = sim::s_handles.find(handle);
+            if (h == sim::s_handles.end())
+            {
+                  return ESP_ERR_NVS_INVALID_HANDLE;
+            }
+            sim::_count(h->second.name_space, &sim::nvs_counters_t::erases);
+            sim::s_namespaces[h->second.name_space].clear();
+            sim::_count(h->second.name_space, &sim::nvs_counters_t::flash_writes);
+            sim::_save();
+            return ESP_OK;
+      }
+}
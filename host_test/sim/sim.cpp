@@ -0,0 +1,672 @@
+#include "sim_internal.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstring>
+#include <list>
+#include <thread>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern "C"
+{
+      extern uint8_t __start_sim_rtc_data[] __attribute__((weak));
+      extern uint8_t __stop_sim_rtc_data[] __attribute__((weak));
+}
+
+namespace sim
+{
+      /**
+       * @brief Task waiting in wait(); woken by notify() when ready() returns true, or by the clock at its deadline
+       *
+       */
+      typedef struct
+      {
+            const std::function<bool()> *ready;
+            int64_t deadline_us;
+            bool woken;
+            bool timed_out;
+            const char *what;
+            const char *task;
+            std::condition_variable cv;
+      } waiter_t;
+
+      static const int64_t TIME_LIMIT_US = 30LL * 24 * 3600 * 1000000; // a boot that runs this long is stuck
+
+      static std::mutex s_mutex;
+      static std::list<waiter_t *> s_waiters;
+      static int s_running = 0; // tasks that are not waiting
+      static std::atomic<int64_t> s_now_us{0};
+      static thread_local const char *t_task_name = "main";
+
+      static sim_device_t *s_device = NULL;
+      static sim_world_t s_world;
+      static esp_reset_reason_t s_reset_reason = ESP_RST_POWERON;
+      static uint64_t s_random_state = 0;
+
+      static std::mutex s_heap_mutex; // malloc() is also called with the scheduler lock held
+      static size_t s_heap_used = 0;
+      static size_t s_heap_peak = 0;
+
+      static std::mutex s_log_mutex;
+      static esp_log_level_t s_log_level = ESP_LOG_WARN;
+
+      lock_t lock()
+      {
+            return lock_t(s_mutex);
+      }
+
+      int64_t now_us()
+      {
+            return s_now_us.load();
+      }
+
+      const char *task_name()
+      {
+            return t_task_name;
+      }
+
+      /**
+       * @brief Every task waits: nothing happens until the first deadline, so the clock jumps there
+       *
+       */
+      static void _advance_clock()
+      {
+            while (s_running == 0)
+            {
+                  int64_t next_us = -1;
+                  for (waiter_t *waiter : s_waiters)
+                  {
+                        if (!waiter->woken && waiter->deadline_us >= 0 && (next_us < 0 || waiter->deadline_us < next_us))
+                        {
+                              next_us = waiter->deadline_us;
+                        }
+                  }
+                  if (next_us < 0 || next_us > TIME_LIMIT_US)
+                  {
+                        fprintf(stderr, "SIM %s at %lld ms; waiting tasks:\n", next_us < 0 ? "DEADLOCK" : "TIME LIMIT",
+                                (long long)(s_now_us.load() / 1000));
+                        for (waiter_t *waiter : s_waiters)
+                        {
+                              fprintf(stderr, "  %-16s %s\n", waiter->task, waiter->what);
+                        }
+                        fflush(stderr);
+                        _exit(125);
+                  }
+                  if (next_us > s_now_us.load())
+                  {
+                        s_now_us.store(next_us);
+                  }
+                  for (waiter_t *waiter : s_waiters)
+                  {
+                        if (!waiter->woken && waiter->deadline_us >= 0 && waiter->deadline_us <= next_us)
+                        {
+                              waiter->woken = true;
+                              waiter->timed_out = true;
+                              s_running++;
+                              waiter->cv.notify_one();
+                        }
+                  }
+            }
+      }
+
+      bool wait(lock_t &lock, const std::function<bool()> &ready, int64_t deadline_us, const char *what)
+      {
+            if (ready())
+            {
+                  return true;
+            }
+            if (deadline_us >= 0 && deadline_us <= s_now_us.load())
+            {
+                  return false;
+            }
+            waiter_t waiter = {&ready, deadline_us, false, false, what, t_task_name, {}};
+            s_waiters.push_back(&waiter);
+            s_running--;
+            _advance_clock();
+            while (!waiter.woken)
+            {
+                  waiter.cv.wait(lock);
+            }
+            s_waiters.remove(&waiter);
+            return !waiter.timed_out;
+      }
+
+      void sleep_locked(lock_t &lock, int64_t us, const char *what)
+      {
+            static const std::function<bool()> never = []
+            { return false; };
+            wait(lock, never, s_now_us.load() + (us > 0 ? us : 0), what);
+      }
+
+      void sleep(int64_t us, const char *what)
+      {
+            lock_t l = lock();
+            sleep_locked(l, us, what);
+      }
+
+      void notify(lock_t &lock)
+      {
+            (void)lock;
+            for (waiter_t *waiter : s_waiters)
+            {
+                  if (!waiter->woken && (*waiter->ready)())
+                  {
+                        waiter->woken = true;
+                        s_running++;
+                        waiter->cv.notify_one();
+                  }
+            }
+      }
+
+      void spawn(lock_t &lock, const char *name, std::function<void()> body)
+      {
+            (void)lock;
+            s_running++; // counted from now on, so the clock does not advance before the task runs
+            std::thread([name, body]
+                        {
+                              t_task_name = name;
+                              body();
+                              lock_t l = sim::lock();
+                              s_running--;
+                              _advance_clock(); })
+                .detach();
+      }
+
+      void spawn(const char *name, std::function<void()> body)
+      {
+            lock_t l = lock();
+            spawn(l, name, body);
+      }
+
+      bool heap_try_alloc(size_t size)
+      {
+            std::lock_guard<std::mutex> guard(s_heap_mutex);
+            if (s_heap_used + size > HEAP_SIZE)
+            {
+                  return false;
+            }
+            s_heap_used += size;
+            if (s_heap_used > s_heap_peak)
+            {
+                  s_heap_peak = s_heap_used;
+            }
+            return true;
+      }
+
+      void heap_alloc(size_t size)
+      {
+            if (!heap_try_alloc(size))
+            {
+                  fprintf(stderr, "SIM heap exhausted: %zu bytes used, %zu requested\n", heap_used(), size);
+                  fflush(stderr);
+                  abort();
+            }
+      }
+
+      void heap_free(size_t size)
+      {
+            std::lock_guard<std::mutex> guard(s_heap_mutex);
+            s_heap_used -= size;
+      }
+
+      size_t heap_used()
+      {
+            std::lock_guard<std::mutex> guard(s_heap_mutex);
+            return s_heap_used;
+      }
+
+      size_t heap_peak()
+      {
+            std::lock_guard<std::mutex> guard(s_heap_mutex);
+            return s_heap_peak;
+      }
+
+      void heap_reset_peak()
+      {
+            std::lock_guard<std::mutex> guard(s_heap_mutex);
+            s_heap_peak = s_heap_used;
+      }
+
+      sim_world_t &world()
+      {
+            return s_world;
+      }
+
+      sim_device_t *device()
+      {
+            return s_device;
+      }
+
+      esp_reset_reason_t reset_reason()
+      {
+            return s_reset_reason;
+      }
+
+      sim_device_t *device_create()
+      {
+            void *memory = mmap(NULL, sizeof(sim_device_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+            {
+                  perror("mmap");
+                  abort();
+            }
+            sim_device_t *device = (sim_device_t *)memory; // zeroed: erased flash, empty RTC memory
+            device->wall_clock_us = 1700000000LL * 1000000; // November 2023
+            return device;
+      }
+
+      void device_destroy(sim_device_t *device)
+      {
+            munmap(device, sizeof(sim_device_t));
+      }
+
+      void device_advance_wall_clock(sim_device_t *device, int64_t us)
+      {
+            device->wall_clock_us += us;
+      }
+
+      void *device_result(sim_device_t *device)
+      {
+            return device->result;
+      }
+
+      /**
+       * @brief RTC slow memory keeps its content in deep sleep only; every other reset starts with zeroed variables
+       *
+       */
+      static void _restore_rtc_memory()
+      {
+            size_t size = __stop_sim_rtc_data - __start_sim_rtc_data;
+            if (size == 0)
+            {
+                  return;
+            }
+            if (size > sizeof(s_device->rtc))
+            {
+                  fprintf(stderr, "SIM RTC memory of %zu bytes does not fit\n", size);
+                  abort();
+            }
+            if (s_reset_reason == ESP_RST_DEEPSLEEP && s_device->rtc_size == size)
+            {
+                  memcpy(__start_sim_rtc_data, s_device->rtc, size);
+            }
+            else
+            {
+                  memset(__start_sim_rtc_data, 0, size);
+            }
+      }
+
+      static void _save_rtc_memory()
+      {
+            size_t size = __stop_sim_rtc_data - __start_sim_rtc_data;
+            memcpy(s_device->rtc, __start_sim_rtc_data, size);
+            s_device->rtc_size = size;
+      }
+
+      /**
+       * @brief Crash of a boot: print the backtrace (addr2line -e <executable> resolves the addresses), and end the boot
+       *        with the signal
+       *
+       */
+      static void _crash_handler(int signal_number)
+      {
+            void *frames[64];
+            int count = backtrace(frames, 64);
+            fprintf(stderr, "boot crashed with signal %d at %lld ms; backtrace:\n", signal_number,
+                    (long long)(s_now_us.load() / 1000));
+            backtrace_symbols_fd(frames, count, STDERR_FILENO);
+            signal(signal_number, SIG_DFL);
+            raise(signal_number);
+      }
+
+      int boot(sim_device_t *device, const sim_world_t &world, esp_reset_reason_t reset_reason,
+               const std::function<int()> &body)
+      {
+            fflush(stdout);
+            fflush(stderr);
+            memset(device->result, 0, sizeof(device->result));
+            device->boots++;
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                  perror("fork");
+                  abort();
+            }
+            if (pid == 0)
+            {
+                  signal(SIGSEGV, _crash_handler);
+                  signal(SIGABRT, _crash_handler);
+                  s_device = device;
+                  s_world = world;
+                  s_reset_reason = reset_reason;
+                  s_running = 1; // main task
+                  s_random_state = 0x9E3779B97F4A7C15ULL * device->boots;
+                  const char *level = getenv("WIFI_PROV_HOST_LOG");
+                  if (level != NULL)
+                  {
+                        const char *levels = "NEWIDV";
+                        const char *found = strchr(levels, level[0]);
+                        s_log_level = found != NULL && level[0] != '\0' ? (esp_log_level_t)(found - levels) : s_log_level;
+                  }
+                  _restore_rtc_memory();
+                  nvs_boot();
+                  timer_boot();
+
+                  int status = body();
+
+                  lock_t l = lock(); // tasks of the simulation stop here
+                  _save_rtc_memory();
+                  device->wall_clock_us += s_now_us.load();
+                  fflush(stdout);
+                  fflush(stderr);
+                  _exit(status);
+            }
+            int status = 0;
+            while (waitpid(pid, &status, 0) < 0)
+            {
+            }
+            if (WIFSIGNALED(status))
+            {
+                  return 128 + WTERMSIG(status);
+            }
+            return WEXITSTATUS(status);
+      }
+
+      void derive_pmk(const uint8_t *password, size_t password_len, const uint8_t *ssid, size_t ssid_len, uint8_t *pmk,
+                      size_t pmk_len)
+      {
+            uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a of passphrase and SSID, expanded with splitmix64
+            for (size_t i = 0; i < password_len; i++)
+            {
+                  hash = (hash ^ password[i]) * 0x100000001b3ULL;
+            }
+            hash = (hash ^ 0xff) * 0x100000001b3ULL;
+            for (size_t i = 0; i < ssid_len; i++)
+            {
+                  hash = (hash ^ ssid[i]) * 0x100000001b3ULL;
+            }
+            for (size_t i = 0; i < pmk_len; i++)
+            {
+                  hash += 0x9E3779B97F4A7C15ULL;
+                  uint64_t z = hash;
+                  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                  pmk[i] = (uint8_t)(z ^ (z >> 31));
+            }
+      }
+} // Namespace
+
+sim_ap_t sim_make_ap(const char *ssid, const char *password, uint8_t channel, int8_t rssi, uint8_t id)
+{
+      sim_ap_t ap = {};
+      ap.ssid = ssid;
+      ap.password = password;
+      ap.authmode = password[0] == '\0' ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK;
+      uint8_t bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, id};
+      memcpy(ap.bssid, bssid, sizeof(bssid));
+      ap.channel = channel;
+      ap.rssi = rssi;
+      ap.up = true;
+      ap.fail_reason = WIFI_REASON_AUTH_EXPIRE;
+      return ap;
+}
+
+// ESP-IDF system functions
+
+extern "C"
+{
+      esp_reset_reason_t esp_reset_reason(void)
+      {
+            return sim::reset_reason();
+      }
+
+      uint32_t esp_get_free_heap_size(void)
+      {
+            return sim::HEAP_SIZE - sim::heap_used();
+      }
+
+      uint32_t esp_get_minimum_free_heap_size(void)
+      {
+            return sim::HEAP_SIZE - sim::heap_peak();
+      }
+
+      uint32_t esp_random(void)
+      {
+            sim::lock_t l = sim::lock();
+            sim::s_random_state ^= sim::s_random_state << 13; // xorshift64: reproducible per boot
+            sim::s_random_state ^= sim::s_random_state >> 7;
+            sim::s_random_state ^= sim::s_random_state << 17;
+            return (uint32_t)(sim::s_random_state >> 32);
+      }
+
+      void esp_fill_random(void *buf, size_t len)
+      {
+            for (size_t i = 0; i < len; i++)
+            {
+                  ((uint8_t *)buf)[i] = (uint8_t)esp_random();
+            }
+      }
+
+      uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+      {
+            crc = ~crc;
+            for (uint32_t i = 0; i < len; i++)
+            {
+                  crc ^= buf[i];
+                  for (int bit = 0; bit < 8; bit++)
+                  {
+                        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+                  }
+            }
+            return ~crc;
+      }
+
+      const char *esp_err_to_name(esp_err_t code)
+      {
+            switch (code)
+            {
+            case ESP_OK:
+                  return "ESP_OK";
+            case ESP_FAIL:
+                  return "ESP_FAIL";
+            case ESP_ERR_NO_MEM:
+                  return "ESP_ERR_NO_MEM";
+            case ESP_ERR_INVALID_ARG:
+                  return "ESP_ERR_INVALID_ARG";
+            case ESP_ERR_INVALID_STATE:
+                  return "ESP_ERR_INVALID_STATE";
+            case ESP_ERR_INVALID_SIZE:
+                  return "ESP_ERR_INVALID_SIZE";
+            case ESP_ERR_NOT_FOUND:
+                  return "ESP_ERR_NOT_FOUND";
+            case ESP_ERR_NOT_SUPPORTED:
+                  return "ESP_ERR_NOT_SUPPORTED";
+            case ESP_ERR_TIMEOUT:
+                  return "ESP_ERR_TIMEOUT";
+            case ESP_ERR_INVALID_CRC:
+                  return "ESP_ERR_INVALID_CRC";
+            case ESP_ERR_INVALID_VERSION:
+                  return "ESP_ERR_INVALID_VERSION";
+            case ESP_ERR_NVS_NOT_INITIALIZED:
+                  return "ESP_ERR_NVS_NOT_INITIALIZED";
+            case ESP_ERR_NVS_NOT_FOUND:
+                  return "ESP_ERR_NVS_NOT_FOUND";
+            case ESP_ERR_NVS_TYPE_MISMATCH:
+                  return "ESP_ERR_NVS_TYPE_MISMATCH";
+            case ESP_ERR_NVS_READ_ONLY:
+                  return "ESP_ERR_NVS_READ_ONLY";
+            case ESP_ERR_NVS_NOT_ENOUGH_SPACE:
+                  return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+            case ESP_ERR_NVS_INVALID_HANDLE:
+                  return "ESP_ERR_NVS_INVALID_HANDLE";
+            case ESP_ERR_NVS_INVALID_LENGTH:
+                  return "ESP_ERR_NVS_INVALID_LENGTH";
+            case ESP_ERR_WIFI_NOT_INIT:
+                  return "ESP_ERR_WIFI_NOT_INIT";
+            case ESP_ERR_WIFI_NOT_STARTED:
+                  return "ESP_ERR_WIFI_NOT_STARTED";
+            case ESP_ERR_WIFI_NOT_STOPPED:
+                  return "ESP_ERR_WIFI_NOT_STOPPED";
+            case ESP_ERR_WIFI_MODE:
+                  return "ESP_ERR_WIFI_MODE";
+            case ESP_ERR_WIFI_STATE:
+                  return "ESP_ERR_WIFI_STATE";
+            case ESP_ERR_WIFI_CONN:
+                  return "ESP_ERR_WIFI_CONN";
+            case ESP_ERR_WIFI_NOT_CONNECT:
+                  return "ESP_ERR_WIFI_NOT_CONNECT";
+            case ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED:
+                  return "ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED";
+            case ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED:
+                  return "ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED";
+            case ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED:
+                  return "ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED";
+            case ESP_ERR_HTTPD_HANDLERS_FULL:
+                  return "ESP_ERR_HTTPD_HANDLERS_FULL";
+            case ESP_ERR_HTTPD_HANDLER_EXISTS:
+                  return "ESP_ERR_HTTPD_HANDLER_EXISTS";
+            case ESP_ERR_HTTPD_RESULT_TRUNC:
+                  return "ESP_ERR_HTTPD_RESULT_TRUNC";
+            default:
+                  return "UNKNOWN ERROR";
+            }
+      }
+
+      void _esp_error_check_failed(esp_err_t rc, const char *file, int line, const char *function, const char *expression)
+      {
+            fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %lld ms\nfile: \"%s\" line %d\nfunc: %s\nexpression: %s\n",
+                    rc, esp_err_to_name(rc), (long long)(sim::now_us() / 1000), file, line, function, expression);
+            fflush(stderr);
+            abort();
+      }
+
+      void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+      {
+            if (level > sim::s_log_level)
+            {
+                  return;
+            }
+            char message[512];
+            va_list args;
+            va_start(args, format);
+            vsnprintf(message, sizeof(message), format, args);
+            va_end(args);
+            std::lock_guard<std::mutex> guard(sim::s_log_mutex);
+            fprintf(stderr, "%c (%lld) %s: %s\n", "NEWIDV"[level], (long long)(sim::now_us() / 1000), tag, message);
+      }
+
+      void esp_log_level_set(const char *tag, esp_log_level_t level)
+      {
+            (void)tag;
+            sim::s_log_level = level;
+      }
+
+      // malloc() and friends of the component and the simulation are wrapped by the linker (-Wl,--wrap=malloc), so
+      // they count in the simulated heap; the header keeps the size for free()
+      typedef struct
+      {
+            size_t size;
+            uint64_t magic;
+      } alloc_header_t;
+
+      static const uint64_t ALLOC_MAGIC = 0x5349444548454150ULL;
+
+      void *__real_malloc(size_t size);
+      void __real_free(void *ptr);
+
+      void *__wrap_malloc(size_t size)
+      {
+            if (!sim::heap_try_alloc(size))
+            {
+                  return NULL;
+            }
+            alloc_header_t *header = (alloc_header_t *)__real_malloc(sizeof(alloc_header_t) + size);
+            if (header == NULL)
+            {
+                  sim::heap_free(size);
+                  return NULL;
+            }
+            header->size = size;
+            header->magic = ALLOC_MAGIC;
+            return header + 1;
+      }
+
+      void __wrap_free(void *ptr)
+      {
+            if (ptr == NULL)
+            {
+                  return;
+            }
+            alloc_header_t *header = (alloc_header_t *)ptr - 1;
+            if (header->magic != ALLOC_MAGIC)
+            {
+                  __real_free(ptr); // allocated by the C library itself
+                  return;
+            }
+            header->magic = 0;
+            sim::heap_free(header->size);
+            __real_free(header);
+      }
+
+      void *__wrap_calloc(size_t count, size_t size)
+      {
+            if (size != 0 && count > SIZE_MAX / size)
+            {
+                  return NULL;
+            }
+            void *ptr = __wrap_malloc(count * size);
+            if (ptr != NULL)
+            {
+                  memset(ptr, 0, count * size);
+            }
+            return ptr;
+      }
+
+      void *__wrap_realloc(void *ptr, size_t size)
+      {
+            if (ptr == NULL)
+            {
+                  return __wrap_malloc(size);
+            }
+            alloc_header_t *header = (alloc_header_t *)ptr - 1;
+            void *resized = __wrap_malloc(size);
+            if (resized != NULL)
+            {
+                  memcpy(resized, ptr, header->size < size ? header->size : size);
+                  __wrap_free(ptr);
+            }
+            return resized;
+      }
+
+#ifdef SIM_STRLCPY
+      size_t strlcpy(char *dst, const char *src, size_t size)
+      {
+            size_t length = strlen(src);
+            if (size != 0)
+            {
+                  size_t copy = length < size - 1 ? length : size - 1;
+                  memcpy(dst, src, copy);
+                  dst[copy] = '\0';
+            }
+            return length;
+      }
+#endif
+
+      // time() is the wall clock of the device: it keeps running across boots (wrapped by the linker)
+      time_t __wrap_time(time_t *tloc)
+      {
+            time_t now = (time_t)((sim::device()->wall_clock_us + sim::now_us()) / 1000000);
+            if (tloc != NULL)
+            {
+                  *tloc = now;
+            }
+            return now;
+      }
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+// Simulation of the ESP-IDF environment of the component on the host.
+//
+// Time is simulated: every task is a host thread, and every blocking call (event group, semaphore, task delay,
+// esp_timer, the driver and the network) waits on the scheduler below. When all tasks wait, the clock jumps to the
+// first deadline. A connect of seconds takes milliseconds, and the reported times follow from the timing model of
+// the world (sim_world.h), not from the speed of the host.
+//
+// Every simulated boot runs in its own process (sim_boot()), because the component keeps its state in static
+// variables, as on the device. What survives a reboot is kept in a sim_device_t: NVS, RTC memory, the last IP
+// address of lwIP, and the wall clock.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include "esp_system.h"
+#include "esp_netif.h"
+#include "sim_world.h"
+
+namespace sim
+{
+    typedef std::unique_lock<std::mutex> lock_t;
+
+    /**
+     * @brief Lock of the scheduler; protects the state of every simulated component
+     *
+     */
+    lock_t lock();
+
+    /**
+     * @brief Simulated time since boot, in microseconds
+     *
+     */
+    int64_t now_us();
+
+    /**
+     * @brief Wait until ready() returns true, or until the deadline. ready() is called with the lock held, and must
+     *        complete the operation it waits for (take the semaphore, clear the bits) when it returns true
+     *
+     * @param lock lock()
+     * @param ready condition
+     * @param deadline_us time since boot; -1 to wait forever
+     * @param what shown when the simulation deadlocks
+     * @return true when ready, false on timeout
+     */
+    bool wait(lock_t &lock, const std::function<bool()> &ready, int64_t deadline_us, const char *what);
+
+    /**
+     * @brief Let the simulated time pass for the calling task
+     *
+     */
+    void sleep_locked(lock_t &lock, int64_t us, const char *what);
+    void sleep(int64_t us, const char *what = "sleep");
+
+    /**
+     * @brief Call after a state change that waiting tasks may wait for
+     *
+     */
+    void notify(lock_t &lock);
+
+    /**
+     * @brief Start a task
+     *
+     */
+    void spawn(lock_t &lock, const char *name, std::function<void()> body);
+    void spawn(const char *name, std::function<void()> body);
+
+    const char *task_name();
+
+    /**
+     * @brief Simulated heap of 280 KB, the free heap of an ESP32 application after boot. Counts the allocations of the
+     *        component (malloc() and friends are wrapped by the linker) and the modelled allocations of ESP-IDF
+     *
+     */
+    const size_t HEAP_SIZE = 280 * 1024;
+    void heap_alloc(size_t size);
+    void heap_free(size_t size);
+    size_t heap_used();
+    size_t heap_peak();
+    /**
+     * @brief Start a new high-water mark at the current use; also what esp_get_minimum_free_heap_size() reports
+     *
+     */
+    void heap_reset_peak();
+
+    typedef struct
+    {
+        uint32_t opens;
+        uint32_t reads;        // nvs_get_*()
+        uint32_t writes;       // nvs_set_*()
+        uint32_t erases;       // nvs_erase_*()
+        uint32_t commits;
+        uint32_t flash_writes; // writes and erases that changed the flash; NVS does not write an unchanged value
+        uint32_t flash_bytes;
+    } nvs_counters_t;
+
+    /**
+     * @brief Counters of the NVS calls of this boot
+     *
+     * @param name_space only the calls on this namespace; NULL for all. The component uses "storage", the wifi driver
+     *        "nvs.net80211" (when wifi_init_config_t::nvs_enable is set), and lwIP "dhcp_state" for the last IP address
+     */
+    nvs_counters_t nvs_counters(const char *name_space = NULL);
+    uint32_t nvs_key_reads(const char *key);
+    uint32_t nvs_key_writes(const char *key);
+
+    /**
+     * @brief World of the current boot; take lock() to change it while the simulation runs
+     *
+     */
+    sim_world_t &world();
+
+    /**
+     * @brief Change an AP while the simulation runs
+     *
+     * @param ap index in world().aps
+     */
+    void set_ap_up(size_t ap, bool up);
+    void set_ap_rssi(size_t ap, int8_t rssi);
+    void set_ap_password(size_t ap, const char *password);
+    void deauth(size_t ap, uint8_t reason);
+
+    /**
+     * @brief Request of a server on the LAN to the device over the connected STA, counted in lwip_stats; the calling
+     *        task waits until it is done. The timing model is in sim_world.h: a STA in power save receives what the AP
+     *        buffered only at its next wake
+     *
+     * @return duration in microseconds; -1 when the STA is not connected
+     */
+    int64_t lan_request(size_t request_bytes = 100, size_t response_bytes = 100);
+
+    /**
+     * @brief State of the device that survives a reboot; shared between the boots of one scenario
+     *
+     */
+    typedef struct sim_device sim_device_t;
+
+    sim_device_t *device_create();
+    void device_destroy(sim_device_t *device);
+    /**
+     * @brief Time that passes between two boots, for the wall clock of the device (time())
+     *
+     */
+    void device_advance_wall_clock(sim_device_t *device, int64_t us);
+    /**
+     * @brief Memory the boot can write its results to, for the caller of boot(); 16 KB, zeroed at every boot
+     *
+     */
+    void *device_result(sim_device_t *device);
+    const size_t RESULT_SIZE = 16 * 1024;
+
+    /**
+     * @brief Boot the device in a new process, and run body in its main task
+     *
+     * @param device persistent state
+     * @param world world of this boot
+     * @param reset_reason reason of esp_reset_reason(); RTC memory is kept only after ESP_RST_DEEPSLEEP
+     * @param body application; returns the exit code of the boot
+     * @return exit code of body; 128 + signal when the boot crashed, or 125 when it deadlocked
+     */
+    int boot(sim_device_t *device, const sim_world_t &world, esp_reset_reason_t reset_reason,
+             const std::function<int()> &body);
+
+    /**
+     * @brief Station on the softAP of the device, for instance a phone
+     *
+     */
+    typedef struct
+    {
+        int status; // HTTP status; 0 when the server is not running, or the handler failed without a response
+        std::map<std::string, std::string> headers;
+        std::string body;
+    } http_response_t;
+
+    void phone_join(uint8_t id);
+    void phone_leave(uint8_t id);
+    http_response_t http_request(int method, const std::string &uri, const std::string &body = "",
+                                 const std::map<std::string, std::string> &headers = {});
+} // Namespace
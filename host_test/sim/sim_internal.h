@@ -0,0 +1,49 @@
+#pragma once
+
+// Interfaces between the parts of the simulation; not for tests
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sim.h"
+#include "esp_event.h"
+
+namespace sim
+{
+    struct sim_device
+    {
+        uint32_t boots;
+        int64_t wall_clock_us;    // time() of the world at the start of the next boot
+        uint32_t nvs_size;
+        uint8_t nvs[64 * 1024];   // serialized NVS partition
+        uint32_t rtc_size;
+        uint8_t rtc[8 * 1024];    // RTC slow memory: the section of RTC_DATA_ATTR variables
+        uint8_t result[RESULT_SIZE];
+    };
+
+    sim_device_t *device();
+    esp_reset_reason_t reset_reason();
+
+    /**
+     * @brief Heap of the simulation; false when the heap is exhausted
+     *
+     */
+    bool heap_try_alloc(size_t size);
+
+    /**
+     * @brief Post an event to the default event loop; dropped when the loop does not exist
+     *
+     */
+    void post_event(lock_t &lock, esp_event_base_t base, int32_t id, const void *data, size_t size);
+
+    /**
+     * @brief Deterministic stand-in of PBKDF2-HMAC-SHA1 of the passphrase and SSID; used by the mbedTLS stub and the
+     *        simulated access points, so a PMK computed by the component is accepted by the AP
+     *
+     */
+    void derive_pmk(const uint8_t *password, size_t password_len, const uint8_t *ssid, size_t ssid_len, uint8_t *pmk,
+                    size_t pmk_len);
+
+    // start of the parts of the simulation, in the boot process
+    void nvs_boot();
+    void timer_boot();
+} // Namespace
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "esp_wifi.h"
+
+/**
+ * @brief An access point of the simulated world. APs with the same SSID are one LAN, with one DHCP server
+ *
+ */
+typedef struct
+{
+    std::string ssid;
+    std::string password;                      // WPA passphrase; "" for an open network
+    wifi_auth_mode_t authmode;
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;                               // as seen by the device
+    bool hidden;                               // SSID not in the beacon; only found by a directed probe
+    bool up;                                   // powered; a down AP is not found, and its STA loses the beacon
+    uint32_t fail_attempts;                    // the next connect attempts to this AP fail with fail_reason
+    uint8_t fail_reason;                       // wifi_err_reason_t
+    bool rrm;                                  // 802.11k: answers a neighbor report request with its neighbors
+    std::vector<size_t> neighbors;             // APs of its neighbor report, as index in sim_world_t::aps
+} sim_ap_t;
+
+/**
+ * @brief The world of a simulated boot: access points, their DHCP servers, and the timing model of driver and network.
+ *        Times are in microseconds; the defaults are typical for an ESP32 at 240 MHz and a home router
+ *
+ */
+typedef struct sim_world
+{
+    std::vector<sim_ap_t> aps;
+    uint8_t country_nchan = 13;                // channels 1..13
+
+    int64_t wifi_init_us = 60000;              // esp_wifi_init(): buffers, wifi task
+    int64_t wifi_start_us = 80000;             // esp_wifi_start(): RF calibration, until STA_START
+    int64_t scan_channel_us = 120000;          // active scan dwell time per channel, when the scan config gives none
+    int64_t probe_us = 30000;                  // directed probe on the channel of a known BSSID
+    int64_t assoc_us = 120000;                 // authentication, association and 4-way handshake
+    int64_t handshake_fail_us = 3000000;       // wrong password: AP retries message 1 until the handshake times out
+    int64_t pmk_us = 400000;                   // PBKDF2-HMAC-SHA1, 4096 iterations, by the supplicant or mbedTLS
+    int64_t beacon_timeout_us = 6000000;       // AP gone until WIFI_REASON_BEACON_TIMEOUT
+    int64_t dhcp_discover_us = 800000;         // DISCOVER, OFFER (after the ping check of the server), REQUEST, ACK
+    int64_t dhcp_reboot_us = 40000;            // INIT-REBOOT: REQUEST, ACK (or NAK)
+    uint32_t dhcp_lease_s = 7200;
+    bool dhcp_nak_reboot = false;              // server lost its leases; INIT-REBOOT is answered with NAK
+    int64_t http_rtt_us = 5000;                // round trip of a request of a phone on the softAP
+    int64_t action_frame_us = 20000;           // 802.11k request of the STA until the answer of the AP
+
+    // traffic of the application over the STA (sim::lan_request())
+    int64_t beacon_interval_us = 102400;       // 100 TU
+    uint8_t dtim_period = 1;                   // WIFI_PS_MIN_MODEM wakes for every DTIM beacon; MAX_MODEM every listen interval
+    int64_t ps_wake_us = 3000;                 // STA in power save: wake up, receive the beacon, poll the buffered frames
+    int64_t ps_awake_tail_us = 50000;          // after a frame, a STA in power save stays awake this long
+    int64_t lan_rtt_us = 2000;                 // from the AP to a server on the LAN and back
+    int64_t frame_overhead_us = 150;           // preamble, contention and 802.11 ACK per frame
+} sim_world_t;
+
+/**
+ * @brief An access point with the BSSID 02:00:00:00:00:<id>
+ *
+ */
+sim_ap_t sim_make_ap(const char *ssid, const char *password, uint8_t channel, int8_t rssi, uint8_t id);
@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+"""Print the size of the component per configuration, and the difference to the first configuration.
+
+Usage: size_report.py <size tool> <name> <archive> <options> [<name> <archive> <options>]...
+
+Each archive is the component built with the given options (comma separated Kconfig options, without CONFIG_). The
+sizes are the totals of `size` over the object files of the archive, for the host CPU and before the linker removes
+unused functions: an approximation, of which the differences between configurations count. The size in a firmware is
+from tools/idf_size_report.py.
+"""
+
+import subprocess
+import sys
+
+
+def archive_size(size_tool, archive):
+    output = subprocess.run([size_tool, '--totals', archive], check=True, capture_output=True, text=True).stdout
+    totals = [line for line in output.splitlines() if line.rstrip().endswith('(TOTALS)')]
+    if not totals:
+        sys.exit('size_report.py: no totals in the output of %s for %s' % (size_tool, archive))
+    text, data, bss = (int(field) for field in totals[0].split()[:3])
+    return text, data, bss
+
+
+def main(argv):
+    if len(argv) < 5 or (len(argv) - 2) % 3 != 0:
+        sys.exit(__doc__)
+    size_tool = argv[1]
+    configs = [argv[i:i + 3] for i in range(2, len(argv), 3)]
+
+    print('%-16s %8s %8s %8s %8s %8s %10s  %s' % ('config', 'text', 'data', 'bss', 'flash', 'RAM', 'flash diff',
+                                                  'options'))
+    base_flash = None
+    for name, archive, options in configs:
+        text, data, bss = archive_size(size_tool, archive)
+        flash = text + data
+        base_flash = flash if base_flash is None else base_flash
+        print('%-16s %8d %8d %8d %8d %8d %+10d  %s' % (name, text, data, bss, flash, data + bss, flash - base_flash,
+                                                       options.replace(',', ' ').replace('WIFI_PROV_', '')))
+    print('\nflash: text and data; RAM: data and bss; flash diff: against %s. Host objects before linking, an '
+          'approximation; tools/idf_size_report.py for the size in a firmware' % configs[0][0])
+
+
+if __name__ == '__main__':
+    main(sys.argv)
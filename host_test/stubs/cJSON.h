@@ -0,0 +1,43 @@
+#pragma once
+
+// Host stub of cJSON (component json of ESP-IDF): the declarations the JSON provisioning API uses, so a configuration
+// with WIFI_PROV_JSON_API compiles for the size report. Not implemented; the tests and benchmarks do not link it
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct cJSON
+    {
+        struct cJSON *next;
+        struct cJSON *prev;
+        struct cJSON *child;
+        int type;
+        char *valuestring;
+        int valueint;
+        double valuedouble;
+        char *string;
+    } cJSON;
+
+    typedef int cJSON_bool;
+
+    cJSON *cJSON_ParseWithLength(const char *value, size_t buffer_length);
+    char *cJSON_PrintUnformatted(const cJSON *item);
+    void cJSON_Delete(cJSON *item);
+    void cJSON_free(void *object);
+
+    cJSON *cJSON_GetObjectItemCaseSensitive(const cJSON *const object, const char *const string);
+    cJSON_bool cJSON_IsNull(const cJSON *const item);
+    cJSON_bool cJSON_IsString(const cJSON *const item);
+    cJSON_bool cJSON_IsObject(const cJSON *const item);
+
+    cJSON *cJSON_CreateObject(void);
+    cJSON *cJSON_AddStringToObject(cJSON *const object, const char *const name, const char *const string);
+    cJSON *cJSON_AddNumberToObject(cJSON *const object, const char *const name, const double number);
+
+#ifdef __cplusplus
+}
+#endif
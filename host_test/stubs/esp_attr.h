@@ -0,0 +1,9 @@
+#pragma once
+
+// Host stub of ESP-IDF esp_attr.h. RTC_DATA_ATTR variables are collected in one section, which the simulation keeps
+// across a simulated deep sleep (see sim_boot)
+
+#define RTC_DATA_ATTR __attribute__((section("sim_rtc_data")))
+#define RTC_NOINIT_ATTR RTC_DATA_ATTR
+#define IRAM_ATTR
+#define DRAM_ATTR
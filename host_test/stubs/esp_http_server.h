@@ -0,0 +1,143 @@
+#pragma once
+
+// Host stub of ESP-IDF esp_http_server.h. The server is a task that runs the registered handlers for the requests of
+// the simulated clients (sim_http_request() in sim.h); responses are captured instead of sent
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef void *httpd_handle_t;
+
+    enum http_method
+    {
+        HTTP_DELETE = 0,
+        HTTP_GET = 1,
+        HTTP_HEAD = 2,
+        HTTP_POST = 3,
+        HTTP_PUT = 4,
+    };
+    typedef enum http_method httpd_method_t;
+
+#define HTTPD_MAX_REQ_HDR_LEN 512
+#define HTTPD_MAX_URI_LEN 512
+#define HTTPD_RESP_USE_STRLEN -1
+#define HTTPD_SOCK_ERR_FAIL -1
+#define HTTPD_SOCK_ERR_INVALID -2
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+
+#define HTTPD_200 "200 OK"
+#define HTTPD_204 "204 No Content"
+#define HTTPD_207 "207 Multi-Status"
+#define HTTPD_400 "400 Bad Request"
+#define HTTPD_404 "404 Not Found"
+#define HTTPD_408 "408 Request Timeout"
+#define HTTPD_500 "500 Internal Server Error"
+
+#define HTTPD_TYPE_JSON "application/json"
+#define HTTPD_TYPE_TEXT "text/html"
+#define HTTPD_TYPE_OCTET "application/octet-stream"
+
+    typedef enum
+    {
+        HTTPD_500_INTERNAL_SERVER_ERROR = 0,
+        HTTPD_501_METHOD_NOT_IMPLEMENTED,
+        HTTPD_505_VERSION_NOT_SUPPORTED,
+        HTTPD_400_BAD_REQUEST,
+        HTTPD_401_UNAUTHORIZED,
+        HTTPD_403_FORBIDDEN,
+        HTTPD_404_NOT_FOUND,
+        HTTPD_405_METHOD_NOT_ALLOWED,
+        HTTPD_408_REQ_TIMEOUT,
+        HTTPD_411_LENGTH_REQUIRED,
+        HTTPD_414_URI_TOO_LONG,
+        HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE,
+        HTTPD_ERR_CODE_MAX
+    } httpd_err_code_t;
+
+    typedef struct httpd_req
+    {
+        httpd_handle_t handle;
+        int method;
+        const char uri[HTTPD_MAX_URI_LEN + 1];
+        size_t content_len;
+        void *aux;
+        void *user_ctx;
+        void *sess_ctx;
+        void (*free_ctx)(void *ctx);
+        bool ignore_sess_ctx_changes;
+    } httpd_req_t;
+
+    typedef esp_err_t (*httpd_err_handler_func_t)(httpd_req_t *req, httpd_err_code_t error);
+
+    typedef struct httpd_uri
+    {
+        const char *uri;
+        httpd_method_t method;
+        esp_err_t (*handler)(httpd_req_t *r);
+        void *user_ctx;
+    } httpd_uri_t;
+
+    typedef bool (*httpd_uri_match_func_t)(const char *reference_uri, const char *uri_to_match, size_t match_upto);
+
+    typedef struct httpd_config
+    {
+        unsigned task_priority;
+        size_t stack_size;
+        int core_id;
+        uint16_t server_port;
+        uint16_t ctrl_port;
+        uint16_t max_open_sockets;
+        uint16_t max_uri_handlers;
+        uint16_t max_resp_headers;
+        uint16_t backlog_conn;
+        bool lru_purge_enable;
+        uint16_t recv_wait_timeout;
+        uint16_t send_wait_timeout;
+        httpd_uri_match_func_t uri_match_fn;
+    } httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG()                                                                                         \
+    {                                                                                                                  \
+        5, 4096, 0x7FFFFFFF, 80, 32768, 7, 8, 8, 5, false, 5, 5, NULL                                                  \
+    }
+
+    esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+    esp_err_t httpd_stop(httpd_handle_t handle);
+    esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler);
+    esp_err_t httpd_register_err_handler(httpd_handle_t handle, httpd_err_code_t error, httpd_err_handler_func_t handler_fn);
+
+    int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len);
+    size_t httpd_req_get_url_query_len(httpd_req_t *r);
+    esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len);
+    size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field);
+    esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size);
+    esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size);
+
+    esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status);
+    esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+    esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value);
+    esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len);
+    esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len);
+    esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg);
+
+    static inline esp_err_t httpd_resp_sendstr(httpd_req_t *r, const char *str)
+    {
+        return httpd_resp_send(r, str, (str == NULL) ? 0 : HTTPD_RESP_USE_STRLEN);
+    }
+
+    static inline esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str)
+    {
+        return httpd_resp_send_chunk(r, str, (str == NULL) ? 0 : HTTPD_RESP_USE_STRLEN);
+    }
+
+#ifdef __cplusplus
+}
+#endif
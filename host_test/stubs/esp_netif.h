@@ -0,0 +1,99 @@
+#pragma once
+
+// Host stub of ESP-IDF esp_netif.h; the STA netif runs the DHCP client of the simulated network (see sim_wifi.cpp)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct esp_netif_obj esp_netif_t;
+
+    typedef struct
+    {
+        uint32_t addr; // network byte order
+    } esp_ip4_addr_t;
+
+    typedef struct
+    {
+        uint32_t addr[4];
+        uint8_t zone;
+    } esp_ip6_addr_t;
+
+#define ESP_IPADDR_TYPE_V4 0
+#define ESP_IPADDR_TYPE_V6 6
+
+    typedef struct
+    {
+        union
+        {
+            esp_ip6_addr_t ip6;
+            esp_ip4_addr_t ip4;
+        } u_addr;
+        uint8_t type;
+    } esp_ip_addr_t;
+
+    typedef struct
+    {
+        esp_ip4_addr_t ip;
+        esp_ip4_addr_t netmask;
+        esp_ip4_addr_t gw;
+    } esp_netif_ip_info_t;
+
+    typedef enum
+    {
+        ESP_NETIF_DNS_MAIN = 0,
+        ESP_NETIF_DNS_BACKUP,
+        ESP_NETIF_DNS_FALLBACK,
+        ESP_NETIF_DNS_MAX
+    } esp_netif_dns_type_t;
+
+    typedef struct
+    {
+        esp_ip_addr_t ip;
+    } esp_netif_dns_info_t;
+
+    ESP_EVENT_DECLARE_BASE(IP_EVENT);
+
+    typedef enum
+    {
+        IP_EVENT_STA_GOT_IP,
+        IP_EVENT_STA_LOST_IP,
+        IP_EVENT_AP_STAIPASSIGNED,
+    } ip_event_t;
+
+    typedef struct
+    {
+        esp_netif_t *esp_netif;
+        esp_netif_ip_info_t ip_info;
+        bool ip_changed;
+    } ip_event_got_ip_t;
+
+#define esp_ip4_addr_get_byte(ipaddr, idx) (((const uint8_t *)(&(ipaddr)->addr))[idx])
+#define esp_ip4_addr1_16(ipaddr) ((uint16_t)esp_ip4_addr_get_byte(ipaddr, 0))
+#define esp_ip4_addr2_16(ipaddr) ((uint16_t)esp_ip4_addr_get_byte(ipaddr, 1))
+#define esp_ip4_addr3_16(ipaddr) ((uint16_t)esp_ip4_addr_get_byte(ipaddr, 2))
+#define esp_ip4_addr4_16(ipaddr) ((uint16_t)esp_ip4_addr_get_byte(ipaddr, 3))
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) esp_ip4_addr1_16(ipaddr), esp_ip4_addr2_16(ipaddr), esp_ip4_addr3_16(ipaddr), esp_ip4_addr4_16(ipaddr)
+
+    esp_err_t esp_netif_init(void);
+    void esp_netif_destroy(esp_netif_t *esp_netif);
+    esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info);
+    esp_err_t esp_netif_set_ip_info(esp_netif_t *esp_netif, const esp_netif_ip_info_t *ip_info);
+    esp_err_t esp_netif_get_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns);
+    esp_err_t esp_netif_set_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns);
+    esp_err_t esp_netif_set_hostname(esp_netif_t *esp_netif, const char *hostname);
+    esp_err_t esp_netif_get_hostname(esp_netif_t *esp_netif, const char **hostname);
+    esp_err_t esp_netif_dhcpc_start(esp_netif_t *esp_netif);
+    esp_err_t esp_netif_dhcpc_stop(esp_netif_t *esp_netif);
+    esp_err_t esp_netif_str_to_ip4(const char *src, esp_ip4_addr_t *dst);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "esp_netif.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // returns the struct netif of lwIP (see lwip/netif.h)
+    void *esp_netif_get_netif_impl(esp_netif_t *esp_netif);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stub of ESP-IDF esp_random.h; a reproducible sequence per simulated boot
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    uint32_t esp_random(void);
+    void esp_fill_random(void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
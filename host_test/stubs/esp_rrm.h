@@ -0,0 +1,22 @@
+#pragma once
+
+// Host stub of ESP-IDF esp_rrm.h (802.11k of the supplicant). Simulated: an AP of the world with rrm set answers a
+// neighbor report request with its neighbors (see sim_world.h)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef void (*neighbor_rep_request_cb)(void *ctx, const uint8_t *report, size_t report_len);
+
+    int esp_rrm_send_neighbor_rep_request(neighbor_rep_request_cb cb, void *cb_ctx);
+    bool esp_rrm_is_rrm_supported_connected_bss(void);
+
+#ifdef __cplusplus
+}
+#endif
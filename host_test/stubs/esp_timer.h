@@ -0,0 +1,41 @@
+#pragma once
+
+// Host stub of ESP-IDF esp_timer.h; time is the simulated time since boot, callbacks run in the esp_timer task
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct esp_timer *esp_timer_handle_t;
+    typedef void (*esp_timer_cb_t)(void *arg);
+
+    typedef enum
+    {
+        ESP_TIMER_TASK,
+    } esp_timer_dispatch_t;
+
+    typedef struct
+    {
+        esp_timer_cb_t callback;
+        void *arg;
+        esp_timer_dispatch_t dispatch_method;
+        const char *name;
+        bool skip_unhandled_events;
+    } esp_timer_create_args_t;
+
+    esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle);
+    esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+    esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period);
+    esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+    esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+    int64_t esp_timer_get_time(void);
+    bool esp_timer_is_active(esp_timer_handle_t timer);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+// Host stub of ESP-IDF esp_wnm.h (802.11v of the supplicant). The APs of the simulation do not support BSS transition
+// management
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    enum btm_query_reason
+    {
+        REASON_UNSPECIFIED = 0,
+        REASON_FRAME_LOSS = 1,
+        REASON_DELAY = 2,
+        REASON_BANDWIDTH = 3,
+        REASON_LOAD_BALANCE = 4,
+        REASON_RSSI = 5,
+        REASON_RETRANSMISSIONS = 6,
+        REASON_INTERFERENCE = 7,
+        REASON_GRAY_ZONE = 8,
+        REASON_PREMIUM_AP = 9,
+    };
+
+    int esp_wnm_send_bss_transition_mgmt_query(enum btm_query_reason query_reason, const char *btm_candidates,
+                                               int cand_list);
+    bool esp_wnm_is_btm_supported_connected_bss(void);
+
+#ifdef __cplusplus
+}
+#endif
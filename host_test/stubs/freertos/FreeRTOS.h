@@ -0,0 +1,50 @@
+#pragma once
+
+// Host stub of FreeRTOS as used by ESP-IDF. Tasks are host threads, scheduled against the simulated clock of sim.h;
+// one tick is 1 ms (CONFIG_FREERTOS_HZ=1000)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_bit_defs.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef uint32_t TickType_t;
+    typedef int BaseType_t;
+    typedef unsigned int UBaseType_t;
+    typedef uint32_t StackType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((uint64_t)(xTimeInMs) * configTICK_RATE_HZ) / 1000U))
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+    typedef struct
+    {
+        volatile int owner; // spinlock; critical sections of the component are short and never block
+    } portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+    void vPortEnterCritical(portMUX_TYPE *mux);
+    void vPortExitCritical(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+#define taskENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL(mux) vPortExitCritical(mux)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct EventGroupDef_t *EventGroupHandle_t;
+    typedef TickType_t EventBits_t;
+
+    typedef struct
+    {
+        EventBits_t bits;
+        void *reserved[4];
+    } StaticEventGroup_t;
+
+    EventGroupHandle_t xEventGroupCreate(void);
+    EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *pxEventGroupBuffer);
+    EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor,
+                                    const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits,
+                                    TickType_t xTicksToWait);
+    EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet);
+    EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear);
+    EventBits_t xEventGroupGetBits(EventGroupHandle_t xEventGroup);
+    void vEventGroupDelete(EventGroupHandle_t xEventGroup);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct tskTaskControlBlock *TaskHandle_t;
+    typedef void (*TaskFunction_t)(void *);
+
+    BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *pcName, const uint32_t usStackDepth, void *pvParameters,
+                           UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask);
+    BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pxTaskCode, const char *pcName, const uint32_t usStackDepth,
+                                       void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask,
+                                       const BaseType_t xCoreID);
+    void vTaskDelete(TaskHandle_t xTaskToDelete);
+    void vTaskDelay(const TickType_t xTicksToDelay);
+    TickType_t xTaskGetTickCount(void);
+    TaskHandle_t xTaskGetCurrentTaskHandle(void);
+    // the stack of a host thread says nothing about the Xtensa stack: returns the stack size the task was created with
+    UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask);
+
+#ifdef __cplusplus
+}
+#endif
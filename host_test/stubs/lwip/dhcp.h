@@ -0,0 +1,16 @@
+#pragma once
+
+// Host stub of lwIP dhcp.h: the client data the simulated DHCP client fills in when the lease is bound
+
+#include "lwip/netif.h"
+
+struct dhcp
+{
+    u8_t state;
+    u8_t tries;
+    u32_t offered_t0_lease; // lease time offered by the server, in seconds
+    u32_t offered_t1_renew;
+    u32_t offered_t2_rebind;
+};
+
+#define netif_dhcp_data(netif) ((struct dhcp *)(netif)->client_data[LWIP_NETIF_CLIENT_DATA_INDEX_DHCP])
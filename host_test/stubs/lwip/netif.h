@@ -0,0 +1,12 @@
+#pragma once
+
+#include "lwip/arch.h"
+
+#define LWIP_NETIF_CLIENT_DATA_INDEX_DHCP 0
+#define LWIP_NUM_NETIF_CLIENT_DATA 1
+
+struct netif
+{
+    void *client_data[LWIP_NUM_NETIF_CLIENT_DATA];
+    u8_t hwaddr[6];
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+// Host stub of lwIP stats.h; link counters are kept by the traffic model of the simulation
+
+#include "sdkconfig.h"
+#include "lwip/arch.h"
+
+#ifdef CONFIG_LWIP_STATS
+#define LWIP_STATS 1
+#define LINK_STATS 1
+#else
+#define LWIP_STATS 0
+#define LINK_STATS 0
+#endif
+
+struct stats_proto
+{
+    u32_t xmit;   // transmitted packets
+    u32_t recv;   // received packets
+    u32_t fw;     // forwarded packets
+    u32_t drop;   // dropped packets
+    u32_t chkerr; // checksum error
+    u32_t lenerr; // invalid length error
+    u32_t memerr; // out of memory error
+    u32_t rterr;  // routing error
+    u32_t proterr;
+    u32_t opterr;
+    u32_t err;
+    u32_t cachehit;
+};
+
+struct stats_
+{
+    struct stats_proto link;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    extern struct stats_ lwip_stats;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+// Host stub of mbedtls/pkcs5.h. The key is derived with the same function the simulated access points use, and takes
+// the simulated time of PBKDF2-HMAC-SHA1 with 4096 iterations on an ESP32 (see sim_world_t::pmk_us)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        MBEDTLS_MD_NONE = 0,
+        MBEDTLS_MD_MD5,
+        MBEDTLS_MD_SHA1,
+        MBEDTLS_MD_SHA224,
+        MBEDTLS_MD_SHA256,
+    } mbedtls_md_type_t;
+
+#define MBEDTLS_ERR_PKCS5_BAD_INPUT_DATA -0x2f80
+
+    int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t md_type, const unsigned char *password, size_t plen,
+                                      const unsigned char *salt, size_t slen, unsigned int iteration_count,
+                                      uint32_t key_length, unsigned char *output);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+// Functions of newlib, the C library of ESP-IDF, that glibc before 2.38 does not have; included in every source
+// file of the host build (-include), like <string.h> on the device
+
+#include <stddef.h>
+#include <features.h>
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    size_t strlcpy(char *dst, const char *src, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#define SIM_STRLCPY 1
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+// Host stub of ESP-IDF nvs.h. Values are kept in memory and in the simulated flash of the device, so they survive a
+// simulated reboot; every call is counted (see sim_nvs_counters_t in sim.h)
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef uint32_t nvs_handle_t;
+
+    typedef enum
+    {
+        NVS_READONLY,
+        NVS_READWRITE
+    } nvs_open_mode_t;
+
+#define NVS_KEY_NAME_MAX_SIZE 16
+
+    esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+    void nvs_close(nvs_handle_t handle);
+    esp_err_t nvs_commit(nvs_handle_t handle);
+    esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+    esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+    esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length);
+    esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value);
+    esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value);
+    esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value);
+    esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+    esp_err_t nvs_erase_all(nvs_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
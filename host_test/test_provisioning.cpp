@@ -0,0 +1,538 @@
+// Tests of the connect flow of the component on the host: connect_to_network(), the captive portal, and the state
+// transitions of wifi_event_handler, with the wifi driver, network and time simulated (sim/).
+//
+//   test_provisioning <test>    run one test; see TESTS below
+//   test_provisioning all       run all tests
+//
+// Log of the component and the simulation: WIFI_PROV_HOST_LOG=I (or D, V)
+
+#include "scenario.h"
+#include "wifi_provisioning.h"
+#include "nvs_flash.h"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+using namespace WIFI_PROVISIONING;
+
+static int s_failures = 0; // of the running boot
+
+#define CHECK(condition)                                                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(condition))                                                                                              \
+        {                                                                                                              \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed at %lld ms\n", __FILE__, __LINE__, #condition,                    \
+                    (long long)(sim::now_us() / 1000));                                                                \
+            s_failures++;                                                                                              \
+        }                                                                                                              \
+    } while (0)
+
+#define SECONDS(s) ((s) * 1000 / portTICK_PERIOD_MS)
+
+// state transitions, as seen by a subscriber
+static std::mutex s_transitions_mutex;
+static std::vector<provisioning_state_t> s_transitions;
+
+static void _record_transition(provisioning_state_t old_state, provisioning_state_t new_state, void *arg)
+{
+    std::lock_guard<std::mutex> guard(s_transitions_mutex);
+    if (s_transitions.empty())
+    {
+        s_transitions.push_back(old_state);
+    }
+    s_transitions.push_back(new_state);
+}
+
+static bool _transitions_contain(const std::vector<provisioning_state_t> &expected)
+{
+    std::lock_guard<std::mutex> guard(s_transitions_mutex);
+    size_t matched = 0;
+    for (provisioning_state_t state : s_transitions)
+    {
+        if (matched < expected.size() && state == expected[matched])
+        {
+            matched++;
+        }
+    }
+    return matched == expected.size();
+}
+
+static bool _transitions_contain(provisioning_state_t state)
+{
+    return _transitions_contain(std::vector<provisioning_state_t>{state});
+}
+
+/**
+ * @brief Boot the device; body gets a wifi_provisioning object, after nvs_flash_init() as in app_main()
+ *
+ * @return nbr of failed checks; a crash or deadlock counts as one
+ */
+static int _boot(sim::sim_device_t *device, const sim_world_t &world, esp_reset_reason_t reason,
+                 const std::function<void(wifi_provisioning &wifi)> &body)
+{
+    int status = sim::boot(device, world, reason, [&body]
+                           {
+                               s_failures = 0;
+                               ESP_ERROR_CHECK(nvs_flash_init());
+                               wifi_provisioning wifi;
+                               wifi.subscribe_state_changes(_record_transition);
+                               body(wifi);
+                               return s_failures; });
+    if (status >= 125)
+    {
+        fprintf(stderr, "boot %s with status %d\n", status == 125 ? "deadlocked" : "crashed", status);
+        return 1;
+    }
+    return status;
+}
+
+/**
+ * @brief First boot of a device: credentials supplied via the portal by a phone
+ *
+ */
+static void _provision(wifi_provisioning &wifi, const char *password = scenario::HOME_PASSWORD)
+{
+    CHECK(wifi.connect_to_network_async() == ESP_OK);
+    CHECK(wifi.wait_for_state(PROVISIONING_STATE_BIT(PROVISIONING_STATE_PORTAL), SECONDS(10)) == PROVISIONING_STATE_PORTAL);
+    CHECK(scenario::phone_provision(scenario::HOME_SSID, password) == scenario::PORTAL_CONNECTED);
+    CHECK(wifi.wait_for_connection(SECONDS(30)) == PROVISIONING_CONNECTED);
+}
+
+static int test_cold_provision()
+{
+    sim::sim_device_t *device = sim::device_create();
+    int failures = _boot(device, scenario::home_world(), ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         {
+                             CHECK(wifi.get_state() == PROVISIONING_STATE_IDLE);
+                             _provision(wifi);
+                             CHECK(wifi.get_state() == PROVISIONING_STATE_CONNECTED);
+                             CHECK(_transitions_contain({PROVISIONING_STATE_IDLE, PROVISIONING_STATE_PORTAL,
+                                                         PROVISIONING_STATE_CONNECTING, PROVISIONING_STATE_CONNECTED}));
+                             connect_metrics_t metrics = wifi.get_metrics();
+                             CHECK(metrics.portal_us > 20000000); // the user typed for 20 s
+                             CHECK(metrics.time_to_ip_us > 20000000); // connected by the test of the portal
+                             CHECK(!metrics.fast_reconnect);
+                             CHECK(sim::nvs_key_writes("nvs_creds") == 1);
+                             CHECK(sim::nvs_key_writes("nvs_fast_conn") == 1);
+                             wifi_ap_record_t ap;
+                             CHECK(esp_wifi_sta_get_ap_info(&ap) == ESP_OK);
+                             CHECK(strcmp((const char *)ap.ssid, scenario::HOME_SSID) == 0);
+                         });
+    sim::device_destroy(device);
+    return failures;
+}
+
+static int test_warm_boot()
+{
+    sim::sim_device_t *device = sim::device_create();
+    sim_world_t world = scenario::home_world();
+    int failures = _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         { _provision(wifi); });
+    sim::device_advance_wall_clock(device, 600000000LL); // 10 minutes off
+    failures += _boot(device, world, ESP_RST_SW, [&world](wifi_provisioning &wifi)
+                      {
+                          CHECK(wifi.connect_to_network(0) == PROVISIONING_CONNECTED);
+                          CHECK(!_transitions_contain(PROVISIONING_STATE_PORTAL));
+                          connect_metrics_t metrics = wifi.get_metrics();
+                          CHECK(metrics.fast_reconnect);
+                          CHECK(metrics.retries == 0);
+                          CHECK(metrics.scan_us == 0);
+                          CHECK(metrics.dhcp_us < world.dhcp_discover_us); // INIT-REBOOT with the address of the last lease
+                          CHECK(metrics.time_to_ip_us < 1000000);
+                          CHECK(sim::nvs_key_writes("nvs_creds") == 0); // no flash wear for a known network
+                      });
+    sim::device_destroy(device);
+    return failures;
+}
+
+static int test_deep_sleep_warm_start()
+{
+    sim::sim_device_t *device = sim::device_create();
+    sim_world_t world = scenario::home_world();
+    int failures = _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         {
+                             _provision(wifi);
+                             CHECK(wifi.stop() == ESP_OK);
+                         });
+    sim::device_advance_wall_clock(device, 60000000LL);
+    failures += _boot(device, world, ESP_RST_DEEPSLEEP, [](wifi_provisioning &wifi)
+                      {
+                          CHECK(wifi.connect_to_network(0) == PROVISIONING_CONNECTED);
+                          connect_metrics_t metrics = wifi.get_metrics();
+                          CHECK(metrics.warm_start);
+                          CHECK(metrics.fast_reconnect);
+                          CHECK(metrics.previous_radio_on_us > 0);
+                          CHECK(sim::nvs_key_reads("nvs_creds") == 0); // context from RTC memory
+                          CHECK(sim::nvs_counters("nvs.net80211").opens == 0); // driver config not restored from NVS
+                      });
+    sim::device_destroy(device);
+    return failures;
+}
+
+static int test_bad_password()
+{
+    sim::sim_device_t *device = sim::device_create();
+    int failures = _boot(device, scenario::home_world(), ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         {
+                             CHECK(wifi.connect_to_network_async() == ESP_OK);
+                             CHECK(wifi.wait_for_state(PROVISIONING_STATE_BIT(PROVISIONING_STATE_PORTAL), SECONDS(10)) ==
+                                   PROVISIONING_STATE_PORTAL);
+                             CHECK(scenario::phone_provision(scenario::HOME_SSID, "wrong password") == scenario::PORTAL_CONNECT_FAILED);
+                             CHECK(scenario::phone_provision(scenario::HOME_SSID, "short") == scenario::PORTAL_REJECTED);
+                             CHECK(scenario::phone_provision("not in range", scenario::HOME_PASSWORD) == scenario::PORTAL_REJECTED);
+                             CHECK(wifi.get_state() == PROVISIONING_STATE_PORTAL);
+                             CHECK(scenario::phone_provision(scenario::HOME_SSID, scenario::HOME_PASSWORD) == scenario::PORTAL_CONNECTED);
+                             CHECK(wifi.wait_for_connection(SECONDS(30)) == PROVISIONING_CONNECTED);
+                             CHECK(sim::nvs_key_writes("nvs_creds") == 1); // only the credentials that connected
+                         });
+    sim::device_destroy(device);
+    return failures;
+}
+
+static int test_stale_password()
+{
+    sim::sim_device_t *device = sim::device_create();
+    sim_world_t world = scenario::home_world();
+    int failures = _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         { _provision(wifi); });
+    world.aps[scenario::HOME_AP].password = "new password";
+    world.aps[scenario::HOME_AP_UPSTAIRS].password = "new password";
+    failures += _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                      {
+                          CHECK(wifi.connect_to_network(60000) == PROVISIONING_CONNECT_FAILED);
+                          CHECK(wifi.get_state() == PROVISIONING_STATE_FAILED);
+                          CHECK(_transitions_contain({PROVISIONING_STATE_CONNECTING, PROVISIONING_STATE_PORTAL,
+                                                      PROVISIONING_STATE_FAILED}));
+                          connect_metrics_t metrics = wifi.get_metrics();
+                          CHECK(metrics.portal_us >= 60000000);
+                          CHECK(metrics.retries > 0);
+                          CHECK(sim::nvs_counters("storage").erases > 0); // fast-reconnect record of the old password
+                      });
+    sim::device_destroy(device);
+    return failures;
+}
+
+/**
+ * @brief The router got a new password and the application passes it with add_network(): the next connect, after a
+ *        reboot and after a deep sleep, uses it right away instead of failing first with the PMK of the old one
+ *
+ */
+static int test_changed_password()
+{
+    sim::sim_device_t *device = sim::device_create();
+    sim_world_t world = scenario::home_world();
+    int failures = _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         {
+                             _provision(wifi);
+                             CHECK(wifi.stop() == ESP_OK);
+                         });
+    world.aps[scenario::HOME_AP].password = "new password";
+    world.aps[scenario::HOME_AP_UPSTAIRS].password = "new password";
+    failures += _boot(device, world, ESP_RST_DEEPSLEEP, [](wifi_provisioning &wifi)
+                      {
+                          CHECK(wifi.add_network(scenario::HOME_SSID, "new password") == ESP_OK);
+                          CHECK(wifi.connect_to_network(1000) == PROVISIONING_CONNECTED);
+                          connect_metrics_t metrics = wifi.get_metrics();
+                          CHECK(!metrics.warm_start); // the RTC context has the old password
+                          CHECK(!metrics.fast_reconnect);
+                          CHECK(metrics.retries == 0);
+                      });
+    world.aps[scenario::HOME_AP].password = "newer password";
+    world.aps[scenario::HOME_AP_UPSTAIRS].password = "newer password";
+    failures += _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                      {
+                          CHECK(wifi.add_network(scenario::HOME_SSID, "newer password") == ESP_OK);
+                          CHECK(wifi.connect_to_network(1000) == PROVISIONING_CONNECTED);
+                          connect_metrics_t metrics = wifi.get_metrics();
+                          CHECK(!metrics.fast_reconnect); // the record has the PMK of the old password
+                          CHECK(metrics.retries == 0);
+                      });
+    sim::device_destroy(device);
+    return failures;
+}
+
+static int test_reconnect_backoff()
+{
+    sim::sim_device_t *device = sim::device_create();
+    int failures = _boot(device, scenario::home_world(), ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         {
+                             _provision(wifi);
+                             sim::set_ap_up(scenario::HOME_AP, false); // router reboots
+                             sim::set_ap_up(scenario::HOME_AP_UPSTAIRS, false);
+                             CHECK(wifi.wait_for_state(PROVISIONING_STATE_BIT(PROVISIONING_STATE_BACKOFF), SECONDS(30)) ==
+                                   PROVISIONING_STATE_BACKOFF);
+                             sim::sleep(60000000, "router boots");
+                             reconnect_status_t status = wifi.get_reconnect_status();
+                             CHECK(status.attempt >= 3);
+                             CHECK(status.attempt <= 12); // exponential backoff, not an attempt per scan
+                             CHECK(status.state != RECONNECT_IDLE);
+                             sim::set_ap_up(scenario::HOME_AP, true);
+                             sim::set_ap_up(scenario::HOME_AP_UPSTAIRS, true);
+                             CHECK(wifi.wait_for_state(PROVISIONING_STATE_BIT(PROVISIONING_STATE_CONNECTED), SECONDS(120)) ==
+                                   PROVISIONING_STATE_CONNECTED);
+                             CHECK(wifi.get_reconnect_status().state == RECONNECT_IDLE);
+                             CHECK(wifi.get_reconnect_status().attempt == 0);
+                         });
+    sim::device_destroy(device);
+    return failures;
+}
+
+/**
+ * @brief The portal page for a browser that accepts gzip, one that does not, and revalidation with the ETag
+ *
+ */
+static int test_portal_assets()
+{
+    sim::sim_device_t *device = sim::device_create();
+    int failures = _boot(device, scenario::home_world(), ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         {
+                             CHECK(wifi.connect_to_network_async() == ESP_OK);
+                             CHECK(wifi.wait_for_state(PROVISIONING_STATE_BIT(PROVISIONING_STATE_PORTAL), SECONDS(10)) ==
+                                   PROVISIONING_STATE_PORTAL);
+                             sim::phone_join(1);
+                             sim::sleep(1000000, "phone gets an address, web server starts");
+                             sim::http_response_t gzip = sim::http_request(HTTP_GET, "/", "", {{"Accept-Encoding", "gzip, deflate"}});
+                             CHECK(gzip.status == 200);
+                             CHECK(gzip.headers["Content-Encoding"] == "gzip");
+                             sim::http_response_t identity = sim::http_request(HTTP_GET, "/", "", {{"Accept-Encoding", "identity"}});
+                             CHECK(identity.status == 200);
+                             CHECK(identity.headers.count("Content-Encoding") == 0);
+                             CHECK(identity.body.find("<FORM") != std::string::npos);
+                             CHECK(identity.body.size() > gzip.body.size());
+                             CHECK(identity.headers["ETag"] != gzip.headers["ETag"]);
+                             CHECK(sim::http_request(HTTP_GET, "/", "", {{"Accept-Encoding", "identity"},
+                                                                        {"If-None-Match", identity.headers["ETag"]}})
+                                       .status == 304);
+                             CHECK(sim::http_request(HTTP_GET, "/", "", {{"Accept-Encoding", "gzip"},
+                                                                        {"If-None-Match", identity.headers["ETag"]}})
+                                       .status == 200); // the cached copy is the other encoding
+                             CHECK(scenario::phone_provision(scenario::HOME_SSID, scenario::HOME_PASSWORD) == scenario::PORTAL_CONNECTED);
+                             CHECK(wifi.wait_for_connection(SECONDS(30)) == PROVISIONING_CONNECTED);
+                         });
+    sim::device_destroy(device);
+    return failures;
+}
+
+static int test_known_network_while_portal()
+{
+    sim::sim_device_t *device = sim::device_create();
+    sim_world_t world = scenario::home_world();
+    int failures = _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         { _provision(wifi); });
+    world.aps[scenario::HOME_AP].up = false; // power cut: the device boots before the router
+    world.aps[scenario::HOME_AP_UPSTAIRS].up = false;
+    failures += _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                      {
+                          CHECK(wifi.connect_to_network_async(0) == ESP_OK);
+                          // the most recent network is tried with the full nbr of retries first: it may be hidden
+                          CHECK(wifi.wait_for_state(PROVISIONING_STATE_BIT(PROVISIONING_STATE_PORTAL), SECONDS(300)) ==
+                                PROVISIONING_STATE_PORTAL);
+                          sim::sleep(40000000, "router boots");
+                          sim::set_ap_up(scenario::HOME_AP, true);
+                          CHECK(wifi.wait_for_connection(SECONDS(60)) == PROVISIONING_CONNECTED); // background scan found it
+                          CHECK(_transitions_contain({PROVISIONING_STATE_CONNECTING, PROVISIONING_STATE_PORTAL,
+                                                      PROVISIONING_STATE_CONNECTING, PROVISIONING_STATE_CONNECTED}));
+                      });
+    sim::device_destroy(device);
+    return failures;
+}
+
+#define GARDEN_AP 5 // third AP of the home network, added by test_roam_neighbor_report
+
+/**
+ * @brief The device connected near the main AP, and moves to the upstairs AP; the AP in the garden is the strongest, but
+ *        the main AP does not know it. With 802.11k, the device asks the main AP for its neighbors and scans only the
+ *        channel of the upstairs AP; without, it scans all channels
+ *
+ */
+static int test_roam_neighbor_report()
+{
+    sim::sim_device_t *device = sim::device_create();
+    sim_world_t world = scenario::home_world();
+    world.aps.push_back(sim_make_ap(scenario::HOME_SSID, scenario::HOME_PASSWORD, 11, -90, 6));
+    int failures = 0;
+    for (bool rrm : {true, false})
+    {
+        world.aps[scenario::HOME_AP].rrm = rrm;
+        world.aps[scenario::HOME_AP].neighbors = {scenario::HOME_AP, scenario::HOME_AP_UPSTAIRS}; // itself too, as many APs
+        failures += _boot(device, world, ESP_RST_POWERON, [rrm, &world](wifi_provisioning &wifi)
+                          {
+                              CHECK(wifi.add_network(scenario::HOME_SSID, scenario::HOME_PASSWORD) == ESP_OK);
+                              CHECK(wifi.connect_to_network(0) == PROVISIONING_CONNECTED);
+                              sim::set_ap_rssi(scenario::HOME_AP, -85); // the device moves upstairs
+                              sim::set_ap_rssi(scenario::HOME_AP_UPSTAIRS, -60);
+                              sim::set_ap_rssi(GARDEN_AP, -55);
+                              sim::sleep(20000000, "link monitor: degraded, neighbor report, roam scan, roam");
+                              roam_metrics_t metrics = wifi.get_roam_metrics();
+                              CHECK(metrics.roams == 1);
+                              CHECK(metrics.roam_scans == 1);
+                              CHECK(metrics.failed_roams == 0);
+                              CHECK(metrics.neighbor_reports == (rrm ? 1u : 0u));
+                              size_t roamed_to = rrm ? scenario::HOME_AP_UPSTAIRS : GARDEN_AP;
+                              CHECK(memcmp(metrics.bssid, world.aps[roamed_to].bssid, sizeof(metrics.bssid)) == 0);
+                              CHECK(wifi.get_state() == PROVISIONING_STATE_CONNECTED);
+                          });
+    }
+    sim::device_destroy(device);
+    return failures;
+}
+
+static int test_static_ip()
+{
+    sim::sim_device_t *device = sim::device_create();
+    sim_world_t world = scenario::home_world();
+    int failures = _boot(device, world, ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         { _provision(wifi); });
+    failures += _boot(device, world, ESP_RST_SW, [&world](wifi_provisioning &wifi)
+                      {
+                          esp_netif_ip_info_t ip_info = {};
+                          esp_ip4_addr_t dns = {};
+                          CHECK(esp_netif_str_to_ip4("192.168.1.40", &ip_info.ip) == ESP_OK);
+                          CHECK(esp_netif_str_to_ip4("255.255.255.0", &ip_info.netmask) == ESP_OK);
+                          CHECK(esp_netif_str_to_ip4("192.168.1.1", &ip_info.gw) == ESP_OK);
+                          CHECK(esp_netif_str_to_ip4("192.168.1.1", &dns) == ESP_OK);
+                          wifi.set_static_ip(&ip_info, &dns);
+                          CHECK(wifi.connect_to_network(0) == PROVISIONING_CONNECTED);
+                          connect_metrics_t metrics = wifi.get_metrics();
+                          CHECK(metrics.dhcp_us < world.dhcp_reboot_us); // no DHCP at all
+                          CHECK(sim::nvs_counters("dhcp_state").writes == 0);
+                      });
+    sim::device_destroy(device);
+    return failures;
+}
+
+static int test_add_forget_network()
+{
+    sim::sim_device_t *device = sim::device_create();
+    int failures = _boot(device, scenario::home_world(), ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         {
+                             CHECK(wifi.add_network("", "password") == ESP_ERR_INVALID_ARG);
+                             CHECK(wifi.add_network(scenario::HOME_SSID, "short") == ESP_ERR_INVALID_ARG);
+                             CHECK(wifi.add_network("neighbour", "their password") == ESP_OK);
+                             CHECK(wifi.add_network(scenario::HOME_SSID, scenario::HOME_PASSWORD) == ESP_OK);
+                             CHECK(wifi.connect_to_network(1000) == PROVISIONING_CONNECTED); // no portal
+                             CHECK(!_transitions_contain(PROVISIONING_STATE_PORTAL));
+                             wifi_ap_record_t ap;
+                             CHECK(esp_wifi_sta_get_ap_info(&ap) == ESP_OK);
+                             CHECK(strcmp((const char *)ap.ssid, scenario::HOME_SSID) == 0); // strongest known network
+                             CHECK(wifi.forget_network(scenario::HOME_SSID) == ESP_OK);
+                             CHECK(wifi.forget_network(scenario::HOME_SSID) == ESP_ERR_NOT_FOUND);
+                             CHECK(wifi.get_state() == PROVISIONING_STATE_IDLE); // connection ended
+                             CHECK(wifi.get_status() == PROVISIONING_NOT_STARTED);
+                             sim::sleep(120000000, "reconnect scheduler would have reconnected");
+                             CHECK(esp_wifi_sta_get_ap_info(&ap) != ESP_OK);
+                             CHECK(wifi.get_state() == PROVISIONING_STATE_IDLE);
+                             CHECK(wifi.connect_to_network(1000) == PROVISIONING_CONNECTED); // the neighbour is left
+                             CHECK(esp_wifi_sta_get_ap_info(&ap) == ESP_OK);
+                             CHECK(strcmp((const char *)ap.ssid, "neighbour") == 0);
+                             CHECK(wifi.forget_network("neighbour") == ESP_OK);
+                             CHECK(wifi.stop() == ESP_OK);
+                             CHECK(wifi.connect_to_network(1000) == PROVISIONING_TIMED_OUT); // nothing known: portal
+                             CHECK(wifi.add_network("neighbour-guest", "") == ESP_OK); // open network
+                             CHECK(wifi.connect_to_network(1000) == PROVISIONING_CONNECTED);
+                             CHECK(esp_wifi_sta_get_ap_info(&ap) == ESP_OK);
+                             CHECK(strcmp((const char *)ap.ssid, "neighbour-guest") == 0);
+                         });
+    sim::device_destroy(device);
+    return failures;
+}
+
+#define SOAK_CYCLES 50
+
+/**
+ * @brief Cycles of connect and stop(), every fifth one provisioned again via the portal: after the first cycle, which
+ *        leaves the TCP/IP stack and the default event loop, every stop() must leave the heap as the first one did
+ *
+ */
+static int test_stop_soak()
+{
+    sim::sim_device_t *device = sim::device_create();
+    int failures = _boot(device, scenario::home_world(), ESP_RST_POWERON, [](wifi_provisioning &wifi)
+                         {
+                             _provision(wifi);
+                             CHECK(wifi.stop() == ESP_OK);
+                             sim::sleep(1000000, "connect task ends, queued events handled");
+                             size_t heap_used = sim::heap_used();
+                             size_t heap_peak = 0;
+                             for (int cycle = 1; cycle <= SOAK_CYCLES; cycle++)
+                             {
+                                   if (cycle % 5 == 0)
+                                   {
+                                         CHECK(wifi.forget_network(scenario::HOME_SSID) == ESP_OK);
+                                         _provision(wifi);
+                                   }
+                                   else
+                                   {
+                                         CHECK(wifi.connect_to_network(0) == PROVISIONING_CONNECTED);
+                                   }
+                                   CHECK(wifi.stop() == ESP_OK);
+                                   CHECK(wifi.get_state() == PROVISIONING_STATE_IDLE);
+                                   CHECK(wifi.wait_for_connection(0) == PROVISIONING_NOT_STARTED);
+                                   sim::sleep(1000000, "connect task ends, queued events handled");
+                                   if (sim::heap_used() != heap_used)
+                                   {
+                                         fprintf(stderr, "cycle %d: %zu bytes in use after stop(), %zu after the first\n", cycle,
+                                                 sim::heap_used(), heap_used);
+                                   }
+                                   CHECK(sim::heap_used() == heap_used);
+                                   if (cycle == 5)
+                                   {
+                                         heap_peak = sim::heap_peak(); // both kinds of cycle done
+                                   }
+                             }
+                             CHECK(sim::heap_peak() == heap_peak); // no cycle needs more than the first ones
+                         });
+    sim::device_destroy(device);
+    return failures;
+}
+
+typedef struct
+{
+    const char *name;
+    int (*test)();
+} test_t;
+
+static const test_t TESTS[] = {
+    {"cold_provision", test_cold_provision},
+    {"warm_boot", test_warm_boot},
+    {"deep_sleep_warm_start", test_deep_sleep_warm_start},
+    {"bad_password", test_bad_password},
+    {"stale_password", test_stale_password},
+    {"changed_password", test_changed_password},
+    {"reconnect_backoff", test_reconnect_backoff},
+    {"portal_assets", test_portal_assets},
+    {"known_network_while_portal", test_known_network_while_portal},
+    {"roam_neighbor_report", test_roam_neighbor_report},
+    {"static_ip", test_static_ip},
+    {"add_forget_network", test_add_forget_network},
+    {"stop_soak", test_stop_soak},
+};
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <test>|all\n", argv[0]);
+        return 2;
+    }
+    int failures = 0;
+    bool found = false;
+    for (const test_t &test : TESTS)
+    {
+        if (strcmp(argv[1], "all") == 0 || strcmp(argv[1], test.name) == 0)
+        {
+            found = true;
+            int test_failures = test.test();
+            printf("%-28s %s\n", test.name, test_failures == 0 ? "OK" : "FAILED");
+            failures += test_failures;
+        }
+    }
+    if (!found)
+    {
+        fprintf(stderr, "unknown test %s\n", argv[1]);
+        return 2;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "sdkconfig.h"
 #include "esp_err.h"
 #include "esp_wifi.h"
 #include "lwip/err.h"
@@ -9,6 +10,190 @@
 
 namespace WIFI_PROVISIONING
 {
+    /**
+     * @brief Result of connect_to_network()
+     *
+     */
+    typedef enum
+    {
+        PROVISIONING_CONNECTED,       // connected to wifi network
+        PROVISIONING_CONNECT_FAILED,  // could not connect to wifi network with the credentials
+        PROVISIONING_TIMED_OUT,       // no credentials supplied via the captive portal within the timeout
+        PROVISIONING_NOT_STARTED,     // get_status(): connect_to_network() not called yet
+        PROVISIONING_IN_PROGRESS,     // get_status(): connect_to_network() is busy
+    } provisioning_status_t;
+
+    /**
+     * @brief Called when connect_to_network_async() is finished
+     *
+     * @param status result of connect_to_network()
+     * @param arg argument passed to connect_to_network_async()
+     */
+    typedef void (*connect_callback_t)(provisioning_status_t status, void *arg);
+
+    /**
+     * @brief Reconnect scheduler settings; a reconnect attempt is done after a delay that grows exponentially per
+     *        failed attempt, up to a maximum, with random jitter so not all devices reconnect at the same moment
+     *
+     */
+    typedef struct
+    {
+        uint32_t initial_delay_ms; // delay before first reconnect attempt
+        uint32_t maximum_delay_ms; // cap of the delay
+        uint8_t multiplier;        // delay is multiplied by this factor after every failed attempt
+        uint8_t jitter_percent;    // delay is randomly changed by at most this percentage, up or down
+    } reconnect_config_t;
+
+    /**
+     * @brief State of the reconnect scheduler
+     *
+     */
+    typedef enum
+    {
+        RECONNECT_IDLE,       // connected, or not trying to connect (anymore)
+        RECONNECT_WAITING,    // waiting for the next attempt
+        RECONNECT_CONNECTING, // attempt in progress
+    } reconnect_state_t;
+
+    typedef struct
+    {
+        reconnect_state_t state;
+        uint32_t attempt;        // nbr of reconnect attempts since the last successful connect
+        int64_t next_attempt_us; // time of the next attempt (esp_timer_get_time()); 0 when no attempt is scheduled
+    } reconnect_status_t;
+
+    /**
+     * @brief Power profile, applied after the connect: PS mode, listen interval and maximum TX power
+     *
+     */
+    typedef enum
+    {
+        POWER_PROFILE_MAX_THROUGHPUT, // no power save, maximum TX power; for mains-powered devices
+        POWER_PROFILE_BALANCED,       // radio sleeps between DTIM beacons; adds up to a DTIM period of latency
+        POWER_PROFILE_MIN_POWER,      // radio sleeps for a long listen interval, lower TX power; for battery devices
+        POWER_PROFILE_ADAPTIVE,       // one of the above, selected by the packet rate; needs CONFIG_LWIP_STATS
+    } power_profile_t;
+
+    /**
+     * @brief Settings of the adaptive power profile
+     *
+     */
+    typedef struct
+    {
+        uint32_t high_packets_per_s; // at or above this packet rate: maximum throughput
+        uint32_t low_packets_per_s;  // at or below this packet rate: minimum power; in between: balanced
+        uint32_t latency_target_ms;  // maximum latency added by power save; limits the listen interval of minimum power,
+                                     // and below a beacon interval (about 100 ms) power save is not used at all
+    } adaptive_power_config_t;
+
+    typedef struct
+    {
+        power_profile_t profile;        // set_power_profile()
+        power_profile_t active_profile; // profile in effect; with POWER_PROFILE_ADAPTIVE, the one selected last
+        uint32_t packets_per_s;         // packet rate in the last second; adaptive profile only
+    } power_status_t;
+
+    /**
+     * @brief Settings of the link monitor and roaming. The link is degraded when a few consecutive samples are below the
+     *        RSSI threshold or above the TX failure percentage, and good again when the RSSI is at least the hysteresis
+     *        above the threshold and TX failures are below the percentage
+     *
+     */
+    typedef struct
+    {
+        int8_t rssi_threshold_dbm;  // link degraded below this RSSI; default from menuconfig
+        uint8_t hysteresis_db;      // link good again at threshold + hysteresis, so it does not flap around the threshold
+        uint8_t margin_db;          // roam only to a BSS at least this much stronger than the current one
+        uint8_t tx_failure_percent; // link degraded at this percentage of failed TX frames; 0 to use the RSSI only
+        uint32_t sample_period_ms;  // RSSI and TX failures are sampled this often
+        uint32_t scan_interval_ms;  // minimum time between roam scans while the link stays degraded
+    } roam_config_t;
+
+    typedef struct
+    {
+        uint32_t roams;              // changes to another BSS of the same SSID; also roams of the driver (802.11v)
+        uint32_t roam_scans;         // scans because the link was degraded
+        uint32_t btm_queries;        // BSS transition queries sent to the AP (802.11v)
+        uint32_t neighbor_reports;   // neighbor reports received from the AP (802.11k); a roam scan covers their channels
+        uint32_t failed_roams;       // roams that did not connect to the new BSS; the STA then reconnects to the SSID
+        int64_t below_threshold_us;  // total time the RSSI was below the threshold while connected
+        int64_t last_roam_us;        // duration of the last roam of this component: disconnect until IP address
+        int8_t rssi;                 // RSSI of the last sample
+        uint8_t tx_failure_percent;  // TX failures in the last sample; 0 without lwIP statistics
+        bool degraded;               // link is degraded
+        uint8_t bssid[6];            // BSS connected to
+    } roam_metrics_t;
+
+    /**
+     * @brief State of the provisioning state machine. Transitions are atomic; the state can be read from any task and
+     *        from event callbacks
+     *
+     */
+    typedef enum
+    {
+        PROVISIONING_STATE_IDLE,       // connect_to_network() not called yet, or stop() called
+        PROVISIONING_STATE_PORTAL,     // captive portal is up, waiting for (or testing) credentials
+        PROVISIONING_STATE_CONNECTING, // connect attempt in progress
+        PROVISIONING_STATE_CONNECTED,  // connected, and IP address obtained
+        PROVISIONING_STATE_BACKOFF,    // disconnected; waiting for the next connect attempt of the reconnect scheduler
+        PROVISIONING_STATE_FAILED,     // connect_to_network() could not connect, or the portal timed out
+    } provisioning_state_t;
+
+#define PROVISIONING_STATE_BIT(state) (1UL << (state)) // for the state mask of wait_for_state()
+
+    /**
+     * @brief Called on every state change, in the task that did the transition (event loop, http server, esp_timer or
+     *        connect task); must not block
+     *
+     * @param old_state state before the transition
+     * @param new_state state after the transition
+     * @param arg argument passed to subscribe_state_changes()
+     */
+    typedef void (*state_callback_t)(provisioning_state_t old_state, provisioning_state_t new_state, void *arg);
+
+    /**
+     * @brief Duration of the phases of the last connect_to_network(), in microseconds; 0 when a phase was not needed
+     *
+     */
+    typedef struct
+    {
+        int64_t constructor_us;   // time the wifi_provisioning object was constructed (esp_timer_get_time())
+        int64_t connect_start_us; // time connect_to_network() started (esp_timer_get_time())
+        int64_t got_ip_us;        // time the IP address was obtained (esp_timer_get_time()); 0 when not connected
+        int64_t nvs_read_us;      // read credentials and fast-reconnect record from NVS
+        int64_t stack_init_us;    // esp_netif_init(), event loop, STA netif and esp_wifi_init(); 0 when initialized before
+        int64_t portal_us;        // captive portal, until credentials were supplied and tested; 0 when not started
+        int64_t wifi_start_us;    // esp_wifi_start() in STA mode
+        int64_t scan_us;          // scan for known networks; 0 with fast reconnect
+        int64_t association_us;   // last connect attempt until associated, including authentication and 4-way handshake
+        int64_t dhcp_us;          // associated until IP address obtained
+        int64_t time_to_ip_us;    // connect_to_network() started until IP address obtained
+        uint32_t retries;         // nbr of disconnects while connecting
+        bool fast_reconnect;      // connected with cached BSSID, channel and PMK
+        int32_t heap_used;        // free heap at start of connect_to_network() minus free heap at the end, in bytes
+        uint32_t heap_minimum_free; // lowest free heap since boot (high-water mark of heap use) at the end, in bytes
+        bool warm_start;          // connected with the context in RTC memory after a wake from deep sleep; NVS not read
+        int64_t radio_on_us;      // esp_wifi_start() until IP address obtained
+        int64_t previous_radio_on_us; // warm start: radio-on time of the previous wake, until stop(); 0 when unknown
+    } connect_metrics_t;
+
+#define CONNECT_HISTOGRAM_BUCKETS 8
+
+    /**
+     * @brief Histogram of boots, kept in NVS. Only boots that connect with stored credentials are counted; the time a
+     *        user needs to fill in the captive portal says nothing about the site. When a histogram holds
+     *        ESP_METRICS_HISTOGRAM_WINDOW boots, all counts are halved, so it follows the recent boots
+     *
+     */
+    typedef struct
+    {
+        uint16_t time_to_ip[CONNECT_HISTOGRAM_BUCKETS]; // bucket i: time-to-IP below 250 ms * 2^i; last bucket: the rest
+        uint16_t retries[CONNECT_HISTOGRAM_BUCKETS];    // bucket i: i retries; last bucket: more
+        uint16_t failures;                              // boots that could not connect (decays with retries histogram)
+        uint16_t reserved;                              // 0
+        uint32_t boot_count;                            // total nbr of boots counted; does not decay
+    } connect_histogram_t;
+
     /**
      * @brief Usage
      * create object, for instance wifi_1
@@ -23,19 +208,32 @@ namespace WIFI_PROVISIONING
     private:
         // define static functions and vars; necessary because the http callback function must be a C-like function,
         // and not a method of a class
-        static esp_err_t index_get_handler(httpd_req_t *req);
         static bool _credentials_stored_in_NVS();
-        static bool network_credentials_sta_set;
+#ifdef CONFIG_WIFI_PROV_PORTAL
+        static esp_err_t index_get_handler(httpd_req_t *req);
         static esp_err_t setWifiParams(httpd_req_t *req);
+        static bool _test_credentials(esp_netif_ip_info_t *ip_info);
+        static void _credentials_test_task(void *arg);
+        static esp_err_t _start_credentials_test(const wifi_config_t *wifi_config, void (*finished)(bool connected));
 
         void wifi_init_softap();
-        void _start_soft_AP_mode_and_get_credentials();
+        bool _start_soft_AP_mode_and_get_credentials(uint32_t portal_timeout_ms);
+        void startHTTPServer();
+#endif
+#ifdef CONFIG_WIFI_PROV_JSON_API
+        static esp_err_t provision_api_post_handler(httpd_req_t *req);
+#endif
         bool _connect_to_network();
         esp_err_t _save_credentials();
         bool wifi_init_sta_try_to_connect_to_wifi(void);
-        void startHTTPServer();
         bool valid_wifi_credentials_in_NVS; // indicated whether valid wifi credentials are saved in NVS
 
+        provisioning_status_t _connect(uint32_t portal_timeout_ms);
+        static void _connect_task(void *arg);
+        uint32_t async_portal_timeout_ms;    // arguments of connect_to_network_async(), for the connect task
+        connect_callback_t async_callback;
+        void *async_callback_arg;
+
     public:
         /**
          * @brief Construct a new wifi provisioning object
@@ -45,5 +243,186 @@ namespace WIFI_PROVISIONING
 
         bool connect_to_network();
 
+        /**
+         * @brief Connect to the wifi network; when no credentials are stored in NVS, or none of the known networks
+         *        connects, the captive portal is started and waits at most portal_timeout_ms for credentials
+         *
+         * @param portal_timeout_ms maximum time to wait for credentials via captive portal; 0 means wait forever
+         * @return provisioning_status_t; PROVISIONING_CONNECT_FAILED at once, without touching the connection, while
+         *         another connect_to_network() or connect_to_network_async() is busy
+         */
+        provisioning_status_t connect_to_network(uint32_t portal_timeout_ms);
+
+        /**
+         * @brief Start connect_to_network(portal_timeout_ms) in a separate task, and return immediately, so the
+         *        application can do its own initialization meanwhile. The object must exist until it is finished
+         *
+         * @param portal_timeout_ms maximum time to wait for credentials via captive portal; 0 means wait forever
+         * @param callback called (from the connect task) when finished; may be NULL
+         * @param arg passed to callback
+         * @return ESP_OK, ESP_ERR_INVALID_STATE when already connecting, ESP_ERR_NO_MEM when the task cannot be created
+         */
+        esp_err_t connect_to_network_async(uint32_t portal_timeout_ms = 0, connect_callback_t callback = NULL, void *arg = NULL);
+
+        /**
+         * @brief Wait until connect_to_network() or connect_to_network_async() is finished
+         *
+         * @param timeout maximum time to wait, in ticks
+         * @return provisioning_status_t result, or PROVISIONING_IN_PROGRESS on timeout
+         */
+        provisioning_status_t wait_for_connection(TickType_t timeout);
+
+        /**
+         * @brief Status of connect_to_network(); does not block
+         *
+         * @return provisioning_status_t
+         */
+        provisioning_status_t get_status();
+
+        /**
+         * @brief Current state of the state machine; does not block, safe from any task and from event callbacks
+         *
+         * @return provisioning_state_t
+         */
+        provisioning_state_t get_state();
+
+        /**
+         * @brief Wait until the state machine is in one of the given states, without polling
+         *
+         * @param states mask of PROVISIONING_STATE_BIT(state), for instance
+         *               PROVISIONING_STATE_BIT(PROVISIONING_STATE_CONNECTED) | PROVISIONING_STATE_BIT(PROVISIONING_STATE_FAILED)
+         * @param timeout maximum time to wait, in ticks
+         * @return provisioning_state_t state after waiting; not in states on timeout
+         */
+        provisioning_state_t wait_for_state(uint32_t states, TickType_t timeout);
+
+        /**
+         * @brief Call callback on every state change
+         *
+         * @param callback called with old and new state; must not block
+         * @param arg passed to callback
+         * @return ESP_OK, or ESP_ERR_NO_MEM when there are ESP_STATE_MAXIMUM_SUBSCRIBERS subscribers already
+         */
+        esp_err_t subscribe_state_changes(state_callback_t callback, void *arg = NULL);
+
+        /**
+         * @brief Stop calling callback on state changes
+         *
+         * @param callback callback passed to subscribe_state_changes()
+         * @param arg arg passed to subscribe_state_changes()
+         * @return ESP_OK, or ESP_ERR_NOT_FOUND when not subscribed
+         */
+        esp_err_t unsubscribe_state_changes(state_callback_t callback, void *arg = NULL);
+
+        /**
+         * @brief Change the settings of the reconnect scheduler. After a successful connect, the connection is restored
+         *        after every disconnect, with exponential backoff
+         *
+         * @param config reconnect scheduler settings
+         */
+        void set_reconnect_config(const reconnect_config_t &config);
+
+        /**
+         * @brief Get the state of the reconnect scheduler, and the time of the next attempt
+         *
+         * @return reconnect_status_t
+         */
+        reconnect_status_t get_reconnect_status();
+
+        /**
+         * @brief Add a network to the known networks in NVS, or change its password, without connecting to it. A new
+         *        network is tried after the networks that were connected to before. When 4 networks
+         *        are known, the least recently used one is forgotten. A new password of the network connected to last
+         *        drops its fast-reconnect data, so the next connect does not try the old one first
+         *
+         * @param ssid SSID, 1..32 characters
+         * @param password WPA passphrase of 8..63 characters, 64 hex digits, or "" for an open network
+         * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE while connect_to_network() is busy, or the NVS error
+         */
+        esp_err_t add_network(const char *ssid, const char *password);
+
+        /**
+         * @brief Remove a network from the known networks in NVS. When it is the network of the last connect, its cached
+         *        AP and PMK are erased too, and a connection to it is ended without reconnect: the state is
+         *        PROVISIONING_STATE_IDLE, as after stop(), and connect_to_network() connects to another known network
+         *
+         * @param ssid SSID, 1..32 characters
+         * @return ESP_OK, ESP_ERR_NOT_FOUND when the network is not known, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE
+         *         while connect_to_network() is busy, or the NVS error
+         */
+        esp_err_t forget_network(const char *ssid);
+
+        /**
+         * @brief Use a static IP address for the STA instead of DHCP; call before connect_to_network(). Without static IP,
+         *        the address of the last DHCP lease is asked for on a warm boot to the same AP
+         *
+         * @param ip_info IP address, netmask and gateway; NULL to use DHCP again
+         * @param dns DNS server; NULL to keep the DNS server of the netif
+         */
+        void set_static_ip(const esp_netif_ip_info_t *ip_info, const esp_ip4_addr_t *dns = NULL);
+
+        /**
+         * @brief Release everything that connect_to_network() allocated: wifi driver, STA netif, event handlers, event
+         *        groups, timers, and the memory of the captive portal. The wifi connection is closed. Afterwards
+         *        connect_to_network() can be called again, without reboot. The TCP/IP stack and the default event loop
+         *        stay, because they cannot be deinitialized and may be used by the application
+         *
+         * @return ESP_OK, or ESP_ERR_INVALID_STATE while connect_to_network() is busy
+         */
+        esp_err_t stop();
+
+        /**
+         * @brief Select the power profile; the default is set in menuconfig. When connected, PS mode and TX power change at
+         *        once; the listen interval (minimum power and adaptive) is used from the next association
+         *
+         * @param profile power profile
+         * @return ESP_OK, ESP_ERR_INVALID_ARG, or ESP_ERR_NOT_SUPPORTED for POWER_PROFILE_ADAPTIVE without CONFIG_LWIP_STATS
+         */
+        esp_err_t set_power_profile(power_profile_t profile);
+
+        /**
+         * @brief Change the settings of the adaptive power profile; default 50 and 2 packets/s, and 1000 ms latency
+         *
+         * @param config settings
+         */
+        void set_adaptive_power_config(const adaptive_power_config_t &config);
+
+        /**
+         * @brief Get the power profile, the profile in effect, and the packet rate
+         *
+         * @return power_status_t
+         */
+        power_status_t get_power_status();
+
+        /**
+         * @brief Change the settings of the link monitor; used from the next sample. Default: threshold from menuconfig,
+         *        5 dB hysteresis, 8 dB margin, 20% TX failures, a sample every 2 s and a roam scan at most every 30 s
+         *
+         * @param config link monitor settings
+         */
+        void set_roam_config(const roam_config_t &config);
+
+        /**
+         * @brief Get the roam counters, the time below the RSSI threshold, and the last sample of the link monitor,
+         *        since the last connect_to_network(); all 0 when roaming is disabled in menuconfig
+         *
+         * @return roam_metrics_t
+         */
+        roam_metrics_t get_roam_metrics();
+
+        /**
+         * @brief Get the duration of the phases of the last connect_to_network()
+         *
+         * @return connect_metrics_t
+         */
+        connect_metrics_t get_metrics();
+
+        /**
+         * @brief Get the histogram of time-to-IP and retries of the previous boots, as stored in NVS
+         *
+         * @return connect_histogram_t
+         */
+        connect_histogram_t get_histogram();
+
     }; // Class
 } // Namespace
\ No newline at end of file
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Minify and gzip all files of the captive portal, and generate a C source with one table of embedded assets.
+
+Usage: embed_web_assets.py <web directory> <output .c file>
+
+Every file under the web directory becomes an entry of web_assets[] (see web_assets.h), with its URI (path relative
+to the web directory), content type, gzip compressed data and a strong ETag (hash of the compressed data). The
+minified data is embedded uncompressed as well, with its own ETag, for clients that do not accept gzip.
+The output is reproducible: same input gives the same output, so the ETag only changes when the content changes.
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+CONTENT_TYPES = {
+    '.html': 'text/html',
+    '.htm': 'text/html',
+    '.css': 'text/css',
+    '.js': 'application/javascript',
+    '.json': 'application/json',
+    '.svg': 'image/svg+xml',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+    '.txt': 'text/plain',
+}
+
+
+def minify_css(text):
+    text = re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+    text = re.sub(r'\s+', ' ', text)
+    text = re.sub(r'\s*([{};:,>])\s*', r'\1', text)
+    return text.replace(';}', '}').strip()
+
+
+def minify_js(text):
+    # conservative: keep line structure (automatic semicolon insertion), only drop indentation,
+    # empty lines and full-line comments
+    lines = []
+    for line in text.splitlines():
+        line = line.strip()
+        if line and not line.startswith('//'):
+            lines.append(line)
+    return '\n'.join(lines)
+
+
+def minify_html(text):
+    parts = []
+    pos = 0
+    # style and script blocks get their own minifier; the rest is markup
+    for block in re.finditer(r'(<(style|script)\b[^>]*>)(.*?)(</\2\s*>)', text, flags=re.S | re.I):
+        parts.append(_minify_markup(text[pos:block.start()]))
+        body = minify_css(block.group(3)) if block.group(2).lower() == 'style' else minify_js(block.group(3))
+        parts.append(block.group(1) + body + block.group(4))
+        pos = block.end()
+    parts.append(_minify_markup(text[pos:]))
+    return ''.join(parts)
+
+
+def _minify_markup(text):
+    text = re.sub(r'<!--.*?-->', '', text, flags=re.S)
+    text = re.sub(r'\s+', ' ', text)
+    return re.sub(r'>\s+<', '><', text)
+
+
+MINIFIERS = {
+    'text/html': minify_html,
+    'text/css': minify_css,
+    'application/javascript': minify_js,
+}
+
+
+def c_identifier(uri):
+    return 'web_asset_' + re.sub(r'[^0-9a-zA-Z]', '_', uri.lstrip('/'))
+
+
+def etag(data):
+    return '"' + hashlib.sha256(data).hexdigest()[:16] + '"'
+
+
+def c_string(text):
+    return text.replace('"', '\\"')
+
+
+def write_array(f, name, data):
+    f.write('static const uint8_t %s[] = {\n' % name)
+    for i in range(0, len(data), 16):
+        f.write('    ' + ', '.join('0x%02x' % b for b in data[i:i + 16]) + ',\n')
+    f.write('};\n\n')
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    web_dir, output = sys.argv[1], sys.argv[2]
+
+    assets = []
+    for root, _, files in os.walk(web_dir):
+        for name in sorted(files):
+            path = os.path.join(root, name)
+            uri = '/' + os.path.relpath(path, web_dir).replace(os.sep, '/')
+            content_type = CONTENT_TYPES.get(os.path.splitext(name)[1].lower(), 'application/octet-stream')
+            with open(path, 'rb') as f:
+                data = f.read()
+            original_size = len(data)
+            if content_type in MINIFIERS:
+                data = MINIFIERS[content_type](data.decode('utf-8', errors='replace')).encode('utf-8')
+            identity = data
+            data = gzip.compress(data, compresslevel=9, mtime=0)
+            # html must be revalidated (cheap with ETag), so a new firmware is visible immediately
+            cache_control = 'no-cache' if content_type == 'text/html' else 'public, max-age=3600'
+            assets.append((uri, content_type, data, etag(data), identity, etag(identity), cache_control, original_size))
+    assets.sort()
+
+    with open(output, 'w') as f:
+        f.write('// Generated by embed_web_assets.py; do not edit\n')
+        f.write('#include "web_assets.h"\n\n')
+        for uri, _, data, _, identity, _, _, _ in assets:
+            write_array(f, c_identifier(uri), data)
+            write_array(f, c_identifier(uri) + '_identity', identity)
+        f.write('const web_asset_t web_assets[] = {\n')
+        for uri, content_type, data, data_etag, identity, identity_etag, cache_control, _ in assets:
+            name = c_identifier(uri)
+            f.write('    {"%s", "%s", %s, sizeof(%s), "%s", %s_identity, sizeof(%s_identity), "%s", "%s"},\n' %
+                    (uri, content_type, name, name, c_string(data_etag), name, name, c_string(identity_etag),
+                     cache_control))
+        f.write('};\n\n')
+        f.write('const size_t web_assets_count = sizeof(web_assets) / sizeof(web_assets[0]);\n')
+
+    for uri, _, data, _, identity, _, _, original_size in assets:
+        print('%s: %d -> %d bytes, %d gzip' % (uri, original_size, len(identity), len(data)))
+
+
+if __name__ == '__main__':
+    main()
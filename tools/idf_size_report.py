@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Print the size of the component in a firmware per configuration, and the difference to the first configuration.
+
+Usage: idf_size_report.py [--target <chip>] [--build-dir <dir>] [<variant>...]
+
+Builds examples/size_report with idf.py for every variant, with sdkconfig.defaults and sdkconfig.defaults.<variant>
+of the example (default: minimal, default, full), and reads the size of the archive of the component from
+`idf.py size-components`. Run it in an ESP-IDF environment (export.sh). The sizes are those of the linked firmware:
+what the linker kept of the component, for the target.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+COMPONENT_DIR = os.path.dirname(os.path.dirname(os.path.realpath(__file__)))
+EXAMPLE_DIR = os.path.join(COMPONENT_DIR, 'examples', 'size_report')
+COMPONENT = os.path.basename(COMPONENT_DIR)  # the component is named after its directory, as in components/
+
+
+def run_idf(build_dir, variant, target, *action):
+    command = ['idf.py', '-C', EXAMPLE_DIR, '-B', build_dir, '-D', 'SDKCONFIG=' + os.path.join(build_dir, 'sdkconfig'),
+               '-D', 'SDKCONFIG_DEFAULTS=sdkconfig.defaults;sdkconfig.defaults.' + variant]
+    if target:
+        command += ['-D', 'IDF_TARGET=' + target]
+    subprocess.run(command + list(action), check=True, stdout=subprocess.DEVNULL)
+
+
+def find_archive(report):
+    """Entry of the archive of the component; a dict by archive name, or a list of entries (esp-idf-size 1.x)"""
+    archive = 'lib%s.a' % COMPONENT
+    entries = report.items() if isinstance(report, dict) else ((entry.get('name', ''), entry) for entry in report)
+    for name, entry in entries:
+        if os.path.basename(name) == archive:
+            return entry
+    sys.exit('idf_size_report.py: %s not in the output of idf.py size-components' % archive)
+
+
+def section_sizes(entry, section=None):
+    """(section, size) of an archive entry: keys that are section names (.flash.text), with their size as value or as
+    "size" of a nested dict; without section names (older idf_size.py), the numbers of the entry except the totals"""
+    found = False
+    for key, value in entry.items():
+        name = key if key.startswith('.') else section
+        if isinstance(value, dict):
+            for nested in section_sizes(value, name):
+                found = True
+                yield nested
+        elif isinstance(value, int) and name is not None and (key == name or key == 'size'):
+            found = True
+            yield name, value
+    if not found and section is None:
+        for key, value in entry.items():
+            if isinstance(value, int) and 'total' not in key:
+                yield key, value
+
+
+def archive_size(build_dir):
+    output = os.path.join(build_dir, 'size_components.json')
+    with open(output) as f:
+        sections = list(section_sizes(find_archive(json.load(f))))
+    # flash: everything that is stored in flash, including IRAM code and initial values of data; RAM: DRAM and IRAM
+    flash = sum(size for name, size in sections if 'bss' not in name and 'noinit' not in name)
+    ram = sum(size for name, size in sections
+              if 'flash' not in name and any(memory in name for memory in ('ram', 'data', 'bss')))
+    return flash, ram
+
+
+def options(variant):
+    with open(os.path.join(EXAMPLE_DIR, 'sdkconfig.defaults.' + variant)) as f:
+        lines = [line.strip() for line in f if line.strip() and not line.startswith('#')]
+    return ' '.join(line.replace('CONFIG_', '').replace('WIFI_PROV_', '') for line in lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--target', help='IDF_TARGET; default: that of the ESP-IDF environment (esp32)')
+    parser.add_argument('--build-dir', default=os.path.join(EXAMPLE_DIR, 'build_size'),
+                        help='directory of the builds, one subdirectory per variant')
+    parser.add_argument('variants', nargs='*', default=['minimal', 'default', 'full'])
+    args = parser.parse_args()
+
+    print('%-16s %8s %8s %10s  %s' % ('config', 'flash', 'RAM', 'flash diff', 'options'))
+    base_flash = None
+    for variant in args.variants:
+        build_dir = os.path.join(args.build_dir, variant)
+        run_idf(build_dir, variant, args.target, 'size-components', '--format', 'json', '--output-file',
+                os.path.join(build_dir, 'size_components.json'))
+        flash, ram = archive_size(build_dir)
+        base_flash = flash if base_flash is None else base_flash
+        print('%-16s %8d %8d %+10d  %s' % (variant, flash, ram, flash - base_flash, options(variant)))
+    print('\nflash: code, read-only data and initial values of %s in the firmware; RAM: its static data, bss and IRAM '
+          'code; flash diff: against %s' % (COMPONENT, args.variants[0]))
+
+
+if __name__ == '__main__':
+    main()
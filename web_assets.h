@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Web asset of the captive portal; generated at build time from the files under web/ by tools/embed_web_assets.py
+     *
+     */
+    typedef struct
+    {
+        const char *uri;           // path relative to web/, for instance "/index.html"
+        const char *content_type;  // MIME type
+        const uint8_t *data;       // minified and gzip compressed content
+        size_t size;               // size of data
+        const char *etag;          // strong ETag of data, including quotes
+        const uint8_t *identity_data; // minified content, not compressed; for clients that do not accept gzip
+        size_t identity_size;      // size of identity_data
+        const char *identity_etag; // strong ETag of identity_data, including quotes
+        const char *cache_control; // value of Cache-Control header
+    } web_asset_t;
+
+    extern const web_asset_t web_assets[];
+    extern const size_t web_assets_count;
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,306 +1,3895 @@
+#include "sdkconfig.h"
 #include <esp_log.h>
 #include "wifi_provisioning.h"
 #include <nvs_flash.h>
+#include <esp_timer.h>
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "mbedtls/pkcs5.h"
+#include "lwip/stats.h"
+#include "lwip/dhcp.h"
+#include "esp_netif_net_stack.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include <cstring>
+#include <atomic>
+#include <ctime>
 
-#define ESP_WIFI_SOFTAP_SSID "ESP32"
-#define ESP_WIFI_SOFTAP_PASS "" // no password means open network
-#define ESP_WIFI_SOFTAP_CHANNEL 11
-#define ESP_WIFI_SOFTAP_MAX_STA_CONN 4
-#define ESP_MAXIMUM_RETRY 10
+// configuration from menuconfig (Component config > Wifi provisioning); see Kconfig
+#ifdef CONFIG_WIFI_PROV_PORTAL
+#define ESP_PORTAL 1 // softAP, http server, DNS responder and web pages to supply credentials
+#define ESP_WIFI_SOFTAP_SSID CONFIG_WIFI_PROV_SOFTAP_SSID
+#define ESP_WIFI_SOFTAP_PASS CONFIG_WIFI_PROV_SOFTAP_PASSWORD // no password means open network
+#define ESP_WIFI_SOFTAP_CHANNEL CONFIG_WIFI_PROV_SOFTAP_CHANNEL
+#ifdef CONFIG_WIFI_PROV_SOFTAP_AUTO_CHANNEL
+#define ESP_SOFTAP_AUTO_CHANNEL 1 // scan before the softAP starts, and use the least congested channel
+#else
+#define ESP_SOFTAP_AUTO_CHANNEL 0
+#endif
+#define ESP_WIFI_SOFTAP_MAX_STA_CONN CONFIG_WIFI_PROV_SOFTAP_MAX_STA_CONN
+#define ESP_HTTPD_STACK_SIZE CONFIG_WIFI_PROV_PORTAL_HTTPD_STACK_SIZE
+#define ESP_CREDENTIALS_TEST_TASK_STACK_SIZE CONFIG_WIFI_PROV_PORTAL_TEST_TASK_STACK_SIZE
+#define ESP_HTTPD_MAX_OPEN_SOCKETS CONFIG_WIFI_PROV_PORTAL_MAX_OPEN_SOCKETS
+#else
+#define ESP_PORTAL 0
+#endif
+#ifdef CONFIG_WIFI_PROV_JSON_API
+#define ESP_PROVISION_API 1 // POST /api/provision, for scripts and test fixtures
+#else
+#define ESP_PROVISION_API 0
+#endif
+#ifdef CONFIG_WIFI_PROV_METRICS_HTTP_ENDPOINT
+#define ESP_METRICS_HTTP_ENDPOINT 1 // serve connect metrics and histogram as /metrics while the portal is up
+#else
+#define ESP_METRICS_HTTP_ENDPOINT 0
+#endif
+#ifdef CONFIG_WIFI_PROV_NVS_PERSISTENCE
+#define ESP_NVS_PERSISTENCE 1 // write credentials, fast-reconnect record, DHCP lease and histogram to NVS
+#else
+#define ESP_NVS_PERSISTENCE 0 // only read NVS (factory provisioned credentials); everything learned is kept in RAM
+#endif
+#ifdef CONFIG_WIFI_PROV_LOG_SECRETS
+#define ESP_LOG_SECRETS 1
+#else
+#define ESP_LOG_SECRETS 0
+#endif
+#ifdef CONFIG_WIFI_PROV_RTC_WARM_START
+#define ESP_RTC_WARM_START 1 // keep the connection context in RTC memory, for a fast reconnect after deep sleep
+#else
+#define ESP_RTC_WARM_START 0
+#endif
+#if defined(CONFIG_WIFI_PROV_DHCP_REBOOT) && defined(CONFIG_LWIP_DHCP_RESTORE_LAST_IP)
+#define ESP_DHCP_REBOOT 1 // DHCP client asks for the address of the last lease after a reboot (INIT-REBOOT)
+#else
+#define ESP_DHCP_REBOOT 0
+#endif
+#if defined(CONFIG_WIFI_PROV_POWER_PROFILE_BALANCED)
+#define ESP_POWER_PROFILE POWER_PROFILE_BALANCED
+#elif defined(CONFIG_WIFI_PROV_POWER_PROFILE_MIN_POWER)
+#define ESP_POWER_PROFILE POWER_PROFILE_MIN_POWER
+#elif defined(CONFIG_WIFI_PROV_POWER_PROFILE_ADAPTIVE)
+#define ESP_POWER_PROFILE POWER_PROFILE_ADAPTIVE
+#else
+#define ESP_POWER_PROFILE POWER_PROFILE_MAX_THROUGHPUT // radio always on; best throughput and latency
+#endif
+#ifdef CONFIG_WIFI_PROV_ROAMING
+#define ESP_ROAMING 1 // monitor the link after the connect, and roam to a stronger BSS of the same SSID
+#define ESP_ROAM_RSSI_THRESHOLD CONFIG_WIFI_PROV_ROAM_RSSI_THRESHOLD
+#else
+#define ESP_ROAMING 0
+#define ESP_ROAM_RSSI_THRESHOLD -75
+#endif
+#if ESP_ROAMING && (defined(CONFIG_ESP_WIFI_11KV_SUPPORT) || defined(CONFIG_WPA_11KV_SUPPORT))
+#define ESP_ROAM_BTM 1 // 802.11v in the supplicant: ask the AP for a transition candidate before scanning
+#define ESP_ROAM_RRM 1 // 802.11k in the supplicant: ask the AP for its neighbors, and scan only their channels
+#else
+#define ESP_ROAM_BTM 0
+#define ESP_ROAM_RRM 0
+#endif
+#define ESP_MAXIMUM_RETRY CONFIG_WIFI_PROV_MAXIMUM_RETRY
+#define ESP_WIFI_STA_HOSTNAME CONFIG_WIFI_PROV_STA_HOSTNAME
 
-#define ESP_WIFI_STA_HOSTNAME "myesp32"
+// passwords in log messages are replaced, unless logging of secrets is enabled in menuconfig
+#define ESP_SECRET(secret) (ESP_LOG_SECRETS ? (secret) : "***")
+
+#if ESP_PORTAL
+#include "web_assets.h"
+#include "captive_dns.h"
+#endif
+#if ESP_PROVISION_API
+#include "cJSON.h"
+#endif
+#if ESP_ROAM_BTM
+#include "esp_wnm.h"
+#endif
+#if ESP_ROAM_RRM
+#include "esp_rrm.h"
+#endif
+
+#define ESP_FAST_RECONNECT_MAXIMUM_RETRY 1 // directed connect with cached BSSID/channel/PMK; fall back to full scan when it fails
+#define ESP_PORTAL_TEST_MAXIMUM_RETRY 3    // retries when credentials supplied via captive portal are tested
+#define ESP_PORTAL_TEST_TIMEOUT_MS 30000   // maximum time to test credentials supplied via captive portal
+#define ESP_PORTAL_RESULT_TIMEOUT_MS 10000 // after a successful test the portal stays up until its result is fetched, or this long
+#define ESP_CREDENTIALS_TEST_TASK_PRIORITY 5
+#define ESP_MAXIMUM_NETWORKS 4             // nbr of wifi networks remembered in NVS
+#define ESP_CANDIDATE_MAXIMUM_RETRY 2      // retries per known network that is visible in the scan at boot
+#define ESP_SCAN_MAXIMUM_RECORDS 20        // nbr of APs read from a scan
+#define ESP_RECENCY_PENALTY_DB 3           // ranking of known networks: RSSI minus this penalty per more recently used network
+#define ESP_SCAN_TABLE_SIZE CONFIG_WIFI_PROV_PORTAL_SCAN_TABLE_SIZE // nbr of networks in the scan table of the portal (/scan.json)
+#define ESP_SCAN_TABLE_MAXIMUM_AGE 3       // network is removed from the scan table when not seen in this nbr of scans
+#define ESP_BACKGROUND_SCAN_PERIOD_MS 15000 // background scan while the portal is up
+#define ESP_BACKGROUND_SCAN_TIME_MS 120    // active scan time per channel of a background scan
+#define ESP_PREFLIGHT_SCAN_TIME_MS 100     // maximum active scan time per channel of the probe scan for supplied credentials
+#define ESP_PREFLIGHT_MAXIMUM_RECORDS 4    // nbr of BSSes of the supplied SSID read from the probe scan
+#define ESP_WIFI_MAXIMUM_CHANNEL 13        // highest 2.4 GHz channel the softAP may use
+#define ESP_CHANNEL_OVERLAP 5              // channels this far apart do not overlap
+#define ESP_SOFTAP_TARGET_CHANNEL_BONUS 1000 // score bonus of the channel of the known network; about 3 strong BSSes on that channel
+
+// defaults of the reconnect scheduler
+#define ESP_RECONNECT_INITIAL_DELAY_MS 500
+#define ESP_RECONNECT_MAXIMUM_DELAY_MS 60000
+#define ESP_RECONNECT_MULTIPLIER 2
+#define ESP_RECONNECT_JITTER_PERCENT 25
+#define ESP_RECONNECT_MAXIMUM_EXPONENT 32 // delay is multiplied at most this often; 2^32 times any delay exceeds every cap
+
+#define ESP_METRICS_HISTOGRAM_WINDOW 64 // histogram of boots in NVS is halved when it holds this nbr of boots
+
+#define ESP_STA_START_TIMEOUT_MS 1000 // maximum wait for WIFI_EVENT_STA_START; not posted when wifi was started already
+#define ESP_ABORT_TIMEOUT_MS 1000     // maximum wait for the DISCONNECTED event of an aborted connect attempt
+#define ESP_CONNECT_TASK_STACK_SIZE CONFIG_WIFI_PROV_CONNECT_TASK_STACK_SIZE // task of connect_to_network_async()
+#define ESP_CONNECT_TASK_PRIORITY 5
+
+#define ESP_STATE_MAXIMUM_SUBSCRIBERS 4 // nbr of callbacks of subscribe_state_changes()
+
+// power profiles
+#define ESP_BEACON_INTERVAL_MS 102           // 100 TU; the beacon interval of nearly every AP
+#define ESP_DEFAULT_LISTEN_INTERVAL 3        // listen interval of the driver
+#define ESP_MIN_POWER_LISTEN_INTERVAL 10     // longest listen interval of the min-power profile, in beacon intervals
+#define ESP_ADAPTIVE_POWER_PERIOD_MS 1000    // traffic is sampled this often by the adaptive profile
+#define ESP_ADAPTIVE_POWER_IDLE_PERIODS 10   // nbr of periods with less traffic before going down to a lower-power profile
+#if LWIP_STATS && LINK_STATS
+#define ESP_ADAPTIVE_POWER 1 // packet counters of lwIP available for the adaptive profile
+#define ESP_TX_FAILURE_STATS ESP_ROAMING // link-layer drop counter of lwIP available for the link monitor
+#else
+#define ESP_ADAPTIVE_POWER 0
+#define ESP_TX_FAILURE_STATS 0
+#endif
+
+#define ESP_ROAM_DEGRADED_SAMPLES 3          // nbr of consecutive bad samples before the link counts as degraded
+#define ESP_ROAM_MINIMUM_TX_FRAMES 10        // TX failure percentage of a sample is only used above this nbr of frames
+#define ESP_ROAM_SCAN_TIME_MS 60             // active scan time per channel of a roam scan; short, the STA leaves its channel
+#define ESP_ROAM_MAXIMUM_SCAN_CHANNELS 6     // channels of a neighbor report scanned one by one; more: scan all channels
+#define ESP_ELEMENT_ID_NEIGHBOR_REPORT 52    // 802.11 element of a neighbor report
+#define ESP_NEIGHBOR_REPORT_MINIMUM_LENGTH 13 // BSSID, BSSID information, operating class, channel, PHY type
 
 /* The event group allows multiple bits for each event, but we only care about two events:
  * - we are connected to the AP with an IP
  * - we failed to connect after the maximum amount of retries */
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
+// set when WIFI_EVENT_STA_START is handled; s_sta_connect_on_start is read then
+#define WIFI_STA_STARTED_BIT BIT2
+// set when the DISCONNECTED event of an aborted connect attempt is handled
+#define WIFI_ABORTED_BIT BIT3
 
-// Index.html that asks for wifi credentials
-extern const uint8_t index_html_start[] asm("_binary_index_html_start");
-extern const uint8_t index_html_end[] asm("_binary_index_html_end");
+// set by the http server task when wifi credentials are supplied via the captive portal
+#define CREDENTIALS_SET_BIT BIT0
+// set when connect_to_network() is finished; cleared when it starts
+#define CONNECT_DONE_BIT BIT1
+// set when no credentials test of the portal runs; cleared when one starts
+#define CREDENTIALS_TEST_IDLE_BIT BIT2
+// set when the page or script has fetched the result of a successful credentials test; the portal may close then
+#define TEST_RESULT_FETCHED_BIT BIT3
+// set by the background scan when a known network shows up while the portal is open because none was in reach
+#define KNOWN_NETWORK_VISIBLE_BIT BIT4
+
+#define CREDENTIALS_RECORD_VERSION 2 // version of credentials record in NVS
+#define HISTOGRAM_RECORD_VERSION 1   // version of histogram record in NVS
+#define RTC_CONTEXT_VERSION 2        // version of the context in RTC memory
+
+#define INDEX_HTML_URI "/index.html" // page that asks for wifi credentials
+#define FORM_MAX_LEN (3 * (32 + 64) + 32) // credentials form: SSID and passkey, all characters %-encoded, plus keys
+#define ESP_PROVISION_API_MAX_LEN 512     // JSON body of POST /api/provision
+
+#if ESP_PORTAL
+// URLs that operating systems fetch to detect a captive portal; answered with a redirect to the portal
+static const char *const CONNECTIVITY_PROBE_URIS[] = {
+    "/generate_204",              // Android, Chrome
+    "/gen_204",                   // Android
+    "/hotspot-detect.html",       // Apple
+    "/library/test/success.html", // Apple
+    "/ncsi.txt",                  // Windows
+    "/connecttest.txt",           // Windows
+    "/redirect",                  // Windows
+    "/canonical.html",            // Firefox
+    "/success.txt",               // Firefox
+};
+#define CONNECTIVITY_PROBE_URI_COUNT (sizeof(CONNECTIVITY_PROBE_URIS) / sizeof(CONNECTIVITY_PROBE_URIS[0]))
+#endif
 
 namespace WIFI_PROVISIONING
 {
-      // define local static variables; these are not part of the class
-      static int s_retry_num = 0;                   // count nbr of retries
+      // define local static variables; these are not part of the class. The connect context below is written by the
+      // task that connects (connect task, or the credentials test task while the portal is up) and read by the event
+      // loop task, the esp_timer task and the http server task; it is atomic, or only accessed via its functions
+      static std::atomic<int> s_retry_num{0};       // count nbr of retries; reset by the connecting task, counted by the event loop task
+      static std::atomic<int> s_maximum_retry{ESP_MAXIMUM_RETRY}; // nbr of retries before WIFI_FAIL_BIT is set; by the connecting task
       static EventGroupHandle_t s_wifi_event_group; // FreeRTOS event group to signal when connected to Wifi
+      static StaticEventGroup_t s_provisioning_event_group_buffer; // static, so stop() never frees it under a waiting task
+      static EventGroupHandle_t s_provisioning_event_group = NULL; // FreeRTOS event group to signal credentials are supplied
+      static std::atomic<int> s_provisioning_event_group_init{0}; // 0: not created, 1: being created, 2: created
+      static esp_netif_t *esp_netif_sta_handler = NULL;
+      static bool s_wifi_stack_initialized = false; // _init_wifi_stack() done, and not released by stop()
+      static esp_event_handler_instance_t s_wifi_event_handler_instance = NULL;
+      static esp_event_handler_instance_t s_ip_event_handler_instance = NULL;
+      static uint32_t s_heap_free_before_init = 0;  // free heap before _init_wifi_stack(); compared after stop()
+      static std::atomic<bool> s_sta_connect_on_start{true}; // connect as soon as STA is started; not in provisioning mode; read by the event loop task
+      static std::atomic<uint8_t> s_last_disconnect_reason{0}; // wifi_err_reason_t of last STA disconnect; by the event loop task
+      static std::atomic<int64_t> s_connect_start_us{0}; // time the last connect attempt started; by the connecting task
+      static std::atomic<int64_t> s_got_ip_us{0};        // time the last IP address was obtained; by the event loop task
+      static std::atomic<bool> s_sta_attempt_active{false}; // connect attempt or connection; ends with a DISCONNECTED event
+      static std::atomic<bool> s_abort_pending{false};      // next DISCONNECTED event is of an aborted attempt; no retry
+#if ESP_PORTAL
       static httpd_handle_t httpd_handle = NULL;    // handle of HTTP server
-      static esp_netif_t *esp_netif_handler;
+      static esp_netif_t *esp_netif_ap_handler = NULL;
+      static char s_portal_url[32] = "http://192.168.4.1/"; // URL of captive portal; set to IP of softAP when started
+
+      // networks found by the background scans while the portal is up; served as /scan.json
+      typedef struct
+      {
+            char ssid[33];     // null terminated
+            uint8_t bssid[6];  // strongest BSSID of this SSID
+            int8_t rssi;       // RSSI of that BSSID
+            uint8_t channel;   // channel of that BSSID
+            uint8_t authmode;  // wifi_auth_mode_t
+            uint8_t age;       // nbr of scans since this SSID was seen
+      } scan_entry_t;
+
+      static scan_entry_t s_scan_table[ESP_SCAN_TABLE_SIZE]; // sorted on RSSI, strongest first
+      static int s_scan_table_count = 0;
+      static SemaphoreHandle_t s_scan_table_mutex = NULL;  // scan table is written by event loop task, read by http server task
+      static bool s_background_scan_active = false;        // scan results are for the scan table; not for a blocking scan
+      static bool s_watch_known_networks = false;          // portal open because no known network was in reach
+      static esp_timer_handle_t s_scan_timer = NULL;       // periodic background scan
+#endif // ESP_PORTAL
+      static bool s_known_network_visible = false;  // a known network was in the scan of the last connect
+      static std::atomic<bool> s_reconnect_forever{false}; // after a successful connect, reconnect without maximum nbr of retries; read by the event loop task
+      static esp_timer_handle_t s_reconnect_timer = NULL; // fires at the next reconnect attempt
+      static reconnect_config_t s_reconnect_config = {ESP_RECONNECT_INITIAL_DELAY_MS, ESP_RECONNECT_MAXIMUM_DELAY_MS,
+                                                      ESP_RECONNECT_MULTIPLIER, ESP_RECONNECT_JITTER_PERCENT};
+      static reconnect_status_t s_reconnect_status = {RECONNECT_IDLE, 0, 0};
+      static portMUX_TYPE s_reconnect_lock = portMUX_INITIALIZER_UNLOCKED; // protects s_reconnect_status (event loop, esp_timer task)
+      static std::atomic<provisioning_status_t> s_status{PROVISIONING_NOT_STARTED}; // result of connect_to_network(), or in progress
+      static connect_metrics_t s_metrics = {};      // phases of the last connect_to_network()
+      static int64_t s_attempt_start_us = 0;        // time the last connect attempt started
+      static int64_t s_associated_us = 0;           // time the STA was associated at the last connect attempt
+
+      // state machine; s_state is changed only by _set_state(), with compare-and-swap, from any task
+      static std::atomic<provisioning_state_t> s_state{PROVISIONING_STATE_IDLE};
+      static StaticEventGroup_t s_state_event_group_buffer;     // static, so the event group is never freed under a waiting task
+      static EventGroupHandle_t s_state_event_group = NULL;     // bit PROVISIONING_STATE_BIT(s_state) is set; for wait_for_state()
+      static std::atomic<int> s_state_event_group_init{0};      // 0: not created, 1: being created, 2: created
+      static portMUX_TYPE s_state_lock = portMUX_INITIALIZER_UNLOCKED; // protects s_state_subscribers; never held during a callback
+
+#define PROVISIONING_STATE_ALL (PROVISIONING_STATE_BIT(PROVISIONING_STATE_FAILED + 1) - 1)
+#define FROM(state) PROVISIONING_STATE_BIT(PROVISIONING_STATE_##state)
+      // per new state: the states it may be entered from
+      static const uint32_t s_state_transitions[] = {
+          FROM(CONNECTING) | FROM(CONNECTED) | FROM(BACKOFF) | FROM(FAILED),                 // IDLE: stop()
+          FROM(IDLE) | FROM(CONNECTING) | FROM(BACKOFF) | FROM(FAILED),                      // PORTAL: no credentials, or none connects
+          FROM(IDLE) | FROM(PORTAL) | FROM(BACKOFF) | FROM(FAILED) | FROM(CONNECTED),        // CONNECTING
+          FROM(CONNECTING) | FROM(BACKOFF),                                                  // CONNECTED: got IP
+          FROM(CONNECTING) | FROM(CONNECTED),                                                // BACKOFF: disconnected
+          FROM(IDLE) | FROM(PORTAL) | FROM(CONNECTING) | FROM(BACKOFF),                      // FAILED
+      };
+#undef FROM
+
+      typedef struct
+      {
+            state_callback_t callback; // NULL: free slot
+            void *arg;
+      } state_subscriber_t;
+
+      static state_subscriber_t s_state_subscribers[ESP_STATE_MAXIMUM_SUBSCRIBERS] = {};
       static const char *TAG = "WIFI_PROVISIONING"; // used in ESP_LOGx
 
-      // init static class variables (no instance of class required)
-      bool wifi_provisioning::network_credentials_sta_set{false};
-      wifi_config_t glob_wifi_config = {}; // used to store wifi_config to connect to network
+      /* Fast-reconnect record, stored in NVS after the first successful connect. It contains everything the driver
+       * otherwise has to find out again on every boot: the BSSID and channel (full channel scan) and the PMK
+       * (4096 PBKDF2-SHA1 iterations over passphrase and SSID) */
+      typedef struct
+      {
+            uint8_t ssid[32];            // SSID the record belongs to; record is ignored when credentials change
+            uint8_t bssid[6];            // BSSID of the AP of the last successful connection
+            uint8_t channel;             // primary channel of that AP
+            uint8_t authmode;            // wifi_auth_mode_t of that AP
+            uint8_t pmk[32];             // PMK derived from passphrase and SSID
+            int64_t cold_time_to_ip_us;  // time-to-IP of the connection that created this record (full scan + PMK derivation)
+      } fast_reconnect_record_t;
+
+      static const char *NVS_KEY_FAST_RECONNECT = "nvs_fast_conn";
 
-      // Constructor
-      wifi_provisioning::wifi_provisioning()
+      /* Last DHCP lease, stored in NVS, so a warm boot to the same AP can ask for the same address (INIT-REBOOT), with
+       * one DHCP exchange instead of two */
+      typedef struct
       {
-            ESP_LOGI(TAG, "Constructor");
-            valid_wifi_credentials_in_NVS = true;
-            wifi_provisioning::network_credentials_sta_set = false; // static var
-      }                                                             // Constructor
+            uint8_t bssid[6];             // AP the lease was obtained from
+            uint8_t reserved[2];          // 0
+            esp_netif_ip_info_t ip_info;  // IP address, netmask and gateway
+            esp_ip4_addr_t dns;           // main DNS server
+            int64_t obtained_s;           // time() when the lease was obtained, or renewed
+            uint32_t lease_s;             // lease time granted by the DHCP server; 0 when not known
+            uint32_t t1_s;                // renewal time (T1) granted by the DHCP server; 0 when not known
+      } dhcp_lease_record_t;
 
-      bool wifi_provisioning::connect_to_network()
+      static const char *NVS_KEY_DHCP_LEASE = "nvs_dhcp_lease";
+      static dhcp_lease_record_t s_stored_lease = {};   // RAM copy of the lease record in NVS
+      static bool s_stored_lease_loaded = false;        // s_stored_lease is read from NVS
+      static bool s_static_ip_set = false;              // set_static_ip() called: STA does not use DHCP
+      static esp_netif_ip_info_t s_static_ip_info = {}; // static IP of set_static_ip()
+      static esp_ip4_addr_t s_static_dns = {};          // DNS server of set_static_ip(); 0 when not set
+
+      // hostname and static IP supplied via the provisioning API, stored in NVS, so they are used after reboot too
+      typedef struct
       {
-            bool ret = false;
-            ESP_LOGI(TAG, "METHOD Connect_to_network");
-            if (!_credentials_stored_in_NVS())
+            char hostname[33];            // null terminated
+            uint8_t static_ip;            // 1: STA uses ip_info and dns instead of DHCP
+            uint8_t reserved[2];          // 0; explicit, so there is no padding in the CRC
+            esp_netif_ip_info_t ip_info;  // IP address, netmask and gateway
+            esp_ip4_addr_t dns;           // main DNS server; 0 when not set
+            uint32_t crc;                 // CRC32 of all preceding fields
+      } station_config_record_t;
+
+      static const char *NVS_KEY_STATION_CONFIG = "nvs_sta_conf";
+
+#if ESP_RTC_WARM_START
+      /* Connection context in RTC slow memory; survives deep sleep, but not a reset or power loss. A wake from deep sleep
+       * connects with it directly to the same AP, without reading NVS. Invalidated when that connect fails */
+      typedef struct
+      {
+            uint8_t version;                        // RTC_CONTEXT_VERSION
+            uint8_t retries;                        // nbr of retries the last connect needed
+            uint8_t reserved[6];                    // 0; explicit, so there is no padding in the CRC
+            uint8_t password[64];                   // passphrase; the SSID is in fast_reconnect
+            fast_reconnect_record_t fast_reconnect; // SSID, BSSID, channel, authmode and PMK of the AP
+            dhcp_lease_record_t lease;              // last DHCP lease; IP address 0 when none
+            station_config_record_t station_config; // hostname and static IP of the provisioning API; invalid CRC when none
+            int64_t radio_on_us;                    // radio-on time of the previous wake, until stop(); 0 when unknown
+            uint32_t crc;                           // CRC32 of all preceding fields
+      } rtc_context_t;
+
+      RTC_DATA_ATTR static rtc_context_t s_rtc_context;
+#endif
+      static bool s_warm_start = false;         // this connect uses the RTC context; NVS is not read
+
+      // PS mode, listen interval (see _listen_interval()) and maximum TX power per power profile
+      typedef struct
+      {
+            wifi_ps_type_t ps_type;
+            int8_t max_tx_power; // in 0.25 dBm; limited by the driver to what the country allows
+      } power_profile_settings_t;
+
+      static const power_profile_settings_t s_power_profile_settings[] = {
+          {WIFI_PS_NONE, 84},      // MAX_THROUGHPUT: radio always on, 21 dBm
+          {WIFI_PS_MIN_MODEM, 78}, // BALANCED: radio wakes for every DTIM beacon, 19.5 dBm
+          {WIFI_PS_MAX_MODEM, 60}, // MIN_POWER: radio wakes every listen interval, 15 dBm
+      };
+
+      static std::atomic<power_profile_t> s_power_profile{ESP_POWER_PROFILE};            // set_power_profile()
+      static std::atomic<power_profile_t> s_active_power_profile{POWER_PROFILE_MAX_THROUGHPUT}; // in effect; differs in the adaptive profile
+      static adaptive_power_config_t s_adaptive_power_config = {50, 2, 1000};
+      static bool s_power_profile_started = false;  // applied after connect; until stop()
+      static SemaphoreHandle_t s_power_mutex = NULL;  // serializes profile changes of the application and of s_power_timer
+      static uint32_t s_packets_per_s = 0;          // packet rate in the last sample period
+#if ESP_ADAPTIVE_POWER
+      static esp_timer_handle_t s_power_timer = NULL; // samples the traffic in the adaptive profile
+      static uint32_t s_last_packet_count = 0;      // packets sent and received at the previous sample
+      static uint32_t s_quiet_periods = 0;          // nbr of periods the traffic allowed a lower-power profile
+#endif
+      static int64_t s_radio_on_start_us = 0;   // time of the first esp_wifi_start(); 0 while wifi is stopped
+
+      static roam_config_t s_roam_config = {ESP_ROAM_RSSI_THRESHOLD, 5, 8, 20, 2000, 30000};
+      static roam_metrics_t s_roam_metrics = {};
+      static portMUX_TYPE s_roam_lock = portMUX_INITIALIZER_UNLOCKED; // protects s_roam_metrics (event loop, esp_timer task)
+
+#if ESP_ROAMING
+      typedef enum
+      {
+            ROAM_IDLE,          // no roam of this component in progress
+            ROAM_DISCONNECTING, // disconnect from the current BSS requested; the STA connects to the new BSS after it
+            ROAM_CONNECTING,    // connecting to the new BSS
+      } roam_state_t;
+
+      static esp_timer_handle_t s_link_timer = NULL;  // samples RSSI and TX failures while connected
+      static bool s_link_monitor_started = false;     // after connect; until stop()
+      static uint32_t s_degraded_samples = 0;         // nbr of consecutive bad samples while the link is not degraded
+      static bool s_btm_query_sent = false;           // BSS transition query sent since the link became degraded
+      static bool s_neighbor_report_requested = false; // neighbor report requested since the link became degraded
+      static uint8_t s_neighbor_channels[ESP_ROAM_MAXIMUM_SCAN_CHANNELS]; // of the last neighbor report; s_roam_lock
+      static uint8_t s_neighbor_channel_count = 0;    // 0: no neighbor report (yet), or used by a roam scan; s_roam_lock
+      static bool s_roam_scan_active = false;         // scan results are for the roam decision
+      static uint8_t s_roam_scan_channels[ESP_ROAM_MAXIMUM_SCAN_CHANNELS]; // scanned one by one; none: all at once
+      static uint8_t s_roam_scan_channel_count = 0;
+      static uint8_t s_roam_scan_channel_index = 0;  // channel of s_roam_scan_channels scanned now
+      static bool s_roam_candidate_found = false;     // s_roam_candidate holds the strongest other BSS of this roam scan
+      static wifi_ap_record_t s_roam_candidate;
+      static int64_t s_last_roam_scan_us = 0;         // time the last roam scan started
+      static roam_state_t s_roam_state = ROAM_IDLE;
+      static int64_t s_roam_start_us = 0;             // time the disconnect of the current roam was requested
+#if ESP_TX_FAILURE_STATS
+      static uint32_t s_last_tx_frames = 0;           // frames sent at the previous sample
+      static uint32_t s_last_tx_failures = 0;         // frames dropped at the previous sample
+#endif
+#endif
+
+      /* Wifi networks the ESP connected to before, stored in NVS as one blob, so SSID and password are always written
+       * together (atomically). Loaded once into RAM (s_credentials); written only when changed, to prevent unnecessary
+       * flash wear */
+      typedef struct
+      {
+            uint8_t ssid[32];          // not null terminated when 32 characters; empty when slot is not used
+            uint8_t password[64];      // not null terminated when 64 characters
+            uint32_t last_success_seq; // value of success_seq of the record at the last successful connect
+      } network_entry_t;
+
+      typedef struct
+      {
+            uint8_t version;                                // CREDENTIALS_RECORD_VERSION
+            uint8_t count;                                  // nbr of used entries in networks
+            uint8_t reserved[2];                            // 0; explicit, so there is no padding in the CRC
+            uint32_t success_seq;                           // incremented on every connect to another network; orders networks by recency without a clock
+            network_entry_t networks[ESP_MAXIMUM_NETWORKS]; // known networks
+            uint32_t crc;                                   // CRC32 of all preceding fields
+      } credentials_record_t;
+
+      // version 1 of the credentials record, with one network; only used to migrate to the current version
+      typedef struct
+      {
+            uint8_t version;
+            uint8_t reserved[3];
+            uint8_t ssid[32];
+            uint8_t password[64];
+            uint32_t crc;
+      } credentials_record_v1_t;
+
+      // histogram of previous boots in NVS; see connect_histogram_t
+      typedef struct
+      {
+            uint8_t version;               // HISTOGRAM_RECORD_VERSION
+            uint8_t reserved[3];           // 0; explicit, so there is no padding in the CRC
+            connect_histogram_t histogram;
+            uint32_t crc;                  // CRC32 of all preceding fields
+      } histogram_record_t;
+
+      static const char *NVS_KEY_HISTOGRAM = "nvs_histogram";
+      static connect_histogram_t s_histogram = {}; // RAM copy of histogram in NVS
+      static bool s_histogram_loaded = false;      // s_histogram is read from NVS
+
+      static const char *NVS_KEY_CREDENTIALS = "nvs_creds";
+      static credentials_record_t s_credentials = {}; // RAM cache of credentials record in NVS
+      static bool s_credentials_loaded = false;       // s_credentials is read from NVS
+
+      // STA config of the network connected to: credentials by the connecting task, by add_network() and
+      // forget_network(); read by the event loop task (roam) and the http server task. Only via _get_wifi_config(),
+      // _set_wifi_config() and _set_wifi_credentials(), which copy it under s_wifi_config_lock
+      static wifi_config_t s_wifi_config = {};
+      static portMUX_TYPE s_wifi_config_lock = portMUX_INITIALIZER_UNLOCKED;
+
+      /**
+       * @brief Copy of the STA config of the network connected to
+       *
+       */
+      static wifi_config_t _get_wifi_config()
+      {
+            portENTER_CRITICAL(&s_wifi_config_lock);
+            wifi_config_t wifi_config = s_wifi_config;
+            portEXIT_CRITICAL(&s_wifi_config_lock);
+            return wifi_config;
+      }
+
+      static void _set_wifi_config(const wifi_config_t &wifi_config)
+      {
+            portENTER_CRITICAL(&s_wifi_config_lock);
+            s_wifi_config = wifi_config;
+            portEXIT_CRITICAL(&s_wifi_config_lock);
+      }
+
+      /**
+       * @brief Set SSID and password of the STA config; the other fields are kept
+       *
+       * @param ssid SSID field, not null terminated when completely filled
+       * @param password password field, idem
+       */
+      static void _set_wifi_credentials(const uint8_t *ssid, const uint8_t *password)
+      {
+            portENTER_CRITICAL(&s_wifi_config_lock);
+            memcpy(s_wifi_config.sta.ssid, ssid, sizeof(s_wifi_config.sta.ssid));
+            memcpy(s_wifi_config.sta.password, password, sizeof(s_wifi_config.sta.password));
+            portEXIT_CRITICAL(&s_wifi_config_lock);
+      }
+
+      /**
+       * @brief CRC of a histogram record, over all fields before the CRC
+       *
+       * @param record histogram record
+       * @return uint32_t CRC
+       */
+      static uint32_t _histogram_record_crc(const histogram_record_t *record)
+      {
+            return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(histogram_record_t, crc));
+      }
+
+      /**
+       * @brief Read the histogram of previous boots from NVS into s_histogram, only on first call; an empty histogram
+       *        when there is none
+       *
+       */
+      static void _load_histogram()
+      {
+            nvs_handle_t nvs_handle;
+            histogram_record_t record;
+            size_t record_size = sizeof(record);
+
+            if (s_histogram_loaded)
             {
-                  _start_soft_AP_mode_and_get_credentials();
+                  return;
             }
-            if (_connect_to_network())
+            s_histogram_loaded = true;
+            s_histogram = {};
+            if (nvs_open("storage", NVS_READONLY, &nvs_handle) != ESP_OK)
             {
-                  ret = true;
-                  _save_credentials(); //@@@
+                  return;
+            }
+            esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_HISTOGRAM, &record, &record_size);
+            nvs_close(nvs_handle);
+            if (err == ESP_OK && record_size == sizeof(record) && record.version == HISTOGRAM_RECORD_VERSION &&
+                record.crc == _histogram_record_crc(&record))
+            {
+                  s_histogram = record.histogram;
+            }
+            else if (err != ESP_ERR_NVS_NOT_FOUND)
+            {
+                  ESP_LOGW(TAG, "histogram in NVS invalid (%s); start new one", esp_err_to_name(err));
             }
-            return ret;
       }
 
       /**
-       * @brief check whether wifi credentials are stored in NVS; when credentials are valid, they are copied in glob_wifi_config
+       * @brief Add a boot to the histogram and write it to NVS; one small write per boot
        *
-       * @return true if wifi credentials are stored in NVS
-       * @return false otherwise
+       * @param connected boot ended with an IP address
        */
-      bool wifi_provisioning::_credentials_stored_in_NVS()
+      static void _update_histogram(bool connected)
       {
-            bool return_value = false;
-            size_t nvs_str_size;
-            nvs_handle_t nvs_handle;
-
-            ESP_LOGD(TAG, "Opening Non-Volatile Storage (NVS) handle... ");
-            esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs_handle);
-            if (err != ESP_OK)
+            _load_histogram();
+            uint32_t total = s_histogram.failures;
+            for (int i = 0; i < CONNECT_HISTOGRAM_BUCKETS; i++)
             {
-                  ESP_LOGE(TAG, "Error (%s) opening NVS handle!\n", esp_err_to_name(err));
-                  return_value = false;
+                  total += s_histogram.retries[i];
             }
-            else
+            if (total >= ESP_METRICS_HISTOGRAM_WINDOW) // decay, so old boots do not dominate
             {
-                  ESP_LOGD(TAG, "Reading SSID from NVS ... ");
-                  err = nvs_get_str(nvs_handle, "nvs_ssid", NULL, &nvs_str_size);
-                  char *ssid = (char *)malloc(nvs_str_size);
-                  err = nvs_get_str(nvs_handle, "nvs_ssid", ssid, &nvs_str_size);
-
-                  switch (err)
+                  for (int i = 0; i < CONNECT_HISTOGRAM_BUCKETS; i++)
                   {
-                  case ESP_OK:
-                        ESP_LOGD(TAG, "NVS_SSID = %s", ssid);
-                        // save read ssid into global wifi_config var
-                        strcpy((char *)glob_wifi_config.sta.ssid, ssid); // C++ does not allow conversion from char[32] to unint8_t[32]
-                        return_value = true;
-                        break;
-                  case ESP_ERR_NVS_NOT_FOUND:
-                        ESP_LOGD(TAG, "SSID is not initialized yet!");
-                        break;
-                  default:
-                        ESP_LOGE(TAG, "Error (%s) reading!", esp_err_to_name(err));
+                        s_histogram.time_to_ip[i] /= 2;
+                        s_histogram.retries[i] /= 2;
                   }
+                  s_histogram.failures /= 2;
+            }
 
-                  err = nvs_get_str(nvs_handle, "nvs_password", NULL, &nvs_str_size);
-                  char *password = (char *)malloc(nvs_str_size);
-                  err = nvs_get_str(nvs_handle, "nvs_password", password, &nvs_str_size);
+            s_histogram.boot_count++;
+            if (connected)
+            {
+                  int bucket = 0;
+                  while (bucket < CONNECT_HISTOGRAM_BUCKETS - 1 && s_metrics.time_to_ip_us >= (250000LL << bucket))
+                  {
+                        bucket++;
+                  }
+                  s_histogram.time_to_ip[bucket]++;
+                  s_histogram.retries[s_metrics.retries < CONNECT_HISTOGRAM_BUCKETS - 1 ? s_metrics.retries : CONNECT_HISTOGRAM_BUCKETS - 1]++;
+            }
+            else
+            {
+                  s_histogram.failures++;
+            }
+            if (!ESP_NVS_PERSISTENCE)
+            {
+                  return;
+            }
 
-                  switch (err)
+            histogram_record_t record = {};
+            record.version = HISTOGRAM_RECORD_VERSION;
+            record.histogram = s_histogram;
+            record.crc = _histogram_record_crc(&record);
+            nvs_handle_t nvs_handle;
+            if (nvs_open("storage", NVS_READWRITE, &nvs_handle) == ESP_OK)
+            {
+                  if (nvs_set_blob(nvs_handle, NVS_KEY_HISTOGRAM, &record, sizeof(record)) == ESP_OK)
                   {
-                  case ESP_OK:
-                        ESP_LOGD(TAG, "nvs_password = %s", password);
-                        // save read password into global wifi_config var
-                        strcpy((char *)glob_wifi_config.sta.password, password); // C++ does not allow conversion from char[32] to unint8_t[32]
-                        return_value = true;
-                        break;
-                  case ESP_ERR_NVS_NOT_FOUND:
-                        ESP_LOGD(TAG, "PASSWORD is not initialized yet!\n");
-                        return_value = false;
-                        break;
-                  default:
-                        ESP_LOGE(TAG, "Error (%s) reading!\n", esp_err_to_name(err));
-                        return_value = false;
+                        nvs_commit(nvs_handle);
                   }
                   nvs_close(nvs_handle);
-                  ESP_LOGI(TAG, "wifi_credentials_stored_in_NVS= %d", return_value);
             }
-            return return_value;
       }
 
       /**
-       * @brief Decode strings from the URL; for instance replace hex codes by ASCII characters (like @)
+       * @brief Create the provisioning event group, when it does not exist yet. It is never deleted, not even by stop(),
+       *        so wait_for_connection() can wait on it at any time; the first caller creates it, as _init_state_machine()
+       *
+       */
+      static void _init_provisioning_event_group()
+      {
+            int init = 0;
+            if (s_provisioning_event_group_init.compare_exchange_strong(init, 1))
+            {
+                  s_provisioning_event_group = xEventGroupCreateStatic(&s_provisioning_event_group_buffer);
+                  s_provisioning_event_group_init = 2;
+            }
+            while (s_provisioning_event_group_init != 2)
+            {
+                  vTaskDelay(1); // another task creates it
+            }
+      }
+
+      /**
+       * @brief CRC of the RTC context, over all fields before the CRC
+       *
+       * @return uint32_t CRC
+       */
+#if ESP_RTC_WARM_START
+      static uint32_t _rtc_context_crc()
+      {
+            return esp_rom_crc32_le(0, (const uint8_t *)&s_rtc_context, offsetof(rtc_context_t, crc));
+      }
+#endif
+
+      /**
+       * @brief On a wake from deep sleep with a valid RTC context, copy its credentials in the STA config, so
+       *        connect_to_network() does not have to read NVS
+       *
+       * @return true when the RTC context is used for this connect
+       */
+      static bool _load_rtc_context()
+      {
+#if ESP_RTC_WARM_START
+            if (esp_reset_reason() != ESP_RST_DEEPSLEEP || s_rtc_context.version != RTC_CONTEXT_VERSION ||
+                s_rtc_context.crc != _rtc_context_crc())
+            {
+                  return false;
+            }
+            _set_wifi_credentials(s_rtc_context.fast_reconnect.ssid, s_rtc_context.password);
+            s_metrics.previous_radio_on_us = s_rtc_context.radio_on_us;
+            ESP_LOGI(TAG, "warm start from RTC context; previous wake radio on %lld ms", s_rtc_context.radio_on_us / 1000);
+            return true;
+#else
+            return false;
+#endif
+      }
+
+      /**
+       * @brief Name of a state, for logging
+       *
+       * @param state state
+       * @return name
+       */
+      static const char *_state_name(provisioning_state_t state)
+      {
+            static const char *const names[] = {"IDLE", "PORTAL", "CONNECTING", "CONNECTED", "BACKOFF", "FAILED"};
+            return state < sizeof(names) / sizeof(names[0]) ? names[state] : "?";
+      }
+
+      /**
+       * @brief Create the state event group; it is never deleted, so a task can wait on it at any time. The first caller
+       *        creates it; a compare-and-swap instead of s_state_lock, since FreeRTOS may not be called in a critical section
+       *
+       */
+      static void _init_state_machine()
+      {
+            int init = 0;
+            if (s_state_event_group_init.compare_exchange_strong(init, 1))
+            {
+                  s_state_event_group = xEventGroupCreateStatic(&s_state_event_group_buffer);
+                  xEventGroupSetBits(s_state_event_group, PROVISIONING_STATE_BIT(s_state.load()));
+                  s_state_event_group_init = 2;
+            }
+            while (s_state_event_group_init != 2)
+            {
+                  vTaskDelay(1); // another task creates it
+            }
+      }
+
+      /**
+       * @brief Change the state, atomically, when the current state is in from_states and the transition is in
+       *        s_state_transitions. Then the bit of the new state is published in s_state_event_group, and the
+       *        subscribers are called. Can be called from any task
        *
-       * @param dst destination with 'normal' characters
-       * @param src sourcing URL string possible hex encoded special characters
+       * @param state new state
+       * @param from_states mask of states the transition is done from; default: every state the table allows
+       * @return true when the state is changed, or already was state
        */
-      void urldecode2(char *dst, const char *src)
+      static bool _set_state(provisioning_state_t state, uint32_t from_states = PROVISIONING_STATE_ALL)
       {
-            char a, b;
-            while (*src)
+            provisioning_state_t old_state = s_state.load();
+            do
             {
-                  if ((*src == '%') &&
-                      ((a = src[1]) && (b = src[2])) &&
-                      (isxdigit(a) && isxdigit(b)))
+                  if (old_state == state)
                   {
-                        if (a >= 'a')
-                              a -= 'a' - 'A';
-                        if (a >= 'A')
-                              a -= ('A' - 10);
-                        else
-                              a -= '0';
-                        if (b >= 'a')
-                              b -= 'a' - 'A';
-                        if (b >= 'A')
-                              b -= ('A' - 10);
-                        else
-                              b -= '0';
-                        *dst++ = 16 * a + b;
-                        src += 3;
+                        return true;
                   }
-                  else if (*src == '+')
+                  if (!(PROVISIONING_STATE_BIT(old_state) & from_states & s_state_transitions[state]))
                   {
-                        *dst++ = ' ';
-                        src++;
+                        ESP_LOGD(TAG, "state %s -> %s refused", _state_name(old_state), _state_name(state));
+                        return false;
                   }
-                  else
+            } while (!s_state.compare_exchange_weak(old_state, state));
+            ESP_LOGI(TAG, "state %s -> %s", _state_name(old_state), _state_name(state));
+
+            // publish the state that is current after the bits are set; another task may have changed it meanwhile
+            provisioning_state_t published;
+            do
+            {
+                  published = s_state.load();
+                  xEventGroupClearBits(s_state_event_group, PROVISIONING_STATE_ALL & ~PROVISIONING_STATE_BIT(published));
+                  xEventGroupSetBits(s_state_event_group, PROVISIONING_STATE_BIT(published));
+            } while (published != s_state.load());
+
+            state_subscriber_t subscribers[ESP_STATE_MAXIMUM_SUBSCRIBERS];
+            portENTER_CRITICAL(&s_state_lock); // copy, so callbacks are called without the lock
+            memcpy(subscribers, s_state_subscribers, sizeof(subscribers));
+            portEXIT_CRITICAL(&s_state_lock);
+            for (int i = 0; i < ESP_STATE_MAXIMUM_SUBSCRIBERS; i++)
+            {
+                  if (subscribers[i].callback != NULL)
                   {
-                        *dst++ = *src++;
+                        subscribers[i].callback(old_state, state, subscribers[i].arg);
                   }
             }
-            *dst++ = '\0';
+            return true;
+      }
+
+      // Constructor
+      wifi_provisioning::wifi_provisioning()
+      {
+            ESP_LOGI(TAG, "Constructor");
+            s_metrics.constructor_us = esp_timer_get_time();
+            valid_wifi_credentials_in_NVS = true;
+            async_portal_timeout_ms = 0;
+            async_callback = NULL;
+            async_callback_arg = NULL;
+            _init_provisioning_event_group();
+            _init_state_machine();
+      } // Constructor
+
+      bool wifi_provisioning::connect_to_network()
+      {
+            return connect_to_network(0) == PROVISIONING_CONNECTED;
+      }
+
+      provisioning_status_t wifi_provisioning::connect_to_network(uint32_t portal_timeout_ms)
+      {
+            // same compare-and-swap as connect_to_network_async(): only one connect drives the driver and event groups
+            provisioning_status_t status = s_status.load();
+            if (status == PROVISIONING_IN_PROGRESS || !s_status.compare_exchange_strong(status, PROVISIONING_IN_PROGRESS))
+            {
+                  ESP_LOGW(TAG, "connect_to_network() refused; another connect is busy");
+                  return PROVISIONING_CONNECT_FAILED;
+            }
+            return _connect(portal_timeout_ms);
       }
 
       /**
-       * @brief Ask for wifi credentials, and/or handle them and put them in global glob_wifi_config
+       * @brief Body of connect_to_network(); s_status is PROVISIONING_IN_PROGRESS already, set by the caller
        *
-       * @param req HTML request
-       * @return esp_err_t
+       * @param portal_timeout_ms maximum time to wait for credentials via captive portal; 0 means wait forever
+       * @return provisioning_status_t
        */
-      esp_err_t wifi_provisioning::setWifiParams(httpd_req_t *req)
+      provisioning_status_t wifi_provisioning::_connect(uint32_t portal_timeout_ms)
       {
-            ESP_LOGI(TAG, "setWifiParams");
-            // present page for requesting wifi credentials
-            httpd_resp_send(req, (const char *)index_html_start, index_html_end - index_html_start);
-
-            char *buf;
-            size_t buf_len;
-
-            /* Read URL query string length and allocate memory for length + 1,
-             * extra byte for null termination */
-            buf_len = httpd_req_get_url_query_len(req) + 1;
-            if (buf_len > 1)
-            {
-                  buf = (char *)malloc(buf_len);
-                  if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK)
-                  {
-                        ESP_LOGI(TAG, "Found URL query => %s", buf);
-                        char urlpart[32];
-                        char ssid[32];
-                        char passkey[32];
-                        // Get value of expected key from query string
-                        if (httpd_query_key_value(buf, "ssid", urlpart, sizeof(urlpart)) == ESP_OK)
-                        {
-                              urldecode2(ssid, urlpart);
-                              ESP_LOGI(TAG, "Found network SSID =%s", ssid);
-                              strcpy((char *)glob_wifi_config.sta.ssid, ssid); // C++ does not allow conversion from char[32] to unint8_t[32]
-                        }
-                        if (httpd_query_key_value(buf, "passkey", urlpart, sizeof(urlpart)) == ESP_OK)
-                        {
-                              urldecode2(passkey, urlpart);
-                              ESP_LOGI(TAG, "Found network PASSKEY =%s", passkey);
-                              strcpy((char *)glob_wifi_config.sta.password, passkey); // C++ does not allow conversion from char[32] to unint8_t[32]
-                        }
-                        wifi_provisioning::network_credentials_sta_set = true;
+            provisioning_status_t ret = PROVISIONING_CONNECT_FAILED;
+            ESP_LOGI(TAG, "METHOD Connect_to_network");
+            // reconnect forever again only after this connect succeeds; until then every connect attempt of this call must
+            // be able to fail, or _connect_to_known_network() waits forever for a network that is out of reach
+            s_reconnect_forever = false;
+            if (s_reconnect_timer != NULL)
+            {
+                  esp_timer_stop(s_reconnect_timer); // no reconnect of the previous connection in the middle of this one
+            }
+            _init_provisioning_event_group();
+            _init_state_machine();
+            xEventGroupClearBits(s_provisioning_event_group, CONNECT_DONE_BIT);
+            s_metrics = {s_metrics.constructor_us, esp_timer_get_time()};
+            uint32_t heap_free_at_start = esp_get_free_heap_size();
+
+            int64_t phase_start_us = esp_timer_get_time();
+            s_warm_start = _load_rtc_context(); // wake from deep sleep: credentials, AP and lease from RTC memory
+            bool credentials_stored = s_warm_start || _credentials_stored_in_NVS();
+            s_metrics.nvs_read_us = esp_timer_get_time() - phase_start_us;
+            bool connected = false;
+            bool portal_used = false;
+            s_known_network_visible = false;
+            if (credentials_stored)
+            {
+                  _set_state(PROVISIONING_STATE_CONNECTING);
+                  connected = _connect_to_network();
+            }
+#if ESP_PORTAL
+            // no credentials, or none of the known networks connects: ask for credentials via the captive portal. When
+            // no known network was in reach, one that shows up in the background scan closes the portal and is tried again.
+            // portal_timeout_ms limits the time the portal is open in total
+            while (!connected && (portal_timeout_ms == 0 || s_metrics.portal_us < portal_timeout_ms * 1000LL))
+            {
+                  int64_t portal_start_us = esp_timer_get_time();
+                  if (credentials_stored || portal_used)
+                  {
+                        ESP_LOGW(TAG, "no known network connects; start captive portal");
+                        esp_wifi_stop(); // STA of the failed connect; the portal starts the wifi in APSTA mode
+                  }
+                  uint32_t remaining_ms = portal_timeout_ms == 0 ? 0 : (portal_timeout_ms * 1000LL - s_metrics.portal_us + 999) / 1000;
+                  s_watch_known_networks = credentials_stored && !s_known_network_visible;
+                  bool credentials_set = _start_soft_AP_mode_and_get_credentials(remaining_ms);
+                  s_watch_known_networks = false;
+                  portal_used = true;
+                  s_metrics.portal_us += esp_timer_get_time() - portal_start_us;
+                  if (!credentials_set && !(xEventGroupGetBits(s_provisioning_event_group) & KNOWN_NETWORK_VISIBLE_BIT))
+                  {
+                        break;
                   }
-                  free(buf);
+                  _set_state(PROVISIONING_STATE_CONNECTING);
+                  connected = _connect_to_network();
             }
-            return ESP_OK;
+            if (!connected && !credentials_stored)
+            {
+                  ret = PROVISIONING_TIMED_OUT;
+            }
+#else
+            if (!credentials_stored)
+            {
+                  ESP_LOGE(TAG, "no wifi credentials in NVS, and captive portal disabled in menuconfig");
+            }
+#endif
+            if (connected)
+            {
+                  ret = PROVISIONING_CONNECTED;
+                  s_reconnect_forever = true; // from now on, restore the connection after every disconnect
+                  if (!s_warm_start || portal_used) // credentials from the RTC context are in NVS already
+                  {
+                        _save_credentials();
+                  }
+            }
+            s_metrics.heap_used = (int32_t)(heap_free_at_start - esp_get_free_heap_size());
+            s_metrics.heap_minimum_free = esp_get_minimum_free_heap_size();
+            if (ret == PROVISIONING_CONNECTED)
+            {
+                  s_metrics.got_ip_us = s_got_ip_us;
+                  s_metrics.time_to_ip_us = s_got_ip_us - s_metrics.connect_start_us;
+                  s_metrics.radio_on_us = s_got_ip_us - s_radio_on_start_us;
+            }
+            s_metrics.warm_start = s_warm_start;
+            ESP_LOGI(TAG, "phases (ms): NVS %lld, init %lld, portal %lld, start %lld, scan %lld, association %lld, DHCP %lld, "
+                          "time-to-IP %lld, retries %lu",
+                     s_metrics.nvs_read_us / 1000, s_metrics.stack_init_us / 1000, s_metrics.portal_us / 1000,
+                     s_metrics.wifi_start_us / 1000, s_metrics.scan_us / 1000, s_metrics.association_us / 1000,
+                     s_metrics.dhcp_us / 1000, s_metrics.time_to_ip_us / 1000, (unsigned long)s_metrics.retries);
+            ESP_LOGI(TAG, "heap: %ld bytes used, minimum free since boot %lu bytes",
+                     (long)s_metrics.heap_used, (unsigned long)s_metrics.heap_minimum_free);
+            ESP_LOGI(TAG, "radio on %lld ms until IP address%s", s_metrics.radio_on_us / 1000, s_warm_start ? " (warm start)" : "");
+            if (credentials_stored && !s_warm_start) // portal time depends on the user, not on the site; a warm start does not touch NVS
+            {
+                  _update_histogram(connected && !portal_used);
+            }
+            _set_state(ret == PROVISIONING_CONNECTED ? PROVISIONING_STATE_CONNECTED : PROVISIONING_STATE_FAILED);
+            s_status = ret;
+            xEventGroupSetBits(s_provisioning_event_group, CONNECT_DONE_BIT);
+            return ret;
       }
 
       /**
-       * @brief event handler, handling both soft_AP and STAT mode
+       * @brief Task of connect_to_network_async()
        *
-       * @param arg not used
-       * @param event_base type of event
-       * @param event_id Id of event to be handled
-       * @param event_data Data belonging to Id
+       * @param arg wifi_provisioning object
        */
-      static void wifi_event_handler(void *arg, esp_event_base_t event_base,
-                                     int32_t event_id, void *event_data)
+      void wifi_provisioning::_connect_task(void *arg)
       {
-            if (event_id == WIFI_EVENT_AP_STACONNECTED)
-            { // softAP
-                  wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
-                  ESP_LOGI(TAG, "station " MACSTR " join, AID=%d",
-                           MAC2STR(event->mac), event->aid);
+            wifi_provisioning *self = (wifi_provisioning *)arg;
+            provisioning_status_t status = self->_connect(self->async_portal_timeout_ms); // IN_PROGRESS set by connect_to_network_async()
+            if (self->async_callback != NULL)
+            {
+                  self->async_callback(status, self->async_callback_arg);
+            }
+            ESP_LOGD(TAG, "connect task: %lu bytes of stack never used", (unsigned long)uxTaskGetStackHighWaterMark(NULL));
+            vTaskDelete(NULL);
+      }
+
+      esp_err_t wifi_provisioning::connect_to_network_async(uint32_t portal_timeout_ms, connect_callback_t callback, void *arg)
+      {
+            // IN_PROGRESS before the task runs, so get_status() and wait_for_connection() are right immediately; with
+            // compare-and-swap, so two tasks calling this at the same moment do not both start a connect task
+            provisioning_status_t status = s_status.load();
+            if (status == PROVISIONING_IN_PROGRESS || !s_status.compare_exchange_strong(status, PROVISIONING_IN_PROGRESS))
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            async_portal_timeout_ms = portal_timeout_ms;
+            async_callback = callback;
+            async_callback_arg = arg;
+            _init_provisioning_event_group();
+            xEventGroupClearBits(s_provisioning_event_group, CONNECT_DONE_BIT);
+            if (xTaskCreate(_connect_task, "wifi_connect", ESP_CONNECT_TASK_STACK_SIZE, this, ESP_CONNECT_TASK_PRIORITY, NULL) != pdPASS)
+            {
+                  s_status = PROVISIONING_NOT_STARTED;
+                  return ESP_ERR_NO_MEM;
+            }
+            return ESP_OK;
+      }
+
+      provisioning_status_t wifi_provisioning::wait_for_connection(TickType_t timeout)
+      {
+            if (s_status == PROVISIONING_NOT_STARTED)
+            {
+                  return PROVISIONING_NOT_STARTED;
+            }
+            xEventGroupWaitBits(s_provisioning_event_group, CONNECT_DONE_BIT, pdFALSE, pdFALSE, timeout);
+            return s_status;
+      }
+
+      provisioning_status_t wifi_provisioning::get_status()
+      {
+            return s_status;
+      }
+
+      provisioning_state_t wifi_provisioning::get_state()
+      {
+            return s_state.load();
+      }
+
+      provisioning_state_t wifi_provisioning::wait_for_state(uint32_t states, TickType_t timeout)
+      {
+            _init_state_machine();
+            xEventGroupWaitBits(s_state_event_group, states & PROVISIONING_STATE_ALL, pdFALSE, pdFALSE, timeout);
+            return s_state.load();
+      }
+
+      esp_err_t wifi_provisioning::subscribe_state_changes(state_callback_t callback, void *arg)
+      {
+            esp_err_t err = ESP_ERR_NO_MEM;
+            portENTER_CRITICAL(&s_state_lock);
+            for (int i = 0; i < ESP_STATE_MAXIMUM_SUBSCRIBERS && err != ESP_OK; i++)
+            {
+                  if (s_state_subscribers[i].callback == NULL)
+                  {
+                        s_state_subscribers[i] = {callback, arg};
+                        err = ESP_OK;
+                  }
+            }
+            portEXIT_CRITICAL(&s_state_lock);
+            return err;
+      }
+
+      esp_err_t wifi_provisioning::unsubscribe_state_changes(state_callback_t callback, void *arg)
+      {
+            esp_err_t err = ESP_ERR_NOT_FOUND;
+            portENTER_CRITICAL(&s_state_lock);
+            for (int i = 0; i < ESP_STATE_MAXIMUM_SUBSCRIBERS && err != ESP_OK; i++)
+            {
+                  if (s_state_subscribers[i].callback == callback && s_state_subscribers[i].arg == arg)
+                  {
+                        s_state_subscribers[i] = {NULL, NULL};
+                        err = ESP_OK;
+                  }
+            }
+            portEXIT_CRITICAL(&s_state_lock);
+            return err;
+      }
+
+      void wifi_provisioning::set_reconnect_config(const reconnect_config_t &config)
+      {
+            s_reconnect_config = config;
+            if (s_reconnect_config.multiplier < 1)
+            {
+                  s_reconnect_config.multiplier = 1;
+            }
+      }
+
+      reconnect_status_t wifi_provisioning::get_reconnect_status()
+      {
+            portENTER_CRITICAL(&s_reconnect_lock);
+            reconnect_status_t status = s_reconnect_status;
+            portEXIT_CRITICAL(&s_reconnect_lock);
+            return status;
+      }
+
+      void wifi_provisioning::set_static_ip(const esp_netif_ip_info_t *ip_info, const esp_ip4_addr_t *dns)
+      {
+            s_static_ip_set = ip_info != NULL;
+            s_static_ip_info = ip_info != NULL ? *ip_info : esp_netif_ip_info_t{};
+            s_static_dns = dns != NULL ? *dns : esp_ip4_addr_t{};
+      }
+
+      connect_metrics_t wifi_provisioning::get_metrics()
+      {
+            return s_metrics;
+      }
+
+      connect_histogram_t wifi_provisioning::get_histogram()
+      {
+            _load_histogram();
+            return s_histogram;
+      }
+
+      /**
+       * @brief CRC of a credentials record, over all fields before the CRC
+       *
+       * @param record credentials record
+       * @return uint32_t CRC
+       */
+      static uint32_t _credentials_record_crc(const credentials_record_t *record)
+      {
+            return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(credentials_record_t, crc));
+      }
+
+      /**
+       * @brief Find a network in the credentials record
+       *
+       * @param record credentials record
+       * @param ssid SSID of the network
+       * @return network entry, or NULL if the network is not known
+       */
+      static network_entry_t *_find_network(credentials_record_t *record, const uint8_t *ssid)
+      {
+            for (int i = 0; i < record->count; i++)
+            {
+                  if (memcmp(record->networks[i].ssid, ssid, sizeof(record->networks[i].ssid)) == 0)
+                  {
+                        return &record->networks[i];
+                  }
+            }
+            return NULL;
+      }
+
+      /**
+       * @brief Network the ESP connected to most recently
+       *
+       * @param record credentials record
+       * @return network entry, or NULL if no networks are known
+       */
+      static network_entry_t *_most_recent_network(credentials_record_t *record)
+      {
+            network_entry_t *most_recent = NULL;
+            for (int i = 0; i < record->count; i++)
+            {
+                  if (most_recent == NULL || record->networks[i].last_success_seq > most_recent->last_success_seq)
+                  {
+                        most_recent = &record->networks[i];
+                  }
+            }
+            return most_recent;
+      }
+
+      /**
+       * @brief Add a network to the credentials record, or update its password. When the record is full,
+       *        the least recently used network is replaced
+       *
+       * @param record credentials record
+       * @param ssid SSID of the network
+       * @param password password of the network
+       * @param connected the ESP just connected to the network: it becomes the most recent one. Otherwise a new
+       *                  network ranks below all networks that were ever connected to, and a known one keeps its rank
+       */
+      static void _add_network(credentials_record_t *record, const uint8_t *ssid, const uint8_t *password, bool connected)
+      {
+            network_entry_t *network = _find_network(record, ssid);
+            if (network == NULL && record->count < ESP_MAXIMUM_NETWORKS)
+            {
+                  network = &record->networks[record->count++];
+            }
+            else if (network == NULL)
+            {
+                  network = &record->networks[0];
+                  for (int i = 1; i < record->count; i++)
+                  {
+                        if (record->networks[i].last_success_seq < network->last_success_seq)
+                        {
+                              network = &record->networks[i];
+                        }
+                  }
+                  ESP_LOGI(TAG, "forget least recently used network %.32s", (const char *)network->ssid);
+            }
+            bool known = memcmp(network->ssid, ssid, sizeof(network->ssid)) == 0;
+            memcpy(network->ssid, ssid, sizeof(network->ssid));
+            memcpy(network->password, password, sizeof(network->password));
+            if (connected)
+            {
+                  network->last_success_seq = ++record->success_seq;
+            }
+            else if (!known)
+            {
+                  network->last_success_seq = 0;
+            }
+      }
+
+      /**
+       * @brief Remove a network from the credentials record; the networks after it move up
+       *
+       * @param record credentials record
+       * @param network network entry in record
+       */
+      static void _remove_network(credentials_record_t *record, network_entry_t *network)
+      {
+            int index = network - record->networks;
+            memmove(&record->networks[index], &record->networks[index + 1], (record->count - index - 1) * sizeof(network_entry_t));
+            record->count--;
+            memset(&record->networks[record->count], 0, sizeof(network_entry_t));
+      }
+
+      /**
+       * @brief Read the credentials from the old formats: one string per field (nvs_ssid, nvs_password), or record
+       *        version 1 with one network
+       *
+       * @param nvs_handle opened NVS handle
+       * @param record record to fill
+       * @return true if credentials in an old format are found
+       */
+      static bool _read_old_format_credentials(nvs_handle_t nvs_handle, credentials_record_t *record)
+      {
+            credentials_record_v1_t record_v1 = {};
+            size_t record_v1_size = sizeof(record_v1);
+            size_t ssid_size = sizeof(record_v1.ssid) + 1;
+            size_t password_size = sizeof(record_v1.password) + 1;
+            char ssid[sizeof(record_v1.ssid) + 1] = {};
+            char password[sizeof(record_v1.password) + 1] = {};
+
+            if (nvs_get_blob(nvs_handle, NVS_KEY_CREDENTIALS, &record_v1, &record_v1_size) == ESP_OK)
+            {
+                  if (record_v1_size != sizeof(record_v1) || record_v1.version != 1 ||
+                      record_v1.crc != esp_rom_crc32_le(0, (const uint8_t *)&record_v1, offsetof(credentials_record_v1_t, crc)))
+                  {
+                        return false;
+                  }
+                  memcpy(ssid, record_v1.ssid, sizeof(record_v1.ssid));
+                  memcpy(password, record_v1.password, sizeof(record_v1.password));
+            }
+            else if (nvs_get_str(nvs_handle, "nvs_ssid", ssid, &ssid_size) != ESP_OK ||
+                     nvs_get_str(nvs_handle, "nvs_password", password, &password_size) != ESP_OK)
+            {
+                  return false;
+            }
+            memset(record, 0, sizeof(credentials_record_t));
+            record->version = CREDENTIALS_RECORD_VERSION;
+            _add_network(record, (const uint8_t *)ssid, (const uint8_t *)password, true);
+            record->crc = _credentials_record_crc(record);
+            return true;
+      }
+
+      /**
+       * @brief Load the credentials record from NVS into the RAM cache s_credentials, only on first call.
+       *        Credentials stored in an old format are migrated to the current record version
+       *
+       */
+      static void _load_credentials_record()
+      {
+            nvs_handle_t nvs_handle;
+            size_t record_size = sizeof(credentials_record_t);
+
+            if (s_credentials_loaded)
+            {
+                  return;
+            }
+            s_credentials_loaded = true;
+            memset(&s_credentials, 0, sizeof(s_credentials));
+            s_credentials.version = CREDENTIALS_RECORD_VERSION;
+
+            ESP_LOGD(TAG, "Opening Non-Volatile Storage (NVS) handle... ");
+            esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs_handle);
+            if (err != ESP_OK)
+            {
+                  ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+                  return;
+            }
+            credentials_record_t record;
+            err = nvs_get_blob(nvs_handle, NVS_KEY_CREDENTIALS, &record, &record_size);
+            if (err == ESP_OK && record_size == sizeof(credentials_record_t) &&
+                record.version == CREDENTIALS_RECORD_VERSION && record.count <= ESP_MAXIMUM_NETWORKS &&
+                record.crc == _credentials_record_crc(&record))
+            {
+                  s_credentials = record;
+            }
+            else if (_read_old_format_credentials(nvs_handle, &record))
+            {
+                  ESP_LOGI(TAG, "migrate credentials in NVS to record version %d", CREDENTIALS_RECORD_VERSION);
+                  if (ESP_NVS_PERSISTENCE && nvs_set_blob(nvs_handle, NVS_KEY_CREDENTIALS, &record, sizeof(credentials_record_t)) == ESP_OK)
+                  {
+                        nvs_erase_key(nvs_handle, "nvs_ssid");
+                        nvs_erase_key(nvs_handle, "nvs_password");
+                        nvs_commit(nvs_handle);
+                  }
+                  s_credentials = record;
+            }
+            else if (err != ESP_ERR_NVS_NOT_FOUND)
+            {
+                  ESP_LOGE(TAG, "credentials record in NVS is invalid (%s); ignored", esp_err_to_name(err));
+            }
+            nvs_close(nvs_handle);
+            ESP_LOGI(TAG, "%d wifi networks known", s_credentials.count);
+      }
+
+      /**
+       * @brief Write a credentials record to NVS, and make it the RAM cache s_credentials. Without NVS persistence only
+       *        the RAM cache is changed; the networks are then known until reboot
+       *
+       * @param record credentials record; its CRC is set
+       * @return esp_err_t
+       */
+      static esp_err_t _write_credentials_record(credentials_record_t *record)
+      {
+            nvs_handle_t nvs_handle;
+
+            record->crc = _credentials_record_crc(record);
+            if (!ESP_NVS_PERSISTENCE)
+            {
+                  s_credentials = *record;
+                  return ESP_OK;
+            }
+
+            ESP_LOGI(TAG, "save wifi credentials to NVS");
+            esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs_handle);
+            if (err != ESP_OK)
+            {
+                  ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+                  return err;
+            }
+            err = nvs_set_blob(nvs_handle, NVS_KEY_CREDENTIALS, record, sizeof(*record));
+            if (err == ESP_OK)
+            {
+                  err = nvs_commit(nvs_handle);
+            }
+            nvs_close(nvs_handle);
+            if (err == ESP_OK)
+            {
+                  s_credentials = *record;
+            }
+            else
+            {
+                  ESP_LOGE(TAG, "Error (%s) saving credentials!", esp_err_to_name(err));
+            }
+            return err;
+      }
+
+      /**
+       * @brief check whether wifi credentials are stored in NVS; when credentials are valid, those of the most recently
+       *        used network are copied in the STA config.
+       *        NVS is only read on the first call; after that the credentials come from the RAM cache
+       *
+       * @return true if wifi credentials are stored in NVS
+       * @return false otherwise
+       */
+      bool wifi_provisioning::_credentials_stored_in_NVS()
+      {
+            _load_credentials_record();
+            network_entry_t *network = _most_recent_network(&s_credentials);
+            if (network != NULL)
+            {
+                  _set_wifi_credentials(network->ssid, network->password);
+            }
+            ESP_LOGD(TAG, "wifi_credentials_stored_in_NVS= %d", network != NULL);
+            return network != NULL;
+      }
+
+      /**
+       * @brief Read the fast-reconnect record from NVS
+       *
+       * @param record read record
+       * @return true if a record for the SSID of the STA config is stored in NVS
+       */
+      static bool _load_fast_reconnect_record(fast_reconnect_record_t *record)
+      {
+            nvs_handle_t nvs_handle;
+            size_t record_size = sizeof(fast_reconnect_record_t);
+
+            if (nvs_open("storage", NVS_READONLY, &nvs_handle) != ESP_OK)
+            {
+                  return false;
+            }
+            esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_FAST_RECONNECT, record, &record_size);
+            nvs_close(nvs_handle);
+            if (err != ESP_OK || record_size != sizeof(fast_reconnect_record_t))
+            {
+                  ESP_LOGD(TAG, "no fast-reconnect record in NVS (%s)", esp_err_to_name(err));
+                  return false;
+            }
+            if (memcmp(record->ssid, _get_wifi_config().sta.ssid, sizeof(record->ssid)) != 0)
+            {
+                  ESP_LOGI(TAG, "fast-reconnect record belongs to other SSID; ignored");
+                  return false;
+            }
+            return true;
+      }
+
+      /**
+       * @brief Fill a fast-reconnect record with the BSSID, channel and authmode of the AP we are connected to, and the PMK
+       *
+       * @param cold_time_to_ip_us time-to-IP of the connection without fast-reconnect record
+       * @param result record to fill
+       * @return true when the record is filled
+       */
+      static bool _make_fast_reconnect_record(int64_t cold_time_to_ip_us, fast_reconnect_record_t *result)
+      {
+            wifi_ap_record_t ap_info;
+            fast_reconnect_record_t record = {};
+
+            if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+            {
+                  ESP_LOGE(TAG, "could not get AP info; no fast-reconnect record");
+                  return false;
+            }
+            wifi_config_t wifi_config = _get_wifi_config();
+            memcpy(record.ssid, wifi_config.sta.ssid, sizeof(record.ssid));
+            memcpy(record.bssid, ap_info.bssid, sizeof(record.bssid));
+            record.channel = ap_info.primary;
+            record.authmode = ap_info.authmode;
+            record.cold_time_to_ip_us = cold_time_to_ip_us;
+
+            // PMK = PBKDF2-HMAC-SHA1(passphrase, SSID, 4096 iterations, 32 bytes); this is what the driver computes on every connect
+            const char *passphrase = (const char *)wifi_config.sta.password;
+            const uint8_t *ssid = wifi_config.sta.ssid;
+            if (mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA1,
+                                              (const unsigned char *)passphrase, strnlen(passphrase, sizeof(wifi_config.sta.password)),
+                                              ssid, strnlen((const char *)ssid, sizeof(wifi_config.sta.ssid)),
+                                              4096, sizeof(record.pmk), record.pmk) != 0)
+            {
+                  ESP_LOGE(TAG, "PMK derivation failed; no fast-reconnect record");
+                  return false;
+            }
+            *result = record;
+            return true;
+      }
+
+      /**
+       * @brief Save the fast-reconnect record in NVS. Nothing is written when an identical record is already stored
+       *
+       * @param record fast-reconnect record of the AP we are connected to
+       */
+      static void _save_fast_reconnect_record(const fast_reconnect_record_t *record)
+      {
+            fast_reconnect_record_t stored_record;
+
+            if (!ESP_NVS_PERSISTENCE) // the record is only of use after a reboot
+            {
+                  return;
+            }
+            if (_load_fast_reconnect_record(&stored_record) &&
+                memcmp(stored_record.bssid, record->bssid, sizeof(record->bssid)) == 0 &&
+                stored_record.channel == record->channel &&
+                stored_record.authmode == record->authmode &&
+                memcmp(stored_record.pmk, record->pmk, sizeof(record->pmk)) == 0)
+            {
+                  ESP_LOGD(TAG, "fast-reconnect record unchanged");
+                  return;
+            }
+
+            nvs_handle_t nvs_handle;
+            if (nvs_open("storage", NVS_READWRITE, &nvs_handle) == ESP_OK)
+            {
+                  if (nvs_set_blob(nvs_handle, NVS_KEY_FAST_RECONNECT, record, sizeof(*record)) == ESP_OK)
+                  {
+                        nvs_commit(nvs_handle);
+                        ESP_LOGI(TAG, "fast-reconnect record saved; BSSID:" MACSTR " channel:%d", MAC2STR(record->bssid), record->channel);
+                  }
+                  nvs_close(nvs_handle);
+            }
+      }
+
+      /**
+       * @brief Remove the fast-reconnect record from NVS, for instance when the AP moved to another channel
+       *
+       */
+      static void _erase_fast_reconnect_record()
+      {
+            nvs_handle_t nvs_handle;
+            if (ESP_NVS_PERSISTENCE && nvs_open("storage", NVS_READWRITE, &nvs_handle) == ESP_OK)
+            {
+                  if (nvs_erase_key(nvs_handle, NVS_KEY_FAST_RECONNECT) == ESP_OK)
+                  {
+                        nvs_commit(nvs_handle);
+                  }
+                  nvs_close(nvs_handle);
+            }
+      }
+
+      /**
+       * @brief Fill the STA config for a directed, scan-free connect; for WPA/WPA2-PSK the PMK is passed as 64 hex digits
+       *        in the password field, so the driver does not have to derive it from the passphrase. SAE (WPA3) does not
+       *        use a PSK, so then the passphrase is kept
+       *
+       * @param record fast-reconnect record
+       * @param wifi_config STA config to fill; SSID and PMF settings are copied from the STA config
+       */
+      static void _fast_reconnect_config(const fast_reconnect_record_t *record, wifi_config_t *wifi_config)
+      {
+            static const char hex_digits[] = "0123456789abcdef";
+
+            *wifi_config = _get_wifi_config();
+            if (record->authmode == WIFI_AUTH_WPA_PSK ||
+                record->authmode == WIFI_AUTH_WPA2_PSK ||
+                record->authmode == WIFI_AUTH_WPA_WPA2_PSK)
+            {
+                  for (size_t i = 0; i < sizeof(record->pmk); i++)
+                  {
+                        wifi_config->sta.password[2 * i] = hex_digits[record->pmk[i] >> 4];
+                        wifi_config->sta.password[2 * i + 1] = hex_digits[record->pmk[i] & 0x0f];
+                  }
+            }
+            wifi_config->sta.bssid_set = true;
+            memcpy(wifi_config->sta.bssid, record->bssid, sizeof(record->bssid));
+            wifi_config->sta.channel = record->channel;
+            wifi_config->sta.scan_method = WIFI_FAST_SCAN;
+            wifi_config->sta.threshold.authmode = (wifi_auth_mode_t)record->authmode;
+      }
+
+      /**
+       * @brief Read the cached DHCP lease from NVS
+       *
+       * @param record read record
+       * @return true if a lease is stored in NVS
+       */
+      static bool _load_dhcp_lease(dhcp_lease_record_t *record)
+      {
+            nvs_handle_t nvs_handle;
+            size_t record_size = sizeof(dhcp_lease_record_t);
+
+            if (nvs_open("storage", NVS_READONLY, &nvs_handle) != ESP_OK)
+            {
+                  return false;
+            }
+            esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_DHCP_LEASE, record, &record_size);
+            nvs_close(nvs_handle);
+            return err == ESP_OK && record_size == sizeof(dhcp_lease_record_t);
+      }
+
+      /**
+       * @brief CRC of a station config record, over all fields before the CRC
+       *
+       * @param record station config record
+       * @return uint32_t CRC
+       */
+      static uint32_t _station_config_record_crc(const station_config_record_t *record)
+      {
+            return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(station_config_record_t, crc));
+      }
+
+      /**
+       * @brief Read the hostname and static IP stored by the provisioning API from NVS
+       *
+       * @param record read record
+       * @return true if a valid record is stored in NVS
+       */
+      static bool _load_station_config(station_config_record_t *record)
+      {
+            nvs_handle_t nvs_handle;
+            size_t record_size = sizeof(station_config_record_t);
+
+            if (nvs_open("storage", NVS_READONLY, &nvs_handle) != ESP_OK)
+            {
+                  return false;
+            }
+            esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_STATION_CONFIG, record, &record_size);
+            nvs_close(nvs_handle);
+            return err == ESP_OK && record_size == sizeof(station_config_record_t) &&
+                   record->crc == _station_config_record_crc(record) && record->hostname[sizeof(record->hostname) - 1] == '\0';
+      }
+
+      /**
+       * @brief Store the connection context in RTC memory after a successful connect, for the next wake from deep sleep.
+       *        Only RAM is written; the DHCP lease is already in the context (see _save_dhcp_lease())
+       *
+       * @param record fast-reconnect record of the AP connected to
+       */
+      static void _save_rtc_context(const fast_reconnect_record_t *record)
+      {
+#if ESP_RTC_WARM_START
+            if (!s_warm_start && !_load_station_config(&s_rtc_context.station_config)) // after a warm start, it is in the context already
+            {
+                  memset(&s_rtc_context.station_config, 0, sizeof(s_rtc_context.station_config));
+            }
+            s_rtc_context.version = RTC_CONTEXT_VERSION;
+            s_rtc_context.retries = s_metrics.retries < ESP_MAXIMUM_RETRY ? s_metrics.retries : ESP_MAXIMUM_RETRY;
+            memcpy(s_rtc_context.password, _get_wifi_config().sta.password, sizeof(s_rtc_context.password));
+            s_rtc_context.fast_reconnect = *record;
+            s_rtc_context.radio_on_us = 0;
+            s_rtc_context.crc = _rtc_context_crc();
+#endif
+      }
+
+      /**
+       * @brief Invalidate the RTC context, when the connect with it failed; the next wake uses the normal path
+       *
+       */
+      static void _invalidate_rtc_context()
+      {
+#if ESP_RTC_WARM_START
+            s_rtc_context.crc = ~_rtc_context_crc();
+#endif
+            s_warm_start = false;
+      }
+
+      /**
+       * @brief Store the radio-on time of this wake in the RTC context, so the next wake can report it
+       *
+       * @param radio_on_us time from esp_wifi_start() until stop()
+       */
+      static void _save_rtc_radio_on_time(int64_t radio_on_us)
+      {
+#if ESP_RTC_WARM_START
+            if (s_rtc_context.crc == _rtc_context_crc())
+            {
+                  s_rtc_context.radio_on_us = radio_on_us;
+                  s_rtc_context.crc = _rtc_context_crc();
+            }
+#endif
+      }
+
+      /**
+       * @brief Get the fast-reconnect record: from the RTC context on a warm start, otherwise from NVS
+       *
+       * @param record read record
+       * @return true if a record for the SSID of the STA config exists
+       */
+      static bool _get_fast_reconnect_record(fast_reconnect_record_t *record)
+      {
+#if ESP_RTC_WARM_START
+            if (s_warm_start)
+            {
+                  *record = s_rtc_context.fast_reconnect;
+                  return true;
+            }
+#endif
+            return _load_fast_reconnect_record(record);
+      }
+
+      /**
+       * @brief Nbr of retries of the directed connect with the fast-reconnect record; on a warm start also the retries
+       *        the previous connect needed, so an AP that usually needs a retry does not make the warm start fail
+       *
+       * @return int nbr of retries
+       */
+      static int _fast_reconnect_maximum_retry()
+      {
+#if ESP_RTC_WARM_START
+            if (s_warm_start)
+            {
+                  return ESP_FAST_RECONNECT_MAXIMUM_RETRY + s_rtc_context.retries;
+            }
+#endif
+            return ESP_FAST_RECONNECT_MAXIMUM_RETRY;
+      }
+
+#if ESP_DHCP_REBOOT
+      /**
+       * @brief Get the cached DHCP lease: from the RTC context on a warm start, otherwise from NVS
+       *
+       * @param record read record
+       * @return true if a lease is cached
+       */
+      static bool _get_dhcp_lease(dhcp_lease_record_t *record)
+      {
+#if ESP_RTC_WARM_START
+            if (s_warm_start)
+            {
+                  *record = s_rtc_context.lease;
+                  return record->ip_info.ip.addr != 0;
+            }
+#endif
+            return _load_dhcp_lease(record);
+      }
+#endif
+
+      /**
+       * @brief Get the hostname and static IP stored by the provisioning API: from the RTC context on a warm start,
+       *        otherwise from NVS
+       *
+       * @param record read record
+       * @return true if a valid record is stored
+       */
+      static bool _get_station_config(station_config_record_t *record)
+      {
+#if ESP_RTC_WARM_START
+            if (s_warm_start)
+            {
+                  *record = s_rtc_context.station_config;
+                  return record->crc == _station_config_record_crc(record) && record->hostname[sizeof(record->hostname) - 1] == '\0';
+            }
+#endif
+            return _load_station_config(record);
+      }
+
+      /**
+       * @brief Save the lease just obtained or renewed via DHCP, with the BSSID of the AP and the lease time and T1 of the
+       *        DHCP ACK, so a warm boot can ask for the same address. NVS is only written when the lease changed, like the
+       *        credentials; the RTC context, for a wake from deep sleep, always
+       *
+       * @param ip_info IP address, netmask and gateway of the lease
+       */
+      static void _save_dhcp_lease(const esp_netif_ip_info_t *ip_info)
+      {
+            wifi_ap_record_t ap_info;
+            esp_netif_dns_info_t dns_info = {};
+            dhcp_lease_record_t record = {};
+
+            if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+            {
+                  return;
+            }
+            memcpy(record.bssid, ap_info.bssid, sizeof(record.bssid));
+            record.ip_info = *ip_info;
+            if (esp_netif_get_dns_info(esp_netif_sta_handler, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK)
+            {
+                  record.dns = dns_info.ip.u_addr.ip4;
+            }
+            record.obtained_s = time(NULL);
+            struct netif *netif = (struct netif *)esp_netif_get_netif_impl(esp_netif_sta_handler);
+            struct dhcp *dhcp = netif != NULL ? netif_dhcp_data(netif) : NULL;
+            if (dhcp != NULL) // times of the last DHCP ACK; read in the event loop task, after lwIP bound the address
+            {
+                  record.lease_s = dhcp->offered_t0_lease;
+                  record.t1_s = dhcp->offered_t1_renew;
+            }
+#if ESP_RTC_WARM_START
+            // a valid context stays valid: a DHCP renew after a reconnect, or at T1, updates its lease.
+            // Before the first connect the context is not valid yet; its CRC is set when it is saved after the connect
+            bool rtc_context_valid = s_rtc_context.crc == _rtc_context_crc();
+            s_rtc_context.lease = record;
+            if (rtc_context_valid)
+            {
+                  s_rtc_context.crc = _rtc_context_crc();
+            }
+#endif
+            if (!ESP_NVS_PERSISTENCE)
+            {
+                  return;
+            }
+
+            if (!s_stored_lease_loaded)
+            {
+                  if (!_load_dhcp_lease(&s_stored_lease))
+                  {
+                        memset(&s_stored_lease, 0, sizeof(s_stored_lease));
+                  }
+                  s_stored_lease_loaded = true;
+            }
+            // the same lease again (reconnect, renew): only the time differs, so NVS is not written. The stored time is
+            // refreshed once it is older than T1, so it is written at most once per renewal period of the server
+            int64_t stored_age_s = record.obtained_s - s_stored_lease.obtained_s;
+            if (memcmp(s_stored_lease.bssid, record.bssid, sizeof(record.bssid)) == 0 &&
+                s_stored_lease.ip_info.ip.addr == record.ip_info.ip.addr &&
+                s_stored_lease.ip_info.netmask.addr == record.ip_info.netmask.addr &&
+                s_stored_lease.ip_info.gw.addr == record.ip_info.gw.addr && s_stored_lease.dns.addr == record.dns.addr &&
+                s_stored_lease.lease_s == record.lease_s && stored_age_s >= 0 && stored_age_s < s_stored_lease.t1_s)
+            {
+                  return;
+            }
+
+            nvs_handle_t nvs_handle;
+            if (nvs_open("storage", NVS_READWRITE, &nvs_handle) == ESP_OK)
+            {
+                  if (nvs_set_blob(nvs_handle, NVS_KEY_DHCP_LEASE, &record, sizeof(record)) == ESP_OK &&
+                      nvs_commit(nvs_handle) == ESP_OK)
+                  {
+                        s_stored_lease = record;
+                  }
+                  nvs_close(nvs_handle);
+            }
+      }
+
+      /**
+       * @brief Set the static IP address, netmask, gateway and DNS server on the STA netif, and stop its DHCP client.
+       *        IP_EVENT_STA_GOT_IP is then posted right after association
+       *
+       * @param ip_info IP address, netmask and gateway
+       * @param dns DNS server; not set when 0
+       */
+      static void _set_fixed_sta_ip(const esp_netif_ip_info_t *ip_info, esp_ip4_addr_t dns)
+      {
+            esp_netif_dhcpc_stop(esp_netif_sta_handler); // already stopped is no problem
+            esp_netif_set_ip_info(esp_netif_sta_handler, ip_info);
+            if (dns.addr != 0)
+            {
+                  esp_netif_dns_info_t dns_info = {};
+                  dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+                  dns_info.ip.u_addr.ip4 = dns;
+                  esp_netif_set_dns_info(esp_netif_sta_handler, ESP_NETIF_DNS_MAIN, &dns_info);
+            }
+      }
+
+      /**
+       * @brief Configure how the STA gets its IP address, before connecting: the static IP of set_static_ip(); otherwise
+       *        DHCP. When the last lease was obtained from bssid and has not expired, the DHCP client of lwIP asks for
+       *        its address with a DHCPREQUEST (INIT-REBOOT), which the server confirms with a single ACK; when the server
+       *        refuses it, a normal DHCP exchange follows. Otherwise the address lwIP restores is erased first, so the
+       *        client starts with DISCOVER. The expiry is only checked after a reset that keeps the system time (deep
+       *        sleep, software reset, panic); after power-on the server decides
+       *
+       * @param bssid AP that is connected to; NULL when not known, which means the last lease is not asked for
+       */
+      static void _configure_sta_ip(const uint8_t *bssid)
+      {
+            if (s_static_ip_set)
+            {
+                  _set_fixed_sta_ip(&s_static_ip_info, s_static_dns);
+                  return;
+            }
+#if ESP_DHCP_REBOOT
+            dhcp_lease_record_t lease;
+            esp_reset_reason_t reset_reason = esp_reset_reason();
+            bool time_kept = reset_reason == ESP_RST_DEEPSLEEP || reset_reason == ESP_RST_SW || reset_reason == ESP_RST_PANIC;
+            if (bssid != NULL && _get_dhcp_lease(&lease) && memcmp(lease.bssid, bssid, sizeof(lease.bssid)) == 0 &&
+                (!time_kept || (time(NULL) >= lease.obtained_s && time(NULL) - lease.obtained_s < lease.lease_s)))
+            {
+                  ESP_LOGI(TAG, "request last DHCP address " IPSTR, IP2STR(&lease.ip_info.ip));
+                  esp_netif_dhcpc_start(esp_netif_sta_handler); // already started is no problem
+                  return;
+            }
+#endif
+            esp_netif_dhcpc_stop(esp_netif_sta_handler); // erases the address lwIP would restore; already stopped is no problem
+            esp_netif_dhcpc_start(esp_netif_sta_handler);
+      }
+
+      /**
+       * @brief Set the security settings, and the 802.11k/v capabilities for roaming, of a STA config; after its
+       *        credentials are set, since the auth mode threshold depends on the password
+       *
+       * @param wifi_config STA config
+       */
+      static void _set_sta_security_config(wifi_config_t *wifi_config)
+      {
+            /* Setting a password implies station will connect to all security modes including WEP/WPA.
+             * However these modes are deprecated and not advisable to be used. Incase your Access point
+             * doesn't support WPA2, these mode can be enabled by commenting below line. Without password the
+             * network is open (add_network() with ""), and the threshold must allow that */
+            wifi_config->sta.threshold.authmode = wifi_config->sta.password[0] == '\0' ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK;
+            wifi_config->sta.pmf_cfg.capable = true;
+            wifi_config->sta.pmf_cfg.required = false;
+            wifi_config->sta.rm_enabled = ESP_ROAMING;  // 802.11k: radio measurements, neighbor reports of the AP
+            wifi_config->sta.btm_enabled = ESP_ROAMING; // 802.11v: the driver follows BSS transition requests of the AP
+      }
+
+#if ESP_PORTAL
+      /**
+       * @brief Value of a hex digit
+       *
+       * @param c hex digit
+       * @return value 0..15, or -1 when c is no hex digit
+       */
+      static int _hex_value(char c)
+      {
+            if (c >= '0' && c <= '9')
+                  return c - '0';
+            if (c >= 'a' && c <= 'f')
+                  return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F')
+                  return c - 'A' + 10;
+            return -1;
+      }
+
+      /**
+       * @brief Parse an application/x-www-form-urlencoded string (URL query or POST body) in a single pass, and decode
+       *        the values of the keys "ssid" and "passkey" directly into the STA config. No heap is used; values that do
+       *        not fit are rejected instead of truncated. Unknown keys are skipped; of a repeated key the last value counts
+       *
+       * @param form form string; need not be null terminated
+       * @param form_len length of form
+       * @param wifi_config STA config to fill; ssid and password are cleared first
+       * @return ESP_OK, ESP_ERR_INVALID_SIZE when a value is too long, ESP_ERR_NOT_FOUND when there is no SSID
+       */
+      static esp_err_t _parse_wifi_form(const char *form, size_t form_len, wifi_config_t *wifi_config)
+      {
+            const char *end = form + form_len;
+            const char *p = form;
+            bool ssid_found = false;
+
+            memset(wifi_config->sta.ssid, 0, sizeof(wifi_config->sta.ssid));
+            memset(wifi_config->sta.password, 0, sizeof(wifi_config->sta.password));
+            while (p < end)
+            {
+                  // key
+                  const char *key = p;
+                  while (p < end && *p != '=' && *p != '&')
+                        p++;
+                  size_t key_len = p - key;
+                  uint8_t *dst = NULL;
+                  size_t dst_size = 0;
+                  if (key_len == 4 && memcmp(key, "ssid", 4) == 0)
+                  {
+                        dst = wifi_config->sta.ssid;
+                        dst_size = sizeof(wifi_config->sta.ssid); // 32 characters without null termination is a valid SSID
+                        ssid_found = true;
+                  }
+                  else if (key_len == 7 && memcmp(key, "passkey", 7) == 0)
+                  {
+                        dst = wifi_config->sta.password;
+                        dst_size = sizeof(wifi_config->sta.password); // 63 characters passphrase, or 64 hex digits PSK
+                  }
+                  if (dst != NULL)
+                  {
+                        memset(dst, 0, dst_size); // no tail of an earlier, longer value of the same key
+                  }
+                  if (p < end && *p == '=')
+                        p++;
+
+                  // value; decoded while scanning
+                  size_t dst_len = 0;
+                  while (p < end && *p != '&')
+                  {
+                        char c = *p++;
+                        if (c == '+')
+                        {
+                              c = ' ';
+                        }
+                        else if (c == '%' && end - p >= 2 && _hex_value(p[0]) >= 0 && _hex_value(p[1]) >= 0)
+                        {
+                              c = (char)(_hex_value(p[0]) * 16 + _hex_value(p[1]));
+                              p += 2;
+                        }
+                        if (dst != NULL)
+                        {
+                              if (dst_len == dst_size)
+                              {
+                                    return ESP_ERR_INVALID_SIZE;
+                              }
+                              dst[dst_len++] = (uint8_t)c;
+                        }
+                  }
+                  if (p < end) // skip '&'
+                        p++;
+            }
+            return ssid_found && wifi_config->sta.ssid[0] != '\0' ? ESP_OK : ESP_ERR_NOT_FOUND;
+      }
+
+      /**
+       * @brief Find an embedded web asset
+       *
+       * @param uri path of the asset, relative to web/
+       * @return web asset, or NULL if not found
+       */
+      static const web_asset_t *_find_web_asset(const char *uri)
+      {
+            for (size_t i = 0; i < web_assets_count; i++)
+            {
+                  if (strcmp(web_assets[i].uri, uri) == 0)
+                  {
+                        return &web_assets[i];
+                  }
+            }
+            return NULL;
+      }
+
+      /**
+       * @brief Check whether the browser accepts gzip: no Accept-Encoding header means any encoding is accepted (RFC 9110);
+       *        otherwise gzip (or *) must be listed, and not with q=0
+       *
+       * @param req HTML request
+       * @return true when the gzip compressed asset may be sent; otherwise the uncompressed copy is sent
+       */
+      static bool _accepts_gzip(httpd_req_t *req)
+      {
+            char accept_encoding[96];
+            esp_err_t err = httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept_encoding, sizeof(accept_encoding));
+            if (err == ESP_ERR_NOT_FOUND)
+            {
+                  return true;
+            }
+            if (err != ESP_OK && err != ESP_ERR_HTTPD_RESULT_TRUNC) // a truncated value still holds the first encodings
+            {
+                  return false;
+            }
+            const char *coding = strstr(accept_encoding, "gzip");
+            if (coding == NULL)
+            {
+                  coding = strstr(accept_encoding, "*");
+            }
+            if (coding == NULL)
+            {
+                  return false;
+            }
+            const char *q = coding + strcspn(coding, ",;");
+            while (*q == ';' || *q == ' ')
+            {
+                  q++;
+            }
+            return !(q[0] == 'q' && q[1] == '=' && strtod(q + 2, NULL) == 0.0);
+      }
+
+      /**
+       * @brief Send an embedded web asset gzip compressed, or 304 Not Modified when the browser already has it.
+       *        A browser that does not accept gzip gets the uncompressed copy, with its own ETag
+       *
+       * @param req HTML request
+       * @param asset web asset to send; NULL when it is missing from web/, answered with 500
+       * @return esp_err_t
+       */
+      static esp_err_t _send_web_asset(httpd_req_t *req, const web_asset_t *asset)
+      {
+            char if_none_match[24];
+
+            if (asset == NULL)
+            {
+                  ESP_LOGE(TAG, "web asset for %s not embedded", req->uri);
+                  return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Page not found in firmware");
+            }
+            httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+            bool gzip = _accepts_gzip(req); // otherwise the uncompressed copy; never refuse the page
+            const char *etag = gzip ? asset->etag : asset->identity_etag;
+            httpd_resp_set_hdr(req, "ETag", etag);
+            httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+            if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+                strcmp(if_none_match, etag) == 0)
+            {
+                  httpd_resp_set_status(req, "304 Not Modified");
+                  return httpd_resp_send(req, NULL, 0);
+            }
+            httpd_resp_set_type(req, asset->content_type);
+            if (!gzip)
+            {
+                  return httpd_resp_send(req, (const char *)asset->identity_data, asset->identity_size);
+            }
+            httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+            return httpd_resp_send(req, (const char *)asset->data, asset->size);
+      }
+
+      /**
+       * @brief Serve an embedded web asset; the asset is passed as user_ctx of the URI handler
+       *
+       * @param req HTML request
+       * @return esp_err_t
+       */
+      static esp_err_t web_asset_get_handler(httpd_req_t *req)
+      {
+            return _send_web_asset(req, (const web_asset_t *)req->user_ctx);
+      }
+
+      /**
+       * @brief Send a page of the captive portal with a title and a message
+       *
+       * @param req HTML request
+       * @param head extra element in the head of the page, for instance a refresh; "" for none
+       * @param title first line of the page
+       * @param message second line of the page
+       */
+      static void _send_page(httpd_req_t *req, const char *head, const char *title, const char *message)
+      {
+            char page[700];
+            snprintf(page, sizeof(page),
+                     "<!DOCTYPE HTML><html><head>"
+                     "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">%s"
+                     "<title>ESP32 Captive Portal</title>"
+                     "<style>body { background-color: #0067B3; font-family: Arial, Helvetica, Sans-Serif; Color: #FFFFFF; } a { color: #FFFFFF; }</style>"
+                     "</head><body><center><h1>ESP32 Captive Portal</h1><h2>%s</h2><p>%s</p></center></body></html>",
+                     head, title, message);
+            httpd_resp_set_hdr(req, "Cache-Control", "no-store"); // result pages change while a test runs
+            httpd_resp_send(req, page, HTTPD_RESP_USE_STRLEN);
+      }
+
+      /**
+       * @brief Send a result page of the captive portal
+       *
+       * @param req HTML request
+       * @param title first line of the page
+       * @param message second line of the page
+       */
+      static void _send_result_page(httpd_req_t *req, const char *title, const char *message)
+      {
+            _send_page(req, "", title, message);
+      }
+
+      /**
+       * @brief Send the page shown while the credentials are tested; it reloads /control/result every second, until
+       *        that shows the result
+       *
+       * @param req HTML request
+       */
+      static void _send_testing_page(httpd_req_t *req)
+      {
+            _send_page(req, "<meta http-equiv=\"refresh\" content=\"1; url=/control/result\">",
+                       "Testing wifi credentials", "Connecting to the wifi network; this takes up to 30 seconds.");
+      }
+
+#endif // ESP_PORTAL
+
+      /**
+       * @brief esp_wifi_start(), and remember when the radio was switched on, for the radio-on time in the metrics
+       *
+       * @return esp_err_t of esp_wifi_start()
+       */
+      static esp_err_t _wifi_start()
+      {
+            if (s_radio_on_start_us == 0)
+            {
+                  s_radio_on_start_us = esp_timer_get_time();
+            }
+            return esp_wifi_start();
+      }
+
+      /**
+       * @brief Start a connect attempt, and remember when it started, for the association time in the metrics
+       *
+       */
+      static void _start_connect_attempt()
+      {
+            s_attempt_start_us = esp_timer_get_time();
+            s_sta_attempt_active = true;
+            esp_wifi_connect();
+      }
+
+      /**
+       * @brief Remove the BSSID and channel from the STA config of the driver. A connect directly to one AP (fast
+       *        reconnect, best candidate of the scan) pins them; once the connection is lost, reconnects must be able to
+       *        use any AP of the SSID, or the STA never recovers when that one AP is gone. STA must be disconnected
+       *
+       */
+      static void _unpin_bssid()
+      {
+            wifi_config_t wifi_config;
+            if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) == ESP_OK && wifi_config.sta.bssid_set)
+            {
+                  wifi_config.sta.bssid_set = false;
+                  wifi_config.sta.channel = 0;
+                  esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+            }
+      }
+
+      /**
+       * @brief Abort the connect attempt or the connection of the STA, and wait until the event handler has handled its
+       *        DISCONNECTED event. That event does not count as a retry and does not schedule a reconnect, so it cannot
+       *        mix with the attempts that follow
+       *
+       */
+      static void _abort_connect_attempt()
+      {
+            esp_timer_stop(s_reconnect_timer);
+            if (!s_sta_attempt_active)
+            {
+                  return; // no DISCONNECTED event to wait for
+            }
+            xEventGroupClearBits(s_wifi_event_group, WIFI_ABORTED_BIT);
+            s_abort_pending = true;
+            esp_wifi_disconnect();
+            EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group, WIFI_ABORTED_BIT, pdTRUE, pdFALSE,
+                                                   pdMS_TO_TICKS(ESP_ABORT_TIMEOUT_MS));
+            if ((bits & WIFI_ABORTED_BIT) == 0)
+            {
+                  ESP_LOGW(TAG, "no disconnect event after abort of connect attempt");
+            }
+            s_abort_pending = false;
+      }
+
+#if ESP_PORTAL
+      /**
+       * @brief Check supplied credentials before they are tested: a probe scan for the SSID, first only on the channel
+       *        where the background scan saw it, and a check of the passkey against the auth mode of the network. A
+       *        misspelled SSID or a passkey that cannot be right is rejected in about 100 ms, instead of after all
+       *        connect retries. When the scan itself fails, the credentials are not rejected
+       *
+       * @param wifi_config credentials to check
+       * @return NULL when the credentials can be tested; otherwise the reason, for the user. When the network was not
+       *         found, s_last_disconnect_reason is WIFI_REASON_NO_AP_FOUND
+       */
+      static const char *_preflight_check(const wifi_config_t *wifi_config)
+      {
+            char ssid[sizeof(wifi_config->sta.ssid) + 1] = {}; // SSID of 32 characters is not null terminated
+            memcpy(ssid, wifi_config->sta.ssid, sizeof(wifi_config->sta.ssid));
+            uint8_t channel_hint = 0;
+            xSemaphoreTake(s_scan_table_mutex, portMAX_DELAY);
+            for (int i = 0; i < s_scan_table_count; i++)
+            {
+                  if (strcmp(s_scan_table[i].ssid, ssid) == 0)
+                  {
+                        channel_hint = s_scan_table[i].channel;
+                  }
+            }
+            xSemaphoreGive(s_scan_table_mutex);
+
+            wifi_scan_config_t scan_config = {};
+            scan_config.ssid = (uint8_t *)ssid; // directed probe requests, so hidden networks are found too
+            scan_config.show_hidden = true;
+            scan_config.scan_time.active.min = 0;
+            scan_config.scan_time.active.max = ESP_PREFLIGHT_SCAN_TIME_MS;
+
+            // the results of this scan are read here; the next background scan enables the scan table again
+            esp_timer_stop(s_scan_timer);
+            s_background_scan_active = false;
+            esp_wifi_scan_stop(); // abort a running background scan
+
+            int64_t start_us = esp_timer_get_time();
+            wifi_ap_record_t ap_records[ESP_PREFLIGHT_MAXIMUM_RECORDS];
+            wifi_ap_record_t *best = NULL;
+            esp_err_t err = ESP_OK;
+            for (int pass = channel_hint == 0 ? 1 : 0; pass < 2 && best == NULL && err == ESP_OK; pass++)
+            {
+                  uint16_t ap_count = ESP_PREFLIGHT_MAXIMUM_RECORDS;
+                  scan_config.channel = pass == 0 ? channel_hint : 0; // 0: all channels
+                  err = esp_wifi_scan_start(&scan_config, true);
+                  if (err == ESP_OK)
+                  {
+                        err = esp_wifi_scan_get_ap_records(&ap_count, ap_records);
+                  }
+                  // ap_count is what the driver reports; never read past ap_records, nor past an SSID without null byte
+                  for (int i = 0; err == ESP_OK && i < ap_count && i < ESP_PREFLIGHT_MAXIMUM_RECORDS; i++)
+                  {
+                        if (strncmp((const char *)ap_records[i].ssid, ssid, sizeof(ap_records[i].ssid)) == 0 &&
+                            (best == NULL || ap_records[i].rssi > best->rssi))
+                        {
+                              best = &ap_records[i];
+                        }
+                  }
+            }
+            esp_timer_start_periodic(s_scan_timer, ESP_BACKGROUND_SCAN_PERIOD_MS * 1000ULL);
+            if (err != ESP_OK)
+            {
+                  ESP_LOGW(TAG, "pre-flight scan failed (%s); credentials are tested anyway", esp_err_to_name(err));
+                  esp_wifi_clear_ap_list();
+                  return NULL;
+            }
+            if (best == NULL)
+            {
+                  ESP_LOGW(TAG, "pre-flight: SSID:%s not found (%lld ms)", ssid, (esp_timer_get_time() - start_us) / 1000);
+                  s_last_disconnect_reason = WIFI_REASON_NO_AP_FOUND;
+                  return "The network is not in range, or the SSID is misspelled.";
+            }
+            ESP_LOGI(TAG, "pre-flight: SSID:%s found on channel %d, RSSI %d, auth mode %d (%lld ms)", ssid, best->primary,
+                     best->rssi, best->authmode, (esp_timer_get_time() - start_us) / 1000);
+
+            size_t password_len = strnlen((const char *)wifi_config->sta.password, sizeof(wifi_config->sta.password));
+            bool hex_psk = password_len == 64;
+            for (size_t i = 0; i < password_len && hex_psk; i++)
+            {
+                  hex_psk = _hex_value(wifi_config->sta.password[i]) >= 0;
+            }
+            switch (best->authmode)
+            {
+            case WIFI_AUTH_OPEN:
+            case WIFI_AUTH_WEP:
+            case WIFI_AUTH_WPA_PSK:
+                  return "The network uses no, WEP or WPA security; only WPA2 and WPA3 networks are supported.";
+            case WIFI_AUTH_WPA2_ENTERPRISE:
+                  return "The network uses enterprise (802.1X) security; this is not supported.";
+            case WIFI_AUTH_WPA2_PSK:
+            case WIFI_AUTH_WPA_WPA2_PSK:
+            case WIFI_AUTH_WPA2_WPA3_PSK:
+                  if ((password_len < 8 || password_len > 63) && !hex_psk)
+                  {
+                        return "The passkey of this network has 8 to 63 characters, or 64 hex digits.";
+                  }
+                  break;
+            case WIFI_AUTH_WPA3_PSK:
+                  if (password_len == 0)
+                  {
+                        return "This network needs a passkey.";
+                  }
+                  break;
+            default:
+                  break;
+            }
+            return NULL;
+      }
+
+      // credentials test of the portal; runs in its own task, the page or script polls its result
+      typedef enum
+      {
+            CREDENTIALS_TEST_IDLE,    // no test started since the portal started
+            CREDENTIALS_TEST_RUNNING,
+            CREDENTIALS_TEST_DONE,
+      } credentials_test_state_t;
+
+      typedef struct
+      {
+            credentials_test_state_t state;
+            const char *rejected;        // reason of the pre-flight check; NULL when the credentials were tested
+            bool connected;
+            uint8_t reason;              // wifi_err_reason_t of the last disconnect; WIFI_REASON_NO_AP_FOUND: not found
+            esp_netif_ip_info_t ip_info; // when connected
+            int64_t elapsed_ms;          // pre-flight check and test
+      } credentials_test_result_t;
+
+      static credentials_test_result_t s_credentials_test = {};
+      static portMUX_TYPE s_credentials_test_lock = portMUX_INITIALIZER_UNLOCKED;
+      static wifi_config_t s_test_wifi_config;             // credentials to test; input of the test task
+      static void (*s_test_finished)(bool connected) = NULL; // called by the test task when the test is done
+
+      /**
+       * @brief Test the credentials in the STA config while softAP and http server keep running (APSTA mode)
+       *
+       * @param ip_info IP info obtained from the network, when connected
+       * @return true when connected to the network and an IP address is obtained
+       */
+      bool wifi_provisioning::_test_credentials(esp_netif_ip_info_t *ip_info)
+      {
+            wifi_config_t wifi_config = _get_wifi_config();
+            ESP_LOGI(TAG, "test credentials for SSID:%.32s", (const char *)wifi_config.sta.ssid);
+
+            _set_sta_security_config(&wifi_config);
+            _set_wifi_config(wifi_config);
+            _abort_connect_attempt(); // of a previous test that might still be running
+            xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+            s_retry_num = 0;
+            s_maximum_retry = ESP_PORTAL_TEST_MAXIMUM_RETRY;
+            s_last_disconnect_reason = 0;
+            s_connect_start_us = esp_timer_get_time();
+            _configure_sta_ip(NULL);
+            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+            _start_connect_attempt();
+
+            EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
+                                                   WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                                                   pdFALSE,
+                                                   pdFALSE,
+                                                   pdMS_TO_TICKS(ESP_PORTAL_TEST_TIMEOUT_MS));
+            if (bits & WIFI_CONNECTED_BIT)
+            {
+                  esp_netif_get_ip_info(esp_netif_sta_handler, ip_info);
+                  return true;
+            }
+            // failed or timed out; make sure STA does not keep trying in the background
+            s_maximum_retry = 0;
+            _abort_connect_attempt();
+            return false;
+      }
+
+      /**
+       * @brief Task that checks and tests credentials supplied via the captive portal, so the http server task keeps
+       *        serving while the test runs. The result is kept for the page or script that polls it; after a successful
+       *        test the portal is closed once the result is fetched, or after ESP_PORTAL_RESULT_TIMEOUT_MS
+       *
+       * @param arg not used
+       */
+      void wifi_provisioning::_credentials_test_task(void *arg)
+      {
+            credentials_test_result_t result = {};
+            int64_t start_us = esp_timer_get_time();
+
+            s_last_disconnect_reason = 0;
+            result.rejected = _preflight_check(&s_test_wifi_config);
+            if (result.rejected == NULL)
+            {
+                  _set_wifi_config(s_test_wifi_config);
+                  ESP_LOGI(TAG, "Found network SSID =%.32s", (const char *)s_test_wifi_config.sta.ssid);
+                  result.connected = _test_credentials(&result.ip_info);
+            }
+            if (s_test_finished != NULL)
+            {
+                  s_test_finished(result.connected);
+            }
+            result.state = CREDENTIALS_TEST_DONE;
+            result.reason = s_last_disconnect_reason;
+            result.elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+            portENTER_CRITICAL(&s_credentials_test_lock);
+            s_credentials_test = result;
+            portEXIT_CRITICAL(&s_credentials_test_lock);
+            ESP_LOGD(TAG, "credentials test task: %lu bytes of stack never used", (unsigned long)uxTaskGetStackHighWaterMark(NULL));
+
+            if (result.connected)
+            {
+                  // the result is fetched via the softAP; switching it off before would leave the page without an answer
+                  xEventGroupWaitBits(s_provisioning_event_group, TEST_RESULT_FETCHED_BIT, pdTRUE, pdFALSE,
+                                      pdMS_TO_TICKS(ESP_PORTAL_RESULT_TIMEOUT_MS));
+                  xEventGroupSetBits(s_provisioning_event_group, CREDENTIALS_SET_BIT); // wake up task waiting for credentials
+            }
+            xEventGroupSetBits(s_provisioning_event_group, CREDENTIALS_TEST_IDLE_BIT);
+            vTaskDelete(NULL);
+      }
+
+      /**
+       * @brief Start the check and test of credentials supplied via the captive portal in their own task
+       *
+       * @param wifi_config credentials to test
+       * @param finished called by the test task when the test is done, before its result can be fetched; NULL for none
+       * @return ESP_OK when started; ESP_ERR_INVALID_STATE when a test runs already; ESP_ERR_NO_MEM when the task could
+       *         not be created
+       */
+      esp_err_t wifi_provisioning::_start_credentials_test(const wifi_config_t *wifi_config, void (*finished)(bool connected))
+      {
+            if ((xEventGroupClearBits(s_provisioning_event_group, CREDENTIALS_TEST_IDLE_BIT) & CREDENTIALS_TEST_IDLE_BIT) == 0)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            s_test_wifi_config = *wifi_config;
+            s_test_finished = finished;
+            xEventGroupClearBits(s_provisioning_event_group, TEST_RESULT_FETCHED_BIT);
+            portENTER_CRITICAL(&s_credentials_test_lock);
+            s_credentials_test = {};
+            s_credentials_test.state = CREDENTIALS_TEST_RUNNING;
+            portEXIT_CRITICAL(&s_credentials_test_lock);
+            if (xTaskCreate(_credentials_test_task, "wifi_test", ESP_CREDENTIALS_TEST_TASK_STACK_SIZE, NULL,
+                            ESP_CREDENTIALS_TEST_TASK_PRIORITY, NULL) != pdPASS)
+            {
+                  portENTER_CRITICAL(&s_credentials_test_lock);
+                  s_credentials_test.state = CREDENTIALS_TEST_IDLE;
+                  portEXIT_CRITICAL(&s_credentials_test_lock);
+                  xEventGroupSetBits(s_provisioning_event_group, CREDENTIALS_TEST_IDLE_BIT);
+                  return ESP_ERR_NO_MEM;
+            }
+            return ESP_OK;
+      }
+
+      /**
+       * @brief Get the state or the result of the last credentials test. A fetched successful result lets the test task
+       *        close the portal
+       *
+       * @return copy of the result
+       */
+      static credentials_test_result_t _fetch_credentials_test_result()
+      {
+            portENTER_CRITICAL(&s_credentials_test_lock);
+            credentials_test_result_t result = s_credentials_test;
+            portEXIT_CRITICAL(&s_credentials_test_lock);
+            return result;
+      }
+
+      /**
+       * @brief Page polled while credentials are tested: GET /control/result shows the testing page until the result is
+       *        there, then the result
+       *
+       * @param req HTML request
+       * @return esp_err_t
+       */
+      static esp_err_t credentials_test_result_get_handler(httpd_req_t *req)
+      {
+            credentials_test_result_t result = _fetch_credentials_test_result();
+            if (result.state == CREDENTIALS_TEST_IDLE)
+            {
+                  _send_result_page(req, "No wifi credentials supplied", "<a href=\"/\">Supply them</a>.");
+            }
+            else if (result.state == CREDENTIALS_TEST_RUNNING)
+            {
+                  _send_testing_page(req);
+            }
+            else if (result.rejected != NULL)
+            {
+                  char message[160];
+                  snprintf(message, sizeof(message), "%s <a href=\"/\">Try again</a>.", result.rejected);
+                  _send_result_page(req, result.reason == WIFI_REASON_NO_AP_FOUND ? "Wifi network not found" : "Passkey does not fit the network", message);
+            }
+            else if (result.connected)
+            {
+                  char message[100];
+                  snprintf(message, sizeof(message), "IP address " IPSTR ". The access point of the ESP32 is switched off.", IP2STR(&result.ip_info.ip));
+                  _send_result_page(req, "Connected to wifi network", message);
+                  xEventGroupSetBits(s_provisioning_event_group, TEST_RESULT_FETCHED_BIT); // after the page; closes the portal
+            }
+            else if (result.reason == WIFI_REASON_NO_AP_FOUND)
+            {
+                  _send_result_page(req, "Wifi network not found", "Check the SSID and <a href=\"/\">try again</a>.");
+            }
+            else
+            {
+                  _send_result_page(req, "Could not connect to wifi network", "Check the passkey and <a href=\"/\">try again</a>.");
+            }
+            return ESP_OK;
+      }
+
+      /**
+       * @brief Ask for wifi credentials, and/or handle them. Supplied credentials are tested in the credentials test
+       *        task while the portal stays up; the browser gets a page that polls the result (/control/result)
+       *
+       * @param req HTML request
+       * @return esp_err_t
+       */
+      esp_err_t wifi_provisioning::setWifiParams(httpd_req_t *req)
+      {
+            ESP_LOGI(TAG, "setWifiParams");
+
+            char form[FORM_MAX_LEN]; // URL query or POST body
+            size_t form_len = 0;
+
+            if (req->method == HTTP_POST)
+            {
+                  if (req->content_len >= sizeof(form))
+                  {
+                        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Form too long");
+                  }
+                  while (form_len < req->content_len)
+                  {
+                        int received = httpd_req_recv(req, form + form_len, req->content_len - form_len);
+                        if (received == HTTPD_SOCK_ERR_TIMEOUT)
+                        {
+                              continue;
+                        }
+                        if (received <= 0)
+                        {
+                              return ESP_FAIL;
+                        }
+                        form_len += received;
+                  }
+            }
+            else if (httpd_req_get_url_query_len(req) > 0)
+            {
+                  if (httpd_req_get_url_query_len(req) >= sizeof(form))
+                  {
+                        return httpd_resp_send_err(req, HTTPD_414_URI_TOO_LONG, "Form too long");
+                  }
+                  httpd_req_get_url_query_str(req, form, sizeof(form));
+                  form_len = strlen(form);
+            }
+
+            if (form_len == 0)
+            {
+                  // present page for requesting wifi credentials
+                  return _send_web_asset(req, _find_web_asset(INDEX_HTML_URI));
+            }
+
+            wifi_config_t wifi_config = _get_wifi_config();
+            esp_err_t err = _parse_wifi_form(form, form_len, &wifi_config);
+            if (err != ESP_OK)
+            {
+                  ESP_LOGW(TAG, "invalid wifi credentials form (%s)", esp_err_to_name(err));
+                  _send_result_page(req, err == ESP_ERR_INVALID_SIZE ? "SSID or passkey too long" : "No SSID supplied",
+                                    "<a href=\"/\">Try again</a>.");
+                  return ESP_OK;
+            }
+            err = _start_credentials_test(&wifi_config, NULL);
+            if (err == ESP_ERR_INVALID_STATE)
+            {
+                  _send_result_page(req, "Other wifi credentials are tested", "<a href=\"/control/result\">Show their result</a>.");
+            }
+            else if (err != ESP_OK)
+            {
+                  _send_result_page(req, "Could not test wifi credentials", "Out of memory. <a href=\"/\">Try again</a>.");
+            }
+            else
+            {
+                  _send_testing_page(req);
+            }
+            ESP_LOGD(TAG, "http server task: %lu bytes of stack never used", (unsigned long)uxTaskGetStackHighWaterMark(NULL));
+            return ESP_OK;
+      }
+
+#if ESP_PROVISION_API
+      // request of POST /api/provision
+      typedef struct
+      {
+            wifi_config_t wifi_config;   // SSID and passphrase; other fields copied from the STA config
+            char hostname[33];           // empty: keep hostname
+            bool static_ip;              // use ip_info and dns instead of DHCP
+            esp_netif_ip_info_t ip_info;
+            esp_ip4_addr_t dns;          // 0 when not supplied
+      } provision_request_t;
+
+      /**
+       * @brief Store the hostname and the static IP settings in NVS, so they are used after reboot too
+       *
+       * @param hostname hostname of the STA
+       */
+      static void _save_station_config(const char *hostname)
+      {
+            station_config_record_t record = {};
+            nvs_handle_t nvs_handle;
+
+            if (!ESP_NVS_PERSISTENCE)
+            {
+                  return;
+            }
+            strlcpy(record.hostname, hostname, sizeof(record.hostname));
+            record.static_ip = s_static_ip_set;
+            record.ip_info = s_static_ip_info;
+            record.dns = s_static_dns;
+            record.crc = _station_config_record_crc(&record);
+            if (nvs_open("storage", NVS_READWRITE, &nvs_handle) == ESP_OK)
+            {
+                  if (nvs_set_blob(nvs_handle, NVS_KEY_STATION_CONFIG, &record, sizeof(record)) == ESP_OK)
+                  {
+                        nvs_commit(nvs_handle);
+                  }
+                  nvs_close(nvs_handle);
+            }
+      }
+
+      /**
+       * @brief Read an IPv4 address from a JSON object
+       *
+       * @param object JSON object
+       * @param name name of the member
+       * @param address read address
+       * @return true when the member is a string with a valid IPv4 address
+       */
+      static bool _json_ip4(const cJSON *object, const char *name, esp_ip4_addr_t *address)
+      {
+            const cJSON *item = cJSON_GetObjectItemCaseSensitive(object, name);
+            return cJSON_IsString(item) && esp_netif_str_to_ip4(item->valuestring, address) == ESP_OK;
+      }
+
+      /**
+       * @brief Parse and validate the JSON body of POST /api/provision:
+       *        {"ssid":"...","passphrase":"...","hostname":"...","static_ip":{"ip":"...","netmask":"...","gateway":"...","dns":"..."}}
+       *        Only ssid is required; passphrase is empty for an open network, 8..63 characters, or 64 hex digits
+       *
+       * @param body request body
+       * @param body_len length of body
+       * @param request parsed request; the wifi config starts as a copy of the STA config
+       * @return NULL when valid; otherwise the reason why not
+       */
+      static const char *_parse_provision_request(const char *body, size_t body_len, provision_request_t *request)
+      {
+            const char *error = NULL;
+            cJSON *root = cJSON_ParseWithLength(body, body_len);
+            if (!cJSON_IsObject(root))
+            {
+                  cJSON_Delete(root);
+                  return "body is no JSON object";
+            }
+
+            *request = {};
+            request->wifi_config = _get_wifi_config();
+            memset(request->wifi_config.sta.ssid, 0, sizeof(request->wifi_config.sta.ssid));
+            memset(request->wifi_config.sta.password, 0, sizeof(request->wifi_config.sta.password));
+            const cJSON *ssid = cJSON_GetObjectItemCaseSensitive(root, "ssid");
+            const cJSON *passphrase = cJSON_GetObjectItemCaseSensitive(root, "passphrase");
+            const cJSON *hostname = cJSON_GetObjectItemCaseSensitive(root, "hostname");
+            const cJSON *static_ip = cJSON_GetObjectItemCaseSensitive(root, "static_ip");
+            size_t passphrase_len = cJSON_IsString(passphrase) ? strlen(passphrase->valuestring) : 0;
+
+            if (!cJSON_IsString(ssid) || strlen(ssid->valuestring) == 0 || strlen(ssid->valuestring) > sizeof(request->wifi_config.sta.ssid))
+            {
+                  error = "ssid must be 1..32 characters";
+            }
+            else if (passphrase != NULL && !cJSON_IsString(passphrase))
+            {
+                  error = "passphrase must be a string";
+            }
+            else if ((passphrase_len > 0 && passphrase_len < 8) || passphrase_len > sizeof(request->wifi_config.sta.password) ||
+                     (passphrase_len == sizeof(request->wifi_config.sta.password) &&
+                      strspn(passphrase->valuestring, "0123456789abcdefABCDEF") != passphrase_len))
+            {
+                  error = "passphrase must be empty, 8..63 characters, or 64 hex digits";
+            }
+            else if (hostname != NULL && (!cJSON_IsString(hostname) || strlen(hostname->valuestring) == 0 ||
+                                          strlen(hostname->valuestring) >= sizeof(request->hostname) ||
+                                          strspn(hostname->valuestring, "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-") != strlen(hostname->valuestring) ||
+                                          hostname->valuestring[0] == '-'))
+            {
+                  error = "hostname must be 1..32 letters, digits and hyphens";
+            }
+            else if (static_ip != NULL && !cJSON_IsNull(static_ip) &&
+                     (!cJSON_IsObject(static_ip) || !_json_ip4(static_ip, "ip", &request->ip_info.ip) ||
+                      !_json_ip4(static_ip, "netmask", &request->ip_info.netmask) || !_json_ip4(static_ip, "gateway", &request->ip_info.gw) ||
+                      (cJSON_GetObjectItemCaseSensitive(static_ip, "dns") != NULL && !_json_ip4(static_ip, "dns", &request->dns))))
+            {
+                  error = "static_ip needs ip, netmask and gateway, and optional dns, as IPv4 addresses";
+            }
+            else
+            {
+                  memcpy(request->wifi_config.sta.ssid, ssid->valuestring, strlen(ssid->valuestring));
+                  if (passphrase_len > 0)
+                  {
+                        memcpy(request->wifi_config.sta.password, passphrase->valuestring, passphrase_len);
+                  }
+                  if (hostname != NULL)
+                  {
+                        strlcpy(request->hostname, hostname->valuestring, sizeof(request->hostname));
+                  }
+                  request->static_ip = static_ip != NULL && !cJSON_IsNull(static_ip);
+            }
+            cJSON_Delete(root);
+            return error;
+      }
+
+      /**
+       * @brief Send the JSON result of POST /api/provision
+       *
+       * @param req HTML request
+       * @param status HTTP status, for instance "200 OK"
+       * @param response JSON object; deleted
+       * @return esp_err_t
+       */
+      static esp_err_t _send_json_response(httpd_req_t *req, const char *status, cJSON *response)
+      {
+            char *json = cJSON_PrintUnformatted(response);
+            cJSON_Delete(response);
+            if (json == NULL)
+            {
+                  return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+            }
+            httpd_resp_set_status(req, status);
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+            esp_err_t err = httpd_resp_sendstr(req, json);
+            cJSON_free(json);
+            return err;
+      }
+
+      // settings of the STA before POST /api/provision applied those of the request; restored when the test fails
+      typedef struct
+      {
+            char hostname[33];
+            bool static_ip_set;
+            esp_netif_ip_info_t static_ip_info;
+            esp_ip4_addr_t static_dns;
+      } provision_rollback_t;
+
+      static provision_rollback_t s_provision_rollback;
+      static char s_provision_hostname[33]; // hostname stored when the test of POST /api/provision succeeds
+
+      /**
+       * @brief Credentials of POST /api/provision are tested: store hostname and static IP on success, otherwise restore
+       *        the previous ones. Called by the credentials test task
+       *
+       * @param connected result of the test
+       */
+      static void _provision_test_finished(bool connected)
+      {
+            if (connected)
+            {
+                  _save_station_config(s_provision_hostname);
+                  return;
+            }
+            esp_netif_set_hostname(esp_netif_sta_handler, s_provision_rollback.hostname);
+            s_static_ip_set = s_provision_rollback.static_ip_set;
+            s_static_ip_info = s_provision_rollback.static_ip_info;
+            s_static_dns = s_provision_rollback.static_dns;
+      }
+
+      /**
+       * @brief Headless provisioning, for scripts and test fixtures: POST /api/provision with a JSON body (see
+       *        _parse_provision_request()). The credentials are tested like those of the web page, in the credentials
+       *        test task: the answer is 202 with {"result":"testing"}, and the script polls GET /api/provision for the
+       *        result. 409 with {"result":"busy"} while another test runs; 400 with {"result":"invalid","error":"..."}
+       *        when the request is not valid. On success hostname and static IP are stored, and the portal is closed
+       *
+       * @param req HTML request
+       * @return esp_err_t
+       */
+      esp_err_t wifi_provisioning::provision_api_post_handler(httpd_req_t *req)
+      {
+            char body[ESP_PROVISION_API_MAX_LEN];
+            size_t body_len = 0;
+            provision_request_t request;
+            cJSON *response = cJSON_CreateObject();
+
+            if (req->content_len >= sizeof(body))
+            {
+                  cJSON_AddStringToObject(response, "result", "invalid");
+                  cJSON_AddStringToObject(response, "error", "body too long");
+                  return _send_json_response(req, HTTPD_400, response);
+            }
+            while (body_len < req->content_len)
+            {
+                  int received = httpd_req_recv(req, body + body_len, req->content_len - body_len);
+                  if (received == HTTPD_SOCK_ERR_TIMEOUT)
+                  {
+                        continue;
+                  }
+                  if (received <= 0)
+                  {
+                        cJSON_Delete(response);
+                        return ESP_FAIL;
+                  }
+                  body_len += received;
+            }
+            const char *error = _parse_provision_request(body, body_len, &request);
+            if (error != NULL)
+            {
+                  ESP_LOGW(TAG, "invalid provisioning request: %s", error);
+                  cJSON_AddStringToObject(response, "result", "invalid");
+                  cJSON_AddStringToObject(response, "error", error);
+                  return _send_json_response(req, HTTPD_400, response);
+            }
+
+            if ((xEventGroupGetBits(s_provisioning_event_group) & CREDENTIALS_TEST_IDLE_BIT) == 0)
+            {
+                  cJSON_AddStringToObject(response, "result", "busy");
+                  return _send_json_response(req, "409 Conflict", response);
+            }
+
+            // apply the settings for the test; restored by _provision_test_finished() when the test fails
+            const char *previous_hostname = NULL;
+            s_provision_rollback = {};
+            if (esp_netif_get_hostname(esp_netif_sta_handler, &previous_hostname) == ESP_OK && previous_hostname != NULL)
+            {
+                  strlcpy(s_provision_rollback.hostname, previous_hostname, sizeof(s_provision_rollback.hostname));
+            }
+            s_provision_rollback.static_ip_set = s_static_ip_set;
+            s_provision_rollback.static_ip_info = s_static_ip_info;
+            s_provision_rollback.static_dns = s_static_dns;
+            strlcpy(s_provision_hostname, request.hostname[0] != '\0' ? request.hostname : s_provision_rollback.hostname, sizeof(s_provision_hostname));
+            if (request.hostname[0] != '\0')
+            {
+                  esp_netif_set_hostname(esp_netif_sta_handler, request.hostname);
+            }
+            if (request.static_ip)
+            {
+                  s_static_ip_set = true;
+                  s_static_ip_info = request.ip_info;
+                  s_static_dns = request.dns;
+            }
+            ESP_LOGI(TAG, "provisioning request for SSID:%.32s", (const char *)request.wifi_config.sta.ssid);
+
+            esp_err_t err = _start_credentials_test(&request.wifi_config, _provision_test_finished);
+            if (err == ESP_ERR_INVALID_STATE) // a test started after the check above
+            {
+                  _provision_test_finished(false);
+                  cJSON_AddStringToObject(response, "result", "busy");
+                  return _send_json_response(req, "409 Conflict", response);
+            }
+            if (err != ESP_OK)
+            {
+                  _provision_test_finished(false);
+                  cJSON_AddStringToObject(response, "result", "error");
+                  cJSON_AddStringToObject(response, "error", "out of memory");
+                  return _send_json_response(req, HTTPD_500, response);
+            }
+            cJSON_AddStringToObject(response, "result", "testing");
+            return _send_json_response(req, "202 Accepted", response);
+      }
+
+      /**
+       * @brief Result of the last POST /api/provision, polled by the script: {"result":"testing"} while the test runs,
+       *        then {"result":"connected","ip":"...","time_to_ip_ms":...} or {"result":"not_found"|"connect_failed",
+       *        "reason":...,"elapsed_ms":...}, or {"result":"not_found"|"rejected","error":"..."} when the pre-flight check
+       *        failed. {"result":"idle"} when no test was started. Fetching a connected result closes the portal
+       *
+       * @param req HTML request
+       * @return esp_err_t
+       */
+      static esp_err_t provision_api_get_handler(httpd_req_t *req)
+      {
+            credentials_test_result_t result = _fetch_credentials_test_result();
+            cJSON *response = cJSON_CreateObject();
+
+            if (result.state != CREDENTIALS_TEST_DONE)
+            {
+                  cJSON_AddStringToObject(response, "result", result.state == CREDENTIALS_TEST_RUNNING ? "testing" : "idle");
+                  return _send_json_response(req, "200 OK", response);
+            }
+            if (result.rejected != NULL)
+            {
+                  cJSON_AddStringToObject(response, "result", result.reason == WIFI_REASON_NO_AP_FOUND ? "not_found" : "rejected");
+                  cJSON_AddStringToObject(response, "error", result.rejected);
+                  return _send_json_response(req, "200 OK", response);
+            }
+            cJSON_AddNumberToObject(response, "elapsed_ms", result.elapsed_ms);
+            if (!result.connected)
+            {
+                  cJSON_AddStringToObject(response, "result", result.reason == WIFI_REASON_NO_AP_FOUND ? "not_found" : "connect_failed");
+                  cJSON_AddNumberToObject(response, "reason", result.reason);
+                  return _send_json_response(req, "200 OK", response);
+            }
+            char ip[16];
+            snprintf(ip, sizeof(ip), IPSTR, IP2STR(&result.ip_info.ip));
+            cJSON_AddStringToObject(response, "result", "connected");
+            cJSON_AddStringToObject(response, "ip", ip);
+            cJSON_AddNumberToObject(response, "time_to_ip_ms", (s_got_ip_us - s_connect_start_us) / 1000);
+            cJSON_AddNumberToObject(response, "association_ms", s_metrics.association_us / 1000);
+            cJSON_AddNumberToObject(response, "dhcp_ms", s_metrics.dhcp_us / 1000);
+            esp_err_t err = _send_json_response(req, "200 OK", response);
+            xEventGroupSetBits(s_provisioning_event_group, TEST_RESULT_FETCHED_BIT); // after the response; closes the portal
+            return err;
+      }
+#endif // ESP_PROVISION_API
+#endif // ESP_PORTAL
+
+      /**
+       * @brief Reconnect timer expired: do the next connect attempt. Runs in the esp_timer task, not in the event loop
+       *
+       * @param arg not used
+       */
+      static void _reconnect_timer_callback(void *arg)
+      {
+            portENTER_CRITICAL(&s_reconnect_lock);
+            s_reconnect_status.state = RECONNECT_CONNECTING;
+            s_reconnect_status.next_attempt_us = 0;
+            portEXIT_CRITICAL(&s_reconnect_lock);
+            _set_state(PROVISIONING_STATE_CONNECTING, PROVISIONING_STATE_BIT(PROVISIONING_STATE_BACKOFF));
+            _start_connect_attempt();
+      }
+
+      /**
+       * @brief Schedule the next reconnect attempt: delay = initial delay * multiplier ^ (attempt - 1), capped at the
+       *        maximum delay, plus or minus a random jitter. The exponent is capped too: with multiplier 1 or initial
+       *        delay 0 the delay never reaches the maximum, and attempt grows without limit while reconnecting forever
+       *
+       * @param attempt nbr of the attempt to schedule, from 1
+       */
+      static void _schedule_reconnect(uint32_t attempt)
+      {
+            uint32_t exponent = attempt - 1 < ESP_RECONNECT_MAXIMUM_EXPONENT ? attempt - 1 : ESP_RECONNECT_MAXIMUM_EXPONENT;
+            uint64_t delay_ms = s_reconnect_config.initial_delay_ms;
+            for (uint32_t i = 0; i < exponent && delay_ms < s_reconnect_config.maximum_delay_ms; i++)
+            {
+                  delay_ms *= s_reconnect_config.multiplier;
+            }
+            if (delay_ms > s_reconnect_config.maximum_delay_ms)
+            {
+                  delay_ms = s_reconnect_config.maximum_delay_ms;
+            }
+            uint64_t jitter_ms = delay_ms * s_reconnect_config.jitter_percent / 100;
+            if (jitter_ms > 0)
+            {
+                  delay_ms = delay_ms - jitter_ms + esp_random() % (2 * jitter_ms + 1);
+            }
+
+            esp_timer_stop(s_reconnect_timer); // not running is no problem
+            int64_t next_attempt_us = esp_timer_get_time() + (int64_t)delay_ms * 1000;
+            portENTER_CRITICAL(&s_reconnect_lock);
+            s_reconnect_status = {RECONNECT_WAITING, attempt, next_attempt_us};
+            portEXIT_CRITICAL(&s_reconnect_lock);
+            _set_state(PROVISIONING_STATE_BACKOFF); // not while the portal tests credentials
+            esp_timer_start_once(s_reconnect_timer, delay_ms * 1000);
+            ESP_LOGI(TAG, "reconnect attempt %lu in %llu ms", (unsigned long)attempt, delay_ms);
+      }
+
+      /**
+       * @brief Listen interval of the min-power profile: ESP_MIN_POWER_LISTEN_INTERVAL, limited by the latency target
+       *
+       * @return listen interval in beacon intervals; 0 when the latency target does not allow the min-power profile
+       */
+      static uint8_t _min_power_listen_interval()
+      {
+            uint32_t listen_interval = s_adaptive_power_config.latency_target_ms / ESP_BEACON_INTERVAL_MS;
+            return listen_interval < ESP_MIN_POWER_LISTEN_INTERVAL ? listen_interval : ESP_MIN_POWER_LISTEN_INTERVAL;
+      }
+
+      /**
+       * @brief Listen interval the STA announces at association; the AP buffers frames for that long. Only used by
+       *        WIFI_PS_MAX_MODEM, so only the min-power and adaptive profiles need a long one
+       *
+       * @return listen interval in beacon intervals
+       */
+      static uint8_t _listen_interval()
+      {
+            if (s_power_profile == POWER_PROFILE_MIN_POWER || s_power_profile == POWER_PROFILE_ADAPTIVE)
+            {
+                  uint8_t listen_interval = _min_power_listen_interval();
+                  return listen_interval > 0 ? listen_interval : 1;
+            }
+            return ESP_DEFAULT_LISTEN_INTERVAL;
+      }
+
+      /**
+       * @brief Set PS mode and TX power of a profile; the listen interval is set at association (see _listen_interval())
+       *
+       * @param profile POWER_PROFILE_MAX_THROUGHPUT, POWER_PROFILE_BALANCED or POWER_PROFILE_MIN_POWER
+       */
+      static void _apply_power_profile(power_profile_t profile)
+      {
+            const power_profile_settings_t *settings = &s_power_profile_settings[profile];
+            esp_wifi_set_ps(settings->ps_type);
+            esp_wifi_set_max_tx_power(settings->max_tx_power);
+            s_active_power_profile = profile;
+            ESP_LOGI(TAG, "power profile %d: PS mode %d, TX power %d.%02d dBm", profile, settings->ps_type,
+                     settings->max_tx_power / 4, settings->max_tx_power % 4 * 25);
+      }
+
+#if ESP_ADAPTIVE_POWER
+      /**
+       * @brief Nbr of packets sent and received on all interfaces since boot
+       *
+       * @return uint32_t packet count; wraps around
+       */
+      static uint32_t _packet_count()
+      {
+            return lwip_stats.link.xmit + lwip_stats.link.recv;
+      }
+
+      /**
+       * @brief Adaptive profile: sample the packet rate, and select the profile. Up to a higher-power profile at once,
+       *        so traffic is not slowed down; down only after ESP_ADAPTIVE_POWER_IDLE_PERIODS quiet periods.
+       *        Runs in the esp_timer task
+       *
+       * @param arg not used
+       */
+      static void _adaptive_power_timer_callback(void *arg)
+      {
+            xSemaphoreTake(s_power_mutex, portMAX_DELAY);
+            if (s_power_profile != POWER_PROFILE_ADAPTIVE) // changed by set_power_profile() while this callback waited
+            {
+                  xSemaphoreGive(s_power_mutex);
+                  return;
+            }
+            uint32_t packet_count = _packet_count();
+            s_packets_per_s = (packet_count - s_last_packet_count) * 1000 / ESP_ADAPTIVE_POWER_PERIOD_MS;
+            s_last_packet_count = packet_count;
+
+            power_profile_t profile = POWER_PROFILE_BALANCED;
+            if (s_packets_per_s >= s_adaptive_power_config.high_packets_per_s)
+            {
+                  profile = POWER_PROFILE_MAX_THROUGHPUT;
+            }
+            else if (s_packets_per_s <= s_adaptive_power_config.low_packets_per_s)
+            {
+                  profile = POWER_PROFILE_MIN_POWER;
+            }
+            // the latency target limits how deep the radio may sleep: DTIM period (balanced), or listen interval (min power)
+            if (profile == POWER_PROFILE_MIN_POWER && _min_power_listen_interval() == 0)
+            {
+                  profile = POWER_PROFILE_BALANCED;
+            }
+            if (s_adaptive_power_config.latency_target_ms < ESP_BEACON_INTERVAL_MS)
+            {
+                  profile = POWER_PROFILE_MAX_THROUGHPUT;
+            }
+
+            // profiles are ordered from high to low power
+            s_quiet_periods = profile > s_active_power_profile ? s_quiet_periods + 1 : 0;
+            if (profile < s_active_power_profile ||
+                (profile > s_active_power_profile && s_quiet_periods >= ESP_ADAPTIVE_POWER_IDLE_PERIODS))
+            {
+                  _apply_power_profile(profile);
+                  s_quiet_periods = 0;
+            }
+            xSemaphoreGive(s_power_mutex);
+      }
+#endif
+
+      /**
+       * @brief Apply the power profile after a connect: the fixed profile, or for the adaptive profile, start with maximum
+       *        throughput (the application usually has data to send right after the connect) and sample the traffic.
+       *        Called from the connect task and from set_power_profile(); s_power_mutex keeps it apart from s_power_timer
+       *
+       */
+      static void _start_power_profile()
+      {
+            xSemaphoreTake(s_power_mutex, portMAX_DELAY);
+            s_power_profile_started = true;
+            power_profile_t profile = s_power_profile.load();
+#if ESP_ADAPTIVE_POWER
+            esp_timer_stop(s_power_timer); // not running is no problem
+            if (profile == POWER_PROFILE_ADAPTIVE)
+            {
+                  s_last_packet_count = _packet_count();
+                  s_quiet_periods = 0;
+                  esp_timer_start_periodic(s_power_timer, ESP_ADAPTIVE_POWER_PERIOD_MS * 1000ULL);
+            }
+#endif
+            _apply_power_profile(profile == POWER_PROFILE_ADAPTIVE ? POWER_PROFILE_MAX_THROUGHPUT : profile);
+            xSemaphoreGive(s_power_mutex);
+      }
+
+      esp_err_t wifi_provisioning::set_power_profile(power_profile_t profile)
+      {
+            if (profile > POWER_PROFILE_ADAPTIVE)
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            if (profile == POWER_PROFILE_ADAPTIVE && !ESP_ADAPTIVE_POWER)
+            {
+                  return ESP_ERR_NOT_SUPPORTED;
+            }
+            s_power_profile = profile;
+            if (s_power_profile_started)
+            {
+                  _start_power_profile();
+            }
+            return ESP_OK;
+      }
+
+      void wifi_provisioning::set_adaptive_power_config(const adaptive_power_config_t &config)
+      {
+            if (s_power_mutex != NULL)
+            {
+                  xSemaphoreTake(s_power_mutex, portMAX_DELAY);
+            }
+            s_adaptive_power_config = config;
+            if (s_power_mutex != NULL)
+            {
+                  xSemaphoreGive(s_power_mutex);
+            }
+      }
+
+      power_status_t wifi_provisioning::get_power_status()
+      {
+            return {s_power_profile, s_active_power_profile, s_packets_per_s};
+      }
+
+#if ESP_ROAMING
+      /**
+       * @brief Percentage of the frames of the last sample period that the link layer could not send. The wifi driver has
+       *        no public retry or failure counter; frames it refuses (TX queue full while it retransmits on a bad link)
+       *        are counted as drops by lwIP
+       *
+       * @return percentage; 0 without lwIP statistics, or when too few frames were sent to tell
+       */
+      static uint8_t _tx_failure_percent()
+      {
+#if ESP_TX_FAILURE_STATS
+            uint32_t frames = lwip_stats.link.xmit - s_last_tx_frames;
+            uint32_t failures = lwip_stats.link.drop - s_last_tx_failures;
+            s_last_tx_frames = lwip_stats.link.xmit;
+            s_last_tx_failures = lwip_stats.link.drop;
+            if (frames + failures >= ESP_ROAM_MINIMUM_TX_FRAMES)
+            {
+                  return failures * 100 / (frames + failures);
+            }
+#endif
+            return 0;
+      }
+
+      /**
+       * @brief Start a non-blocking scan for the BSSes of the SSID connected to, on one channel of s_roam_scan_channels,
+       *        or on all channels when there are none; the result is handled by _roam_scan_done()
+       *
+       * @return true when the scan started
+       */
+      static bool _start_roam_channel_scan()
+      {
+            static uint8_t ssid[sizeof(s_wifi_config.sta.ssid) + 1]; // null terminated copy
+            memcpy(ssid, _get_wifi_config().sta.ssid, sizeof(s_wifi_config.sta.ssid));
+            wifi_scan_config_t scan_config = {};
+            scan_config.ssid = ssid;
+            scan_config.channel = s_roam_scan_channel_count > 0 ? s_roam_scan_channels[s_roam_scan_channel_index] : 0;
+            scan_config.scan_time.active.min = ESP_ROAM_SCAN_TIME_MS;
+            scan_config.scan_time.active.max = ESP_ROAM_SCAN_TIME_MS;
+            s_roam_scan_active = true;
+            esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+            if (err != ESP_OK)
+            {
+                  s_roam_scan_active = false;
+                  ESP_LOGD(TAG, "roam scan not started (%s)", esp_err_to_name(err));
+                  return false;
+            }
+            return true;
+      }
+
+      /**
+       * @brief Start a roam scan: only the channels of the neighbor report of the AP, when it sent one since the link
+       *        became degraded, one after the other; otherwise all channels. A neighbor report is used for one scan, so
+       *        when its channels have no better BSS, the next scan covers all channels
+       *
+       */
+      static void _start_roam_scan()
+      {
+            portENTER_CRITICAL(&s_roam_lock);
+            memcpy(s_roam_scan_channels, s_neighbor_channels, sizeof(s_roam_scan_channels));
+            s_roam_scan_channel_count = s_neighbor_channel_count;
+            s_neighbor_channel_count = 0;
+            portEXIT_CRITICAL(&s_roam_lock);
+            s_roam_scan_channel_index = 0;
+            s_roam_candidate_found = false;
+            s_last_roam_scan_us = esp_timer_get_time();
+            if (!_start_roam_channel_scan())
+            {
+                  return;
+            }
+            portENTER_CRITICAL(&s_roam_lock);
+            s_roam_metrics.roam_scans++;
+            portEXIT_CRITICAL(&s_roam_lock);
+      }
+
+#if ESP_ROAM_RRM
+      /**
+       * @brief Neighbor report of the AP (802.11k): keep the channels of the neighbors for the next roam scan. Each
+       *        neighbor report element holds the BSSID (6 bytes), BSSID information (4), operating class, channel and PHY
+       *        type, and optional subelements. Runs in the task of the supplicant
+       *
+       * @param ctx not used
+       * @param report dialog token, followed by the neighbor report elements; NULL when there is no report
+       * @param report_len length of report
+       */
+      static void _neighbor_report_received(void *ctx, const uint8_t *report, size_t report_len)
+      {
+            uint8_t channels[ESP_ROAM_MAXIMUM_SCAN_CHANNELS];
+            uint8_t count = 0;
+            bool complete = true;
+            for (size_t pos = 1; report != NULL && pos + 2 <= report_len && pos + 2 + report[pos + 1] <= report_len;
+                 pos += 2 + report[pos + 1])
+            {
+                  const uint8_t *element = report + pos;
+                  if (element[0] != ESP_ELEMENT_ID_NEIGHBOR_REPORT || element[1] < ESP_NEIGHBOR_REPORT_MINIMUM_LENGTH)
+                  {
+                        continue;
+                  }
+                  uint8_t channel = element[2 + 11];
+                  if (channel == 0 || memchr(channels, channel, count) != NULL)
+                  {
+                        continue;
+                  }
+                  if (count == ESP_ROAM_MAXIMUM_SCAN_CHANNELS)
+                  {
+                        complete = false; // a scan of all channels is faster
+                        break;
+                  }
+                  channels[count++] = channel;
+            }
+            ESP_LOGI(TAG, "neighbor report: %d channels%s", count, complete ? "" : " and more; scan all channels");
+            portENTER_CRITICAL(&s_roam_lock);
+            memcpy(s_neighbor_channels, channels, count);
+            s_neighbor_channel_count = complete ? count : 0;
+            if (report != NULL)
+            {
+                  s_roam_metrics.neighbor_reports++;
+            }
+            portEXIT_CRITICAL(&s_roam_lock);
+      }
+#endif
+
+      /**
+       * @brief Sample RSSI and TX failures. The link becomes degraded after ESP_ROAM_DEGRADED_SAMPLES bad samples, and
+       *        good again only above the threshold plus the hysteresis. While degraded, ask the AP for its neighbors
+       *        (802.11k) and for a better BSS (802.11v; the driver follows its answer by itself), and when the STA is still
+       *        on the same BSS at the next sample, scan; at most every scan_interval_ms. Runs in the esp_timer task
+       *
+       * @param arg not used
+       */
+      static void _link_timer_callback(void *arg)
+      {
+            wifi_ap_record_t ap_info;
+            if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+            {
+                  s_degraded_samples = 0; // not associated; the reconnect scheduler or a roam is busy
+                  return;
+            }
+            uint8_t tx_failure_percent = _tx_failure_percent();
+            bool rssi_low = ap_info.rssi < s_roam_config.rssi_threshold_dbm;
+            bool tx_failing = s_roam_config.tx_failure_percent > 0 && tx_failure_percent >= s_roam_config.tx_failure_percent;
+            portENTER_CRITICAL(&s_roam_lock);
+            s_roam_metrics.rssi = ap_info.rssi;
+            s_roam_metrics.tx_failure_percent = tx_failure_percent;
+            if (rssi_low)
+            {
+                  s_roam_metrics.below_threshold_us += s_roam_config.sample_period_ms * 1000LL;
+            }
+            bool was_degraded = s_roam_metrics.degraded;
+            if (!was_degraded)
+            {
+                  s_degraded_samples = rssi_low || tx_failing ? s_degraded_samples + 1 : 0;
+                  s_roam_metrics.degraded = s_degraded_samples >= ESP_ROAM_DEGRADED_SAMPLES;
+            }
+            else if (ap_info.rssi >= s_roam_config.rssi_threshold_dbm + s_roam_config.hysteresis_db && !tx_failing)
+            {
+                  s_roam_metrics.degraded = false;
+                  s_degraded_samples = 0;
+            }
+            bool degraded = s_roam_metrics.degraded;
+            portEXIT_CRITICAL(&s_roam_lock);
+
+            if (!degraded)
+            {
+                  if (was_degraded)
+                  {
+                        ESP_LOGI(TAG, "link good again: RSSI %d dBm", ap_info.rssi);
+                  }
+                  return;
+            }
+            if (!was_degraded)
+            {
+                  s_btm_query_sent = false;
+                  s_neighbor_report_requested = false;
+                  ESP_LOGI(TAG, "link degraded: RSSI %d dBm, TX failures %d%%", ap_info.rssi, tx_failure_percent);
+            }
+
+            if (s_roam_state != ROAM_IDLE || s_roam_scan_active)
+            {
+                  return;
+            }
+            bool ap_asked = false; // the answer of the AP comes before the next sample; scan then
+#if ESP_ROAM_RRM
+            if (!s_neighbor_report_requested && esp_rrm_is_rrm_supported_connected_bss())
+            {
+                  s_neighbor_report_requested = true;
+                  portENTER_CRITICAL(&s_roam_lock);
+                  s_neighbor_channel_count = 0;
+                  portEXIT_CRITICAL(&s_roam_lock);
+                  ap_asked = esp_rrm_send_neighbor_rep_request(&_neighbor_report_received, NULL) == 0;
+                  ESP_LOGI(TAG, "neighbor report %s", ap_asked ? "requested from the AP" : "request failed");
+            }
+#endif
+#if ESP_ROAM_BTM
+            if (!s_btm_query_sent && esp_wnm_is_btm_supported_connected_bss())
+            {
+                  s_btm_query_sent = true;
+                  portENTER_CRITICAL(&s_roam_lock);
+                  s_roam_metrics.btm_queries++;
+                  portEXIT_CRITICAL(&s_roam_lock);
+                  esp_wnm_send_bss_transition_mgmt_query(tx_failing ? REASON_RETRANSMISSIONS : REASON_RSSI, NULL, 0);
+                  ESP_LOGI(TAG, "BSS transition query sent to the AP");
+                  ap_asked = true;
+            }
+#endif
+            if (ap_asked)
+            {
+                  return;
+            }
+            if (s_last_roam_scan_us == 0 || esp_timer_get_time() - s_last_roam_scan_us >= s_roam_config.scan_interval_ms * 1000LL)
+            {
+                  _start_roam_scan();
+            }
+      }
+
+      /**
+       * @brief Roam scan of a channel, or of all channels, done: keep the strongest other BSS of the SSID, and scan the
+       *        next channel of the neighbor report. After the last one, when the strongest other BSS is at least
+       *        margin_db stronger than the current one, connect to it directly, with its BSSID and channel. Runs in the
+       *        event loop task
+       *
+       */
+      static void _roam_scan_done()
+      {
+            s_roam_scan_active = false;
+            uint16_t ap_count = ESP_SCAN_MAXIMUM_RECORDS;
+            wifi_ap_record_t current;
+            wifi_ap_record_t *ap_records = (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * ap_count);
+            if (ap_records == NULL || esp_wifi_scan_get_ap_records(&ap_count, ap_records) != ESP_OK ||
+                esp_wifi_sta_get_ap_info(&current) != ESP_OK)
+            {
+                  free(ap_records);
+                  esp_wifi_clear_ap_list();
+                  return;
+            }
+            for (int i = 0; i < ap_count; i++)
+            {
+                  const wifi_ap_record_t *ap = &ap_records[i];
+                  if (memcmp(ap->bssid, current.bssid, sizeof(ap->bssid)) != 0 &&
+                      (!s_roam_candidate_found || ap->rssi > s_roam_candidate.rssi))
+                  {
+                        s_roam_candidate = *ap;
+                        s_roam_candidate_found = true;
+                  }
+            }
+            free(ap_records);
+            if (++s_roam_scan_channel_index < s_roam_scan_channel_count && _start_roam_channel_scan())
+            {
+                  return;
+            }
+
+            const wifi_ap_record_t *best = s_roam_candidate_found ? &s_roam_candidate : NULL;
+            if (best == NULL || best->rssi < current.rssi + s_roam_config.margin_db)
+            {
+                  ESP_LOGI(TAG, "no better BSS; current %d dBm, best other %d dBm", current.rssi, best == NULL ? -128 : best->rssi);
+                  return;
+            }
+
+            ESP_LOGI(TAG, "roam from " MACSTR " (%d dBm) to " MACSTR " (%d dBm) on channel %d", MAC2STR(current.bssid),
+                     current.rssi, MAC2STR(best->bssid), best->rssi, best->primary);
+            wifi_config_t wifi_config = _get_wifi_config();
+            wifi_config.sta.bssid_set = true;
+            memcpy(wifi_config.sta.bssid, best->bssid, sizeof(wifi_config.sta.bssid));
+            wifi_config.sta.channel = best->primary;
+            s_roam_state = ROAM_DISCONNECTING;
+            s_roam_start_us = esp_timer_get_time();
+            esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+            esp_wifi_disconnect(); // the disconnect event starts the connect to the new BSS
+      }
+#endif // ESP_ROAMING
+
+      /**
+       * @brief STA associated: a different BSS than before, while the link monitor runs, is a roam; by this component,
+       *        or by the driver after a BSS transition request of the AP
+       *
+       * @param bssid BSSID of the AP associated with
+       */
+      static void _roam_connected(const uint8_t *bssid)
+      {
+#if ESP_ROAMING
+            portENTER_CRITICAL(&s_roam_lock);
+            if (s_link_monitor_started && memcmp(s_roam_metrics.bssid, bssid, sizeof(s_roam_metrics.bssid)) != 0)
+            {
+                  s_roam_metrics.roams++;
+                  s_roam_metrics.degraded = false;
+                  s_degraded_samples = 0;
+                  s_neighbor_channel_count = 0; // neighbors of the previous AP
+            }
+            memcpy(s_roam_metrics.bssid, bssid, sizeof(s_roam_metrics.bssid));
+            portEXIT_CRITICAL(&s_roam_lock);
+#endif
+      }
+
+      /**
+       * @brief STA disconnected: when it is the disconnect of a roam, connect to the new BSS at once. When the connect to
+       *        the new BSS failed, forget the BSSID, so the reconnect scheduler connects to any BSS of the SSID
+       *
+       * @return true when the disconnect is handled by the roam; false when the reconnect scheduler must handle it
+       */
+      static bool _roam_disconnected()
+      {
+#if ESP_ROAMING
+            if (s_roam_state == ROAM_DISCONNECTING)
+            {
+                  s_roam_state = ROAM_CONNECTING;
+                  _set_state(PROVISIONING_STATE_CONNECTING, PROVISIONING_STATE_BIT(PROVISIONING_STATE_CONNECTED));
+                  _start_connect_attempt();
+                  return true;
+            }
+            if (s_roam_state == ROAM_CONNECTING)
+            {
+                  ESP_LOGW(TAG, "roam failed; reconnect to SSID:%.32s", (const char *)_get_wifi_config().sta.ssid);
+                  portENTER_CRITICAL(&s_roam_lock);
+                  s_roam_metrics.failed_roams++;
+                  portEXIT_CRITICAL(&s_roam_lock);
+                  s_roam_state = ROAM_IDLE;
+                  _unpin_bssid();
+            }
+#endif
+            return false;
+      }
+
+      /**
+       * @brief Got IP address: a roam of this component is finished. The driver config still holds the BSSID of the new
+       *        BSS; the first disconnect removes it before a reconnect is scheduled (see _unpin_bssid()), so a later link
+       *        loss reconnects to any BSS of the SSID
+       *
+       */
+      static void _roam_got_ip()
+      {
+#if ESP_ROAMING
+            if (s_roam_state == ROAM_CONNECTING)
+            {
+                  int64_t roam_us = esp_timer_get_time() - s_roam_start_us;
+                  portENTER_CRITICAL(&s_roam_lock);
+                  s_roam_metrics.last_roam_us = roam_us;
+                  portEXIT_CRITICAL(&s_roam_lock);
+                  ESP_LOGI(TAG, "roam done in %lld ms", roam_us / 1000);
+            }
+            s_roam_state = ROAM_IDLE;
+#endif
+      }
+
+      /**
+       * @brief Start the link monitor after a connect; the counters start from 0
+       *
+       */
+      static void _start_link_monitor()
+      {
+#if ESP_ROAMING
+            wifi_ap_record_t ap_info;
+            bool associated = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+            portENTER_CRITICAL(&s_roam_lock);
+            s_roam_metrics = {};
+            if (associated)
+            {
+                  memcpy(s_roam_metrics.bssid, ap_info.bssid, sizeof(s_roam_metrics.bssid));
+                  s_roam_metrics.rssi = ap_info.rssi;
+            }
+            s_neighbor_channel_count = 0;
+            portEXIT_CRITICAL(&s_roam_lock);
+            s_degraded_samples = 0;
+            s_last_roam_scan_us = 0;
+#if ESP_TX_FAILURE_STATS
+            s_last_tx_frames = lwip_stats.link.xmit;
+            s_last_tx_failures = lwip_stats.link.drop;
+#endif
+            s_link_monitor_started = true;
+            esp_timer_stop(s_link_timer); // not running is no problem
+            esp_timer_start_periodic(s_link_timer, s_roam_config.sample_period_ms * 1000ULL);
+#endif
+      }
+
+      void wifi_provisioning::set_roam_config(const roam_config_t &config)
+      {
+            s_roam_config = config;
+#if ESP_ROAMING
+            if (s_link_monitor_started)
+            {
+                  esp_timer_stop(s_link_timer);
+                  esp_timer_start_periodic(s_link_timer, s_roam_config.sample_period_ms * 1000ULL);
+            }
+#endif
+      }
+
+      roam_metrics_t wifi_provisioning::get_roam_metrics()
+      {
+            portENTER_CRITICAL(&s_roam_lock);
+            roam_metrics_t metrics = s_roam_metrics;
+            portEXIT_CRITICAL(&s_roam_lock);
+            return metrics;
+      }
+
+#if ESP_PORTAL
+      /**
+       * @brief Merge the results of a background scan into the scan table: per SSID the strongest BSSID is kept, entries
+       *        not seen for ESP_SCAN_TABLE_MAXIMUM_AGE scans are removed, and the table is sorted on RSSI, strongest first.
+       *        When known networks are watched, a known network in the scan sets KNOWN_NETWORK_VISIBLE_BIT.
+       *        Runs in the event loop task on WIFI_EVENT_SCAN_DONE
+       *
+       */
+      static void _update_scan_table()
+      {
+            bool known_network_visible = false;
+            uint16_t ap_count = ESP_SCAN_MAXIMUM_RECORDS;
+            wifi_ap_record_t *ap_records = (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * ap_count);
+            if (ap_records == NULL || esp_wifi_scan_get_ap_records(&ap_count, ap_records) != ESP_OK)
+            {
+                  free(ap_records);
+                  esp_wifi_clear_ap_list();
+                  return;
+            }
+
+            xSemaphoreTake(s_scan_table_mutex, portMAX_DELAY);
+            for (int i = 0; i < s_scan_table_count; i++)
+            {
+                  s_scan_table[i].age++;
+            }
+            for (int i = 0; i < ap_count; i++)
+            {
+                  const wifi_ap_record_t *ap = &ap_records[i];
+                  if (ap->ssid[0] == '\0')
+                  {
+                        continue; // hidden network
+                  }
+                  known_network_visible |= s_watch_known_networks && _find_network(&s_credentials, ap->ssid) != NULL;
+                  scan_entry_t *entry = NULL;
+                  for (int j = 0; j < s_scan_table_count && entry == NULL; j++)
+                  {
+                        if (strcmp(s_scan_table[j].ssid, (const char *)ap->ssid) == 0)
+                        {
+                              entry = &s_scan_table[j];
+                        }
+                  }
+                  if (entry != NULL && entry->age == 0 && entry->rssi >= ap->rssi)
+                  {
+                        continue; // stronger BSSID of this SSID already seen in this scan
+                  }
+                  if (entry == NULL && s_scan_table_count < ESP_SCAN_TABLE_SIZE)
+                  {
+                        entry = &s_scan_table[s_scan_table_count++];
+                  }
+                  else if (entry == NULL)
+                  {
+                        // replace the weakest, if weaker; searched, because entries updated by this scan are not sorted yet
+                        entry = &s_scan_table[0];
+                        for (int j = 1; j < s_scan_table_count; j++)
+                        {
+                              if (s_scan_table[j].rssi < entry->rssi)
+                              {
+                                    entry = &s_scan_table[j];
+                              }
+                        }
+                        if (entry->rssi >= ap->rssi)
+                        {
+                              continue;
+                        }
+                  }
+                  strlcpy(entry->ssid, (const char *)ap->ssid, sizeof(entry->ssid));
+                  memcpy(entry->bssid, ap->bssid, sizeof(entry->bssid));
+                  entry->rssi = ap->rssi;
+                  entry->channel = ap->primary;
+                  entry->authmode = ap->authmode;
+                  entry->age = 0;
+            }
+            // remove entries not seen for a while, and sort on RSSI (insertion sort; table is small and nearly sorted)
+            int count = 0;
+            for (int i = 0; i < s_scan_table_count; i++)
+            {
+                  if (s_scan_table[i].age > ESP_SCAN_TABLE_MAXIMUM_AGE)
+                  {
+                        continue;
+                  }
+                  scan_entry_t entry = s_scan_table[i];
+                  int pos = count++;
+                  while (pos > 0 && s_scan_table[pos - 1].rssi < entry.rssi)
+                  {
+                        s_scan_table[pos] = s_scan_table[pos - 1];
+                        pos--;
+                  }
+                  s_scan_table[pos] = entry;
+            }
+            s_scan_table_count = count;
+            xSemaphoreGive(s_scan_table_mutex);
+            free(ap_records);
+            ESP_LOGD(TAG, "scan table updated; %d networks", count);
+            if (known_network_visible)
+            {
+                  ESP_LOGI(TAG, "known network visible again");
+                  xEventGroupSetBits(s_provisioning_event_group, KNOWN_NETWORK_VISIBLE_BIT);
+            }
+      }
+
+      /**
+       * @brief Start a non-blocking background scan; called when the portal starts, and periodically by s_scan_timer.
+       *        While credentials are tested the scan is refused by the driver; the next period tries again
+       *
+       * @param arg not used
+       */
+      static void _start_background_scan(void *arg)
+      {
+            wifi_scan_config_t scan_config = {};
+            s_background_scan_active = true; // results are for the scan table; a pre-flight scan switches this off
+            scan_config.scan_time.active.min = ESP_BACKGROUND_SCAN_TIME_MS; // short dwell time per channel, so the softAP is not away for long
+            scan_config.scan_time.active.max = ESP_BACKGROUND_SCAN_TIME_MS;
+            esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+            if (err != ESP_OK)
+            {
+                  ESP_LOGD(TAG, "background scan not started (%s)", esp_err_to_name(err));
+            }
+      }
+
+#endif // ESP_PORTAL
+
+      /**
+       * @brief event handler, handling both soft_AP and STAT mode
+       *
+       * @param arg not used
+       * @param event_base type of event
+       * @param event_id Id of event to be handled
+       * @param event_data Data belonging to Id
+       */
+      static void wifi_event_handler(void *arg, esp_event_base_t event_base,
+                                     int32_t event_id, void *event_data)
+      {
+            if (event_id == WIFI_EVENT_AP_STACONNECTED)
+            { // softAP
+                  wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
+                  ESP_LOGI(TAG, "station " MACSTR " join, AID=%d",
+                           MAC2STR(event->mac), event->aid);
+            }
+            else if (event_id == WIFI_EVENT_AP_STADISCONNECTED)
+            { // softAP
+                  wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
+                  ESP_LOGI(TAG, "station " MACSTR " leave, AID=%d",
+                           MAC2STR(event->mac), event->aid);
+            }
+            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
+            {
+#if ESP_ROAMING
+                  if (s_roam_scan_active) // started by the link monitor while connected
+                  {
+                        _roam_scan_done();
+                  }
+#endif
+#if ESP_PORTAL
+                  if (s_background_scan_active) // results of blocking scans are read by the scanning task itself
+                  {
+                        _update_scan_table();
+                  }
+#endif
+            }
+            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+            { // STA mode
+                  if (s_sta_connect_on_start) // in APSTA provisioning mode there are no credentials to connect with yet
+                  {
+                        _start_connect_attempt();
+                  }
+                  xEventGroupSetBits(s_wifi_event_group, WIFI_STA_STARTED_BIT);
+            }
+            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+            { // STA mode
+                  wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+                  s_associated_us = esp_timer_get_time();
+                  _roam_connected(event->bssid);
+                  if (s_status == PROVISIONING_IN_PROGRESS)
+                  {
+                        s_metrics.association_us = s_associated_us - s_attempt_start_us;
+                  }
+            }
+            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+            { // STA mode
+                  wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+                  if (!s_sta_attempt_active)
+                  {
+                        return; // of the wifi stopped by stop(), handled after wifi was started again
+                  }
+                  s_sta_attempt_active = false;
+                  if (s_abort_pending)
+                  {
+                        ESP_LOGI(TAG, "connect attempt aborted");
+                        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+                        xEventGroupSetBits(s_wifi_event_group, WIFI_ABORTED_BIT);
+                        return;
+                  }
+                  s_last_disconnect_reason = event->reason;
+                  if (s_status == PROVISIONING_IN_PROGRESS)
+                  {
+                        s_metrics.retries++;
+                  }
+                  xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+                  if (_roam_disconnected())
+                  {
+                        ESP_LOGI(TAG, "disconnected for roam; connect to the new BSS");
+                        return;
+                  }
+                  if (s_reconnect_forever)
+                  {
+                        _unpin_bssid(); // was connected: reconnect to any AP of the SSID
+                  }
+                  if (s_reconnect_forever || s_retry_num < s_maximum_retry)
+                  {
+                        s_retry_num++;
+                        _schedule_reconnect(s_retry_num); // not directly; so a rebooting AP is not hammered by all its stations at the same moment
+                  }
+                  else
+                  {
+                        portENTER_CRITICAL(&s_reconnect_lock);
+                        s_reconnect_status.state = RECONNECT_IDLE;
+                        portEXIT_CRITICAL(&s_reconnect_lock);
+                        xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+                  }
+                  ESP_LOGI(TAG, "connect to the AP fail, reason %d", event->reason);
+            }
+            else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+            { // STA mode
+                  ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+                  ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+                  s_got_ip_us = esp_timer_get_time();
+                  if (s_status == PROVISIONING_IN_PROGRESS)
+                  {
+                        s_metrics.dhcp_us = s_got_ip_us - s_associated_us;
+                  }
+                  if (ESP_DHCP_REBOOT && !s_static_ip_set) // address obtained via DHCP; kept to ask for it after reboot
+                  {
+                        _save_dhcp_lease(&event->ip_info);
+                  }
+                  s_retry_num = 0;
+                  esp_timer_stop(s_reconnect_timer);
+                  portENTER_CRITICAL(&s_reconnect_lock);
+                  s_reconnect_status = {RECONNECT_IDLE, 0, 0};
+                  portEXIT_CRITICAL(&s_reconnect_lock);
+                  _roam_got_ip();
+                  _set_state(PROVISIONING_STATE_CONNECTED); // not while the portal tests credentials
+                  xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+            }
+      }
+
+      /**
+       * @brief Initialize TCP/IP stack, default event loop, STA netif and wifi driver, and register the event handler.
+       *        Done only once; both the captive portal and STA mode use the same stack, so switching from
+       *        provisioning to STA mode does not require a complete deinit/init cycle
+       *
+       */
+      static void _init_wifi_stack()
+      {
+            static bool tcpip_initialized = false; // TCP/IP stack and default event loop are never released
+            if (s_wifi_stack_initialized)
+            {
+                  return;
+            }
+            int64_t start_us = esp_timer_get_time();
+            if (!tcpip_initialized)
+            {
+                  ESP_ERROR_CHECK(esp_netif_init()); // Initialize the underlying TCP/IP stack; only call once
+                  esp_err_t err = esp_event_loop_create_default();
+                  if (err != ESP_ERR_INVALID_STATE) // already created by the application is no problem
+                  {
+                        ESP_ERROR_CHECK(err);
+                  }
+                  tcpip_initialized = true;
+            }
+            s_heap_free_before_init = esp_get_free_heap_size();
+
+            esp_netif_sta_handler = esp_netif_create_default_wifi_sta();
+            ESP_LOGI(TAG, "set hostname"); // must be done before connection
+            station_config_record_t station_config;
+            bool station_config_stored = _get_station_config(&station_config); // supplied via the provisioning API
+            ESP_ERROR_CHECK(esp_netif_set_hostname(esp_netif_sta_handler, station_config_stored && station_config.hostname[0] != '\0'
+                                                                              ? station_config.hostname
+                                                                              : ESP_WIFI_STA_HOSTNAME));
+            if (station_config_stored && station_config.static_ip && !s_static_ip_set) // set_static_ip() has priority
+            {
+                  s_static_ip_set = true;
+                  s_static_ip_info = station_config.ip_info;
+                  s_static_dns = station_config.dns;
+            }
+
+            wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+            cfg.nvs_enable = !s_warm_start; // the STA config is always set by this component; the driver copy in NVS is not needed
+            ESP_ERROR_CHECK(esp_wifi_init(&cfg)); // Initialize WiFi Allocate resource for WiFi driver, such as WiFi control structure, RX/TX buffer, WiFi NVS structure etc. This WiFi also starts WiFi task.
+
+            s_wifi_event_group = xEventGroupCreate(); // create event group before starting wifi; the event handler sets its bits
+
+            esp_timer_create_args_t reconnect_timer_args = {};
+            reconnect_timer_args.callback = &_reconnect_timer_callback;
+            reconnect_timer_args.name = "wifi_reconnect";
+            ESP_ERROR_CHECK(esp_timer_create(&reconnect_timer_args, &s_reconnect_timer));
+
+            s_power_mutex = xSemaphoreCreateMutex();
+#if ESP_ADAPTIVE_POWER
+            esp_timer_create_args_t power_timer_args = {};
+            power_timer_args.callback = &_adaptive_power_timer_callback;
+            power_timer_args.name = "wifi_power";
+            ESP_ERROR_CHECK(esp_timer_create(&power_timer_args, &s_power_timer));
+#endif
+#if ESP_ROAMING
+            esp_timer_create_args_t link_timer_args = {};
+            link_timer_args.callback = &_link_timer_callback;
+            link_timer_args.name = "wifi_link";
+            ESP_ERROR_CHECK(esp_timer_create(&link_timer_args, &s_link_timer));
+#endif
+            // register last: an event of the wifi stopped by an earlier stop() can still be in the queue, and the handler
+            // uses the event group and timers
+            ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
+                                                                ESP_EVENT_ANY_ID,
+                                                                &wifi_event_handler,
+                                                                NULL,
+                                                                &s_wifi_event_handler_instance)); // kept, to unregister in stop()
+            ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+                                                                IP_EVENT_STA_GOT_IP, // only for GOT_IP event
+                                                                &wifi_event_handler, // this handler is for both SoftAP as well as STA
+                                                                NULL,
+                                                                &s_ip_event_handler_instance));
+            s_metrics.stack_init_us = esp_timer_get_time() - start_us;
+            s_wifi_stack_initialized = true;
+      }
+
+      /**
+       * @brief Release everything _init_wifi_stack() and the captive portal allocated, in reverse order. The event handlers
+       *        are unregistered first, so stopping wifi does not schedule a reconnect
+       *
+       */
+      static void _deinit_wifi_stack()
+      {
+            if (!s_wifi_stack_initialized)
+            {
+                  return;
+            }
+            ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, s_ip_event_handler_instance));
+            ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, s_wifi_event_handler_instance));
+            s_ip_event_handler_instance = NULL;
+            s_wifi_event_handler_instance = NULL;
+            s_sta_attempt_active = false; // the DISCONNECTED event of esp_wifi_stop() below is not handled
+
+            esp_timer_stop(s_reconnect_timer); // not running is no problem
+            esp_timer_delete(s_reconnect_timer);
+            s_reconnect_timer = NULL;
+#if ESP_ADAPTIVE_POWER
+            esp_timer_stop(s_power_timer);
+            esp_timer_delete(s_power_timer);
+            s_power_timer = NULL;
+#endif
+            s_power_profile_started = false;
+            vSemaphoreDelete(s_power_mutex);
+            s_power_mutex = NULL;
+#if ESP_ROAMING
+            esp_timer_stop(s_link_timer);
+            esp_timer_delete(s_link_timer);
+            s_link_timer = NULL;
+            s_link_monitor_started = false;
+            s_roam_scan_active = false;
+            s_roam_state = ROAM_IDLE;
+#endif
+#if ESP_PORTAL
+            if (s_scan_timer != NULL) // created when the portal was started the first time
+            {
+                  esp_timer_delete(s_scan_timer);
+                  s_scan_timer = NULL;
+                  vSemaphoreDelete(s_scan_table_mutex);
+                  s_scan_table_mutex = NULL;
+                  s_scan_table_count = 0;
+            }
+#endif
+
+            esp_wifi_stop(); // not started is no problem
+            if (s_radio_on_start_us != 0)
+            {
+                  int64_t radio_on_us = esp_timer_get_time() - s_radio_on_start_us;
+                  ESP_LOGI(TAG, "radio was on %lld ms", radio_on_us / 1000);
+                  _save_rtc_radio_on_time(radio_on_us); // reported by the next wake from deep sleep
+                  s_radio_on_start_us = 0;
+            }
+            ESP_ERROR_CHECK(esp_wifi_deinit());
+            esp_netif_destroy_default_wifi(esp_netif_sta_handler); // also unregisters the default wifi handlers of the netif
+            esp_netif_sta_handler = NULL;
+            vEventGroupDelete(s_wifi_event_group);
+            s_wifi_event_group = NULL;
+
+            s_reconnect_forever = false;
+            portENTER_CRITICAL(&s_reconnect_lock);
+            s_reconnect_status = {RECONNECT_IDLE, 0, 0};
+            portEXIT_CRITICAL(&s_reconnect_lock);
+            s_wifi_stack_initialized = false;
+            ESP_LOGI(TAG, "wifi stopped; free heap %lu bytes, %ld bytes less than before init; minimum free heap since boot %lu bytes",
+                     (unsigned long)esp_get_free_heap_size(), (long)s_heap_free_before_init - (long)esp_get_free_heap_size(),
+                     (unsigned long)esp_get_minimum_free_heap_size());
+      }
+
+      esp_err_t wifi_provisioning::stop()
+      {
+            if (s_status == PROVISIONING_IN_PROGRESS)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            _deinit_wifi_stack();
+            if (s_provisioning_event_group != NULL)
+            {
+                  // not deleted: a task may still wait for it. CONNECT_DONE_BIT stays, the last connect is done
+                  xEventGroupClearBits(s_provisioning_event_group, CREDENTIALS_SET_BIT | CREDENTIALS_TEST_IDLE_BIT |
+                                                                       TEST_RESULT_FETCHED_BIT | KNOWN_NETWORK_VISIBLE_BIT);
+            }
+            s_status = PROVISIONING_NOT_STARTED;
+            _set_state(PROVISIONING_STATE_IDLE);
+            return ESP_OK;
+      }
+
+#if ESP_PORTAL
+      /**
+       * @brief Scan, and select the softAP channel with the least interference. Every BSS adds its signal strength
+       *        (RSSI + 100 dB) to each channel its 20 MHz channel overlaps, weighted by the overlap. The channel of the
+       *        network the STA will connect to, when already known, gets a bonus: in APSTA mode the softAP has to
+       *        follow the STA to that channel anyway, which makes the phone lose the portal for a moment.
+       *        Wifi must be initialized and stopped
+       *
+       * @return channel allowed in the configured country; ESP_WIFI_SOFTAP_CHANNEL when the scan fails
+       */
+      static uint8_t _select_softap_channel()
+      {
+            int score[ESP_WIFI_MAXIMUM_CHANNEL + 1] = {}; // index is channel; lower is better
+            wifi_country_t country = {};
+            wifi_scan_config_t scan_config = {};
+            uint16_t ap_count = ESP_SCAN_MAXIMUM_RECORDS;
+            uint8_t target_channel = 0;
+            int8_t target_rssi = -128;
+
+            wifi_ap_record_t *ap_records = (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * ap_count);
+            esp_err_t err = ap_records == NULL ? ESP_ERR_NO_MEM : esp_wifi_set_mode(WIFI_MODE_STA);
+            if (err == ESP_OK)
+            {
+                  err = _wifi_start();
+            }
+            if (err == ESP_OK)
+            {
+                  err = esp_wifi_scan_start(&scan_config, true);
             }
-            else if (event_id == WIFI_EVENT_AP_STADISCONNECTED)
-            { // softAP
-                  wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
-                  ESP_LOGI(TAG, "station " MACSTR " leave, AID=%d",
-                           MAC2STR(event->mac), event->aid);
+            if (err == ESP_OK)
+            {
+                  err = esp_wifi_scan_get_ap_records(&ap_count, ap_records);
             }
-            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
-            { // STA mode
-                  esp_wifi_connect();
+            esp_wifi_stop();
+            if (err != ESP_OK || esp_wifi_get_country(&country) != ESP_OK)
+            {
+                  ESP_LOGW(TAG, "channel scan failed; softAP on channel %d", ESP_WIFI_SOFTAP_CHANNEL);
+                  free(ap_records);
+                  return ESP_WIFI_SOFTAP_CHANNEL;
             }
-            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
-            { // STA mode
-                  if (s_retry_num < ESP_MAXIMUM_RETRY)
+
+            wifi_config_t wifi_config = _get_wifi_config(); // the softAP goes on the channel of the known network, if in reach
+            uint8_t first_channel = country.schan;
+            uint8_t last_channel = country.schan + country.nchan - 1;
+            if (last_channel > ESP_WIFI_MAXIMUM_CHANNEL)
+            {
+                  last_channel = ESP_WIFI_MAXIMUM_CHANNEL;
+            }
+            for (int i = 0; i < ap_count; i++)
+            {
+                  const wifi_ap_record_t *ap = &ap_records[i];
+                  int weight = ap->rssi + 100 > 1 ? ap->rssi + 100 : 1;
+                  for (int channel = first_channel; channel <= last_channel; channel++)
                   {
-                        esp_wifi_connect();
-                        s_retry_num++;
-                        ESP_LOGI(TAG, "retry to connect to the AP");
+                        int distance = abs(channel - ap->primary);
+                        if (distance < ESP_CHANNEL_OVERLAP) // 20 MHz channels 5 apart do not overlap
+                        {
+                              score[channel] += weight * (ESP_CHANNEL_OVERLAP - distance);
+                        }
                   }
-                  else
+                  if (wifi_config.sta.ssid[0] != '\0' &&
+                      strncmp((const char *)ap->ssid, (const char *)wifi_config.sta.ssid, sizeof(wifi_config.sta.ssid)) == 0 &&
+                      ap->rssi > target_rssi)
                   {
-                        xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+                        target_channel = ap->primary;
+                        target_rssi = ap->rssi;
                   }
-                  ESP_LOGI(TAG, "connect to the AP fail");
             }
-            else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
-            { // STA mode
-                  ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-                  ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-                  s_retry_num = 0;
-                  xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+            free(ap_records);
+            if (target_channel >= first_channel && target_channel <= last_channel)
+            {
+                  score[target_channel] -= ESP_SOFTAP_TARGET_CHANNEL_BONUS;
             }
-            else if (event_id == WIFI_EVENT_AP_STACONNECTED)
-            { // STA mode
-                  wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
-                  ESP_LOGI(TAG, "station " MACSTR " join, AID=%d",
-                           MAC2STR(event->mac), event->aid);
+
+            uint8_t best_channel = ESP_WIFI_SOFTAP_CHANNEL;
+            if (best_channel < first_channel || best_channel > last_channel)
+            {
+                  best_channel = first_channel;
             }
-            else if (event_id == WIFI_EVENT_AP_STADISCONNECTED)
-            { // STA mode
-                  wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
-                  ESP_LOGI(TAG, "station " MACSTR " leave, AID=%d",
-                           MAC2STR(event->mac), event->aid);
+            for (int channel = first_channel; channel <= last_channel; channel++)
+            {
+                  if (score[channel] < score[best_channel])
+                  {
+                        best_channel = channel;
+                  }
             }
+            ESP_LOGI(TAG, "%d BSSes found; softAP on channel %d (score %d, channel %d: %d)%s", ap_count, best_channel,
+                     score[best_channel], ESP_WIFI_SOFTAP_CHANNEL, score[ESP_WIFI_SOFTAP_CHANNEL],
+                     best_channel == target_channel ? "; channel of known network" : "");
+            return best_channel;
       }
 
       /**
-       * @brief Init wifi in softAP mode, so that wifi credentials can be asked for
+       * @brief Init wifi in APSTA mode, so that wifi credentials can be asked for, and tested while the softAP stays up
        *
        */
       void wifi_provisioning::wifi_init_softap(void)
       {
             ESP_LOGI(TAG, "Start Wifi in SoftAP mode");
-            ESP_ERROR_CHECK(esp_netif_init()); // Initialize the underlying TCP/IP stack; only call once
-            ESP_ERROR_CHECK(esp_event_loop_create_default());
-            esp_netif_handler = esp_netif_create_default_wifi_ap(); // create esp_netif object with default WiFi access point config, attaches the netif to wifi and registers default wifi handlers
-
-            wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-            ESP_ERROR_CHECK(esp_wifi_init(&cfg)); // Initialize WiFi Allocate resource for WiFi driver, such as WiFi control structure, RX/TX buffer, WiFi NVS structure etc. This WiFi also starts WiFi task.
+            _init_wifi_stack();
+            esp_netif_ap_handler = esp_netif_create_default_wifi_ap(); // create esp_netif object with default WiFi access point config, attaches the netif to wifi and registers default wifi handlers
 
-            ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-                                                                ESP_EVENT_ANY_ID,
-                                                                &wifi_event_handler,
-                                                                NULL,
-                                                                NULL));
+            s_sta_connect_on_start = false; // STA is only used to scan, and to test supplied credentials
 
             wifi_config_t wifi_config = {};
             strcpy((char *)wifi_config.ap.ssid, ESP_WIFI_SOFTAP_SSID); // C++ does not allow conversion from cons string to unin8[32]
             wifi_config.ap.ssid_len = strlen(ESP_WIFI_SOFTAP_SSID);
-            wifi_config.ap.channel = ESP_WIFI_SOFTAP_CHANNEL;
+            wifi_config.ap.channel = ESP_SOFTAP_AUTO_CHANNEL ? _select_softap_channel() : ESP_WIFI_SOFTAP_CHANNEL;
             strcpy((char *)wifi_config.ap.password, ESP_WIFI_SOFTAP_PASS);
             wifi_config.ap.max_connection = ESP_WIFI_SOFTAP_MAX_STA_CONN;
             wifi_config.ap.authmode = WIFI_AUTH_WPA_WPA2_PSK;
@@ -310,18 +3899,19 @@ namespace WIFI_PROVISIONING
                   wifi_config.ap.authmode = WIFI_AUTH_OPEN;
             }
 
-            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));               // set wifi operating mode
+            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));            // set wifi operating mode
             ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config)); // set wifi config
-            ESP_ERROR_CHECK(esp_wifi_start());                              // Start WiFi according to current configuration
+            ESP_ERROR_CHECK(_wifi_start());                                 // Start WiFi according to current configuration
 
             ESP_LOGI(TAG, "wifi_init_softap finished. SSID:%s password:%s channel:%d",
-                     ESP_WIFI_SOFTAP_SSID, ESP_WIFI_SOFTAP_PASS, ESP_WIFI_SOFTAP_CHANNEL);
+                     ESP_WIFI_SOFTAP_SSID, ESP_SECRET(ESP_WIFI_SOFTAP_PASS), wifi_config.ap.channel);
             ESP_LOGI(TAG, "wifi_init_softap - end");
       } // wifi_init_softap
 
       /**
-       * @brief Process HTTP GET from root URL; if nov valid wifi credentials are stored in NVS, wifi credentials are asked for.
-       *        Otherwise the GET is handled depending of the type of user logged in, or no user logged in at all
+       * @brief Process HTTP GET from root URL: ask for wifi credentials. While supplied credentials are tested, or after
+       *        a successful test until the portal closes, redirect to the result page instead, so a reload of the page
+       *        or a second phone does not start another test meanwhile
        *
        * @param req
        * @return esp_err_t
@@ -330,11 +3920,128 @@ namespace WIFI_PROVISIONING
       {
             ESP_LOGI(TAG, "index_get_handler");
 
-            if (!_credentials_stored_in_NVS())
+            credentials_test_result_t result = _fetch_credentials_test_result();
+            if (result.state == CREDENTIALS_TEST_RUNNING || (result.state == CREDENTIALS_TEST_DONE && result.connected))
             {
-                  setWifiParams(req); // in SoftAP mode, ask for wifi credentials
+                  httpd_resp_set_status(req, "302 Found");
+                  httpd_resp_set_hdr(req, "Location", "/control/result");
+                  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+                  return httpd_resp_send(req, NULL, 0);
             }
-            return ESP_OK;
+            return setWifiParams(req); // no form in the request: sends the page that asks for wifi credentials
+      }
+
+      /**
+       * @brief Serve the scan table as JSON: [{"ssid":"...","rssi":-50,"ch":6,"auth":3},...], strongest first.
+       *        Only reads the table that is kept up to date by the background scans, so it never waits for a scan
+       *
+       * @param req HTML request
+       * @return esp_err_t
+       */
+      static esp_err_t scan_json_get_handler(httpd_req_t *req)
+      {
+            char json[6 * sizeof(s_scan_table[0].ssid) + 64]; // one entry; every SSID character escaped as \u00XX in the worst case
+
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+            httpd_resp_send_chunk(req, "[", 1);
+            xSemaphoreTake(s_scan_table_mutex, portMAX_DELAY);
+            for (int i = 0; i < s_scan_table_count; i++)
+            {
+                  // SSID is arbitrary bytes: escape quote, backslash and control characters
+                  int len = snprintf(json, sizeof(json), "%s{\"ssid\":\"", i == 0 ? "" : ",");
+                  for (const char *c = s_scan_table[i].ssid; *c != '\0'; c++)
+                  {
+                        if (*c == '"' || *c == '\\')
+                              len += snprintf(json + len, sizeof(json) - len, "\\%c", *c);
+                        else if ((uint8_t)*c < 0x20)
+                              len += snprintf(json + len, sizeof(json) - len, "\\u%04x", *c);
+                        else
+                              json[len++] = *c;
+                  }
+                  len += snprintf(json + len, sizeof(json) - len, "\",\"rssi\":%d,\"ch\":%d,\"auth\":%d}",
+                                  s_scan_table[i].rssi, s_scan_table[i].channel, s_scan_table[i].authmode);
+                  httpd_resp_send_chunk(req, json, len);
+            }
+            xSemaphoreGive(s_scan_table_mutex);
+            httpd_resp_send_chunk(req, "]", 1);
+            return httpd_resp_send_chunk(req, NULL, 0);
+      }
+
+#if ESP_METRICS_HTTP_ENDPOINT
+      /**
+       * @brief Serve the metrics of the last connect_to_network() and the histogram of previous boots as JSON; all times in microseconds
+       *
+       * @param req HTML request
+       * @return esp_err_t
+       */
+      static esp_err_t metrics_get_handler(httpd_req_t *req)
+      {
+            char json[160];
+
+            _load_histogram();
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+            snprintf(json, sizeof(json), "{\"nvs_read\":%lld,\"stack_init\":%lld,\"portal\":%lld,\"wifi_start\":%lld,\"scan\":%lld,",
+                     (long long)s_metrics.nvs_read_us, (long long)s_metrics.stack_init_us, (long long)s_metrics.portal_us,
+                     (long long)s_metrics.wifi_start_us, (long long)s_metrics.scan_us);
+            httpd_resp_sendstr_chunk(req, json);
+            snprintf(json, sizeof(json), "\"association\":%lld,\"dhcp\":%lld,\"time_to_ip\":%lld,\"retries\":%lu,\"fast_reconnect\":%s,",
+                     (long long)s_metrics.association_us, (long long)s_metrics.dhcp_us, (long long)s_metrics.time_to_ip_us,
+                     (unsigned long)s_metrics.retries,
+                     s_metrics.fast_reconnect ? "true" : "false");
+            httpd_resp_sendstr_chunk(req, json);
+            snprintf(json, sizeof(json), "\"heap_used\":%ld,\"heap_minimum_free\":%lu,",
+                     (long)s_metrics.heap_used, (unsigned long)s_metrics.heap_minimum_free);
+            httpd_resp_sendstr_chunk(req, json);
+            snprintf(json, sizeof(json), "\"warm_start\":%s,\"radio_on\":%lld,\"previous_radio_on\":%lld,",
+                     s_metrics.warm_start ? "true" : "false", (long long)s_metrics.radio_on_us,
+                     (long long)s_metrics.previous_radio_on_us);
+            httpd_resp_sendstr_chunk(req, json);
+            snprintf(json, sizeof(json), "\"boot_count\":%lu,\"failures\":%u,\"time_to_ip_histogram\":[",
+                     (unsigned long)s_histogram.boot_count, s_histogram.failures);
+            httpd_resp_sendstr_chunk(req, json);
+            for (int i = 0; i < CONNECT_HISTOGRAM_BUCKETS; i++)
+            {
+                  snprintf(json, sizeof(json), "%s%u", i == 0 ? "" : ",", s_histogram.time_to_ip[i]);
+                  httpd_resp_sendstr_chunk(req, json);
+            }
+            httpd_resp_sendstr_chunk(req, "],\"retries_histogram\":[");
+            for (int i = 0; i < CONNECT_HISTOGRAM_BUCKETS; i++)
+            {
+                  snprintf(json, sizeof(json), "%s%u", i == 0 ? "" : ",", s_histogram.retries[i]);
+                  httpd_resp_sendstr_chunk(req, json);
+            }
+            httpd_resp_sendstr_chunk(req, "]}");
+            return httpd_resp_sendstr_chunk(req, NULL);
+      }
+#endif
+
+      /**
+       * @brief Answer a connectivity probe of an operating system, or any unknown URL, with a redirect to the portal.
+       *        Because the expected answer (for instance 204 or "Success") is not given, the OS shows the portal at once
+       *
+       * @param req HTML request
+       * @return esp_err_t
+       */
+      static esp_err_t connectivity_probe_handler(httpd_req_t *req)
+      {
+            httpd_resp_set_status(req, "302 Found");
+            httpd_resp_set_hdr(req, "Location", s_portal_url);
+            httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+            return httpd_resp_send(req, NULL, 0);
+      }
+
+      /**
+       * @brief 404 handler of the portal: redirect to the portal, so probes not in CONNECTIVITY_PROBE_URIS also work
+       *
+       * @param req HTML request
+       * @param error not used
+       * @return esp_err_t
+       */
+      static esp_err_t not_found_handler(httpd_req_t *req, httpd_err_code_t error)
+      {
+            return connectivity_probe_handler(req);
       }
 
       /**
@@ -344,7 +4051,10 @@ namespace WIFI_PROVISIONING
       void wifi_provisioning::startHTTPServer()
       {
             httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-            config.stack_size = 8000; // to avoid stack overflow
+            config.stack_size = ESP_HTTPD_STACK_SIZE; // credentials are tested in their own task
+            config.max_open_sockets = ESP_HTTPD_MAX_OPEN_SOCKETS;
+            config.max_uri_handlers = 5 + ESP_METRICS_HTTP_ENDPOINT + 2 * ESP_PROVISION_API + CONNECTIVITY_PROBE_URI_COUNT + web_assets_count; // every embedded web asset has its own URI
+            config.lru_purge_enable = true; // phones open many connections for probes; close the oldest instead of refusing new ones
 
             // httpd_uri_t logout_uri = {
             //     .uri = "/logout",
@@ -366,6 +4076,24 @@ namespace WIFI_PROVISIONING
                 .handler = setWifiParams,
                 .user_ctx = NULL};
 
+            httpd_uri_t scan_json_uri = {
+                .uri = "/scan.json", // networks found by background scan; used in index.html to choose the SSID
+                .method = HTTP_GET,
+                .handler = scan_json_get_handler,
+                .user_ctx = NULL};
+
+            httpd_uri_t setWifiParams_post_uri = {
+                .uri = "/control", // form of index.html is posted, so credentials do not end up in URL and logs
+                .method = HTTP_POST,
+                .handler = setWifiParams,
+                .user_ctx = NULL};
+
+            httpd_uri_t test_result_uri = {
+                .uri = "/control/result", // polled by the page that is shown while the credentials are tested
+                .method = HTTP_GET,
+                .handler = credentials_test_result_get_handler,
+                .user_ctx = NULL};
+
             // httpd_uri_t update_post = {
             //     .uri = "/update_post",
             //     .method = HTTP_POST,
@@ -380,6 +4108,50 @@ namespace WIFI_PROVISIONING
                   // httpd_register_uri_handler(httpd_handle, &logout_uri);
                   httpd_register_uri_handler(httpd_handle, &index_uri);
                   httpd_register_uri_handler(httpd_handle, &setWifiParams_uri);
+                  httpd_register_uri_handler(httpd_handle, &setWifiParams_post_uri);
+                  httpd_register_uri_handler(httpd_handle, &test_result_uri);
+                  httpd_register_uri_handler(httpd_handle, &scan_json_uri);
+#if ESP_PROVISION_API
+                  httpd_uri_t provision_api_uri = {
+                      .uri = "/api/provision", // JSON; for scripts and test fixtures
+                      .method = HTTP_POST,
+                      .handler = provision_api_post_handler,
+                      .user_ctx = NULL};
+                  httpd_register_uri_handler(httpd_handle, &provision_api_uri);
+                  httpd_uri_t provision_api_result_uri = {
+                      .uri = "/api/provision", // polled for the result of the POST
+                      .method = HTTP_GET,
+                      .handler = provision_api_get_handler,
+                      .user_ctx = NULL};
+                  httpd_register_uri_handler(httpd_handle, &provision_api_result_uri);
+#endif
+#if ESP_METRICS_HTTP_ENDPOINT
+                  httpd_uri_t metrics_uri = {
+                      .uri = "/metrics",
+                      .method = HTTP_GET,
+                      .handler = metrics_get_handler,
+                      .user_ctx = NULL};
+                  httpd_register_uri_handler(httpd_handle, &metrics_uri);
+#endif
+                  for (size_t i = 0; i < web_assets_count; i++)
+                  {
+                        httpd_uri_t web_asset_uri = {
+                            .uri = web_assets[i].uri,
+                            .method = HTTP_GET,
+                            .handler = web_asset_get_handler,
+                            .user_ctx = (void *)&web_assets[i]};
+                        httpd_register_uri_handler(httpd_handle, &web_asset_uri);
+                  }
+                  for (size_t i = 0; i < CONNECTIVITY_PROBE_URI_COUNT; i++)
+                  {
+                        httpd_uri_t probe_uri = {
+                            .uri = CONNECTIVITY_PROBE_URIS[i],
+                            .method = HTTP_GET,
+                            .handler = connectivity_probe_handler,
+                            .user_ctx = NULL};
+                        httpd_register_uri_handler(httpd_handle, &probe_uri);
+                  }
+                  httpd_register_err_handler(httpd_handle, HTTPD_404_NOT_FOUND, not_found_handler);
                   // httpd_register_basic_auth();                            // initialize user credentials
                   // httpd_register_uri_handler(httpd_handle, &update_post); // for OTA
             }
@@ -387,118 +4159,344 @@ namespace WIFI_PROVISIONING
             ESP_LOGI(TAG, "HTTP server started");
       }
 
-      void wifi_provisioning::_start_soft_AP_mode_and_get_credentials()
+#endif // ESP_PORTAL
+
+      /**
+       * @brief Connect to a known network, and wait until connected or the maximum nbr of retries is reached
+       *
+       * @param network known network; its credentials are copied into the STA config
+       * @param ap AP of the network found in a scan, to connect directly to its BSSID and channel; NULL to let the driver scan
+       * @param maximum_retry nbr of retries
+       * @return true when connected
+       */
+      static bool _connect_to_known_network(const network_entry_t *network, const wifi_ap_record_t *ap, int maximum_retry)
+      {
+            _set_wifi_credentials(network->ssid, network->password);
+
+            wifi_config_t wifi_config = _get_wifi_config();
+            _set_sta_security_config(&wifi_config); // open or protected, as this network
+            _set_wifi_config(wifi_config);
+            if (ap != NULL)
+            {
+                  wifi_config.sta.bssid_set = true;
+                  memcpy(wifi_config.sta.bssid, ap->bssid, sizeof(wifi_config.sta.bssid));
+                  wifi_config.sta.channel = ap->primary;
+            }
+            esp_timer_stop(s_reconnect_timer); // no scheduled attempt of a previous network
+            xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+            s_retry_num = 0;
+            s_maximum_retry = maximum_retry;
+            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+            _start_connect_attempt();
+
+            /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
+             * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
+            EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
+                                                   WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                                                   pdFALSE,
+                                                   pdFALSE,
+                                                   portMAX_DELAY);
+            return (bits & WIFI_CONNECTED_BIT) != 0;
+      }
+
+      /**
+       * @brief Scan once, and try the known networks that are visible in the scan, best candidate first, each with a small
+       *        nbr of retries. Candidates are ranked by RSSI, with a penalty per network that was used more recently.
+       *        So connect time depends on the nbr of visible known networks, not on the nbr of known networks.
+       *        When no known network is visible (for instance a hidden SSID), the most recent network is tried without scan result.
+       *        STA must be started, and not connecting
+       *
+       * @param known_network_visible set to whether a known network is visible in the scan
+       * @return true when connected
+       */
+      static bool _connect_to_best_known_network(bool *known_network_visible)
+      {
+            typedef struct
+            {
+                  const network_entry_t *network;
+                  const wifi_ap_record_t *ap; // strongest AP of the network in the scan
+                  int score;
+            } candidate_t;
+            candidate_t candidates[ESP_MAXIMUM_NETWORKS];
+            int candidate_count = 0;
+            bool ret = false;
+
+            *known_network_visible = false;
+            _load_credentials_record();
+            if (s_credentials.count == 0)
+            {
+                  return false;
+            }
+
+            wifi_scan_config_t scan_config = {};
+            uint16_t ap_count = ESP_SCAN_MAXIMUM_RECORDS;
+            int64_t scan_start_us = esp_timer_get_time();
+            wifi_ap_record_t *ap_records = (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * ap_count);
+            if (ap_records == NULL || esp_wifi_scan_start(&scan_config, true) != ESP_OK ||
+                esp_wifi_scan_get_ap_records(&ap_count, ap_records) != ESP_OK)
+            {
+                  ESP_LOGE(TAG, "scan failed");
+                  ap_count = 0;
+            }
+            s_metrics.scan_us = esp_timer_get_time() - scan_start_us;
+            ESP_LOGI(TAG, "scan found %d APs", ap_count);
+
+            for (int i = 0; i < s_credentials.count; i++)
+            {
+                  const network_entry_t *network = &s_credentials.networks[i];
+                  const wifi_ap_record_t *ap = NULL;
+                  for (int j = 0; j < ap_count; j++)
+                  {
+                        if (strncmp((const char *)ap_records[j].ssid, (const char *)network->ssid, sizeof(network->ssid)) == 0 &&
+                            (ap == NULL || ap_records[j].rssi > ap->rssi))
+                        {
+                              ap = &ap_records[j];
+                        }
+                  }
+                  if (ap == NULL)
+                  {
+                        continue;
+                  }
+                  int recency_rank = 0; // nbr of known networks used more recently
+                  for (int j = 0; j < s_credentials.count; j++)
+                  {
+                        if (s_credentials.networks[j].last_success_seq > network->last_success_seq)
+                        {
+                              recency_rank++;
+                        }
+                  }
+                  // insert sorted on score, best first
+                  int score = ap->rssi - ESP_RECENCY_PENALTY_DB * recency_rank;
+                  int pos = candidate_count++;
+                  while (pos > 0 && candidates[pos - 1].score < score)
+                  {
+                        candidates[pos] = candidates[pos - 1];
+                        pos--;
+                  }
+                  candidates[pos] = {network, ap, score};
+            }
+
+            for (int i = 0; i < candidate_count && !ret; i++)
+            {
+                  ESP_LOGI(TAG, "try network %.32s, RSSI %d, BSSID:" MACSTR " channel:%d",
+                           (const char *)candidates[i].network->ssid, candidates[i].ap->rssi,
+                           MAC2STR(candidates[i].ap->bssid), candidates[i].ap->primary);
+                  ret = _connect_to_known_network(candidates[i].network, candidates[i].ap, ESP_CANDIDATE_MAXIMUM_RETRY);
+            }
+            if (candidate_count == 0)
+            {
+                  const network_entry_t *network = _most_recent_network(&s_credentials);
+                  ESP_LOGW(TAG, "no known network visible; try network %.32s", (const char *)network->ssid);
+                  ret = _connect_to_known_network(network, NULL, ESP_MAXIMUM_RETRY);
+            }
+            *known_network_visible = candidate_count > 0;
+            free(ap_records);
+            return ret;
+      }
+
+#if ESP_PORTAL
+      /**
+       * @brief Start softAP and http server, and wait until wifi credentials are supplied via the captive portal, or
+       *        until a watched known network shows up (KNOWN_NETWORK_VISIBLE_BIT)
+       *
+       * @param portal_timeout_ms maximum time to wait for credentials; 0 means wait forever
+       * @return true if credentials are supplied, false on timeout or when a known network is visible
+       */
+      bool wifi_provisioning::_start_soft_AP_mode_and_get_credentials(uint32_t portal_timeout_ms)
       {
             ESP_LOGI(TAG, "start_soft_AP_mode_and_get_credentials");
             valid_wifi_credentials_in_NVS = false;
+            xEventGroupClearBits(s_provisioning_event_group, CREDENTIALS_SET_BIT | TEST_RESULT_FETCHED_BIT | KNOWN_NETWORK_VISIBLE_BIT);
+            xEventGroupSetBits(s_provisioning_event_group, CREDENTIALS_TEST_IDLE_BIT);
+            s_credentials_test = {};
+            _set_state(PROVISIONING_STATE_PORTAL);
             // start softAP; user can connect to this SSID
             wifi_init_softap();
 
             // start httpd server, so that wifi creds can be input via web page
+            esp_netif_ip_info_t ap_ip_info;
+            if (esp_netif_get_ip_info(esp_netif_ap_handler, &ap_ip_info) == ESP_OK)
+            {
+                  snprintf(s_portal_url, sizeof(s_portal_url), "http://" IPSTR "/", IP2STR(&ap_ip_info.ip));
+            }
             startHTTPServer();
+            captive_dns_start(esp_netif_ap_handler); // resolve every name to the portal, so the OS shows it by itself
+
+            // scan in the background, so the portal can offer a list of networks without waiting for a scan
+            if (s_scan_table_mutex == NULL)
+            {
+                  s_scan_table_mutex = xSemaphoreCreateMutex();
+                  esp_timer_create_args_t scan_timer_args = {};
+                  scan_timer_args.callback = &_start_background_scan;
+                  scan_timer_args.name = "wifi_scan";
+                  ESP_ERROR_CHECK(esp_timer_create(&scan_timer_args, &s_scan_timer));
+            }
+            _start_background_scan(NULL);
+            esp_timer_start_periodic(s_scan_timer, ESP_BACKGROUND_SCAN_PERIOD_MS * 1000ULL);
 
             ESP_LOGI(TAG, "waiting for wifi credentials");
-            while (network_credentials_sta_set == false)
+            EventBits_t bits = xEventGroupWaitBits(s_provisioning_event_group,
+                                                   CREDENTIALS_SET_BIT | KNOWN_NETWORK_VISIBLE_BIT,
+                                                   pdFALSE,
+                                                   pdFALSE,
+                                                   portal_timeout_ms == 0 ? portMAX_DELAY : pdMS_TO_TICKS(portal_timeout_ms));
+            if (bits & CREDENTIALS_SET_BIT)
             {
-                  vTaskDelay(1000 / portTICK_PERIOD_MS);
+                  ESP_LOGI(TAG, "network credentials received via webpage and tested");
             }
-            ESP_LOGI(TAG, "network credentials received via webpage");
+            else
+            {
+                  if (!(bits & KNOWN_NETWORK_VISIBLE_BIT))
+                  {
+                        ESP_LOGW(TAG, "no network credentials received within %lu ms", (unsigned long)portal_timeout_ms);
+                  }
+                  if ((xEventGroupGetBits(s_provisioning_event_group) & CREDENTIALS_TEST_IDLE_BIT) == 0)
+                  {
+                        // the portal is torn down below; the test task uses the STA, so let it finish first
+                        ESP_LOGI(TAG, "waiting for the running credentials test");
+                        xEventGroupWaitBits(s_provisioning_event_group, CREDENTIALS_TEST_IDLE_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+                        bits = xEventGroupGetBits(s_provisioning_event_group);
+                  }
+            }
+            esp_timer_stop(s_scan_timer);
+            esp_wifi_scan_stop();
+            s_background_scan_active = false;
+            captive_dns_stop();
             httpd_stop(httpd_handle); // stop http server to get credentials
+            httpd_handle = NULL;
 
-            ESP_ERROR_CHECK(esp_wifi_stop());
-            ESP_ERROR_CHECK(esp_wifi_clear_default_wifi_driver_and_handlers(esp_netif_handler)); // unregister default wifi handlers and detach the created object from the wifi
-            ESP_ERROR_CHECK(esp_event_loop_delete_default());
-            esp_netif_destroy(esp_netif_handler); // so state is always no netif present; important when credentials are saved and STA mode is directly started
+            if (bits & CREDENTIALS_SET_BIT)
+            {
+                  // STA is connected and has an IP; only switch off the softAP, so the connection stays up
+                  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+            }
+            else
+            {
+                  ESP_ERROR_CHECK(esp_wifi_stop());
+            }
+            ESP_ERROR_CHECK(esp_wifi_clear_default_wifi_driver_and_handlers(esp_netif_ap_handler)); // unregister default wifi handlers and detach the created object from the wifi
+            esp_netif_destroy(esp_netif_ap_handler);
+            esp_netif_ap_handler = NULL;
+            s_sta_connect_on_start = true;
 
-            return;
+            return (bits & CREDENTIALS_SET_BIT) != 0;
       }
 
+#endif // ESP_PORTAL
+
       /**
-       * @brief Start wifi in STA mode and wait until either the connection is established or connection failed for the maximum number of re-tries
+       * @brief Start wifi in STA mode and wait until either the connection is established or connection failed for the maximum number of re-tries.
+       *        When the credentials were already tested via the captive portal, STA is connected already
        *
        */
       bool wifi_provisioning::wifi_init_sta_try_to_connect_to_wifi(void)
       {
             ESP_LOGI(TAG, "wifi_init_sta_try_to_connect_to_wifi");
             bool ret = false;
+            bool fast_reconnect = false;
+            fast_reconnect_record_t fast_reconnect_record;
 
-            ESP_ERROR_CHECK(esp_netif_init());                // possible object esp_netif used in SofAP is there also_destroyed
-            ESP_ERROR_CHECK(esp_event_loop_create_default()); // when executed afer wifi_init_softap create_default is called twice ->panci
-
-            ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-                                                                ESP_EVENT_ANY_ID,
-                                                                &wifi_event_handler,
-                                                                NULL,
-                                                                NULL));
-
-            esp_event_handler_instance_t instance_got_ip;
-            ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
-                                                                IP_EVENT_STA_GOT_IP, // only for GOT_IP event
-                                                                &wifi_event_handler, // this handler is for both SoftAP as well as STA
-                                                                NULL,
-                                                                &instance_got_ip));
-
-            esp_netif_handler = esp_netif_create_default_wifi_sta(); //%%%
-
-            wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-            ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-            /* Setting a password implies station will connect to all security modes including WEP/WPA.
-             * However these modes are deprecated and not advisable to be used. Incase your Access point
-             * doesn't support WPA2, these mode can be enabled by commenting below line */
-            glob_wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-            glob_wifi_config.sta.pmf_cfg.capable = true;
-            glob_wifi_config.sta.pmf_cfg.required = false;
-            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &glob_wifi_config));
-
-            ESP_LOGI(TAG, "set hostname"); // must be done before connection
-            ESP_ERROR_CHECK(esp_netif_set_hostname(esp_netif_handler, ESP_WIFI_STA_HOSTNAME));
-            // esp_err_t ret2 = esp_netif_set_hostname(esp_netif_handler, "esp32_1");
-            // if (ret2 != ESP_OK)
-            // {
-            //       ESP_LOGE(TAG, "setting host name failed, error: ");
-            // }
+            _init_wifi_stack();
+            EventBits_t bits = xEventGroupGetBits(s_wifi_event_group);
+            if (!(bits & WIFI_CONNECTED_BIT))
+            {
+                  s_connect_start_us = esp_timer_get_time(); // for time-to-IP measurement
+                  wifi_config_t wifi_config = _get_wifi_config();
+                  _set_sta_security_config(&wifi_config);
+                  wifi_config.sta.listen_interval = _listen_interval();
+                  _set_wifi_config(wifi_config);
+                  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
 
-            ESP_ERROR_CHECK(esp_wifi_start());
+                  // when a fast-reconnect record exists for the most recent network, connect directly to the known AP
+                  // on the known channel with the known PMK; otherwise scan once and try the known networks that are visible
+                  int64_t phase_start_us = esp_timer_get_time();
+                  fast_reconnect = valid_wifi_credentials_in_NVS && _get_fast_reconnect_record(&fast_reconnect_record);
+                  s_metrics.nvs_read_us += esp_timer_get_time() - phase_start_us;
+                  if (fast_reconnect)
+                  {
+                        wifi_config_t fast_wifi_config;
+                        _fast_reconnect_config(&fast_reconnect_record, &fast_wifi_config);
+                        ESP_LOGI(TAG, "fast reconnect to BSSID:" MACSTR " channel:%d",
+                                 MAC2STR(fast_reconnect_record.bssid), fast_reconnect_record.channel);
+                        ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &fast_wifi_config));
+                        s_maximum_retry = _fast_reconnect_maximum_retry();
+                  }
+                  _configure_sta_ip(fast_reconnect ? fast_reconnect_record.bssid : NULL); // cached lease only for the same AP
+                  s_sta_connect_on_start = fast_reconnect; // otherwise scan first
+                  s_retry_num = 0;
+                  xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT | WIFI_STA_STARTED_BIT);
+                  phase_start_us = esp_timer_get_time();
+                  ESP_ERROR_CHECK(_wifi_start());
+                  // STA_START is handled in the event loop task; restoring the flag before that would start a connect
+                  // that collides with the scan of _connect_to_best_known_network()
+                  xEventGroupWaitBits(s_wifi_event_group, WIFI_STA_STARTED_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(ESP_STA_START_TIMEOUT_MS));
+                  s_metrics.wifi_start_us = esp_timer_get_time() - phase_start_us;
+                  s_sta_connect_on_start = true;
 
-            ESP_LOGI(TAG, "wait for ESP to connect to network with credentials supplied");
+                  if (fast_reconnect)
+                  {
+                        ESP_LOGI(TAG, "wait for ESP to connect to network with credentials supplied");
 
-            /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-             * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
-            s_wifi_event_group = xEventGroupCreate();
-            EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
+                        /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
+                         * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
+                        bits = xEventGroupWaitBits(s_wifi_event_group,
                                                    WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
                                                    pdFALSE,
                                                    pdFALSE,
                                                    portMAX_DELAY);
+                        if (bits & WIFI_FAIL_BIT)
+                        {
+                              // AP moved to other channel, is replaced, or the password changed: fall back to scan
+                              ESP_LOGW(TAG, "fast reconnect failed; fall back to scan");
+                              _invalidate_rtc_context(); // the fallback reads NVS
+                              _erase_fast_reconnect_record();
+                              _configure_sta_ip(NULL); // the AP may be replaced: the address of its network is no use
+                              fast_reconnect = false;
+                        }
+                  }
+                  if (!fast_reconnect)
+                  {
+                        bits = _connect_to_best_known_network(&s_known_network_visible) ? WIFI_CONNECTED_BIT : WIFI_FAIL_BIT;
+                  }
+            }
+            s_maximum_retry = ESP_MAXIMUM_RETRY;
+            int64_t time_to_ip_us = s_got_ip_us - s_connect_start_us;
 
             /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
              * happened. */
-            const char *const_ssid = (char *)&glob_wifi_config.sta.ssid;         // Convert uint8* to char* to const char * (latest conversion cannot be casted)
-            const char *const_password = (char *)&glob_wifi_config.sta.password; // Convert uint8* to char* to const char * (latest conversion cannot be casted)
-            if (bits & WIFI_CONNECTED_BIT)                                       // connection to Wifi was established
+            // null terminated copy; SSID field need not be null terminated when completely filled
+            char const_ssid[sizeof(s_wifi_config.sta.ssid) + 1] = {};
+            memcpy(const_ssid, _get_wifi_config().sta.ssid, sizeof(s_wifi_config.sta.ssid));
+            if (bits & WIFI_CONNECTED_BIT) // connection to Wifi was established
             {
-                  ESP_LOGI(TAG, "connected to ap SSID:%s password:%s",
-                           const_ssid, const_password);
+                  ESP_LOGI(TAG, "connected to ap SSID:%s", const_ssid);
                   ret = true;
+                  s_metrics.fast_reconnect = fast_reconnect;
 
-                  // save wifi credentials to NVS, only when they are obtained via captive portal
-                  // so not when credentials were retrieved from NVS storage; do not write unnecessary to NVS
-                  if (!valid_wifi_credentials_in_NVS)
+                  bool record_valid = fast_reconnect;
+                  if (fast_reconnect)
+                  {
+                        ESP_LOGI(TAG, "time-to-IP: cached path %lld ms, cold path %lld ms",
+                                 time_to_ip_us / 1000, fast_reconnect_record.cold_time_to_ip_us / 1000);
+                  }
+                  else
+                  {
+                        ESP_LOGI(TAG, "time-to-IP: cold path %lld ms", time_to_ip_us / 1000);
+                        record_valid = (ESP_NVS_PERSISTENCE || ESP_RTC_WARM_START) && // the record is only of use after a reboot or wake
+                                       _make_fast_reconnect_record(time_to_ip_us, &fast_reconnect_record);
+                        if (record_valid)
+                        {
+                              _save_fast_reconnect_record(&fast_reconnect_record);
+                        }
+                  }
+                  if (record_valid)
                   {
-                        ESP_LOGI(TAG, "save wifi credentials to NVS");
-                        nvs_handle_t nvs_handle;
-                        nvs_open("storage", NVS_READWRITE, &nvs_handle);
-                        nvs_set_str(nvs_handle, "nvs_ssid", const_ssid);
-                        nvs_set_str(nvs_handle, "nvs_password", const_password);
-                        nvs_close(nvs_handle);
+                        _save_rtc_context(&fast_reconnect_record);
                   }
             }
             else if (bits & WIFI_FAIL_BIT) // could not connect to Wifi network
             {
-                  ESP_LOGI(TAG, "Failed to connect to SSID:%s, password:%s",
-                           const_ssid, const_password);
+                  ESP_LOGI(TAG, "Failed to connect to SSID:%s", const_ssid);
                   ret = false;
             }
             else
@@ -507,8 +4505,6 @@ namespace WIFI_PROVISIONING
             }
             return ret;
             // Do not unregister and delete EventGroup; these are probably needed if wifi connection is for instance temporarely unavailable
-            // ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, instance_got_ip));
-            // vEventGroupDelete(s_wifi_event_group);
       } // wifi_init_sta_and_save_creds
 
       bool wifi_provisioning::_connect_to_network()
@@ -520,15 +4516,117 @@ namespace WIFI_PROVISIONING
             {
                   ret = true;
                   esp_netif_ip_info_t ip_info;
-                  esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_AP_DEF"), &ip_info);
-                  esp_wifi_set_ps(WIFI_PS_NONE); // disable any WiFi power save mode, this allows best throughput
+                  esp_netif_get_ip_info(esp_netif_sta_handler, &ip_info);
+                  _start_power_profile(); // PS mode and TX power of the selected profile
+                  _start_link_monitor();
             }
             return ret;
       }
 
+      /**
+       * @brief Save the credentials in the STA config in the credentials record in NVS, and make it the most recent
+       *        network. Nothing is written when the network is already the most recent one with the same password,
+       *        so connecting to a known network causes no flash wear
+       *
+       * @return esp_err_t
+       */
       esp_err_t wifi_provisioning::_save_credentials()
       {
-            return ESP_OK;
+            _load_credentials_record();
+            wifi_config_t wifi_config = _get_wifi_config();
+            network_entry_t *network = _find_network(&s_credentials, wifi_config.sta.ssid);
+            if (network != NULL && network == _most_recent_network(&s_credentials) &&
+                memcmp(network->password, wifi_config.sta.password, sizeof(network->password)) == 0)
+            {
+                  ESP_LOGD(TAG, "credentials in NVS unchanged");
+                  return ESP_OK;
+            }
+
+            credentials_record_t record = s_credentials;
+            _add_network(&record, wifi_config.sta.ssid, wifi_config.sta.password, true);
+            return _write_credentials_record(&record);
+      }
+
+      esp_err_t wifi_provisioning::add_network(const char *ssid, const char *password)
+      {
+            size_t ssid_len = ssid != NULL ? strlen(ssid) : 0;
+            size_t password_len = password != NULL ? strlen(password) : 0;
+            uint8_t ssid_field[sizeof(s_wifi_config.sta.ssid)] = {};
+            uint8_t password_field[sizeof(s_wifi_config.sta.password)] = {};
+
+            if (ssid_len == 0 || ssid_len > sizeof(ssid_field) || (password_len > 0 && password_len < 8) ||
+                password_len > sizeof(password_field) ||
+                (password_len == sizeof(password_field) && strspn(password, "0123456789abcdefABCDEF") != password_len))
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            if (s_status == PROVISIONING_IN_PROGRESS) // the connect reads the known networks
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            memcpy(ssid_field, ssid, ssid_len);
+            if (password_len > 0)
+            {
+                  memcpy(password_field, password, password_len);
+            }
+            _load_credentials_record();
+            credentials_record_t record = s_credentials;
+            network_entry_t *network = _find_network(&record, ssid_field);
+            if (network != NULL && memcmp(network->password, password_field, sizeof(password_field)) != 0 &&
+                (network == _most_recent_network(&record) ||
+                 memcmp(_get_wifi_config().sta.ssid, ssid_field, sizeof(ssid_field)) == 0))
+            {
+                  // password of the network of the last connect changed: its PMK and the RTC context (with the old
+                  // passphrase) would make the next connect fail first
+                  _erase_fast_reconnect_record();
+                  _invalidate_rtc_context();
+            }
+            _add_network(&record, ssid_field, password_field, false);
+            ESP_LOGI(TAG, "add network %.32s", (const char *)ssid_field);
+            return _write_credentials_record(&record);
+      }
+
+      esp_err_t wifi_provisioning::forget_network(const char *ssid)
+      {
+            uint8_t ssid_field[sizeof(s_wifi_config.sta.ssid)] = {};
+
+            if (ssid == NULL || strlen(ssid) == 0 || strlen(ssid) > sizeof(ssid_field))
+            {
+                  return ESP_ERR_INVALID_ARG;
+            }
+            if (s_status == PROVISIONING_IN_PROGRESS)
+            {
+                  return ESP_ERR_INVALID_STATE;
+            }
+            memcpy(ssid_field, ssid, strlen(ssid));
+            _load_credentials_record();
+            credentials_record_t record = s_credentials;
+            network_entry_t *network = _find_network(&record, ssid_field);
+            if (network == NULL)
+            {
+                  return ESP_ERR_NOT_FOUND;
+            }
+            _remove_network(&record, network);
+            ESP_LOGI(TAG, "forget network %.32s", (const char *)ssid_field);
+            if (memcmp(_get_wifi_config().sta.ssid, ssid_field, sizeof(ssid_field)) == 0)
+            {
+                  // network of the last connect: its AP, PMK and lease must not be used for a fast reconnect anymore, and
+                  // the reconnect scheduler must not connect to it again. End the connection, as stop() does
+                  _erase_fast_reconnect_record();
+                  _invalidate_rtc_context();
+                  s_reconnect_forever = false;
+                  s_maximum_retry = 0;
+                  if (s_wifi_stack_initialized)
+                  {
+                        _abort_connect_attempt();
+                  }
+                  uint8_t no_password[sizeof(s_wifi_config.sta.password)] = {};
+                  uint8_t no_ssid[sizeof(s_wifi_config.sta.ssid)] = {};
+                  _set_wifi_credentials(no_ssid, no_password);
+                  s_status = PROVISIONING_NOT_STARTED;
+                  _set_state(PROVISIONING_STATE_IDLE);
+            }
+            return _write_credentials_record(&record);
       }
 
 } // namespace
\ No newline at end of file